@@ -12,6 +12,19 @@
  */
 
 #include "pgbitmap.h"
+#include "miscadmin.h"
+#include "access/detoast.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "nodes/primnodes.h"
+#include "utils/tuplestore.h"
+#include "utils/varbit.h"
+#include "utils/array.h"
+#include "utils/multirangetypes.h"
+#include "common/int.h"
+#ifdef WORDS_BIGENDIAN
+#include "port/pg_bswap.h"
+#endif
 
 PG_MODULE_MAGIC;
 
@@ -94,11 +107,14 @@ static const short b64lookup[128] = {
 	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
 };
 
+/* Unlike the pgcrypto original, this does not break its output into
+ * lines: serialise_bitmap() does not allow space for the newlines.
+ * Text written by versions before 0.9.6 has them, and is still read
+ * by deserialise_stream(). */
 static unsigned
 b64_encode(const char *src, unsigned len, char *dst)
 {
-	char	   *p,
-			   *lend = dst + 76;
+	char	   *p;
 	const char *s,
 			   *end = src + len;
 	int			pos = 2;
@@ -124,11 +140,6 @@ b64_encode(const char *src, unsigned len, char *dst)
 			pos = 2;
 			buf = 0;
 		}
-		if (p >= lend)
-		{
-			*p++ = '\n';
-			lend = p + 76;
-		}
 	}
 	if (pos != 2)
 	{
@@ -216,6 +227,17 @@ b64_decode(const char *src, unsigned len, char *dst)
  **********************************************************************
  */
 
+/**
+ * Whether the ::BitmapCounters, and the per-function call counters,
+ * are being maintained.  This is the pgbitmap.track_stats GUC, which
+ * is defined in pgbitmap_stats.c.
+ */
+bool pgbitmap_track_stats = false;
+
+/**
+ * The statistics counters for this backend.
+ */
+BitmapCounters bitmap_counters;
 
 
 
@@ -229,8 +251,7 @@ b64_decode(const char *src, unsigned len, char *dst)
  * 
  * @return True if the bit at bitmin is zero.
  */
-
-static boolean
+boolean
 bitmapEmpty(Bitmap *bitmap)
 {
 	return ((bitmap->bitset[0]) == 0);
@@ -269,6 +290,8 @@ newBitmap(int32 min, int32 max)
 	Bitmap *bitmap = bitmap = palloc(size);
 	
 	SET_VARSIZE(bitmap, size);
+	BITMAP_STAT_ADD(allocations, 1);
+	BITMAP_STAT_ADD(bytes_allocated, size);
 	
 	bitmap->bitmin = min;
 	bitmap->bitmax = max;
@@ -351,6 +374,7 @@ bitmapCopy(Bitmap *bitmap)
 	int32 i;
 
 	result = newBitmap(bitmap->bitmin, bitmap->bitmax);
+	BITMAP_STAT_ADD(copies, 1);
 	
 	for (i = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax) - 1; i >= 0; i--) {
 		result->bitset[i] = bitmap->bitset[i];
@@ -385,6 +409,7 @@ extendBitmap(Bitmap *bitmap,
 	// Allocate new bitmap (no need to clear it)
 	result = newBitmap(MIN(bit, bitmap->bitmin),
 					   MAX(bit, bitmap->bitmax));
+	BITMAP_STAT_ADD(extensions, 1);
 	//elog(NOTICE, "New: %d->%d", result->bitmin, result->bitmax);
 
 	// Copy existing bitset into our new bitset.
@@ -458,7 +483,13 @@ bitmapSetbit(Bitmap *bitmap,
 {
 	Bitmap *result;
 
-	if ((bit > bitmap->bitmax) || (bit < bitmap->bitmin)) {
+	if (bitmapEmpty(bitmap)) {
+		/* Extending an empty bitmap would leave the new bit far from
+		 * the bitset's base, so start afresh. */
+		result = newBitmap(bit, bit);
+		clearBitmap(result);
+	}
+	else if ((bit > bitmap->bitmax) || (bit < bitmap->bitmin)) {
 		result = extendBitmap(bitmap, bit);
 	}
 	else {
@@ -470,7 +501,8 @@ bitmapSetbit(Bitmap *bitmap,
 
 
 /** 
- * Return the next set bit in the ::Bitmap.
+ * Return the next set bit in the ::Bitmap.  The bitmap is scanned a
+ * word at a time, starting with the word containing inbit.
  * 
  * @param bitmap The ::Bitmap being scanned.
  * @param inbit The starting bit from which to scan the bitmap
@@ -485,13 +517,85 @@ bitmapNextBit(Bitmap *bitmap,
 			  int32 inbit,
 			  bool *found)
 {
-	int32 bit = inbit;
-	while (bit <= bitmap->bitmax) {
-		if (bitmapTestbit(bitmap, bit)) {
-			*found = true;
-			return bit;
+	int32 bitzero = BITZERO(bitmap->bitmin);
+	int32 bit = MAX(inbit, bitmap->bitmin);
+	int32 relative_bit;
+	int32 elem;
+	int32 last_elem;
+	bm_int word;
+
+	if (bit <= bitmap->bitmax) {
+		relative_bit = bit - bitzero;
+		elem = BITSET_ELEM(relative_bit);
+		last_elem = BITSET_ELEM(bitmap->bitmax - bitzero);
+
+		/* Ignore the bits in the first word that precede bit. */
+		word = bitmap->bitset[elem] & ~(bitmasks[BITSET_BIT(relative_bit)] - 1);
+		while (true) {
+			if (word) {
+				bit = bitzero + (elem * ELEMBITS) + BM_CTZ(word);
+				if (bit <= bitmap->bitmax) {
+					*found = true;
+					return bit;
+				}
+				break;
+			}
+			if (++elem > last_elem) {
+				break;
+			}
+			word = bitmap->bitset[elem];
+		}
+	}
+	*found = false;
+	return inbit;
+}
+
+/** 
+ * Return the previous set bit in the ::Bitmap, ie the highest set bit
+ * that is no greater than inbit.  This is the mirror image of
+ * bitmapNextBit().
+ * 
+ * @param bitmap The ::Bitmap being scanned.
+ * @param inbit The starting bit from which to scan the bitmap downwards
+ * @param found Boolean that will be set to true when a set bit has been
+ * found.
+ * 
+ * @return The bit id of the found bit, or the inbit parameter if no set
+ *         bits were found.  
+ */
+static int32
+bitmapPrevBit(Bitmap *bitmap,
+			  int32 inbit,
+			  bool *found)
+{
+	int32 bitzero = BITZERO(bitmap->bitmin);
+	int32 bit = MIN(inbit, bitmap->bitmax);
+	int32 relative_bit;
+	int32 elem;
+	bm_int mask;
+	bm_int word;
+
+	if (bit >= bitmap->bitmin) {
+		relative_bit = bit - bitzero;
+		elem = BITSET_ELEM(relative_bit);
+
+		/* Ignore the bits in the first word that follow bit. */
+		mask = bitmasks[BITSET_BIT(relative_bit)];
+		word = bitmap->bitset[elem] & (mask | (mask - 1));
+		while (true) {
+			if (word) {
+				bit = bitzero + (elem * ELEMBITS) + BM_HIGHBIT(word);
+				if (bit >= bitmap->bitmin) {
+					*found = true;
+					return bit;
+				}
+				break;
+			}
+			if (--elem < 0) {
+				break;
+			}
+			word = bitmap->bitset[elem];
 		}
-		bit++;
 	}
 	*found = false;
 	return inbit;
@@ -500,9 +604,25 @@ bitmapNextBit(Bitmap *bitmap,
 static char *
 serialise_bitmap(Bitmap *bitmap);
 
+/** 
+ * Set the size of a ::Bitmap datum to that needed for its bitmin and
+ * bitmax.  This must be done whenever the bounds of a bitmap are
+ * narrowed in place, as otherwise the unused words following the new
+ * bitmax would be stored, and copied, along with the bitmap.
+ * 
+ * @param bitmap  The ::Bitmap
+ */
+static void
+trimBitmap(Bitmap *bitmap)
+{
+	SET_VARSIZE(bitmap, BITMAP_PLAIN_SIZE(bitmap->bitmin, bitmap->bitmax));
+	SETCANARY(bitmap);
+}
+
 /** 
  * Take an existing ::Bitmap, and shrink it to be bounded by the elements
- * containing the highest and lowest bits.
+ * containing the highest and lowest bits.  The size of the datum is
+ * reduced to match.
  * 
  * @param bitmap  The original ::Bitmap
  *
@@ -512,6 +632,8 @@ static void
 reduceBitmap(Bitmap *bitmap)
 {
 	int32 bit = bitmap->bitmin;
+	int32 orig_bitmin = bitmap->bitmin;
+	int32 orig_bitmax = bitmap->bitmax;
 	bool found;
 	int32 first_elem;
 	int32 last_elem = BITSET_ELEM(bitmap->bitmax) - BITSET_ELEM(bitmap->bitmin);
@@ -521,6 +643,7 @@ reduceBitmap(Bitmap *bitmap)
 	if (!found) {
 		/* Bitmap is empty: do a quick exit. */
 		bitmap->bitmax = bitmap->bitmin;
+		trimBitmap(bitmap);
 		return;
 	}
 	first_elem = BITSET_ELEM(bit) - BITSET_ELEM(bitmap->bitmin);
@@ -534,12 +657,13 @@ reduceBitmap(Bitmap *bitmap)
 	}
 	bitmap->bitmin = bit;
 
-	/* Now find last bit (we know that found is true at this point). */
-	while (found) {
-		bit += 1;
-		bit = bitmapNextBit(bitmap, bit, &found);
+	/* Now find the last bit, scanning back a word at a time from the
+	 * original bitmax.  We know that there is one. */
+	bitmap->bitmax = bitmapPrevBit(bitmap, orig_bitmax, &found);
+	trimBitmap(bitmap);
+	if ((bitmap->bitmin != orig_bitmin) || (bitmap->bitmax != orig_bitmax)) {
+		BITMAP_STAT_ADD(reductions, 1);
 	}
-	bitmap->bitmax = bit - 1; /* -1 undoes the last increment in above loop. */
 }
 
 /** 
@@ -584,6 +708,93 @@ bitmapClearbit(Bitmap *bitmap,
 }
 
 
+/** 
+ * Return a new ::Bitmap with each of an array of bits set.  The bounds
+ * of the result are computed first, so that it is allocated only once,
+ * and as every bound comes from a set bit, no reduction is needed.
+ * 
+ * @param bitmap The ::Bitmap within which the bits are to be set.
+ * @param bits The bits to be set, in any order.
+ * @param nbits The number of bits.
+ *
+ * @return New bitmap with the specified bits set.
+ */
+static Bitmap *
+bitmapSetBits(Bitmap *bitmap,
+			  int32 *bits,
+			  int32 nbits)
+{
+	Bitmap *result;
+	bool    empty = bitmapEmpty(bitmap);
+	int32   bitmin;
+	int32   bitmax;
+	int32   relative_bit;
+	int32   elem;
+	int32   i;
+
+	if (nbits == 0) {
+		return bitmapCopy(bitmap);
+	}
+	bitmin = empty? bits[0]: bitmap->bitmin;
+	bitmax = empty? bits[0]: bitmap->bitmax;
+	for (i = 0; i < nbits; i++) {
+		bitmin = MIN(bitmin, bits[i]);
+		bitmax = MAX(bitmax, bits[i]);
+	}
+
+	result = newBitmap(bitmin, bitmax);
+	clearBitmap(result);
+	if (!empty) {
+		elem = BITSET_ELEM((int32) (BITZERO(bitmap->bitmin) -
+									BITZERO(bitmin)));
+		memcpy(result->bitset + elem, bitmap->bitset,
+			   sizeof(bm_int) * ARRAYELEMS(bitmap->bitmin, bitmap->bitmax));
+	}
+	for (i = 0; i < nbits; i++) {
+		relative_bit = bits[i] - BITZERO(bitmin);
+		result->bitset[BITSET_ELEM(relative_bit)] |=
+			bitmasks[BITSET_BIT(relative_bit)];
+	}
+	return result;
+}
+
+
+/** 
+ * Return a new ::Bitmap with each of an array of bits cleared.  The
+ * bitmap is copied once, and reduced only if its bitmin or bitmax is
+ * among the bits cleared.
+ * 
+ * @param bitmap The ::Bitmap within which the bits are to be cleared.
+ * @param bits The bits to be cleared, in any order.
+ * @param nbits The number of bits.
+ *
+ * @return New bitmap with the specified bits cleared.
+ */
+static Bitmap *
+bitmapClearBits(Bitmap *bitmap,
+				int32 *bits,
+				int32 nbits)
+{
+	Bitmap *result = bitmapCopy(bitmap);
+	bool    reduce = false;
+	int32   i;
+
+	if (bitmapEmpty(result)) {
+		return result;
+	}
+	for (i = 0; i < nbits; i++) {
+		doClearBit(result, bits[i]);
+		if ((bits[i] == bitmap->bitmin) || (bits[i] == bitmap->bitmax)) {
+			reduce = true;
+		}
+	}
+	if (reduce) {
+		reduceBitmap(result);
+	}
+	return result;
+}
+
+
 /** 
  * Ensure bitmin of bitmap is no less than parameter.  This provides the
  * means to quickly truncate a bitmap.
@@ -596,12 +807,21 @@ bitmapClearbit(Bitmap *bitmap,
 static Bitmap *
 bitmapSetMin(Bitmap *bitmap, int bitmin)
 {
-	Bitmap *result = newBitmap(MAX(bitmap->bitmin, bitmin),
-							   bitmap->bitmax);
+	Bitmap *result;
 	int32 bitmap_elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
-	int32 res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
-	int32 lost_elems = bitmap_elems - res_elems;
+	int32 res_elems;
+	int32 lost_elems;
 	int32 i;
+
+	if (bitmin > bitmap->bitmax) {
+		/* No bits remain. */
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	result = newBitmap(MAX(bitmap->bitmin, bitmin), bitmap->bitmax);
+	res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
+	lost_elems = bitmap_elems - res_elems;
 	
 	/* Copy the bitset elements that we need. */
 	for (i = 0; i < res_elems; i++) {
@@ -609,37 +829,10 @@ bitmapSetMin(Bitmap *bitmap, int bitmin)
 	}
 
 	if (result->bitmin != bitmap->bitmin) {
-		/* Clear any bits below bitmin */
-		if (result->bitmin > BITZERO(result->bitmin)) {
-			for (i = BITSET_ELEM(result->bitmin - 1); i >= 0; i--) {
-				result->bitset[0] &= ~(bitmasks[BITSET_BIT(i)]);
-			}
-		}
-		/* Update bitmin to match the lowest bit that is actually set. */
-		/* If the bitmap is sparse, there may be entire words that are
-		 * empty of bits.  Let's deal with that situation first. */
-		lost_elems = 0;
-		for (i = 0; i < res_elems; i++) {
-			if (result->bitset[i] == 0) {
-				lost_elems++;
-			}
-			else {
-				break;
-			}
-		}
-		if (lost_elems) {
-			for (i = 0; i < (res_elems - lost_elems); i++) {
-				result->bitset[i] = result->bitset[i + lost_elems];
-			}
-			result->bitmin = BITZERO(result->bitmin + (lost_elems * ELEMBITS));
-		}
-		
-		for (i = BITSET_ELEM(result->bitmin); i < ELEMBITS; i++) {
-			if (result->bitset[0] & bitmasks[BITSET_BIT(i)]) {
-				result->bitmin = BITZERO(result->bitmin) + i;
-				break;
-			}
-		}
+		/* Clear any bits below bitmin, and then update bitmin to match
+		 * the lowest bit that is actually set. */
+		result->bitset[0] &= ~(bitmasks[BITSET_BIT(bitmin)] - 1);
+		reduceBitmap(result);
 	}
 
 	return result;
@@ -656,48 +849,31 @@ bitmapSetMin(Bitmap *bitmap, int bitmin)
 static Bitmap *
 bitmapSetMax(Bitmap *bitmap, int bitmax)
 {
-	Bitmap *result = newBitmap(bitmap->bitmin,
-							   MIN(bitmap->bitmax, bitmax));
-	int32 res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
-	int32 last_elem;
-	int32 lost_elems;
+	Bitmap *result;
+	int32 res_elems;
+	bm_int mask;
 	int32 i;
 
+	if (bitmax < bitmap->bitmin) {
+		/* No bits remain. */
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	result = newBitmap(bitmap->bitmin, MIN(bitmap->bitmax, bitmax));
+	res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
+
 	/* Copy the bitset elements that we need. */
 	for (i = 0; i < res_elems; i++) {
 		result->bitset[i] = bitmap->bitset[i];
 	}
 
 	if (result->bitmax != bitmap->bitmax) {
-		last_elem = res_elems - 1;
-		/* Clear any bits above bitmax */
-		for (i = BITSET_BIT(result->bitmax) + 1; i < ELEMBITS; i++) {
-			result->bitset[last_elem] &= ~(bitmasks[BITSET_BIT(i)]);
-		}
-		
-		/* Update bitmax to match the highest bit that is actually set. */
-		lost_elems = 0;
-		for (i = last_elem; i > 0; i--) {
-			if (result->bitset[i] == 0) {
-				// We found an empty word
-				lost_elems++;
-			}
-			else {
-				break;
-			}
-		}
-		if (lost_elems) {
-			result->bitmax = BITZERO(result->bitmax) -
-				(lost_elems * ELEMBITS) + ELEMBITS - 1;
-		}
-		last_elem -= lost_elems;
-
-		for (i = ELEMBITS - 1; i > 0; i--) {
-			if (result->bitset[last_elem] & bitmasks[BITSET_BIT(i)]) {
-				result->bitmax = BITZERO(result->bitmax) + i;
-				break;
-			}
-		}
+		/* Clear any bits above bitmax, and then update bitmax to match
+		 * the highest bit that is actually set. */
+		mask = bitmasks[BITSET_BIT(bitmax)];
+		result->bitset[res_elems - 1] &= mask | (mask - 1);
+		reduceBitmap(result);
 	}
 
 	return result;
@@ -745,17 +921,16 @@ bitmapEqual(Bitmap *bitmap1,
  *
  * @return A newly allocated bitmap which is the union
  */
-static Bitmap *
+Bitmap *
 bitmapUnion(Bitmap *bitmap1,
 			Bitmap *bitmap2)
 {
-	Bitmap *result = newBitmap(MIN(bitmap1->bitmin, bitmap2->bitmin),
-							   MAX(bitmap1->bitmax, bitmap2->bitmax));
-	int32 res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
-	int32 bit_offset1 = BITZERO(result->bitmin) - BITZERO(bitmap1->bitmin);
-	int32 bit_offset2 = BITZERO(result->bitmin) - BITZERO(bitmap2->bitmin);
-	int32 elem_offset1 = BITSET_ELEM(bit_offset1);
-	int32 elem_offset2 = BITSET_ELEM(bit_offset2);
+	Bitmap *result;
+	int32 res_elems;
+	int32 bit_offset1;
+	int32 bit_offset2;
+	int32 elem_offset1;
+	int32 elem_offset2;
 	int32 elem_max1 = BITSET_ELEM((bitmap1->bitmax - 
 								   BITZERO(bitmap1->bitmin)));
 	int32 elem_max2 = BITSET_ELEM((bitmap2->bitmax - 
@@ -763,6 +938,21 @@ bitmapUnion(Bitmap *bitmap1,
 	bm_int elem;
 	int32 to;
 	int32 from;
+
+	if (bitmapEmpty(bitmap1) || bitmapEmpty(bitmap2)) {
+		/* Don't allocate words for the span between the bounds of an
+		 * empty bitmap and the bits of the other. */
+		result = bitmapCopy(bitmapEmpty(bitmap1)? bitmap2: bitmap1);
+		reduceBitmap(result);
+		return result;
+	}
+	result = newBitmap(MIN(bitmap1->bitmin, bitmap2->bitmin),
+					   MAX(bitmap1->bitmax, bitmap2->bitmax));
+	res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
+	bit_offset1 = BITZERO(result->bitmin) - BITZERO(bitmap1->bitmin);
+	bit_offset2 = BITZERO(result->bitmin) - BITZERO(bitmap2->bitmin);
+	elem_offset1 = BITSET_ELEM(bit_offset1);
+	elem_offset2 = BITSET_ELEM(bit_offset2);
 	
 	for (to = 0; to < res_elems; to++) {
 		elem = 0;
@@ -776,9 +966,9 @@ bitmapUnion(Bitmap *bitmap1,
 		}
 		result->bitset[to] = elem;
 	}
-	// This would normally be unncessary but it is possible that
-	// either of the source bitmaps are empty, so we do this to be
-	// safe.
+	// This would normally be unncessary but bitmaps stored by earlier
+	// versions may not have bits set at their bitmin and bitmax, so
+	// we do this to be safe.
 	reduceBitmap(result);
 	return result;
 }
@@ -796,13 +986,14 @@ static Bitmap *
 bitmapIntersect(Bitmap *bitmap1,
 				Bitmap *bitmap2)
 {
-	Bitmap *result = newBitmap(MAX(bitmap1->bitmin, bitmap2->bitmin),
-							   MIN(bitmap1->bitmax, bitmap2->bitmax));
-	int32 res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
-	int32 bit_offset1 = BITZERO(result->bitmin) - BITZERO(bitmap1->bitmin);
-	int32 bit_offset2 = BITZERO(result->bitmin) - BITZERO(bitmap2->bitmin);
-	int32 elem_offset1 = BITSET_ELEM(bit_offset1);
-	int32 elem_offset2 = BITSET_ELEM(bit_offset2);
+	int32 bitmin = MAX(bitmap1->bitmin, bitmap2->bitmin);
+	int32 bitmax = MIN(bitmap1->bitmax, bitmap2->bitmax);
+	Bitmap *result;
+	int32 res_elems;
+	int32 bit_offset1;
+	int32 bit_offset2;
+	int32 elem_offset1;
+	int32 elem_offset2;
 	int32 elem_max1 = BITSET_ELEM((bitmap1->bitmax - 
 								   BITZERO(bitmap1->bitmin)));
 	int32 elem_max2 = BITSET_ELEM((bitmap2->bitmax - 
@@ -811,6 +1002,21 @@ bitmapIntersect(Bitmap *bitmap1,
 	int32 to;
 	int32 from;
 
+	if (bitmin > bitmax) {
+		/* The ranges of the bitmaps do not overlap, so neither can their
+		 * bits.  Without this check we would try to allocate a bitmap
+		 * with a negative number of elements. */
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	result = newBitmap(bitmin, bitmax);
+	res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
+	bit_offset1 = BITZERO(result->bitmin) - BITZERO(bitmap1->bitmin);
+	bit_offset2 = BITZERO(result->bitmin) - BITZERO(bitmap2->bitmin);
+	elem_offset1 = BITSET_ELEM(bit_offset1);
+	elem_offset2 = BITSET_ELEM(bit_offset2);
+
 	for (to = 0; to < res_elems; to++) {
 		elem = 0;
 		from = to + elem_offset1;
@@ -845,8 +1051,9 @@ bitmapMinus(Bitmap *bitmap1,
 			Bitmap *bitmap2)
 {
 	Bitmap *result = bitmapCopy(bitmap1);
-	bool found = !bitmapEmpty(bitmap2);
-	int32 bit = MAX(bitmap1->bitmin, bitmap2->bitmin);
+	bool found;
+	int32 bit = bitmapNextBit(bitmap2, MAX(bitmap1->bitmin, bitmap2->bitmin),
+							  &found);
 	
 	/* Now clear any bits that match from bitmap2 */
 	while (found && (bit <= bitmap1->bitmax)) {
@@ -859,91 +1066,4315 @@ bitmapMinus(Bitmap *bitmap1,
 }
 
 
-/*
- * Serialisation functions follow
- **********************************************************************
+/** 
+ * Create a copy of a bitmap in which every bit has been moved by shift
+ * positions.  If shift is a multiple of the word size, the words of
+ * the bitmap are unchanged and only its bounds are adjusted.
+ * Otherwise each result word is built from the two source words that
+ * overlap it, in a single pass.  The caller must ensure that the
+ * shifted bounds remain within the range of int32.
+ * 
+ * @param bitmap The ::Bitmap to be shifted
+ * @param shift The amount to be added to each bit.  This may be
+ * negative.
+ *
+ * @return A newly allocated, shifted, bitmap.
  */
+static Bitmap *
+bitmapShift(Bitmap *bitmap,
+			int64 shift)
+{
+	Bitmap *result;
+	int32 bitmin = bitmap->bitmin;
+	int32 src_elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int32 res_elems;
+	int32 bits = (int32) (shift & (ELEMBITS - 1));
+	int32 offset;
+	int32 from;
+	int32 to;
+	bm_int elem;
 
+	if (bitmapEmpty(bitmap) || (bits == 0)) {
+		result = bitmapCopy(bitmap);
+		if (!bitmapEmpty(bitmap)) {
+			result->bitmin = (int32) (bitmap->bitmin + shift);
+			result->bitmax = (int32) (bitmap->bitmax + shift);
+		}
+		return result;
+	}
 
-/** 
- * Serialise an int32 value as a base64 stream (truncated to save a
- * byte) into *p_stream.
+	result = newBitmap((int32) (bitmap->bitmin + shift),
+					   (int32) (bitmap->bitmax + shift));
+	res_elems = ARRAYELEMS(result->bitmin, result->bitmax);
+
+	/* Moving each word up by bits leaves the lowest result bit either
+	 * in the first word or, if it has been carried over, in the
+	 * second. */
+	offset = ((BITSET_BIT(bitmin) + bits) >= ELEMBITS)? 1: 0;
+	for (to = 0; to < res_elems; to++) {
+		from = to + offset;
+		elem = 0;
+		if (from < src_elems) {
+			elem = bitmap->bitset[from] << bits;
+		}
+		if ((from > 0) && (from <= src_elems)) {
+			elem |= bitmap->bitset[from - 1] >> (ELEMBITS - bits);
+		}
+		result->bitset[to] = elem;
+	}
+	return result;
+}
+
+
+/**
+ * Count the bits set in a ::Bitmap.
  *
- * @param p_stream Pointer into stream currently being written.  This
- * must be large enought to take the contents to be written.  This
- * pointer is updated to point to the next free slot in the stream after
- * writing the int32 value, and is null terminated at that position.
- * @param value The value to be written to the stream.
+ * @param bitmap The ::Bitmap being counted.
+ *
+ * @return The number of bits set in the bitmap.
  */
-static void
-serialise_int32(char **p_stream, int32 value)
+int64
+bitmapCardinality(Bitmap *bitmap)
 {
-	int32 len = b64_encode((char *) &value, sizeof(int32), *p_stream);
-	(*p_stream) += (len - 1);  /* X: dumb optimisation saves a byte */
-	(**p_stream) = '\0';
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64 result = 0;
+	int32 i;
+
+	for (i = 0; i < elems; i++) {
+		result += BM_POPCOUNT(bitmap->bitset[i]);
+	}
+	return result;
 }
 
 
-/** 
- * De-serialise an int32 value from a base64 character stream.
+/**
+ * Predicate identifying whether every bit of bitmap2 is also set in
+ * bitmap1.  No new bitmaps are allocated.
  *
- * @param p_stream Pointer into the stream currently being read.
- * must be large enought to take the contents to be written.  This
- * pointer is updated to point to the next free slot in the stream after
- * reading the int32 value.
- * @return the int32 value read from the stream
+ * @param bitmap1 The ::Bitmap that may contain bitmap2
+ * @param bitmap2 The ::Bitmap that may be contained in bitmap1
+ *
+ * @return True if bitmap2 is a subset of bitmap1.
  */
-static int32
-deserialise_int32(char **p_stream)
+bool
+bitmapContains(Bitmap *bitmap1,
+			   Bitmap *bitmap2)
 {
-	int32 value;
-	char *endpos = (*p_stream) + INT32SIZE_B64;
-	char endchar = *endpos;
-	*endpos = '=';	/* deal with dumb optimisation (X) above */
-	b64_decode(*p_stream, INT32SIZE_B64 + 1, (char *) &value);
-	*endpos = endchar;
-	(*p_stream) += INT32SIZE_B64;
-	return value;
+	int32 elems;
+	int32 bit_offset;
+	int32 elem_offset;
+	int32 i;
+
+	if (bitmapEmpty(bitmap2)) {
+		return true;
+	}
+	if (bitmapEmpty(bitmap1) ||
+		(bitmap2->bitmin < bitmap1->bitmin) ||
+		(bitmap2->bitmax > bitmap1->bitmax)) {
+		return false;
+	}
+
+	elems = ARRAYELEMS(bitmap2->bitmin, bitmap2->bitmax);
+	bit_offset = BITZERO(bitmap2->bitmin) - BITZERO(bitmap1->bitmin);
+	elem_offset = BITSET_ELEM(bit_offset);
+	for (i = 0; i < elems; i++) {
+		if (bitmap2->bitset[i] & ~(bitmap1->bitset[i + elem_offset])) {
+			return false;
+		}
+	}
+	return true;
 }
 
 
-/** 
- * Serialise a binary stream as a base64 stream into *p_stream.
+/**
+ * Predicate identifying whether two bitmaps have any bits in common.
+ * Only the words in the overlapping range of the bitmaps are examined,
+ * and no new bitmaps are allocated.
  *
- * @param p_stream Pointer into stream currently being written.  This
- * pointer is updated to point to the next free slot in the stream after
- * writing the contents of instream and is null terminated at that
- * position.
+ * @param bitmap1 The first ::Bitmap to be compared
+ * @param bitmap2 The second ::Bitmap to be compared
  *
- * @param bytes The number of bytes to be written.
- * @param instream The binary stream to be written.
+ * @return True if the intersection of the bitmaps would not be empty.
  */
-static void
-serialise_stream(char **p_stream, int32 bytes, char *instream)
+bool
+bitmapOverlaps(Bitmap *bitmap1,
+			   Bitmap *bitmap2)
 {
-	int32 len = b64_encode(instream, bytes, *p_stream);
-	(*p_stream)[len] = '\0';
-	(*p_stream) += len;
+	int32 lo = MAX(bitmap1->bitmin, bitmap2->bitmin);
+	int32 hi = MIN(bitmap1->bitmax, bitmap2->bitmax);
+	int32 bit_offset1;
+	int32 bit_offset2;
+	int32 elem_offset1;
+	int32 elem_offset2;
+	int32 elems;
+	int32 i;
+
+	if ((lo > hi) || bitmapEmpty(bitmap1) || bitmapEmpty(bitmap2)) {
+		return false;
+	}
+
+	bit_offset1 = BITZERO(lo) - BITZERO(bitmap1->bitmin);
+	bit_offset2 = BITZERO(lo) - BITZERO(bitmap2->bitmin);
+	elem_offset1 = BITSET_ELEM(bit_offset1);
+	elem_offset2 = BITSET_ELEM(bit_offset2);
+	elems = ARRAYELEMS(lo, hi);
+	for (i = 0; i < elems; i++) {
+		if (bitmap1->bitset[i + elem_offset1] &
+			bitmap2->bitset[i + elem_offset2]) {
+			return true;
+		}
+	}
+	return false;
 }
 
 
-/** 
- * Return the length of a base64 encoded stream for a binary stream of
- * ::bytes length.
- * 
- * @param bytes The length of the input binary stream in bytes
- * @return The length of the base64 character stream required to
- * represent the input stream.
+/**
+ * Count the bits set in an array of words.
+ *
+ * @param words The words to be counted
+ * @param n The number of words
+ *
+ * @return The number of bits set.
  */
-static int
-streamlen(int32 bytes)
+static int64
+countWords(bm_int *words,
+		   int64 n)
 {
-	return (4 * ((bytes + 2) / 3));
+	int64 result = 0;
+	int64 i;
+
+	for (i = 0; i < n; i++) {
+		result += BM_POPCOUNT(words[i]);
+	}
+	return result;
 }
 
 
-/** 
- * De-serialise a binary stream.
+/**
+ * Count the bits in each of two bitmaps, and the bits that they have
+ * in common, in a single pass over their words.  No new bitmaps are
+ * allocated.  From these counts the Jaccard and Hamming distances
+ * between the bitmaps can be calculated.
+ *
+ * @param bitmap1 The first ::Bitmap to be counted
+ * @param bitmap2 The second ::Bitmap to be counted
+ * @param card1 Returns the number of bits in bitmap1
+ * @param card2 Returns the number of bits in bitmap2
+ * @param common Returns the number of bits in both bitmaps
+ */
+static void
+bitmapDistanceCounts(Bitmap *bitmap1,
+					 Bitmap *bitmap2,
+					 int64 *card1,
+					 int64 *card2,
+					 int64 *common)
+{
+	int64 elems1 = ARRAYELEMS(bitmap1->bitmin, bitmap1->bitmax);
+	int64 elems2 = ARRAYELEMS(bitmap2->bitmin, bitmap2->bitmax);
+	int64 first1 = ((int64) (int32) BITZERO(bitmap1->bitmin)) / ELEMBITS;
+	int64 first2 = ((int64) (int32) BITZERO(bitmap2->bitmin)) / ELEMBITS;
+	int64 first = MAX(first1, first2);
+	int64 last = MIN(first1 + elems1, first2 + elems2);
+	bm_int *words1;
+	bm_int *words2;
+	bm_int word1;
+	bm_int word2;
+	int64 count1 = 0;
+	int64 count2 = 0;
+	int64 count = 0;
+	int64 i;
+
+	if (bitmapEmpty(bitmap1) || bitmapEmpty(bitmap2) || (first >= last)) {
+		*card1 = bitmapEmpty(bitmap1)? 0: countWords(bitmap1->bitset, elems1);
+		*card2 = bitmapEmpty(bitmap2)? 0: countWords(bitmap2->bitset, elems2);
+		*common = 0;
+		return;
+	}
+
+	words1 = bitmap1->bitset + (first - first1);
+	words2 = bitmap2->bitset + (first - first2);
+	for (i = 0; i < last - first; i++) {
+		word1 = words1[i];
+		word2 = words2[i];
+		count1 += BM_POPCOUNT(word1);
+		count2 += BM_POPCOUNT(word2);
+		count += BM_POPCOUNT(word1 & word2);
+	}
+
+	// Add the words of each bitmap that lie outside the overlap.
+	count1 += countWords(bitmap1->bitset, first - first1);
+	count1 += countWords(bitmap1->bitset + (last - first1),
+						 first1 + elems1 - last);
+	count2 += countWords(bitmap2->bitset, first - first2);
+	count2 += countWords(bitmap2->bitset + (last - first2),
+						 first2 + elems2 - last);
+	*card1 = count1;
+	*card2 = count2;
+	*common = count;
+}
+
+
+/*
+ * Rank and select functions follow
+ **********************************************************************
+ */
+
+
+/**
+ * The number of bitset words covered by each entry in a rank
+ * directory.
+ */
+#define RANK_BLOCK_WORDS 32
+
+/**
+ * Gives the number of rank directory entries needed for a bitset of
+ * elems words.
+ */
+#define RANK_BLOCKS(elems) (((elems) + RANK_BLOCK_WORDS - 1) / RANK_BLOCK_WORDS)
+
+/**
+ * Marker identifying a rank directory stored at the end of a ::Bitmap
+ * datum ("BMRD").
+ */
+#define RANK_DIRECTORY_MAGIC 0x424d5244
+
+/**
+ * Gives the offset, from the start of a ::Bitmap, of a stored rank
+ * directory.
+ */
+#define RANK_DIRECTORY_OFFSET(elems)						\
+	MAXALIGN(sizeof(Bitmap) + (sizeof(bm_int) * ((elems) + DBG_ELEMS)))
+
+/**
+ * Gives the size of a ::Bitmap datum with a stored rank directory.
+ * The directory is an array of int64 counts followed by a pair of int32
+ * values: the number of counts, and ::RANK_DIRECTORY_MAGIC.
+ */
+#define RANK_DIRECTORY_DATUM_SIZE(elems)						\
+	(RANK_DIRECTORY_OFFSET(elems) +								\
+	 (sizeof(int64) * RANK_BLOCKS(elems)) + (2 * sizeof(int32)))
+
+
+/**
+ * Fill in a rank directory for a ::Bitmap.  Each entry records the
+ * number of bits set in the words preceding a block of
+ * ::RANK_BLOCK_WORDS words.
+ *
+ * @param bitmap The ::Bitmap being indexed
+ * @param counts Array of RANK_BLOCKS(elems) entries to be filled in.
+ */
+static void
+fillRankDirectory(Bitmap *bitmap, int64 *counts)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64 total = 0;
+	int32 i;
+
+	for (i = 0; i < elems; i++) {
+		if ((i % RANK_BLOCK_WORDS) == 0) {
+			counts[i / RANK_BLOCK_WORDS] = total;
+		}
+		total += BM_POPCOUNT(bitmap->bitset[i]);
+	}
+}
+
+
+/**
+ * Return the rank directory stored at the end of a ::Bitmap datum, if
+ * there is one.  Rank directories are added by bitmap_rank_index().
+ * Since all other code determines the size of the bitset from bitmin
+ * and bitmax, the directory is invisible to everything else.
+ *
+ * @param bitmap The ::Bitmap being examined
+ *
+ * @return Pointer to the rank directory, or NULL.
+ */
+static int64 *
+bitmapStoredRankDirectory(Bitmap *bitmap)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	Size size = RANK_DIRECTORY_DATUM_SIZE(elems);
+	int32 *trailer;
+
+	if (VARSIZE(bitmap) != size) {
+		return NULL;
+	}
+	trailer = (int32 *) (((char *) bitmap) + size - (2 * sizeof(int32)));
+	if ((trailer[0] != RANK_BLOCKS(elems)) ||
+		(trailer[1] != RANK_DIRECTORY_MAGIC)) {
+		return NULL;
+	}
+	return (int64 *) (((char *) bitmap) + RANK_DIRECTORY_OFFSET(elems));
+}
+
+
+/**
+ * Return a copy of a ::Bitmap with a rank directory appended.
+ *
+ * @param bitmap The ::Bitmap to be indexed
+ *
+ * @return The new bitmap.
+ */
+static Bitmap *
+bitmapAddRankDirectory(Bitmap *bitmap)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	Size size = RANK_DIRECTORY_DATUM_SIZE(elems);
+	Bitmap *result = palloc0(size);
+	int32 *trailer;
+
+	memcpy(result, bitmap,
+		   sizeof(Bitmap) + (sizeof(bm_int) * (elems + DBG_ELEMS)));
+	SET_VARSIZE(result, size);
+	fillRankDirectory(result, (int64 *) (((char *) result) +
+										 RANK_DIRECTORY_OFFSET(elems)));
+	trailer = (int32 *) (((char *) result) + size - (2 * sizeof(int32)));
+	trailer[0] = RANK_BLOCKS(elems);
+	trailer[1] = RANK_DIRECTORY_MAGIC;
+	return result;
+}
+
+
+/**
+ * Count the bits in a ::Bitmap that are less than or equal to bit.  For
+ * a bit that is set, this gives its 1-based position in the bitmap.
+ *
+ * @param bitmap The ::Bitmap being examined
+ * @param counts The bitmap's rank directory, or NULL if it has none
+ * @param bit The bit whose rank is required
+ *
+ * @return The number of bits set, up to and including bit.
+ */
+static int64
+bitmapRank(Bitmap *bitmap,
+		   int64 *counts,
+		   int32 bit)
+{
+	int32 relative_bit;
+	int32 elem;
+	int32 i = 0;
+	int64 result = 0;
+	bm_int mask;
+
+	if (bitmapEmpty(bitmap) || (bit < bitmap->bitmin)) {
+		return 0;
+	}
+	if (bit > bitmap->bitmax) {
+		bit = bitmap->bitmax;
+	}
+	relative_bit = bit - BITZERO(bitmap->bitmin);
+	elem = BITSET_ELEM(relative_bit);
+	if (counts) {
+		i = (elem / RANK_BLOCK_WORDS) * RANK_BLOCK_WORDS;
+		result = counts[elem / RANK_BLOCK_WORDS];
+	}
+	for (; i < elem; i++) {
+		result += BM_POPCOUNT(bitmap->bitset[i]);
+	}
+	/* Count the bits in the final word up to and including bit. */
+	mask = bitmasks[BITSET_BIT(relative_bit)];
+	result += BM_POPCOUNT(bitmap->bitset[elem] & (mask | (mask - 1)));
+	return result;
+}
+
+
+/**
+ * Find the nth (1-based) lowest bit set in a ::Bitmap.
+ *
+ * @param bitmap The ::Bitmap being examined
+ * @param counts The bitmap's rank directory, or NULL if it has none
+ * @param n The position of the required bit
+ * @param found Boolean that will be set to true if the bitmap has at
+ * least n bits.
+ *
+ * @return The nth bit, if found.
+ */
+static int32
+bitmapSelect(Bitmap *bitmap,
+			 int64 *counts,
+			 int64 n,
+			 bool *found)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64 seen = 0;
+	int32 i = 0;
+	int32 pop;
+	bm_int word;
+
+	*found = false;
+	if ((n < 1) || bitmapEmpty(bitmap)) {
+		return 0;
+	}
+	if (counts) {
+		/* Find the last block having fewer than n bits before it. */
+		int32 lo = 0;
+		int32 hi = RANK_BLOCKS(elems) - 1;
+
+		while (lo < hi) {
+			int32 mid = (lo + hi + 1) / 2;
+			if (counts[mid] < n) {
+				lo = mid;
+			}
+			else {
+				hi = mid - 1;
+			}
+		}
+		i = lo * RANK_BLOCK_WORDS;
+		seen = counts[lo];
+	}
+	for (; i < elems; i++) {
+		pop = BM_POPCOUNT(bitmap->bitset[i]);
+		if ((seen + pop) >= n) {
+			break;
+		}
+		seen += pop;
+	}
+	if (i >= elems) {
+		return 0;
+	}
+
+	/* Discard the lower bits of the word that precede the one we
+	 * want. */
+	word = bitmap->bitset[i];
+	for (seen = n - seen - 1; seen > 0; seen--) {
+		word &= word - 1;
+	}
+	*found = true;
+	return BITZERO(bitmap->bitmin) + (i * ELEMBITS) + BM_CTZ(word);
+}
+
+
+/*
+ * Frozen bitmap functions follow
+ **********************************************************************
+ */
+
+
+/**
+ * Marker identifying a frozen ::Bitmap datum ("BMEF").
+ */
+#define FROZEN_MAGIC 0x424d4546
+
+/**
+ * The spacing of the position samples in a frozen bitmap.  A sample
+ * is recorded for every FROZEN_SAMPLE'th element and for every
+ * FROZEN_SAMPLE'th bucket.
+ */
+#define FROZEN_SAMPLE 256
+
+/**
+ * A frozen bitmap is an immutable, Elias-Fano encoded, form of a
+ * ::Bitmap, as created by bitmap_freeze().  Each element, b, is
+ * encoded by its offset, x = b - bitmin.  The low order lowbits bits
+ * of x are stored in a packed array of lowbits-bit values, and the
+ * remaining high order bits of x, its bucket, are stored in unary in
+ * the upper bitvector: element i sets bit (x >> lowbits) + i.  Each
+ * bucket is therefore represented by a 1 bit for each of its elements,
+ * followed by a 0 bit.  Since lowbits is chosen as log2 of the average
+ * gap between elements, this takes a little over lowbits + 2 bits per
+ * element, however widely the elements are spread.
+ *
+ * The data array contains, in order, the low bits, the upper
+ * bitvector, the upper bitvector positions of every FROZEN_SAMPLE'th
+ * element, and the start positions of every FROZEN_SAMPLE'th bucket.
+ * The samples allow any element, or the start of any bucket, to be
+ * found by scanning a small part of the upper bitvector.
+ *
+ * The bitmin and bitmax fields are at the same positions as in a
+ * ::Bitmap.  A bitmap is only frozen if that makes it smaller, so a
+ * frozen bitmap can be recognised by its size being smaller than a
+ * flat bitmap with the same bounds would need.  See
+ * BITMAP_IS_FROZEN().
+ */
+typedef struct FrozenBitmap {
+	char    vl_len[4];  /**< Standard postgres length header */
+    int32   bitmin;	    /**< The lowest bit set */
+    int32   bitmax;		/**< The highest bit set */
+	int32   lowbits;	/**< The number of low order bits stored for
+						 * each element */
+	int32   magic;		/**< ::FROZEN_MAGIC */
+	int64   nbits;		/**< The number of bits set */
+	uint64  data[0];	/**< Low bits, upper bitvector and samples */
+} FrozenBitmap;
+
+/**
+ * The parts of a ::FrozenBitmap, as located by frozenLayout().
+ */
+typedef struct FrozenLayout {
+	FrozenBitmap *frozen;	 /**< The frozen bitmap */
+	int64   n;				 /**< The number of elements */
+	int32   l;				 /**< The number of low bits per element */
+	uint64  lowmask;		 /**< Mask for the low bits of an offset */
+	int64   nbuckets;		 /**< The number of buckets */
+	int64   upper_len;		 /**< The length of the upper bitvector */
+	int64   upper_offset;	 /**< Word offset of the upper bitvector */
+	int64   elem_offset;	 /**< Word offset of the element samples */
+	int64   bucket_offset;	 /**< Word offset of the bucket samples */
+	int64   words;			 /**< Total words in the data array */
+	uint64 *low;			 /**< The packed low bits */
+	uint64 *upper;			 /**< The upper bitvector */
+	int64  *elem_samples;	 /**< Positions of sampled elements */
+	int64  *bucket_samples;	 /**< Start positions of sampled buckets */
+} FrozenLayout;
+
+
+/**
+ * Work out the sizes and offsets of the parts of a frozen bitmap.
+ *
+ * @param layout The ::FrozenLayout to be filled in
+ * @param n The number of elements
+ * @param l The number of low bits stored for each element
+ * @param range The number of bits from bitmin to bitmax inclusive
+ */
+static void
+setFrozenLayout(FrozenLayout *layout,
+				int64 n,
+				int32 l,
+				int64 range)
+{
+	layout->frozen = NULL;
+	layout->n = n;
+	layout->l = l;
+	layout->lowmask = (((uint64) 1) << l) - 1;
+	layout->nbuckets = ((range - 1) >> l) + 1;
+	layout->upper_len = n + layout->nbuckets;
+	layout->upper_offset = ((n * l) + 63) >> 6;
+	layout->elem_offset = layout->upper_offset +
+		((layout->upper_len + 63) >> 6);
+	layout->bucket_offset = layout->elem_offset +
+		((n + FROZEN_SAMPLE - 1) / FROZEN_SAMPLE);
+	layout->words = layout->bucket_offset +
+		((layout->nbuckets + FROZEN_SAMPLE - 1) / FROZEN_SAMPLE);
+}
+
+
+/**
+ * Locate the parts of a frozen bitmap.
+ *
+ * @param frozen The ::FrozenBitmap
+ * @param layout The ::FrozenLayout to be filled in
+ */
+static void
+frozenLayout(FrozenBitmap *frozen,
+			 FrozenLayout *layout)
+{
+	setFrozenLayout(layout, frozen->nbits, frozen->lowbits,
+					(int64) frozen->bitmax - frozen->bitmin + 1);
+	layout->frozen = frozen;
+	layout->low = frozen->data;
+	layout->upper = frozen->data + layout->upper_offset;
+	layout->elem_samples = (int64 *) (frozen->data + layout->elem_offset);
+	layout->bucket_samples =
+		(int64 *) (frozen->data + layout->bucket_offset);
+}
+
+
+/**
+ * Return the low bits of the ith element of a frozen bitmap.
+ */
+static uint64
+frozenLow(FrozenLayout *layout,
+		  int64 i)
+{
+	int64  offset = i * layout->l;
+	int64  w = offset >> 6;
+	int32  shift = offset & 63;
+	uint64 result;
+
+	if (layout->l == 0) {
+		return 0;
+	}
+	result = layout->low[w] >> shift;
+	if ((shift + layout->l) > 64) {
+		result |= layout->low[w + 1] << (64 - shift);
+	}
+	return result & layout->lowmask;
+}
+
+
+/**
+ * Predicate identifying whether bit pos of the upper bitvector of a
+ * frozen bitmap is set.
+ */
+static bool
+frozenUpperBit(FrozenLayout *layout,
+			   int64 pos)
+{
+	return ((layout->upper[pos >> 6] >> (pos & 63)) & 1) != 0;
+}
+
+
+/**
+ * Find the position of the count'th (counting from 1) 1 bit, or 0 bit,
+ * at or after pos in a bitvector.  The caller must ensure that there
+ * is such a bit.
+ *
+ * @param vec The bitvector
+ * @param pos The position from which to start
+ * @param count The number of matching bits to find
+ * @param ones Whether we are looking for 1 bits rather than 0 bits
+ *
+ * @return The position of the count'th matching bit.
+ */
+static int64
+frozenSkip(uint64 *vec,
+		   int64 pos,
+		   int64 count,
+		   bool ones)
+{
+	int64  w = pos >> 6;
+	uint64 word = (ones? vec[w]: ~vec[w]) & (~((uint64) 0) << (pos & 63));
+	int32  pop;
+
+	while ((pop = __builtin_popcountll(word)) < count) {
+		count -= pop;
+		w++;
+		word = ones? vec[w]: ~vec[w];
+	}
+	while (--count > 0) {
+		word &= word - 1;
+	}
+	return (w << 6) + __builtin_ctzll(word);
+}
+
+
+/**
+ * Find the position of the last 1 bit at or before pos in a bitvector.
+ * The caller must ensure that there is such a bit.
+ */
+static int64
+frozenPrevOne(uint64 *vec,
+			  int64 pos)
+{
+	int64  w = pos >> 6;
+	uint64 word = vec[w] & (~((uint64) 0) >> (63 - (pos & 63)));
+
+	while (word == 0) {
+		word = vec[--w];
+	}
+	return (w << 6) + 63 - __builtin_clzll(word);
+}
+
+
+/**
+ * Return the position in the upper bitvector at which bucket h starts.
+ * The number of elements in earlier buckets is this position less h.
+ */
+static int64
+frozenBucketStart(FrozenLayout *layout,
+				  int64 h)
+{
+	int64 k = h / FROZEN_SAMPLE;
+	int64 need = h - (k * FROZEN_SAMPLE);
+
+	if (need == 0) {
+		return layout->bucket_samples[k];
+	}
+	return frozenSkip(layout->upper, layout->bucket_samples[k],
+					  need, false) + 1;
+}
+
+
+/**
+ * Return the position in the upper bitvector of element i, which must
+ * exist.
+ */
+static int64
+frozenElemPos(FrozenLayout *layout,
+			  int64 i)
+{
+	int64 k = i / FROZEN_SAMPLE;
+	int64 need = i - (k * FROZEN_SAMPLE);
+
+	if (need == 0) {
+		return layout->elem_samples[k];
+	}
+	return frozenSkip(layout->upper, layout->elem_samples[k] + 1,
+					  need, true);
+}
+
+
+/**
+ * Return the value of element i, whose position in the upper bitvector
+ * is pos.
+ */
+static int32
+frozenValue(FrozenLayout *layout,
+			int64 i,
+			int64 pos)
+{
+	return (int32) (layout->frozen->bitmin +
+					(int64) (((uint64) (pos - i) << layout->l) |
+							 frozenLow(layout, i)));
+}
+
+
+/** 
+ * Return a frozen, Elias-Fano encoded, version of a ::Bitmap.  If the
+ * frozen form would be no smaller than the original, which is the
+ * case for empty and for dense bitmaps, the original is returned.
+ * 
+ * @param bitmap The ::Bitmap to be frozen
+ *
+ * @return The frozen bitmap, or the original.
+ */
+static Bitmap *
+bitmapFreeze(Bitmap *bitmap)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int32 bitzero_offset = bitmap->bitmin - BITZERO(bitmap->bitmin);
+	int64 range = (int64) bitmap->bitmax - bitmap->bitmin + 1;
+	int64 n;
+	int32 l = 0;
+	FrozenLayout layout;
+	FrozenBitmap *frozen;
+	Size  size;
+	int64 i = 0;
+	int64 x;
+	int64 pos;
+	int64 w;
+	int64 zeros = 0;
+	int32 elem;
+	int32 shift;
+	bm_int word;
+	uint64 uword;
+
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		return bitmap;
+	}
+	n = bitmapCardinality(bitmap);
+	if (n == 0) {
+		return bitmap;
+	}
+	while (((range / n) >> (l + 1)) > 0) {
+		l++;
+	}
+	setFrozenLayout(&layout, n, l, range);
+	size = offsetof(FrozenBitmap, data) + (sizeof(uint64) * layout.words);
+	if (size >= BITMAP_PLAIN_SIZE(bitmap->bitmin, bitmap->bitmax)) {
+		return bitmap;
+	}
+
+	frozen = palloc0(size);
+	SET_VARSIZE(frozen, size);
+	BITMAP_STAT_ADD(allocations, 1);
+	BITMAP_STAT_ADD(bytes_allocated, size);
+	frozen->bitmin = bitmap->bitmin;
+	frozen->bitmax = bitmap->bitmax;
+	frozen->lowbits = l;
+	frozen->magic = FROZEN_MAGIC;
+	frozen->nbits = n;
+	frozenLayout(frozen, &layout);
+
+	for (elem = 0; elem < elems; elem++) {
+		word = bitmap->bitset[elem];
+		while (word) {
+			x = ((int64) elem * ELEMBITS) + BM_CTZ(word) - bitzero_offset;
+			word &= word - 1;
+
+			if (l > 0) {
+				pos = i * l;
+				shift = pos & 63;
+				layout.low[pos >> 6] |= (x & layout.lowmask) << shift;
+				if ((shift + l) > 64) {
+					layout.low[(pos >> 6) + 1] |=
+						(x & layout.lowmask) >> (64 - shift);
+				}
+			}
+			pos = (x >> l) + i;
+			layout.upper[pos >> 6] |= ((uint64) 1) << (pos & 63);
+			if ((i % FROZEN_SAMPLE) == 0) {
+				layout.elem_samples[i / FROZEN_SAMPLE] = pos;
+			}
+			i++;
+		}
+	}
+
+	/* Each 0 bit ends a bucket, so the bucket following the zeros'th 0
+	 * bit starts at the next position. */
+	layout.bucket_samples[0] = 0;
+	for (w = 0; w < ((layout.upper_len + 63) >> 6); w++) {
+		uword = ~layout.upper[w];
+		if (((w + 1) << 6) > layout.upper_len) {
+			uword &= (((uint64) 1) << (layout.upper_len & 63)) - 1;
+		}
+		while (uword) {
+			zeros++;
+			if (((zeros % FROZEN_SAMPLE) == 0) &&
+				(zeros < layout.nbuckets)) {
+				layout.bucket_samples[zeros / FROZEN_SAMPLE] =
+					(w << 6) + __builtin_ctzll(uword) + 1;
+			}
+			uword &= uword - 1;
+		}
+	}
+	return (Bitmap *) frozen;
+}
+
+
+/** 
+ * Return the flat ::Bitmap equivalent of a frozen bitmap.  This is
+ * called by PG_GETARG_BITMAP() so that frozen bitmaps can be passed to
+ * any function.
+ * 
+ * @param bitmap The frozen bitmap
+ *
+ * @return A newly allocated flat bitmap.
+ */
+Bitmap *
+bitmapThaw(Bitmap *bitmap)
+{
+	FrozenLayout layout;
+	Bitmap *result;
+	int64  i = 0;
+	int64  w;
+	uint64 word;
+
+	frozenLayout((FrozenBitmap *) bitmap, &layout);
+	if (layout.frozen->magic != FROZEN_MAGIC) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("Corrupted bitmap"),
+				 errdetail("bitmap (range %d..%d) has size %d.", 
+						   bitmap->bitmin, bitmap->bitmax,
+						   (int) VARSIZE(bitmap))));
+	}
+	BITMAP_STAT_ADD(thaws, 1);
+	result = newBitmap(bitmap->bitmin, bitmap->bitmax);
+	clearBitmap(result);
+	for (w = 0; w < layout.elem_offset - layout.upper_offset; w++) {
+		word = layout.upper[w];
+		while (word) {
+			doSetBit(result, frozenValue(&layout, i,
+										 (w << 6) + __builtin_ctzll(word)));
+			word &= word - 1;
+			i++;
+		}
+	}
+	return result;
+}
+
+
+/** 
+ * Test a bit within a frozen bitmap.  Only the bucket that would
+ * contain the bit is examined.
+ * 
+ * @param frozen The ::FrozenBitmap being examined
+ * @param bit The bit to be tested.
+ * 
+ * @return True if the bit is set, false otherwise.
+ */
+static bool
+frozenTestbit(FrozenBitmap *frozen,
+			  int32 bit)
+{
+	FrozenLayout layout;
+	int64  x;
+	int64  h;
+	int64  pos;
+	int64  i;
+	uint64 lo;
+	uint64 low;
+
+	if ((bit < frozen->bitmin) || (bit > frozen->bitmax)) {
+		return false;
+	}
+	frozenLayout(frozen, &layout);
+	x = (int64) bit - frozen->bitmin;
+	h = x >> layout.l;
+	lo = x & layout.lowmask;
+	pos = frozenBucketStart(&layout, h);
+	for (i = pos - h; frozenUpperBit(&layout, pos); pos++, i++) {
+		low = frozenLow(&layout, i);
+		if (low >= lo) {
+			return low == lo;
+		}
+	}
+	return false;
+}
+
+
+/**
+ * Count the bits in a frozen bitmap that are less than or equal to
+ * bit.
+ *
+ * @param frozen The ::FrozenBitmap being examined
+ * @param bit The bit whose rank is required
+ *
+ * @return The number of bits set, up to and including bit.
+ */
+static int64
+frozenRank(FrozenBitmap *frozen,
+		   int32 bit)
+{
+	FrozenLayout layout;
+	int64  x;
+	int64  h;
+	int64  pos;
+	int64  i;
+	uint64 lo;
+
+	if (bit < frozen->bitmin) {
+		return 0;
+	}
+	if (bit >= frozen->bitmax) {
+		return frozen->nbits;
+	}
+	frozenLayout(frozen, &layout);
+	x = (int64) bit - frozen->bitmin;
+	h = x >> layout.l;
+	lo = x & layout.lowmask;
+	pos = frozenBucketStart(&layout, h);
+	for (i = pos - h; frozenUpperBit(&layout, pos); pos++, i++) {
+		if (frozenLow(&layout, i) > lo) {
+			break;
+		}
+	}
+	return i;
+}
+
+
+/**
+ * Find the nth (1-based) lowest bit set in a frozen bitmap.
+ *
+ * @param frozen The ::FrozenBitmap being examined
+ * @param n The position of the required bit
+ * @param found Boolean that will be set to true if the bitmap has at
+ * least n bits.
+ *
+ * @return The nth bit, if found.
+ */
+static int32
+frozenSelect(FrozenBitmap *frozen,
+			 int64 n,
+			 bool *found)
+{
+	FrozenLayout layout;
+
+	*found = (n >= 1) && (n <= frozen->nbits);
+	if (!*found) {
+		return 0;
+	}
+	frozenLayout(frozen, &layout);
+	return frozenValue(&layout, n - 1, frozenElemPos(&layout, n - 1));
+}
+
+
+/** 
+ * Return the next set bit in a frozen bitmap, starting at inbit.
+ * 
+ * @param frozen The ::FrozenBitmap being examined
+ * @param inbit The starting bit from which to search
+ * @param found Boolean that will be set to true when a set bit has
+ * been found.
+ *
+ * @return The bit id of the found bit, or zero if no bits were found. 
+ */
+static int32
+frozenNextBit(FrozenBitmap *frozen,
+			  int32 inbit,
+			  bool *found)
+{
+	if (inbit <= frozen->bitmin) {
+		return frozenSelect(frozen, 1, found);
+	}
+	return frozenSelect(frozen, frozenRank(frozen, inbit - 1) + 1, found);
+}
+
+
+/** 
+ * Return the previous set bit in a frozen bitmap, starting at inbit.
+ * 
+ * @param frozen The ::FrozenBitmap being examined
+ * @param inbit The starting bit from which to search
+ * @param found Boolean that will be set to true when a set bit has
+ * been found.
+ *
+ * @return The bit id of the found bit, or zero if no bits were found. 
+ */
+static int32
+frozenPrevBit(FrozenBitmap *frozen,
+			  int32 inbit,
+			  bool *found)
+{
+	return frozenSelect(frozen, frozenRank(frozen, inbit), found);
+}
+
+
+/**
+ * Call fn for each element of a frozen bitmap between lo and hi
+ * inclusive, in ascending or descending order.  Consecutive elements
+ * are found by scanning the upper bitvector, so this is much faster
+ * than repeated calls to frozenNextBit().
+ *
+ * @param frozen The ::FrozenBitmap being scanned
+ * @param lo The lowest bit to be returned
+ * @param hi The highest bit to be returned
+ * @param reverse Whether the bits are to be returned in descending order
+ * @param fn Function to be called for each bit
+ * @param arg Argument to be passed to fn
+ */
+static void
+frozenForEach(FrozenBitmap *frozen,
+			  int32 lo,
+			  int32 hi,
+			  bool reverse,
+			  void (*fn)(int32 bit, void *arg),
+			  void *arg)
+{
+	FrozenLayout layout;
+	int64 first;
+	int64 last;
+	int64 i;
+	int64 pos;
+
+	if (lo > hi) {
+		return;
+	}
+	first = (lo <= frozen->bitmin)? 0: frozenRank(frozen, lo - 1);
+	last = frozenRank(frozen, hi) - 1;
+	if (first > last) {
+		return;
+	}
+	frozenLayout(frozen, &layout);
+	i = reverse? last: first;
+	pos = frozenElemPos(&layout, i);
+	while (true) {
+		fn(frozenValue(&layout, i, pos), arg);
+		if (reverse) {
+			if (--i < first) {
+				break;
+			}
+			pos = frozenPrevOne(layout.upper, pos - 1);
+		}
+		else {
+			if (++i > last) {
+				break;
+			}
+			pos = frozenSkip(layout.upper, pos + 1, 1, true);
+		}
+	}
+}
+
+
+/** 
+ * Return the next set bit in a bitmap, which may be frozen, starting
+ * at inbit.
+ * 
+ * @param bitmap The ::Bitmap being examined
+ * @param inbit The starting bit from which to search
+ * @param found Boolean that will be set to true when a set bit has
+ * been found.
+ *
+ * @return The bit id of the found bit, or zero if no bits were found. 
+ */
+static int32
+anyNextBit(Bitmap *bitmap,
+		   int32 inbit,
+		   bool *found)
+{
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		return frozenNextBit((FrozenBitmap *) bitmap, inbit, found);
+	}
+	return bitmapNextBit(bitmap, inbit, found);
+}
+
+
+/** 
+ * Return the previous set bit in a bitmap, which may be frozen,
+ * starting at inbit.
+ * 
+ * @param bitmap The ::Bitmap being examined
+ * @param inbit The starting bit from which to search
+ * @param found Boolean that will be set to true when a set bit has
+ * been found.
+ *
+ * @return The bit id of the found bit, or zero if no bits were found. 
+ */
+static int32
+anyPrevBit(Bitmap *bitmap,
+		   int32 inbit,
+		   bool *found)
+{
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		return frozenPrevBit((FrozenBitmap *) bitmap, inbit, found);
+	}
+	return bitmapPrevBit(bitmap, inbit, found);
+}
+
+
+/**
+ * State for collecting the result of frozenIntersect().
+ */
+typedef struct FrozenIntersectState {
+	Bitmap *other;		/**< The bitmap being probed */
+	Bitmap *result;		/**< The result, with the bounds of the overlap */
+	int64   nbits;		/**< The number of bits found */
+} FrozenIntersectState;
+
+
+/**
+ * frozenForEach() callback for frozenIntersect(): set bit in the result
+ * if it is also in the other bitmap.
+ */
+static void
+frozenIntersectBit(int32 bit,
+				   void *arg)
+{
+	FrozenIntersectState *state = (FrozenIntersectState *) arg;
+	Bitmap *other = state->other;
+	int32   relative_bit;
+
+	if (BITMAP_IS_FROZEN(other)?
+		frozenTestbit((FrozenBitmap *) other, bit):
+		bitmapTestbit(other, bit)) {
+		relative_bit = bit - BITZERO(state->result->bitmin);
+		state->result->bitset[BITSET_ELEM(relative_bit)] |=
+			bitmasks[BITSET_BIT(relative_bit)];
+		state->nbits++;
+	}
+}
+
+
+/** 
+ * Create the intersection of two bitmaps, at least one of which is
+ * frozen.  The elements of the frozen bitmap, or of the smaller one if
+ * both are frozen, that are within the range of the other bitmap are
+ * scanned and tested in the other bitmap.  Matching bits are set
+ * directly in a flat result covering the overlapping range of the two
+ * bitmaps, which is then reduced to the bounds of its bits.
+ * 
+ * @param bitmap1 The first ::Bitmap to be intersected.
+ * @param bitmap2 The second ::Bitmap, to be intersected with bitmap1.
+ *
+ * @return A newly allocated bitmap which is the intersection
+ */
+static Bitmap *
+frozenIntersect(Bitmap *bitmap1,
+				Bitmap *bitmap2)
+{
+	FrozenIntersectState state;
+	FrozenBitmap *frozen;
+	Bitmap *result;
+	int32  lo;
+	int32  hi;
+
+	if (!BITMAP_IS_FROZEN(bitmap1) ||
+		(BITMAP_IS_FROZEN(bitmap2) &&
+		 (((FrozenBitmap *) bitmap2)->nbits <
+		  ((FrozenBitmap *) bitmap1)->nbits))) {
+		frozen = (FrozenBitmap *) bitmap2;
+		state.other = bitmap1;
+	}
+	else {
+		frozen = (FrozenBitmap *) bitmap1;
+		state.other = bitmap2;
+	}
+
+	lo = MAX(frozen->bitmin, state.other->bitmin);
+	hi = MIN(frozen->bitmax, state.other->bitmax);
+	state.nbits = 0;
+	if ((lo <= hi) &&
+		(BITMAP_IS_FROZEN(state.other) || !bitmapEmpty(state.other))) {
+		state.result = newBitmap(lo, hi);
+		clearBitmap(state.result);
+		frozenForEach(frozen, lo, hi, false, frozenIntersectBit, &state);
+		if (state.nbits > 0) {
+			reduceBitmap(state.result);
+			return state.result;
+		}
+		pfree(state.result);
+	}
+	result = newBitmap(0, 0);
+	clearBitmap(result);
+	return result;
+}
+
+
+/*
+ * Binary conversion functions follow
+ **********************************************************************
+ */
+
+
+#ifdef WORDS_BIGENDIAN
+/**
+ * Convert a bitmap word between native and little-endian byte order.
+ */
+#ifdef USE_64_BIT
+#define BM_SWAP_LE(x) pg_bswap64(x)
+#else
+#define BM_SWAP_LE(x) pg_bswap32(x)
+#endif
+#endif
+
+/**
+ * The size of the header of the bytea form of a bitmap.  This contains
+ * bitmin and bitmax as little-endian int32 values.
+ */
+#define BYTEA_HEADER_SIZE 8
+
+/**
+ * Gives the number of 64-bit words following the header in the bytea
+ * form of a bitmap with the given bounds.  The first word starts at the
+ * 64-bit boundary at or below min, whatever the word size of bm_int.
+ */
+#define BYTEA_WORDS(min, max) ((((int64) (max) - ((min) & ~63)) >> 6) + 1)
+
+/**
+ * Gives the byte offset, within the words of the bytea form of a
+ * bitmap, at which its bitset starts.  This is non-zero only for
+ * 32-bit bitsets whose first word is the upper half of a 64-bit word.
+ */
+#define BYTEA_OFFSET(min) (((int32) BITZERO(min) - ((min) & ~63)) / 8)
+
+/**
+ * Give the size of the bytea form of a ::Bitmap, excluding its varlena
+ * header.
+ *
+ * @param bitmap The ::Bitmap
+ *
+ * @return The size in bytes.
+ */
+static Size
+bitmapByteaSize(Bitmap *bitmap)
+{
+	return BYTEA_HEADER_SIZE +
+		(sizeof(uint64) * BYTEA_WORDS(bitmap->bitmin, bitmap->bitmax));
+}
+
+
+/** 
+ * Write the bytea form of a ::Bitmap.  This is bitmin and bitmax,
+ * followed by the bits of the bitmap as little-endian 64-bit words.
+ * On little-endian machines the bitset is copied with a single
+ * memcpy(); otherwise each word is byte-swapped as it is copied.
+ * 
+ * @param bitmap The ::Bitmap to be written
+ * @param dst Where to write it.  This must have space for
+ * bitmapByteaSize() bytes.
+ */
+static void
+bitmapToBytes(Bitmap *bitmap,
+			  char *dst)
+{
+	int32  elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64  words = BYTEA_WORDS(bitmap->bitmin, bitmap->bitmax);
+	uint32 header[2];
+#ifdef WORDS_BIGENDIAN
+	bm_int word;
+	int32  i;
+#endif
+
+	header[0] = (uint32) bitmap->bitmin;
+	header[1] = (uint32) bitmap->bitmax;
+#ifdef WORDS_BIGENDIAN
+	header[0] = pg_bswap32(header[0]);
+	header[1] = pg_bswap32(header[1]);
+#endif
+	memcpy(dst, header, BYTEA_HEADER_SIZE);
+	dst += BYTEA_HEADER_SIZE;
+
+	memset(dst, 0, sizeof(uint64) * words);
+	dst += BYTEA_OFFSET(bitmap->bitmin);
+#ifdef WORDS_BIGENDIAN
+	for (i = 0; i < elems; i++) {
+		word = BM_SWAP_LE(bitmap->bitset[i]);
+		memcpy(dst + (i * sizeof(bm_int)), &word, sizeof(bm_int));
+	}
+#else
+	memcpy(dst, bitmap->bitset, sizeof(bm_int) * elems);
+#endif
+}
+
+
+/** 
+ * Create a ::Bitmap from its bytea form, as written by bitmapToBytes().
+ * Any bits outside of the bounds given in the header are ignored, and
+ * the bounds are then reduced to the bits actually set, so the header
+ * need only give bounds that contain all of the bits.
+ * 
+ * @param src The bytea data
+ * @param len The length of src
+ *
+ * @return New bitmap
+ */
+static Bitmap *
+bitmapFromBytes(const char *src,
+				Size len)
+{
+	Bitmap *result;
+	int32   elems;
+	int32   bitmin;
+	int32   bitmax;
+	uint32  header[2];
+	bm_int  mask;
+#ifdef WORDS_BIGENDIAN
+	int32   i;
+#endif
+
+	if (len < BYTEA_HEADER_SIZE) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid binary bitmap"),
+				 errdetail("Binary bitmaps need at least %d bytes.",
+						   BYTEA_HEADER_SIZE)));
+	}
+	memcpy(header, src, BYTEA_HEADER_SIZE);
+#ifdef WORDS_BIGENDIAN
+	header[0] = pg_bswap32(header[0]);
+	header[1] = pg_bswap32(header[1]);
+#endif
+	bitmin = (int32) header[0];
+	bitmax = (int32) header[1];
+	if ((bitmin > bitmax) ||
+		(len != BYTEA_HEADER_SIZE +
+		 (sizeof(uint64) * BYTEA_WORDS(bitmin, bitmax)))) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid binary bitmap"),
+				 errdetail("The length of a binary bitmap with range "
+						   "%d..%d must be %lld bytes.", bitmin, bitmax,
+						   (long long) (BYTEA_HEADER_SIZE + (sizeof(uint64) *
+											 BYTEA_WORDS(bitmin, bitmax))))));
+	}
+
+	result = newBitmap(bitmin, bitmax);
+	elems = ARRAYELEMS(bitmin, bitmax);
+	src += BYTEA_HEADER_SIZE + BYTEA_OFFSET(bitmin);
+	memcpy(result->bitset, src, sizeof(bm_int) * elems);
+#ifdef WORDS_BIGENDIAN
+	for (i = 0; i < elems; i++) {
+		result->bitset[i] = BM_SWAP_LE(result->bitset[i]);
+	}
+#endif
+
+	/* Discard any bits outside of the bounds. */
+	result->bitset[0] &= ~(bitmasks[BITSET_BIT(bitmin)] - 1);
+	mask = bitmasks[BITSET_BIT(bitmax)];
+	result->bitset[elems - 1] &= mask | (mask - 1);
+	reduceBitmap(result);
+	return result;
+}
+
+
+/**
+ * Give a byte with its bits in reverse order.  These macros build
+ * ::reversed_bits.
+ */
+#define REV2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define REV4(n) REV2(n), REV2(n + 2 * 16), REV2(n + 1 * 16), REV2(n + 3 * 16)
+#define REV6(n) REV4(n), REV4(n + 2 * 4), REV4(n + 1 * 4), REV4(n + 3 * 4)
+
+/**
+ * Array of byte values with their bits reversed, indexed by byte value.
+ * Bit strings store their first bit in the high order bit of each byte,
+ * whereas bitmaps store their lowest bit in the low order bit, so bytes
+ * are converted between the two using this.
+ */
+static const uint8 reversed_bits[256] = {
+	REV6(0), REV6(2), REV6(1), REV6(3)
+};
+
+
+/** 
+ * Write a ::Bitmap as a bit string, in which bit n of the string is 1
+ * if bit n is set in the bitmap.  The bitmap must not be empty and
+ * bitmin must not be negative.  Bits are converted a byte at a time.
+ * 
+ * @param bitmap The ::Bitmap to be written
+ * @param dst Where to write the bit string.  This must be zeroed, and
+ * have space for at least (bitmax / 8) + 1 bytes.
+ * @param nbytes The size of dst.
+ */
+static void
+bitmapToBitString(Bitmap *bitmap,
+				  uint8 *dst,
+				  int64 nbytes)
+{
+	int32  elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64  byte = ((int32) BITZERO(bitmap->bitmin)) / 8;
+	bm_int word;
+	int32  i;
+	int32  j;
+
+	for (i = 0; i < elems; i++, byte += sizeof(bm_int)) {
+		word = bitmap->bitset[i];
+		for (j = 0; word && ((byte + j) < nbytes); j++) {
+			dst[byte + j] = reversed_bits[word & 0xff];
+			word >>= 8;
+		}
+	}
+}
+
+
+/** 
+ * Create a ::Bitmap from a bit string, in which bit n of the string is
+ * 1 if bit n is to be set in the bitmap.  Bits are converted a byte at
+ * a time.
+ * 
+ * @param src The bit string
+ * @param nbytes The size of src in bytes.  Any padding bits in the
+ * last byte must be zero.
+ *
+ * @return New bitmap
+ */
+static Bitmap *
+bitmapFromBitString(const uint8 *src,
+					int64 nbytes)
+{
+	Bitmap *result;
+	int64   first = 0;
+	int64   last = nbytes - 1;
+	int64   byte;
+	int32   bitzero;
+	int32   relative_bit;
+
+	while ((first < nbytes) && (src[first] == 0)) {
+		first++;
+	}
+	if (first >= nbytes) {
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	while (src[last] == 0) {
+		last--;
+	}
+
+	result = newBitmap(
+		(int32) ((first * 8) + __builtin_ctz(reversed_bits[src[first]])),
+		(int32) ((last * 8) + 31 - __builtin_clz(reversed_bits[src[last]])));
+	clearBitmap(result);
+	bitzero = BITZERO(result->bitmin);
+	for (byte = first; byte <= last; byte++) {
+		if (src[byte]) {
+			relative_bit = (int32) (byte * 8) - bitzero;
+			result->bitset[BITSET_ELEM(relative_bit)] |=
+				((bm_int) reversed_bits[src[byte]]) <<
+				BITSET_BIT(relative_bit);
+		}
+	}
+	return result;
+}
+
+
+/*
+ * Roaring conversion functions follow.  These convert bitmaps to and
+ * from the portable serialisation format used by the Roaring bitmap
+ * libraries (see https://github.com/RoaringBitmap/RoaringFormatSpec).
+ * A Roaring bitmap divides the 32-bit integers into chunks of 65536
+ * values, each stored in its own container.  Containers hold either a
+ * sorted array of 16-bit values, a 65536 bit bitmap, or a list of runs
+ * of consecutive values.  Roaring values are unsigned: values of 2^31
+ * and above correspond to our negative integers.
+ **********************************************************************
+ */
+
+
+/**
+ * Cookie for serialised Roaring bitmaps that have no run containers.
+ */
+#define ROARING_COOKIE_NO_RUNS 12346
+
+/**
+ * Cookie for serialised Roaring bitmaps that may have run containers.
+ * The high 16 bits of the cookie word give the number of containers,
+ * less one.
+ */
+#define ROARING_COOKIE 12347
+
+/**
+ * Serialised Roaring bitmaps with run containers have an offset header
+ * only if they have at least this many containers.
+ */
+#define ROARING_NO_OFFSET_THRESHOLD 4
+
+/**
+ * The greatest cardinality of an array container.  Containers, other
+ * than run containers, with more values than this are bitmaps.
+ */
+#define ROARING_MAX_ARRAY 4096
+
+/**
+ * The number of 64-bit words in a bitmap container.
+ */
+#define ROARING_BITMAP_WORDS 1024
+
+/**
+ * The types of Roaring container.
+ */
+#define ROARING_ARRAY  0
+#define ROARING_BITMAP 1
+#define ROARING_RUN    2
+
+/**
+ * Describes one container of a serialised Roaring bitmap.
+ */
+typedef struct RoaringContainer {
+	uint16 key;		   /**< The high 16 bits of each value */
+	int16  type;	   /**< ROARING_ARRAY, ROARING_BITMAP or ROARING_RUN */
+	int32  card;	   /**< The number of values in the container */
+	int32  nruns;	   /**< The number of runs of consecutive values */
+	int64  offset;	   /**< The offset of the container's data */
+} RoaringContainer;
+
+/**
+ * Gives the lowest integer in the chunk with the given key.
+ */
+#define ROARING_BASE(key) ((int32) (((uint32) (key)) << 16))
+
+/**
+ * Gives the key of the chunk containing the given integer.
+ */
+#define ROARING_KEY(bit) ((uint16) (((uint32) (bit)) >> 16))
+
+/**
+ * Read a little-endian 16-bit value.
+ */
+static inline uint16
+readLE16(const char *src)
+{
+	uint16 result;
+
+	memcpy(&result, src, sizeof(result));
+#ifdef WORDS_BIGENDIAN
+	result = pg_bswap16(result);
+#endif
+	return result;
+}
+
+/**
+ * Read a little-endian 32-bit value.
+ */
+static inline uint32
+readLE32(const char *src)
+{
+	uint32 result;
+
+	memcpy(&result, src, sizeof(result));
+#ifdef WORDS_BIGENDIAN
+	result = pg_bswap32(result);
+#endif
+	return result;
+}
+
+/**
+ * Read a little-endian 64-bit value.
+ */
+static inline uint64
+readLE64(const char *src)
+{
+	uint64 result;
+
+	memcpy(&result, src, sizeof(result));
+#ifdef WORDS_BIGENDIAN
+	result = pg_bswap64(result);
+#endif
+	return result;
+}
+
+/**
+ * Write a little-endian 16-bit value.
+ */
+static inline void
+writeLE16(char *dst, uint16 value)
+{
+#ifdef WORDS_BIGENDIAN
+	value = pg_bswap16(value);
+#endif
+	memcpy(dst, &value, sizeof(value));
+}
+
+/**
+ * Write a little-endian 32-bit value.
+ */
+static inline void
+writeLE32(char *dst, uint32 value)
+{
+#ifdef WORDS_BIGENDIAN
+	value = pg_bswap32(value);
+#endif
+	memcpy(dst, &value, sizeof(value));
+}
+
+/**
+ * Write a little-endian 64-bit value.
+ */
+static inline void
+writeLE64(char *dst, uint64 value)
+{
+#ifdef WORDS_BIGENDIAN
+	value = pg_bswap64(value);
+#endif
+	memcpy(dst, &value, sizeof(value));
+}
+
+
+/** 
+ * Report an invalid serialised Roaring bitmap.
+ * 
+ * @param detail Describes what is wrong with it.
+ */
+static void
+invalidRoaring(const char *detail)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+			 errmsg("invalid roaring bitmap"),
+			 errdetail("%s", detail)));
+}
+
+
+/** 
+ * Return 64 bits of a ::Bitmap, starting from a multiple of 64.  Bits
+ * outside of the bitmap's bitset are returned as zeroes.
+ * 
+ * @param bitmap The ::Bitmap
+ * @param bit The first bit, relative to BITZERO(bitmap->bitmin)
+ *
+ * @return The 64 bits, with the first in the low order bit.
+ */
+static uint64
+bitmapWord64(Bitmap *bitmap,
+			 int64 bit)
+{
+	int64  elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64  elem = bit / ELEMBITS;
+#ifdef USE_64_BIT
+
+	return ((elem >= 0) && (elem < elems))? bitmap->bitset[elem]: 0;
+#else
+	uint64 result = 0;
+
+	if ((elem >= 0) && (elem < elems)) {
+		result = bitmap->bitset[elem];
+	}
+	if ((elem + 1 >= 0) && (elem + 1 < elems)) {
+		result |= ((uint64) bitmap->bitset[elem + 1]) << 32;
+	}
+	return result;
+#endif
+}
+
+
+/** 
+ * Set 64 bits of a ::Bitmap, starting from a multiple of 64, by or-ing
+ * them with the bits from a 64-bit word.  Bits of the word outside of
+ * the bitmap's bitset must be zero.
+ * 
+ * @param bitmap The ::Bitmap
+ * @param bit The first bit, relative to BITZERO(bitmap->bitmin)
+ * @param word The bits to be set, with the first in the low order bit.
+ */
+static void
+bitmapOrWord64(Bitmap *bitmap,
+			   int64 bit,
+			   uint64 word)
+{
+	int64  elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64  elem = bit / ELEMBITS;
+
+#ifdef USE_64_BIT
+	if ((elem >= 0) && (elem < elems)) {
+		bitmap->bitset[elem] |= word;
+	}
+#else
+	if ((elem >= 0) && (elem < elems)) {
+		bitmap->bitset[elem] |= (bm_int) word;
+	}
+	if ((elem + 1 >= 0) && (elem + 1 < elems)) {
+		bitmap->bitset[elem + 1] |= (bm_int) (word >> 32);
+	}
+#endif
+}
+
+
+/** 
+ * Set a range of bits in a ::Bitmap, a word at a time.
+ * 
+ * @param bitmap The ::Bitmap
+ * @param lo The first bit to be set, relative to
+ * BITZERO(bitmap->bitmin)
+ * @param hi The last bit to be set, relative to BITZERO(bitmap->bitmin)
+ */
+static void
+bitmapSetRange(Bitmap *bitmap,
+			   int64 lo,
+			   int64 hi)
+{
+	int64  first = lo / ELEMBITS;
+	int64  last = hi / ELEMBITS;
+	bm_int lo_mask = ~((bm_int) 0) << (lo % ELEMBITS);
+	bm_int hi_mask = ~((bm_int) 0) >> ((ELEMBITS - 1) - (hi % ELEMBITS));
+	int64  i;
+
+	if (first == last) {
+		bitmap->bitset[first] |= lo_mask & hi_mask;
+		return;
+	}
+	bitmap->bitset[first] |= lo_mask;
+	for (i = first + 1; i < last; i++) {
+		bitmap->bitset[i] = ~((bm_int) 0);
+	}
+	bitmap->bitset[last] |= hi_mask;
+}
+
+
+/** 
+ * Check the data of a Roaring container, and record its size.  Arrays
+ * must be strictly ascending, and runs must be ascending and not
+ * overlap, so that the lowest and highest values of the container are
+ * those found by roaringContainerBounds().
+ * 
+ * @param container The ::RoaringContainer, whose type, card and offset
+ * have been set.
+ * @param src The serialised Roaring bitmap
+ * @param len The length of src
+ *
+ * @return The offset following the container's data.
+ */
+static int64
+checkRoaringContainer(RoaringContainer *container,
+					  const char *src,
+					  int64 len)
+{
+	const char *data = src + container->offset;
+	int64 size;
+	int32 prev = -1;
+	int32 start;
+	int32 i;
+
+	if (container->type == ROARING_RUN) {
+		if (container->offset + 2 > len) {
+			invalidRoaring("The data is truncated.");
+		}
+		container->nruns = readLE16(data);
+		size = 2 + ((int64) container->nruns * 4);
+	}
+	else if (container->type == ROARING_ARRAY) {
+		size = (int64) container->card * 2;
+	}
+	else {
+		size = ROARING_BITMAP_WORDS * sizeof(uint64);
+	}
+	if (container->offset + size > len) {
+		invalidRoaring("The data is truncated.");
+	}
+
+	if (container->type == ROARING_RUN) {
+		if (container->nruns == 0) {
+			invalidRoaring("A run container is empty.");
+		}
+		for (i = 0; i < container->nruns; i++) {
+			start = readLE16(data + 2 + (i * 4));
+			if ((start <= prev) ||
+				(start + readLE16(data + 4 + (i * 4)) > 0xffff)) {
+				invalidRoaring("The runs of a container are out of order.");
+			}
+			prev = start + readLE16(data + 4 + (i * 4));
+		}
+	}
+	else if (container->type == ROARING_ARRAY) {
+		for (i = 0; i < container->card; i++) {
+			start = readLE16(data + (i * 2));
+			if (start <= prev) {
+				invalidRoaring("The values of a container are out of order.");
+			}
+			prev = start;
+		}
+	}
+	return container->offset + size;
+}
+
+
+/** 
+ * Find the lowest and highest values in a Roaring container, as
+ * offsets from the base of its chunk.
+ * 
+ * @param container The ::RoaringContainer, which has been checked by
+ * checkRoaringContainer().
+ * @param src The serialised Roaring bitmap
+ * @param p_lo Where the lowest value is to be returned
+ * @param p_hi Where the highest value is to be returned
+ */
+static void
+roaringContainerBounds(RoaringContainer *container,
+					   const char *src,
+					   int32 *p_lo,
+					   int32 *p_hi)
+{
+	const char *data = src + container->offset;
+	uint64 word;
+	int32  i;
+
+	if (container->type == ROARING_RUN) {
+		*p_lo = readLE16(data + 2);
+		data += (container->nruns - 1) * 4;
+		*p_hi = readLE16(data + 2) + readLE16(data + 4);
+	}
+	else if (container->type == ROARING_ARRAY) {
+		*p_lo = readLE16(data);
+		*p_hi = readLE16(data + ((container->card - 1) * 2));
+	}
+	else {
+		for (i = 0; i < ROARING_BITMAP_WORDS; i++) {
+			if ((word = readLE64(data + (i * sizeof(uint64))))) {
+				break;
+			}
+		}
+		if (i == ROARING_BITMAP_WORDS) {
+			invalidRoaring("A bitmap container is empty.");
+		}
+		*p_lo = (i * 64) + __builtin_ctzll(word);
+		for (i = ROARING_BITMAP_WORDS - 1; i >= 0; i--) {
+			if ((word = readLE64(data + (i * sizeof(uint64))))) {
+				break;
+			}
+		}
+		*p_hi = (i * 64) + 63 - __builtin_clzll(word);
+	}
+}
+
+
+/** 
+ * Set the bits from a Roaring container in a ::Bitmap.  Bitmap
+ * containers are copied a word at a time, and runs are set a word at a
+ * time.
+ * 
+ * @param bitmap The ::Bitmap, whose bounds include all values in the
+ * container.
+ * @param container The ::RoaringContainer, which has been checked by
+ * checkRoaringContainer().
+ * @param src The serialised Roaring bitmap
+ */
+static void
+setRoaringContainer(Bitmap *bitmap,
+					RoaringContainer *container,
+					const char *src)
+{
+	const char *data = src + container->offset;
+	int64 base = (int64) ROARING_BASE(container->key) -
+		(int64) (int32) BITZERO(bitmap->bitmin);
+	int64 bit;
+	int32 start;
+	int32 i;
+
+	if (container->type == ROARING_RUN) {
+		for (i = 0; i < container->nruns; i++) {
+			start = readLE16(data + 2 + (i * 4));
+			bitmapSetRange(bitmap, base + start,
+						   base + start + readLE16(data + 4 + (i * 4)));
+		}
+	}
+	else if (container->type == ROARING_ARRAY) {
+		for (i = 0; i < container->card; i++) {
+			bit = base + readLE16(data + (i * 2));
+			bitmap->bitset[bit / ELEMBITS] |= ((bm_int) 1) << (bit % ELEMBITS);
+		}
+	}
+	else {
+		for (i = 0; i < ROARING_BITMAP_WORDS; i++) {
+			bitmapOrWord64(bitmap, base + (i * 64),
+						   readLE64(data + (i * sizeof(uint64))));
+		}
+	}
+}
+
+
+/** 
+ * Create a ::Bitmap from a Roaring bitmap in the portable serialisation
+ * format.  The headers are read, and each container checked, to find
+ * the exact bounds of the result, and then each container's bits are
+ * set in the new bitmap.
+ * 
+ * @param src The serialised Roaring bitmap
+ * @param len The length of src
+ *
+ * @return New bitmap
+ */
+static Bitmap *
+bitmapFromRoaring(const char *src,
+				  int64 len)
+{
+	RoaringContainer *containers;
+	RoaringContainer *first;
+	RoaringContainer *last;
+	Bitmap *result;
+	const char *runflags = NULL;
+	const char *header;
+	uint32 cookie;
+	int64  ncontainers;
+	int64  offset;
+	int32  lo;
+	int32  hi;
+	int32  bitmin;
+	int32  bitmax;
+	int32  i;
+
+	if (len < 4) {
+		invalidRoaring("The data is truncated.");
+	}
+	cookie = readLE32(src);
+	if (((cookie & 0xffff) != ROARING_COOKIE) &&
+		(cookie != ROARING_COOKIE_NO_RUNS)) {
+		invalidRoaring("The cookie is not recognised.");
+	}
+	if ((cookie & 0xffff) == ROARING_COOKIE) {
+		ncontainers = (cookie >> 16) + 1;
+		runflags = src + 4;
+		header = runflags + ((ncontainers + 7) / 8);
+		offset = (header - src) + (ncontainers * 4);
+		if (ncontainers >= ROARING_NO_OFFSET_THRESHOLD) {
+			offset += ncontainers * 4;
+		}
+	}
+	else {
+		if (len < 8) {
+			invalidRoaring("The data is truncated.");
+		}
+		ncontainers = readLE32(src + 4);
+		if (ncontainers > 65536) {
+			invalidRoaring("There are too many containers.");
+		}
+		header = src + 8;
+		offset = 8 + (ncontainers * 8);
+	}
+	if (offset > len) {
+		invalidRoaring("The data is truncated.");
+	}
+
+	if (ncontainers == 0) {
+		if (offset != len) {
+			invalidRoaring("There is data following the last container.");
+		}
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+
+	/* Read the descriptive header and check each container. */
+	containers = palloc(sizeof(RoaringContainer) * ncontainers);
+	for (i = 0; i < ncontainers; i++) {
+		containers[i].key = readLE16(header + (i * 4));
+		containers[i].card = readLE16(header + (i * 4) + 2) + 1;
+		if ((i > 0) && (containers[i].key <= containers[i - 1].key)) {
+			invalidRoaring("The keys are out of order.");
+		}
+		if (runflags && (runflags[i / 8] & (1 << (i % 8)))) {
+			containers[i].type = ROARING_RUN;
+		}
+		else if (containers[i].card > ROARING_MAX_ARRAY) {
+			containers[i].type = ROARING_BITMAP;
+		}
+		else {
+			containers[i].type = ROARING_ARRAY;
+		}
+		containers[i].offset = offset;
+		offset = checkRoaringContainer(&containers[i], src, len);
+	}
+	if (offset != len) {
+		invalidRoaring("There is data following the last container.");
+	}
+
+	/* Containers are in unsigned order, so those with the high bit set
+	 * in their keys, ie those for negative integers, come last. */
+	first = &containers[0];
+	last = &containers[ncontainers - 1];
+	for (i = 0; i < ncontainers; i++) {
+		if (containers[i].key & 0x8000) {
+			first = &containers[i];
+			if (i > 0) {
+				last = &containers[i - 1];
+			}
+			break;
+		}
+	}
+	roaringContainerBounds(first, src, &lo, &hi);
+	bitmin = ROARING_BASE(first->key) + lo;
+	roaringContainerBounds(last, src, &lo, &hi);
+	bitmax = ROARING_BASE(last->key) + hi;
+
+	result = newBitmap(bitmin, bitmax);
+	clearBitmap(result);
+	for (i = 0; i < ncontainers; i++) {
+		setRoaringContainer(result, &containers[i], src);
+	}
+	pfree(containers);
+	return result;
+}
+
+
+/** 
+ * Describe the containers needed to store a ::Bitmap in the Roaring
+ * portable serialisation format.  Each chunk of the bitmap is counted
+ * a word at a time, and stored in whichever type of container is
+ * smallest.
+ * 
+ * @param bitmap The ::Bitmap, which must not be empty.
+ * @param containers Array, with one entry for each chunk between bitmin
+ * and bitmax, into which the containers are written in signed order.
+ *
+ * @return The number of containers, excluding empty chunks.
+ */
+static int32
+roaringContainers(Bitmap *bitmap,
+				  RoaringContainer *containers)
+{
+	int64  bitzero = (int64) (int32) BITZERO(bitmap->bitmin);
+	int32  key = bitmap->bitmin >> 16;
+	int32  lastkey = bitmap->bitmax >> 16;
+	int32  ncontainers = 0;
+	int64  base;
+	uint64 word;
+	uint64 carry;
+	int64  runsize;
+	RoaringContainer *container;
+	int32  i;
+
+	for (; key <= lastkey; key++) {
+		container = &containers[ncontainers];
+		container->key = (uint16) key;
+		container->card = 0;
+		container->nruns = 0;
+		base = ((int64) key * 65536) - bitzero;
+		carry = 0;
+		for (i = 0; i < ROARING_BITMAP_WORDS; i++) {
+			word = bitmapWord64(bitmap, base + (i * 64));
+			container->card += __builtin_popcountll(word);
+			container->nruns += __builtin_popcountll(word & ~((word << 1) |
+															 carry));
+			carry = word >> 63;
+		}
+		if (container->card == 0) {
+			continue;
+		}
+		runsize = 2 + ((int64) container->nruns * 4);
+		if (container->card <= ROARING_MAX_ARRAY) {
+			container->type = (runsize < container->card * 2)?
+				ROARING_RUN: ROARING_ARRAY;
+		}
+		else {
+			container->type =
+				(runsize < ROARING_BITMAP_WORDS * sizeof(uint64))?
+				ROARING_RUN: ROARING_BITMAP;
+		}
+		ncontainers++;
+	}
+	return ncontainers;
+}
+
+
+/** 
+ * Give the size of the data of a Roaring container.
+ * 
+ * @param container The ::RoaringContainer
+ *
+ * @return The size in bytes.
+ */
+static int64
+roaringContainerSize(RoaringContainer *container)
+{
+	if (container->type == ROARING_RUN) {
+		return 2 + ((int64) container->nruns * 4);
+	}
+	else if (container->type == ROARING_ARRAY) {
+		return (int64) container->card * 2;
+	}
+	return ROARING_BITMAP_WORDS * sizeof(uint64);
+}
+
+
+/** 
+ * Write the data of a Roaring container from the bits of a ::Bitmap.
+ * Array and run containers are written by finding each set bit, or
+ * each change between set and unset bits, a word at a time.
+ * 
+ * @param bitmap The ::Bitmap
+ * @param container The ::RoaringContainer
+ * @param dst Where the container's data is to be written.
+ */
+static void
+writeRoaringContainer(Bitmap *bitmap,
+					  RoaringContainer *container,
+					  char *dst)
+{
+	int64  base = (int64) ROARING_BASE(container->key) -
+		(int64) (int32) BITZERO(bitmap->bitmin);
+	uint64 word;
+	uint64 changes;
+	uint64 carry = 0;
+	int32  start = 0;
+	int32  bit;
+	int32  i;
+
+	if (container->type == ROARING_RUN) {
+		writeLE16(dst, (uint16) container->nruns);
+		dst += 2;
+	}
+	for (i = 0; i < ROARING_BITMAP_WORDS; i++) {
+		word = bitmapWord64(bitmap, base + (i * 64));
+		if (container->type == ROARING_BITMAP) {
+			writeLE64(dst + (i * sizeof(uint64)), word);
+		}
+		else if (container->type == ROARING_ARRAY) {
+			while (word) {
+				writeLE16(dst, (uint16) ((i * 64) + __builtin_ctzll(word)));
+				dst += 2;
+				word &= word - 1;
+			}
+		}
+		else {
+			changes = word ^ ((word << 1) | carry);
+			carry = word >> 63;
+			while (changes) {
+				bit = __builtin_ctzll(changes);
+				if (word & (((uint64) 1) << bit)) {
+					start = (i * 64) + bit;
+				}
+				else {
+					writeLE16(dst, (uint16) start);
+					writeLE16(dst + 2, (uint16) ((i * 64) + bit - 1 - start));
+					dst += 4;
+				}
+				changes &= changes - 1;
+			}
+		}
+	}
+	if (carry) {
+		/* The last run continues to the end of the chunk. */
+		writeLE16(dst, (uint16) start);
+		writeLE16(dst + 2, (uint16) (0xffff - start));
+	}
+}
+
+
+/** 
+ * Give the size of a ::Bitmap in the Roaring portable serialisation
+ * format, given its containers.
+ * 
+ * @param containers The ::RoaringContainer array from
+ * roaringContainers()
+ * @param ncontainers The number of containers
+ * @param p_runs Where to return whether there are any run containers.
+ *
+ * @return The size in bytes.
+ */
+static int64
+roaringSize(RoaringContainer *containers,
+			int32 ncontainers,
+			bool *p_runs)
+{
+	int64 size = 0;
+	int32 i;
+
+	*p_runs = false;
+	for (i = 0; i < ncontainers; i++) {
+		size += roaringContainerSize(&containers[i]);
+		if (containers[i].type == ROARING_RUN) {
+			*p_runs = true;
+		}
+	}
+	if (*p_runs) {
+		size += 4 + ((ncontainers + 7) / 8) + (ncontainers * 4);
+		if (ncontainers >= ROARING_NO_OFFSET_THRESHOLD) {
+			size += ncontainers * 4;
+		}
+	}
+	else {
+		size += 8 + (ncontainers * 8);
+	}
+	return size;
+}
+
+
+/** 
+ * Write a ::Bitmap in the Roaring portable serialisation format.
+ * 
+ * @param bitmap The ::Bitmap
+ * @param containers The ::RoaringContainer array from
+ * roaringContainers()
+ * @param ncontainers The number of containers
+ * @param runs Whether there are any run containers, from roaringSize()
+ * @param dst Where to write the result.  This must be zeroed, and have
+ * space for the number of bytes given by roaringSize().
+ */
+static void
+bitmapToRoaring(Bitmap *bitmap,
+				RoaringContainer *containers,
+				int32 ncontainers,
+				bool runs,
+				char *dst)
+{
+	RoaringContainer *container;
+	int32  first = 0;
+	int64  offset;
+	char  *header;
+	char  *offsets = NULL;
+	uint8 *runflags = NULL;
+	int32  i;
+
+	if (runs) {
+		writeLE32(dst, ROARING_COOKIE | ((ncontainers - 1) << 16));
+		runflags = (uint8 *) dst + 4;
+		header = (char *) runflags + ((ncontainers + 7) / 8);
+		offset = (header - dst) + (ncontainers * 4);
+		if (ncontainers >= ROARING_NO_OFFSET_THRESHOLD) {
+			offsets = header + (ncontainers * 4);
+			offset += ncontainers * 4;
+		}
+	}
+	else {
+		writeLE32(dst, ROARING_COOKIE_NO_RUNS);
+		writeLE32(dst + 4, ncontainers);
+		header = dst + 8;
+		offsets = header + (ncontainers * 4);
+		offset = 8 + (ncontainers * 8);
+	}
+
+	/* Our containers are in signed order, so the output starts with the
+	 * first one for a non-negative integer. */
+	while ((first < ncontainers) && (containers[first].key & 0x8000)) {
+		first++;
+	}
+	for (i = 0; i < ncontainers; i++) {
+		container = &containers[(first + i) % ncontainers];
+		writeLE16(header + (i * 4), container->key);
+		writeLE16(header + (i * 4) + 2, (uint16) (container->card - 1));
+		if (container->type == ROARING_RUN) {
+			runflags[i / 8] |= 1 << (i % 8);
+		}
+		if (offsets) {
+			writeLE32(offsets + (i * 4), (uint32) offset);
+		}
+		writeRoaringContainer(bitmap, container, dst + offset);
+		offset += roaringContainerSize(container);
+	}
+}
+
+
+/*
+ * Range conversion functions follow
+ **********************************************************************
+ */
+
+/** 
+ * Find the runs of consecutive bits in a ::Bitmap.  The bits of x ^ ((x
+ * << 1) | carry), where carry is the top bit of the previous word, mark
+ * the positions at which runs of x start or end, so the runs are found
+ * a word at a time, with one step for each run boundary rather than
+ * one for each bit.
+ * 
+ * @param bitmap The ::Bitmap to be examined
+ * @param p_nruns Location into which the number of runs is written
+ *
+ * @return A newly allocated array of the first and last bits of each
+ * run, in ascending order, or NULL if the bitmap is empty.
+ */
+static int32 *
+bitmapRuns(Bitmap *bitmap,
+		   int32 *p_nruns)
+{
+	int32   elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int64   base = (int32) BITZERO(bitmap->bitmin);
+	int32  *runs;
+	int32   nruns = 0;
+	int32   n = 0;
+	int32   elem;
+	int32   bit;
+	int64   pos;
+	bm_int  word;
+	bm_int  edges;
+	bm_int  carry = 0;
+
+	*p_nruns = 0;
+	if (bitmapEmpty(bitmap)) {
+		return NULL;
+	}
+	for (elem = 0; elem < elems; elem++) {
+		word = bitmap->bitset[elem];
+		edges = word ^ ((word << 1) | carry);
+		nruns += BM_POPCOUNT(edges & word);
+		carry = word >> (ELEMBITS - 1);
+	}
+
+	runs = palloc(sizeof(int32) * 2 * nruns);
+	carry = 0;
+	for (elem = 0; elem < elems; elem++) {
+		word = bitmap->bitset[elem];
+		edges = word ^ ((word << 1) | carry);
+		while (edges) {
+			bit = BM_CTZ(edges);
+			pos = base + ((int64) elem * ELEMBITS) + bit;
+			if (word & bitmasks[bit]) {
+				/* The start of a run. */
+				runs[n++] = (int32) pos;
+			}
+			else {
+				/* The bit after the end of a run. */
+				runs[n++] = (int32) (pos - 1);
+			}
+			edges &= edges - 1;
+		}
+		carry = word >> (ELEMBITS - 1);
+	}
+	if (carry) {
+		/* The last run ends at the last bit of the final word. */
+		runs[n++] = (int32) (base + ((int64) elems * ELEMBITS) - 1);
+	}
+	*p_nruns = nruns;
+	return runs;
+}
+
+
+/** 
+ * Create a ::Bitmap from runs of consecutive bits.  Whole words within
+ * each run are filled directly, so the cost depends on the size of the
+ * result and the number of runs, rather than on the number of bits.
+ * 
+ * @param runs Array of the first and last bits of each run.  The runs
+ * must be in ascending order and must not overlap.
+ * @param nruns The number of runs
+ *
+ * @return New bitmap
+ */
+static Bitmap *
+bitmapFromRuns(int32 *runs,
+			   int32 nruns)
+{
+	Bitmap *result;
+	int64   base;
+	int32   i;
+
+	if (nruns == 0) {
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	result = newBitmap(runs[0], runs[(2 * nruns) - 1]);
+	clearBitmap(result);
+	base = (int32) BITZERO(result->bitmin);
+	for (i = 0; i < nruns; i++) {
+		bitmapSetRange(result, runs[2 * i] - base, runs[(2 * i) + 1] - base);
+	}
+	return result;
+}
+
+
+/*
+ * Chunk functions follow.  These support the chunked storage of large
+ * bitmaps, in which each range of chunk_bits integers is stored as a
+ * separate small bitmap.
+ **********************************************************************
+ */
+
+
+/** 
+ * Return a new ::Bitmap containing those bits of bitmap that lie
+ * between lo and hi.  The words are copied directly, with only those
+ * at each end being masked.
+ * 
+ * @param bitmap The ::Bitmap from which bits are to be taken
+ * @param lo The lowest bit to be copied
+ * @param hi The highest bit to be copied
+ *
+ * @return New bitmap, or NULL if there are no bits in the range.
+ */
+static Bitmap *
+bitmapChunk(Bitmap *bitmap,
+			int32 lo,
+			int32 hi)
+{
+	Bitmap *result;
+	int32   first;
+	int32   last;
+	int32   offset;
+	int32   elems;
+	bool    found;
+	bm_int  mask;
+
+	first = bitmapNextBit(bitmap, lo, &found);
+	if ((!found) || (first > hi)) {
+		return NULL;
+	}
+	last = bitmapPrevBit(bitmap, hi, &found);
+
+	result = newBitmap(first, last);
+	elems = ARRAYELEMS(first, last);
+	offset = BITSET_ELEM((int32) (BITZERO(first) - BITZERO(bitmap->bitmin)));
+	memcpy(result->bitset, bitmap->bitset + offset, sizeof(bm_int) * elems);
+	result->bitset[0] &= ~(bitmasks[BITSET_BIT(first)] - 1);
+	mask = bitmasks[BITSET_BIT(last)];
+	result->bitset[elems - 1] &= mask | (mask - 1);
+	return result;
+}
+
+
+/** 
+ * Create the union of an array of bitmaps.  Unlike repeated calls to
+ * bitmapUnion(), the result is allocated once and the words of each
+ * bitmap are or-ed into it directly.  This makes reassembling a bitmap
+ * from its chunks linear in the size of the result.
+ * 
+ * @param bitmaps The array of ::Bitmap pointers, any of which may be
+ * NULL.
+ * @param n The number of entries in bitmaps
+ *
+ * @return A newly allocated bitmap which is the union.
+ */
+static Bitmap *
+bitmapUnionAll(Bitmap **bitmaps,
+			   int32 n)
+{
+	Bitmap *result;
+	Bitmap *bitmap;
+	bool    empty = true;
+	int32   bitmin = 0;
+	int32   bitmax = 0;
+	int32   offset;
+	int32   elems;
+	int32   i;
+	int32   j;
+
+	for (i = 0; i < n; i++) {
+		bitmap = bitmaps[i];
+		if (bitmap && !bitmapEmpty(bitmap)) {
+			if (empty || (bitmap->bitmin < bitmin)) {
+				bitmin = bitmap->bitmin;
+			}
+			if (empty || (bitmap->bitmax > bitmax)) {
+				bitmax = bitmap->bitmax;
+			}
+			empty = false;
+		}
+	}
+
+	result = newBitmap(bitmin, bitmax);
+	clearBitmap(result);
+	if (empty) {
+		return result;
+	}
+	for (i = 0; i < n; i++) {
+		bitmap = bitmaps[i];
+		if (bitmap && !bitmapEmpty(bitmap)) {
+			offset = BITSET_ELEM((int32) (BITZERO(bitmap->bitmin) -
+										  BITZERO(bitmin)));
+			elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+			for (j = 0; j < elems; j++) {
+				result->bitset[offset + j] |= bitmap->bitset[j];
+			}
+		}
+	}
+	// This would normally be unncessary but bitmaps stored by earlier
+	// versions may not have bits set at their bitmin and bitmax.
+	reduceBitmap(result);
+	return result;
+}
+
+
+/*
+ * MinHash functions follow.  A MinHash signature records, for each of
+ * k hash functions, the minimum hash of the elements of a bitmap.  The
+ * proportion of matching elements in the signatures of two bitmaps
+ * estimates their Jaccard similarity.
+ **********************************************************************
+ */
+
+/** 
+ * The largest number of hash functions allowed in a MinHash signature.
+ */
+#define MINHASH_MAX_K 4096
+
+/** 
+ * The seed from which the MinHash hash functions are derived.  This
+ * must never change, as signatures must remain comparable with those
+ * previously stored.
+ */
+#define MINHASH_SEED UINT64CONST(0x5bd1e9955bd1e995)
+
+/** 
+ * Mix the bits of x (this is the splitmix64 finaliser), giving a well
+ * distributed 64-bit hash.
+ * 
+ * @param x The value to be mixed
+ *
+ * @return The mixed value
+ */
+static inline uint64
+minhashMix(uint64 x)
+{
+	x ^= x >> 30;
+	x *= UINT64CONST(0xbf58476d1ce4e5b9);
+	x ^= x >> 27;
+	x *= UINT64CONST(0x94d049bb133111eb);
+	x ^= x >> 31;
+	return x;
+}
+
+/** 
+ * Compute the MinHash signature of a ::Bitmap.  Each element is hashed
+ * once, and that hash is then transformed by each of the k
+ * multiply-shift hash functions.  The loop over the hash functions has
+ * no dependencies between iterations so that the compiler is able to
+ * vectorise it.
+ * 
+ * @param bitmap The ::Bitmap to be examined
+ * @param k The number of hash functions
+ * @param mins Array of k values into which the signature is written.
+ * For an empty bitmap, every value is PG_UINT32_MAX.
+ */
+static void
+bitmapMinhash(Bitmap *bitmap,
+			  int32 k,
+			  uint32 *mins)
+{
+	uint64 *mult = palloc(sizeof(uint64) * k);
+	uint64 *add = palloc(sizeof(uint64) * k);
+	uint64  seed = MINHASH_SEED;
+	int32   bitzero;
+	int32   elems;
+	int32   elem;
+	bm_int  word;
+	uint64  hash;
+	uint32  value;
+	int32   i;
+
+	for (i = 0; i < k; i++) {
+		seed += UINT64CONST(0x9e3779b97f4a7c15);
+		mult[i] = minhashMix(seed) | 1;
+		seed += UINT64CONST(0x9e3779b97f4a7c15);
+		add[i] = minhashMix(seed);
+		mins[i] = PG_UINT32_MAX;
+	}
+
+	if (!bitmapEmpty(bitmap)) {
+		bitzero = BITZERO(bitmap->bitmin);
+		elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+		for (elem = 0; elem < elems; elem++) {
+			word = bitmap->bitset[elem];
+			while (word) {
+				hash = minhashMix((uint32) (bitzero + (elem * ELEMBITS) +
+											BM_CTZ(word)));
+				for (i = 0; i < k; i++) {
+					value = (uint32) ((hash * mult[i] + add[i]) >> 32);
+					mins[i] = (value < mins[i])? value: mins[i];
+				}
+				word &= word - 1;
+			}
+		}
+	}
+	pfree(mult);
+	pfree(add);
+}
+
+/** 
+ * Compute the LSH bucket key for one band of a MinHash signature.  The
+ * band number is included in the key so that matching values in
+ * different bands do not give matching keys.
+ * 
+ * @param band The band number
+ * @param values The signature values for the band
+ * @param rows The number of values in the band
+ *
+ * @return The bucket key
+ */
+static int64
+minhashBandKey(int32 band,
+			   uint32 *values,
+			   int32 rows)
+{
+	uint64 key = minhashMix(MINHASH_SEED + (uint32) band);
+	int32  i;
+
+	for (i = 0; i < rows; i++) {
+		key = minhashMix(key ^ values[i]);
+	}
+	return (int64) key;
+}
+
+
+/*
+ * Exported C API functions follow
+ **********************************************************************
+ */
+
+/** 
+ * Return the version of the C API implemented by the loaded pgbitmap
+ * library.  Extensions built against pgbitmap.h can compare this with
+ * PGBITMAP_API_VERSION to ensure that the library they are linked with
+ * is the one they were compiled for.
+ * 
+ * @return PGBITMAP_API_VERSION
+ */
+int
+bitmapApiVersion(void)
+{
+	return PGBITMAP_API_VERSION;
+}
+
+/** 
+ * Initialise a caller-provided buffer as an empty ::Bitmap.  This is
+ * the usual starting point for accumulating a result using
+ * bitmapUnionInto().
+ * 
+ * @param buffer The memory to be used for the bitmap.  This must be
+ * suitably aligned for a ::Bitmap.
+ * @param size The size of the buffer in bytes
+ *
+ * @return The buffer as an empty bitmap, or NULL if the buffer is too
+ * small.
+ */
+Bitmap *
+bitmapInitEmpty(void *buffer,
+				Size size)
+{
+	Bitmap *bitmap = (Bitmap *) buffer;
+
+	if (size < BITMAP_PLAIN_SIZE(0, 0)) {
+		return NULL;
+	}
+	bitmap->bitmin = 0;
+	bitmap->bitmax = 0;
+	bitmap->bitset[0] = 0;
+	trimBitmap(bitmap);
+	return bitmap;
+}
+
+/** 
+ * Give the buffer size needed for the union of two bitmaps.
+ * 
+ * @param bitmap1 The first ::Bitmap
+ * @param bitmap2 The second ::Bitmap
+ *
+ * @return The size, in bytes, needed by bitmapUnionBuffer().
+ */
+Size
+bitmapUnionSize(Bitmap *bitmap1,
+				Bitmap *bitmap2)
+{
+	if (bitmapEmpty(bitmap1)) {
+		return BITMAP_PLAIN_SIZE(bitmap2->bitmin, bitmap2->bitmax);
+	}
+	if (bitmapEmpty(bitmap2)) {
+		return BITMAP_PLAIN_SIZE(bitmap1->bitmin, bitmap1->bitmax);
+	}
+	return BITMAP_PLAIN_SIZE(MIN(bitmap1->bitmin, bitmap2->bitmin),
+							 MAX(bitmap1->bitmax, bitmap2->bitmax));
+}
+
+/** 
+ * Give the buffer size needed for the intersection of two bitmaps.
+ * 
+ * @param bitmap1 The first ::Bitmap
+ * @param bitmap2 The second ::Bitmap
+ *
+ * @return The size, in bytes, needed by bitmapIntersectBuffer().
+ */
+Size
+bitmapIntersectSize(Bitmap *bitmap1,
+					Bitmap *bitmap2)
+{
+	int32 bitmin = MAX(bitmap1->bitmin, bitmap2->bitmin);
+	int32 bitmax = MIN(bitmap1->bitmax, bitmap2->bitmax);
+
+	if ((bitmin > bitmax) || bitmapEmpty(bitmap1) || bitmapEmpty(bitmap2)) {
+		return BITMAP_PLAIN_SIZE(0, 0);
+	}
+	return BITMAP_PLAIN_SIZE(bitmin, bitmax);
+}
+
+/** 
+ * Give the buffer size needed for the subtraction of one bitmap from
+ * another.
+ * 
+ * @param bitmap1 The ::Bitmap from which bitmap2 will be subtracted
+ * @param bitmap2 The ::Bitmap to be subtracted
+ *
+ * @return The size, in bytes, needed by bitmapMinusBuffer().
+ */
+Size
+bitmapMinusSize(Bitmap *bitmap1,
+				Bitmap *bitmap2)
+{
+	return BITMAP_PLAIN_SIZE(bitmap1->bitmin, bitmap1->bitmax);
+}
+
+/** 
+ * Add the bits of source to target, in place.  As the union may extend
+ * the bounds of target, the caller must say how much space is
+ * available for it: if this is not enough, target is left unchanged.
+ * Source may be the same bitmap as target.
+ * 
+ * @param target The flat ::Bitmap to be updated
+ * @param capacity The size, in bytes, of the memory holding target.
+ * This may be larger than VARSIZE(target).
+ * @param source The flat ::Bitmap whose bits are to be added
+ *
+ * @return True if the union was done, false if target did not have
+ * the capacity for it.
+ */
+bool
+bitmapUnionInto(Bitmap *target,
+				Size capacity,
+				Bitmap *source)
+{
+	int32 bitmin;
+	int32 bitmax;
+	int32 elems;
+	int32 old_elems;
+	int32 shift;
+	int32 offset;
+	int32 src_elems;
+	int32 bit_offset;
+	int32 i;
+
+	if (bitmapEmpty(source)) {
+		return true;
+	}
+	if (bitmapEmpty(target)) {
+		if (capacity < BITMAP_PLAIN_SIZE(source->bitmin, source->bitmax)) {
+			return false;
+		}
+		memcpy(target, source,
+			   BITMAP_PLAIN_SIZE(source->bitmin, source->bitmax));
+		reduceBitmap(target);
+		return true;
+	}
+
+	bitmin = MIN(target->bitmin, source->bitmin);
+	bitmax = MAX(target->bitmax, source->bitmax);
+	if (capacity < BITMAP_PLAIN_SIZE(bitmin, bitmax)) {
+		return false;
+	}
+	elems = ARRAYELEMS(bitmin, bitmax);
+	old_elems = ARRAYELEMS(target->bitmin, target->bitmax);
+	bit_offset = BITZERO(target->bitmin) - BITZERO(bitmin);
+	shift = BITSET_ELEM(bit_offset);
+
+	/* Re-base the existing words of target to the new bitmin, and
+	 * clear the words that are new to it. */
+	if (shift) {
+		memmove(&(target->bitset[shift]), target->bitset,
+				sizeof(bm_int) * old_elems);
+		memset(target->bitset, 0, sizeof(bm_int) * shift);
+	}
+	memset(&(target->bitset[shift + old_elems]), 0,
+		   sizeof(bm_int) * (elems - (shift + old_elems)));
+
+	bit_offset = BITZERO(source->bitmin) - BITZERO(bitmin);
+	offset = BITSET_ELEM(bit_offset);
+	src_elems = ARRAYELEMS(source->bitmin, source->bitmax);
+	for (i = 0; i < src_elems; i++) {
+		target->bitset[i + offset] |= source->bitset[i];
+	}
+	target->bitmin = bitmin;
+	target->bitmax = bitmax;
+
+	/* As in bitmapUnion(), bitmaps stored by earlier versions may not
+	 * have bits set at their bounds. */
+	reduceBitmap(target);
+	return true;
+}
+
+/** 
+ * Write the intersection of two bitmaps into result.  The intersection
+ * can be no larger than bitmap1, and its words are never written ahead
+ * of those that are read from bitmap1, so result may be the same
+ * memory as bitmap1.
+ * 
+ * @param result The ::Bitmap into which the intersection is written.
+ * This must be at least bitmapIntersectSize() bytes.
+ * @param bitmap1 The first ::Bitmap to be intersected
+ * @param bitmap2 The second ::Bitmap to be intersected
+ */
+static void
+intersectBitmaps(Bitmap *result,
+				 Bitmap *bitmap1,
+				 Bitmap *bitmap2)
+{
+	int32 bitmin = MAX(bitmap1->bitmin, bitmap2->bitmin);
+	int32 bitmax = MIN(bitmap1->bitmax, bitmap2->bitmax);
+	int32 elems;
+	int32 bit_offset1;
+	int32 bit_offset2;
+	int32 elem_offset1;
+	int32 elem_offset2;
+	int32 i;
+
+	if ((bitmin > bitmax) || bitmapEmpty(bitmap1) || bitmapEmpty(bitmap2)) {
+		bitmapInitEmpty(result, BITMAP_PLAIN_SIZE(0, 0));
+		return;
+	}
+	elems = ARRAYELEMS(bitmin, bitmax);
+	bit_offset1 = BITZERO(bitmin) - BITZERO(bitmap1->bitmin);
+	bit_offset2 = BITZERO(bitmin) - BITZERO(bitmap2->bitmin);
+	elem_offset1 = BITSET_ELEM(bit_offset1);
+	elem_offset2 = BITSET_ELEM(bit_offset2);
+	for (i = 0; i < elems; i++) {
+		result->bitset[i] = (bitmap1->bitset[i + elem_offset1] &
+							 bitmap2->bitset[i + elem_offset2]);
+	}
+	result->bitmin = bitmin;
+	result->bitmax = bitmax;
+	reduceBitmap(result);
+}
+
+/** 
+ * Remove from target any bits that are not also in source, in place.
+ * Target can only shrink, so no capacity is needed.  Source may be the
+ * same bitmap as target.
+ * 
+ * @param target The flat ::Bitmap to be updated
+ * @param source The flat ::Bitmap to be intersected with target
+ */
+void
+bitmapIntersectInto(Bitmap *target,
+					Bitmap *source)
+{
+	intersectBitmaps(target, target, source);
+}
+
+/** 
+ * Remove from target any bits that are set in source, in place.
+ * Target can only shrink, so no capacity is needed.  Source may be the
+ * same bitmap as target.
+ * 
+ * @param target The flat ::Bitmap to be updated
+ * @param source The flat ::Bitmap whose bits are to be removed
+ */
+void
+bitmapMinusInto(Bitmap *target,
+				Bitmap *source)
+{
+	int32 bitmin = MAX(target->bitmin, source->bitmin);
+	int32 bitmax = MIN(target->bitmax, source->bitmax);
+	int32 elems;
+	int32 bit_offset1;
+	int32 bit_offset2;
+	int32 elem_offset1;
+	int32 elem_offset2;
+	int32 i;
+
+	if ((bitmin > bitmax) || bitmapEmpty(target) || bitmapEmpty(source)) {
+		return;
+	}
+	elems = ARRAYELEMS(bitmin, bitmax);
+	bit_offset1 = BITZERO(bitmin) - BITZERO(target->bitmin);
+	bit_offset2 = BITZERO(bitmin) - BITZERO(source->bitmin);
+	elem_offset1 = BITSET_ELEM(bit_offset1);
+	elem_offset2 = BITSET_ELEM(bit_offset2);
+	for (i = 0; i < elems; i++) {
+		target->bitset[i + elem_offset1] &= ~(source->bitset[i + elem_offset2]);
+	}
+	reduceBitmap(target);
+}
+
+/** 
+ * Create the union of two bitmaps in a caller-provided buffer.
+ * 
+ * @param bitmap1 The first ::Bitmap to be unioned
+ * @param bitmap2 The second ::Bitmap to be unioned
+ * @param buffer The memory for the result, which must be suitably
+ * aligned for a ::Bitmap and must not overlap either argument.
+ * @param size The size of the buffer in bytes.  bitmapUnionSize() gives
+ * the size needed.
+ *
+ * @return The buffer, containing the union, or NULL if it is too
+ * small.
+ */
+Bitmap *
+bitmapUnionBuffer(Bitmap *bitmap1,
+				  Bitmap *bitmap2,
+				  void *buffer,
+				  Size size)
+{
+	Bitmap *result = bitmapInitEmpty(buffer, size);
+
+	if ((result == NULL) ||
+		!bitmapUnionInto(result, size, bitmap1) ||
+		!bitmapUnionInto(result, size, bitmap2)) {
+		return NULL;
+	}
+	return result;
+}
+
+/** 
+ * Create the intersection of two bitmaps in a caller-provided buffer.
+ * 
+ * @param bitmap1 The first ::Bitmap to be intersected
+ * @param bitmap2 The second ::Bitmap to be intersected
+ * @param buffer The memory for the result, which must be suitably
+ * aligned for a ::Bitmap.  This may be the same memory as bitmap1.
+ * @param size The size of the buffer in bytes.  bitmapIntersectSize()
+ * gives the size needed.
+ *
+ * @return The buffer, containing the intersection, or NULL if it is
+ * too small.
+ */
+Bitmap *
+bitmapIntersectBuffer(Bitmap *bitmap1,
+					  Bitmap *bitmap2,
+					  void *buffer,
+					  Size size)
+{
+	if (size < bitmapIntersectSize(bitmap1, bitmap2)) {
+		return NULL;
+	}
+	intersectBitmaps((Bitmap *) buffer, bitmap1, bitmap2);
+	return (Bitmap *) buffer;
+}
+
+/** 
+ * Create the subtraction of two bitmaps in a caller-provided buffer.
+ * 
+ * @param bitmap1 The ::Bitmap from which bitmap2 will be subtracted
+ * @param bitmap2 The ::Bitmap to be subtracted
+ * @param buffer The memory for the result, which must be suitably
+ * aligned for a ::Bitmap and must not overlap bitmap2.  It may be the
+ * same memory as bitmap1.
+ * @param size The size of the buffer in bytes.  bitmapMinusSize()
+ * gives the size needed.
+ *
+ * @return The buffer, containing the subtraction, or NULL if it is too
+ * small.
+ */
+Bitmap *
+bitmapMinusBuffer(Bitmap *bitmap1,
+				  Bitmap *bitmap2,
+				  void *buffer,
+				  Size size)
+{
+	Bitmap *result = (Bitmap *) buffer;
+
+	if (size < bitmapMinusSize(bitmap1, bitmap2)) {
+		return NULL;
+	}
+	if (result != bitmap1) {
+		memcpy(result, bitmap1,
+			   BITMAP_PLAIN_SIZE(bitmap1->bitmin, bitmap1->bitmax));
+	}
+	trimBitmap(result);
+	bitmapMinusInto(result, bitmap2);
+	return result;
+}
+
+
+/*
+ * Bit-sliced index functions follow
+ **********************************************************************
+ */
+
+/**
+ * The largest number of slices in a ::Bsi.  Values are int4, so their
+ * offsets from the lowest value fit in 32 bits.
+ */
+#define BSI_MAX_SLICES 32
+
+/**
+ * A bit-sliced index, recording an integer value for each of a set of
+ * row ids.  The value for a row is base plus the sum of 2^i for each
+ * slice i whose bitmap contains the row.  The header is followed by
+ * nslices + 1 flat bitmaps, each starting on a MAXALIGN boundary: the
+ * existence bitmap, containing every row that has a value, followed by
+ * the bitmaps for slices 0 to nslices - 1.
+ */
+typedef struct Bsi {
+	char    vl_len[4];	/**< Standard postgres length header */
+	int32   nslices;	/**< The number of slice bitmaps */
+	int64   base;		/**< The lowest value recorded */
+} Bsi;
+
+/**
+ * Provide a macro for dealing with bsi arguments.
+ */
+#define PG_GETARG_BSI(x) ((Bsi *) PG_DETOAST_DATUM(PG_GETARG_DATUM(x)))
+
+/** 
+ * Return one of the bitmaps of a ::Bsi.
+ * 
+ * @param bsi The ::Bsi
+ * @param n 0 for the existence bitmap, or 1 + i for slice i.
+ *
+ * @return The bitmap, within the bsi.
+ */
+static Bitmap *
+bsiBitmap(Bsi *bsi,
+		  int32 n)
+{
+	char *p = ((char *) bsi) + MAXALIGN(sizeof(Bsi));
+
+	while (n-- > 0) {
+		p += MAXALIGN(VARSIZE(p));
+	}
+	return (Bitmap *) p;
+}
+
+/** 
+ * Create a ::Bsi from its bitmaps.
+ * 
+ * @param bitmaps The flat existence bitmap, followed by the flat bitmap
+ * for each slice.
+ * @param nslices The number of slices
+ * @param base The lowest value
+ *
+ * @return The new bsi.
+ */
+static Bsi *
+bsiBuild(Bitmap **bitmaps,
+		 int32 nslices,
+		 int64 base)
+{
+	Bsi   *bsi;
+	Size   size = MAXALIGN(sizeof(Bsi));
+	char  *p;
+	int32  i;
+
+	for (i = 0; i <= nslices; i++) {
+		size += MAXALIGN(VARSIZE(bitmaps[i]));
+	}
+	bsi = palloc0(size);
+	SET_VARSIZE(bsi, size);
+	bsi->nslices = nslices;
+	bsi->base = base;
+	p = ((char *) bsi) + MAXALIGN(sizeof(Bsi));
+	for (i = 0; i <= nslices; i++) {
+		memcpy(p, bitmaps[i], VARSIZE(bitmaps[i]));
+		p += MAXALIGN(VARSIZE(bitmaps[i]));
+	}
+	return bsi;
+}
+
+/** 
+ * Find the rows of a ::Bsi whose values, less base, are at most, or at
+ * least, a given value.  Slices are examined from the most
+ * significant, keeping the set of rows whose values are so far equal
+ * to the given value, and adding to the result those that have become
+ * strictly less, or greater.  All of the sets lie within the bounds of
+ * the existence bitmap, so they are built in place, in buffers of that
+ * size, using the in-place union, intersection and subtraction
+ * functions, with no other allocations.
+ * 
+ * @param bsi The ::Bsi
+ * @param value The value to be compared, which must be less than
+ * 2^nslices.
+ * @param greater True to find values of at least value, false to find
+ * values of at most value.
+ *
+ * @return Newly allocated bitmap of the matching rows.
+ */
+static Bitmap *
+bsiCompare(Bsi *bsi,
+		   uint64 value,
+		   bool greater)
+{
+	Bitmap *ebm = bsiBitmap(bsi, 0);
+	Size    size = BITMAP_PLAIN_SIZE(ebm->bitmin, ebm->bitmax);
+	Bitmap *result = bitmapInitEmpty(palloc(size), size);
+	Bitmap *eq = palloc(size);
+	Bitmap *scratch = palloc(size);
+	Bitmap *slice;
+	int32   i;
+
+	memcpy(eq, ebm, size);
+	for (i = bsi->nslices - 1; (i >= 0) && !bitmapEmpty(eq); i--) {
+		slice = bsiBitmap(bsi, i + 1);
+		if (((value >> i) & 1) != (greater? 1: 0)) {
+			/* Rows still equal, which have a 1 in this slice where
+			 * value has a 0 (or the reverse), are strictly greater
+			 * (or less) than value. */
+			memcpy(scratch, eq, VARSIZE(eq));
+			if (greater) {
+				bitmapIntersectInto(scratch, slice);
+			}
+			else {
+				bitmapMinusInto(scratch, slice);
+			}
+			bitmapUnionInto(result, size, scratch);
+		}
+		if ((value >> i) & 1) {
+			bitmapIntersectInto(eq, slice);
+		}
+		else {
+			bitmapMinusInto(eq, slice);
+		}
+	}
+	bitmapUnionInto(result, size, eq);
+	pfree(eq);
+	pfree(scratch);
+	return result;
+}
+
+/** 
+ * Find the rows of a ::Bsi whose values lie within a range.
+ * 
+ * @param bsi The ::Bsi
+ * @param lo The lowest value to be matched
+ * @param hi The highest value to be matched
+ *
+ * @return Newly allocated bitmap of the matching rows.
+ */
+static Bitmap *
+bsiRange(Bsi *bsi,
+		 int64 lo,
+		 int64 hi)
+{
+	int64   maxval = (((int64) 1) << bsi->nslices) - 1;
+	Bitmap *result;
+	Bitmap *ge;
+
+	lo -= bsi->base;
+	hi -= bsi->base;
+	if ((lo > hi) || (hi < 0) || (lo > maxval) ||
+		bitmapEmpty(bsiBitmap(bsi, 0))) {
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	if (hi >= maxval) {
+		result = bitmapCopy(bsiBitmap(bsi, 0));
+	}
+	else {
+		result = bsiCompare(bsi, (uint64) hi, false);
+	}
+	if (lo > 0) {
+		ge = bsiCompare(bsi, (uint64) lo, true);
+		bitmapIntersectInto(result, ge);
+		pfree(ge);
+	}
+	return result;
+}
+
+/** 
+ * Count the bits that two bitmaps have in common, without creating
+ * their intersection.
+ * 
+ * @param bitmap1 The first ::Bitmap
+ * @param bitmap2 The second ::Bitmap
+ *
+ * @return The cardinality of the intersection of the bitmaps.
+ */
+static int64
+bitmapIntersectCount(Bitmap *bitmap1,
+					 Bitmap *bitmap2)
+{
+	int32 lo = MAX(bitmap1->bitmin, bitmap2->bitmin);
+	int32 hi = MIN(bitmap1->bitmax, bitmap2->bitmax);
+	int32 bit_offset1;
+	int32 bit_offset2;
+	int32 elem_offset1;
+	int32 elem_offset2;
+	int32 elems;
+	int64 result = 0;
+	int32 i;
+
+	if ((lo > hi) || bitmapEmpty(bitmap1) || bitmapEmpty(bitmap2)) {
+		return 0;
+	}
+	bit_offset1 = BITZERO(lo) - BITZERO(bitmap1->bitmin);
+	bit_offset2 = BITZERO(lo) - BITZERO(bitmap2->bitmin);
+	elem_offset1 = BITSET_ELEM(bit_offset1);
+	elem_offset2 = BITSET_ELEM(bit_offset2);
+	elems = ARRAYELEMS(lo, hi);
+	for (i = 0; i < elems; i++) {
+		result += BM_POPCOUNT(bitmap1->bitset[i + elem_offset1] &
+							  bitmap2->bitset[i + elem_offset2]);
+	}
+	return result;
+}
+
+
+/*
+ * Overlap matrix functions follow
+ **********************************************************************
+ */
+
+/**
+ * The number of bytes of all of the bitmaps that are processed
+ * together by bitmapOverlapCounts().  This is chosen to fit within a
+ * typical level 2 cache.
+ */
+#define OVERLAP_TILE_BYTES (256 * 1024)
+
+/**
+ * The smallest number of words of each bitmap processed together by
+ * bitmapOverlapCounts().
+ */
+#define OVERLAP_MIN_TILE_WORDS 8
+
+/** 
+ * Count the bits in common for every pair of a set of bitmaps.  Rather
+ * than intersecting each pair in turn, which would read each bitmap n
+ * times from memory, the bitmaps are processed a tile of words at a
+ * time: the words of each bitmap within the tile are counted against
+ * those of every other, while they are all still in cache.  Tiles in
+ * which no bitmap has any words are skipped.
+ * 
+ * @param bitmaps The flat, non-frozen bitmaps
+ * @param n The number of bitmaps
+ * @param counts Array of n * n counts into which the number of bits
+ * in common for bitmaps i and j is written at [i * n + j].  The
+ * diagonal gives the cardinality of each bitmap.
+ */
+static void
+bitmapOverlapCounts(Bitmap **bitmaps,
+					int32 n,
+					int64 *counts)
+{
+	int32  tile_words = MAX(OVERLAP_MIN_TILE_WORDS,
+							OVERLAP_TILE_BYTES / (sizeof(bm_int) * MAX(n, 1)));
+	int32 *first = palloc(sizeof(int32) * n);
+	int32 *last = palloc(sizeof(int32) * n);
+	int32 *active = palloc(sizeof(int32) * n);
+	int32  nactive;
+	int32  tile_first = PG_INT32_MAX;
+	int32  tile_last;
+	int32  max_last = PG_INT32_MIN;
+	int32  next_first;
+	int32  lo;
+	int32  hi;
+	int32  i;
+	int32  j;
+	int32  a;
+	int32  b;
+	int32  w;
+	bm_int *words1;
+	bm_int *words2;
+	int64  count;
+
+	memset(counts, 0, sizeof(int64) * n * n);
+
+	/* Words are identified by their position relative to bit zero, so
+	 * that the words of different bitmaps can be matched. */
+	for (i = 0; i < n; i++) {
+		if (bitmapEmpty(bitmaps[i])) {
+			first[i] = 0;
+			last[i] = -1;
+			continue;
+		}
+		first[i] = BITSET_ELEM(bitmaps[i]->bitmin);
+		last[i] = BITSET_ELEM(bitmaps[i]->bitmax);
+		tile_first = MIN(tile_first, first[i]);
+		max_last = MAX(max_last, last[i]);
+	}
+
+	while (tile_first <= max_last) {
+		tile_last = tile_first + MIN(tile_words - 1, max_last - tile_first);
+		nactive = 0;
+		next_first = PG_INT32_MAX;
+		for (i = 0; i < n; i++) {
+			if (first[i] > last[i]) {
+				continue;
+			}
+			if (first[i] > tile_last) {
+				next_first = MIN(next_first, first[i]);
+			}
+			else if (last[i] >= tile_first) {
+				active[nactive++] = i;
+			}
+		}
+		if (nactive == 0) {
+			/* A gap between the bitmaps: skip to the next bitmap. */
+			if (next_first == PG_INT32_MAX) {
+				break;
+			}
+			tile_first = next_first;
+			continue;
+		}
+
+		for (a = 0; a < nactive; a++) {
+			i = active[a];
+			for (b = a; b < nactive; b++) {
+				j = active[b];
+				lo = MAX(tile_first, MAX(first[i], first[j]));
+				hi = MIN(tile_last, MIN(last[i], last[j]));
+				if (lo > hi) {
+					continue;
+				}
+				words1 = &(bitmaps[i]->bitset[lo - first[i]]);
+				words2 = &(bitmaps[j]->bitset[lo - first[j]]);
+				count = 0;
+				for (w = 0; w <= hi - lo; w++) {
+					count += BM_POPCOUNT(words1[w] & words2[w]);
+				}
+				counts[(i * n) + j] += count;
+			}
+		}
+		if (tile_last == max_last) {
+			break;
+		}
+		tile_first = tile_last + 1;
+	}
+
+	/* Only the upper triangle has been counted. */
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			counts[(j * n) + i] = counts[(i * n) + j];
+		}
+	}
+	pfree(first);
+	pfree(last);
+	pfree(active);
+}
+
+
+/*
+ * Bit-sliced counter functions follow.  These count, for each bit, the
+ * number of bitmaps containing that bit, with the counts held
+ * vertically: slice s holds bit s of the count of every bit, so that a
+ * word of a bitmap is counted with a few word-wide operations rather
+ * than one increment for each of its bits.
+ **********************************************************************
+ */
+
+/**
+ * The largest number of slices in a ::BitCounters.  Counts cannot
+ * exceed the number of rows, which is an int64.
+ */
+#define BITCOUNTER_MAX_SLICES 63
+
+/**
+ * Vertical, bit-sliced, counters for each bit in a range of words.
+ * The count for bit b of word w is the sum of 2^s for each slice s in
+ * which bit b of slices[s][w] is set.
+ */
+typedef struct BitCounters {
+	int64    rows;		    /**< The number of bitmaps counted */
+	int32    k;			    /**< The threshold for threshold_of() */
+	int32    firstword;	    /**< BITSET_ELEM() of the first bit covered */
+	int32    nwords;	    /**< The number of words covered */
+	int32    nslices;	    /**< The number of slices */
+	bm_int  *slices[BITCOUNTER_MAX_SLICES]; /**< nslices arrays of
+											 * nwords words */
+} BitCounters;
+
+/** 
+ * Ensure that a ::BitCounters covers the words from lo_word to
+ * hi_word.  As for coverBitCounts(), the counters are extended by at
+ * least their current size, so that extending them in small steps does
+ * not cause them to be copied each time.
+ * 
+ * @param counters The ::BitCounters
+ * @param lo_word BITSET_ELEM() of the lowest bit to be covered
+ * @param hi_word BITSET_ELEM() of the highest bit to be covered
+ */
+static void
+coverBitCounters(BitCounters *counters,
+				 int32 lo_word,
+				 int32 hi_word)
+{
+	int32   last_word = counters->firstword + counters->nwords - 1;
+	int32   new_first;
+	int32   new_last;
+	int32   offset;
+	bm_int *slice;
+	int32   s;
+
+	if (counters->nwords == 0) {
+		counters->firstword = lo_word;
+		counters->nwords = hi_word - lo_word + 1;
+		return;
+	}
+	if ((lo_word >= counters->firstword) && (hi_word <= last_word)) {
+		return;
+	}
+	new_first = counters->firstword;
+	new_last = last_word;
+	if (lo_word < counters->firstword) {
+		new_first = MAX(BITSET_ELEM(PG_INT32_MIN),
+						MIN(lo_word, counters->firstword - counters->nwords));
+	}
+	if (hi_word > last_word) {
+		new_last = MIN(BITSET_ELEM(PG_INT32_MAX),
+					   MAX(hi_word, last_word + counters->nwords));
+	}
+	offset = counters->firstword - new_first;
+	for (s = 0; s < counters->nslices; s++) {
+		slice = palloc0(sizeof(bm_int) * (new_last - new_first + 1));
+		memcpy(slice + offset, counters->slices[s],
+			   sizeof(bm_int) * counters->nwords);
+		pfree(counters->slices[s]);
+		counters->slices[s] = slice;
+	}
+	counters->firstword = new_first;
+	counters->nwords = new_last - new_first + 1;
+}
+
+/** 
+ * Add a carry into the counters for a word, from slice s upwards.
+ * Each slice is a half adder: the bits of the carry that were already
+ * set in the slice are carried into the next.
+ * 
+ * @param counters The ::BitCounters
+ * @param s The slice into which the carry is added
+ * @param word_idx The index of the word within each slice
+ * @param carry The bits to be added
+ */
+static void
+carryBitCounters(BitCounters *counters,
+				 int32 s,
+				 int32 word_idx,
+				 bm_int carry)
+{
+	bm_int next;
+
+	while (carry) {
+		if (s == counters->nslices) {
+			counters->slices[s] = palloc0(sizeof(bm_int) * counters->nwords);
+			counters->nslices++;
+		}
+		next = counters->slices[s][word_idx] & carry;
+		counters->slices[s][word_idx] ^= carry;
+		carry = next;
+		s++;
+	}
+}
+
+/** 
+ * Count the bits of a bitmap in a ::BitCounters.  Any new slices, or
+ * extensions to existing ones, are allocated in the current memory
+ * context.
+ * 
+ * @param counters The ::BitCounters
+ * @param bitmap The flat, non-frozen, ::Bitmap to be counted
+ */
+static void
+bitCountersAdd(BitCounters *counters,
+			   Bitmap *bitmap)
+{
+	int32 elems;
+	int32 offset;
+	int32 i;
+
+	counters->rows++;
+	if (bitmapEmpty(bitmap)) {
+		return;
+	}
+	coverBitCounters(counters, BITSET_ELEM(bitmap->bitmin),
+					 BITSET_ELEM(bitmap->bitmax));
+	offset = BITSET_ELEM(bitmap->bitmin) - counters->firstword;
+	elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	for (i = 0; i < elems; i++) {
+		carryBitCounters(counters, 0, i + offset, bitmap->bitset[i]);
+	}
+}
+
+/** 
+ * Add the counts of one ::BitCounters to another.  Each word of the
+ * counts is added with a full adder for each slice, as a vertical
+ * counter adds words: the sum for a slice is the exclusive or of its
+ * inputs, and the carry into the next slice is their majority.
+ * 
+ * @param counters The ::BitCounters to be updated
+ * @param other The ::BitCounters whose counts are to be added
+ */
+static void
+bitCountersCombine(BitCounters *counters,
+				   BitCounters *other)
+{
+	int32   offset;
+	int32   w;
+	int32   s;
+	bm_int *word;
+	bm_int  in;
+	bm_int  sum;
+	bm_int  carry;
+
+	counters->rows += other->rows;
+	if (other->nwords == 0) {
+		return;
+	}
+	coverBitCounters(counters, other->firstword,
+					 other->firstword + other->nwords - 1);
+	while (counters->nslices < other->nslices) {
+		counters->slices[counters->nslices++] =
+			palloc0(sizeof(bm_int) * counters->nwords);
+	}
+	offset = other->firstword - counters->firstword;
+	for (w = 0; w < other->nwords; w++) {
+		carry = 0;
+		for (s = 0; s < other->nslices; s++) {
+			word = &(counters->slices[s][w + offset]);
+			in = other->slices[s][w];
+			sum = *word ^ in ^ carry;
+			carry = (*word & in) | (carry & (*word ^ in));
+			*word = sum;
+		}
+		carryBitCounters(counters, s, w + offset, carry);
+	}
+}
+
+/** 
+ * Return the bits of a word whose counts are at least k.  The slices
+ * are compared with k from the most significant, tracking the bits
+ * whose counts are so far equal to k, and those that are already
+ * greater.
+ * 
+ * @param counters The ::BitCounters
+ * @param word_idx The index of the word within each slice
+ * @param k The threshold, which must be at least 1 and less than
+ * 2^nslices.
+ *
+ * @return The word of bits whose counts are at least k.
+ */
+static bm_int
+bitCountersAtLeast(BitCounters *counters,
+				   int32 word_idx,
+				   int64 k)
+{
+	bm_int eq = ~((bm_int) 0);
+	bm_int gt = 0;
+	bm_int slice;
+	int32  s;
+
+	for (s = counters->nslices - 1; s >= 0; s--) {
+		slice = counters->slices[s][word_idx];
+		if ((k >> s) & 1) {
+			eq &= slice;
+		}
+		else {
+			gt |= eq & slice;
+			eq &= ~slice;
+		}
+	}
+	return gt | eq;
+}
+
+/** 
+ * Return a bitmap of the bits counted in at least k bitmaps.
+ * 
+ * @param counters The ::BitCounters
+ * @param k The threshold, which must be at least 1.
+ *
+ * @return Newly allocated ::Bitmap.
+ */
+static Bitmap *
+bitCountersThreshold(BitCounters *counters,
+					 int64 k)
+{
+	Bitmap *result;
+	bm_int *words;
+	int32   first = -1;
+	int32   last = -1;
+	int32   i;
+
+	if ((counters->nslices == 0) ||
+		((counters->nslices < BITCOUNTER_MAX_SLICES) &&
+		 (k >= (((int64) 1) << counters->nslices)))) {
+		/* No count can reach k. */
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+
+	words = palloc(sizeof(bm_int) * counters->nwords);
+	for (i = 0; i < counters->nwords; i++) {
+		words[i] = bitCountersAtLeast(counters, i, k);
+		if (words[i]) {
+			if (first < 0) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+	if (first < 0) {
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+	}
+	else {
+		result = newBitmap(
+			((counters->firstword + first) * ELEMBITS) +
+			BM_CTZ(words[first]),
+			((counters->firstword + last) * ELEMBITS) +
+			BM_HIGHBIT(words[last]));
+		memcpy(result->bitset, words + first,
+			   sizeof(bm_int) * (last - first + 1));
+	}
+	pfree(words);
+	return result;
+}
+
+/** 
+ * Return the number of bits with non-zero counts in a ::BitCounters.
+ * 
+ * @param counters The ::BitCounters
+ *
+ * @return The number of bits counted in at least one bitmap.
+ */
+static int64
+bitCountersBits(BitCounters *counters)
+{
+	bm_int word;
+	int64  result = 0;
+	int32  s;
+	int32  i;
+
+	for (i = 0; i < counters->nwords; i++) {
+		word = 0;
+		for (s = 0; s < counters->nslices; s++) {
+			word |= counters->slices[s][i];
+		}
+		result += BM_POPCOUNT(word);
+	}
+	return result;
+}
+
+/** 
+ * Write the bits with non-zero counts in a ::BitCounters, and their
+ * counts, into arrays of bitCountersBits() elements, in bit order.
+ * 
+ * @param counters The ::BitCounters
+ * @param bits The array into which the bits are written
+ * @param counts The array into which the count for each bit is written
+ */
+static void
+bitCountersFrequencies(BitCounters *counters,
+					   int32 *bits,
+					   int64 *counts)
+{
+	bm_int word;
+	int64  count;
+	int32  bitno;
+	int32  n = 0;
+	int32  s;
+	int32  i;
+
+	for (i = 0; i < counters->nwords; i++) {
+		word = 0;
+		for (s = 0; s < counters->nslices; s++) {
+			word |= counters->slices[s][i];
+		}
+		while (word) {
+			bitno = BM_CTZ(word);
+			word &= word - 1;
+			count = 0;
+			for (s = 0; s < counters->nslices; s++) {
+				if (counters->slices[s][i] & bitmasks[bitno]) {
+					count |= ((int64) 1) << s;
+				}
+			}
+			bits[n] = ((counters->firstword + i) * ELEMBITS) + bitno;
+			counts[n] = count;
+			n++;
+		}
+	}
+}
+
+
+/*
+ * Folding functions follow.  A folded bitmap records, for each element
+ * x of a bitmap, the element x mod nbits, giving a bitmap of bounded
+ * size that can be used as a lossy summary of one or more bitmaps.
+ * nbits must be a power of 2 no smaller than ELEMBITS, so that it
+ * divides 2^32 and each word of a bitmap folds onto a single word.
+ **********************************************************************
+ */
+
+/**
+ * Gives the index of the word of a folded bitmap of nbits bits onto
+ * which the word starting at bit x folds.
+ */
+#define FOLDED_WORD(x, nbits) (((uint32) (x) % (uint32) (nbits)) / ELEMBITS)
+
+/** 
+ * Return the folded form of a bitmap.
+ * 
+ * @param bitmap The flat ::Bitmap to be folded
+ * @param nbits The size of the folded bitmap, a power of 2 no smaller
+ * than ELEMBITS.
+ *
+ * @return A newly allocated ::Bitmap whose elements lie between 0 and
+ * nbits - 1.
+ */
+Bitmap *
+bitmapFold(Bitmap *bitmap,
+		   int32 nbits)
+{
+	Bitmap *result;
+	int64   bitzero = (int32) BITZERO(bitmap->bitmin);
+	int32   elems;
+	int32   i;
+
+	if (bitmapEmpty(bitmap) ||
+		((bitmap->bitmin >= 0) && (bitmap->bitmax < nbits))) {
+		return bitmapCopy(bitmap);
+	}
+	result = newBitmap(0, nbits - 1);
+	clearBitmap(result);
+	elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	for (i = 0; i < elems; i++) {
+		result->bitset[FOLDED_WORD(bitzero + ((int64) i * ELEMBITS),
+								   nbits)] |= bitmap->bitset[i];
+	}
+	reduceBitmap(result);
+	return result;
+}
+
+/** 
+ * Predicate identifying whether a bitmap may have elements in common
+ * with those that were folded to give another, without folding or
+ * allocating anything.
+ * 
+ * @param folded The folded ::Bitmap
+ * @param bitmap The flat ::Bitmap to be checked
+ * @param nbits The size to which folded was folded
+ *
+ * @return True if some element of bitmap folds onto an element of
+ * folded.
+ */
+bool
+bitmapFoldedOverlaps(Bitmap *folded,
+					 Bitmap *bitmap,
+					 int32 nbits)
+{
+	int64  bitzero = (int32) BITZERO(bitmap->bitmin);
+	int32  first_word;
+	int32  last_word;
+	int32  word;
+	int32  elems;
+	int32  i;
+
+	if (bitmapEmpty(folded) || bitmapEmpty(bitmap)) {
+		return false;
+	}
+	first_word = BITSET_ELEM(folded->bitmin);
+	last_word = BITSET_ELEM(folded->bitmax);
+	elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	for (i = 0; i < elems; i++) {
+		word = FOLDED_WORD(bitzero + ((int64) i * ELEMBITS), nbits);
+		if ((word >= first_word) && (word <= last_word) &&
+			(folded->bitset[word - first_word] & bitmap->bitset[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+ * Expression evaluation functions follow.  An expression combining
+ * bitmaps with the + (union), * (intersection) and - (minus)
+ * operators is compiled into a ::BitmapExpr, a postfix program, which
+ * is then evaluated in a single pass over the words of all of its
+ * inputs.  No intermediate bitmaps are created: the bounds of the
+ * result are worked out from those of the inputs before evaluation
+ * starts, and each block of result words is built in a small stack of
+ * word buffers before being copied into the result.
+ **********************************************************************
+ */
+
+/**
+ * The maximum number of steps, operands and operators, in a
+ * ::BitmapExpr.
+ */
+#define BITMAP_EXPR_MAX_STEPS 255
+
+/**
+ * The maximum depth of the evaluation stack of a ::BitmapExpr.  Only
+ * deeply right-nested expressions, such as a + (b + (c + ...)), need
+ * more than a few entries.
+ */
+#define BITMAP_EXPR_MAX_DEPTH 16
+
+/**
+ * The highest input number that an expression may refer to.
+ */
+#define BITMAP_EXPR_MAX_INPUT 65535
+
+/**
+ * The number of words evaluated at a time.  Each operator is applied
+ * to a whole block of words in a simple loop, which the compiler is
+ * able to vectorise.
+ */
+#define BITMAP_EXPR_BLOCK_WORDS 64
+
+/**
+ * The operations that make up a ::BitmapExpr.
+ */
+typedef enum BitmapExprOp {
+	BITMAP_EXPR_INPUT,		/**< Push the words of an input */
+	BITMAP_EXPR_UNION,		/**< Replace the top 2 entries with their union */
+	BITMAP_EXPR_INTERSECT,	/**< ...with their intersection */
+	BITMAP_EXPR_MINUS		/**< ...with the first minus the second */
+} BitmapExprOp;
+
+/**
+ * A single step of a ::BitmapExpr.
+ */
+typedef struct BitmapExprStep {
+	int32 op;				/**< The ::BitmapExprOp */
+	int32 input;			/**< For BITMAP_EXPR_INPUT, the 0-based input */
+} BitmapExprStep;
+
+/**
+ * A compiled bitmap expression.  This is of fixed size, and contains
+ * no pointers, so it may be copied and cached freely.
+ */
+typedef struct BitmapExpr {
+	int32 nsteps;			/**< The number of steps */
+	int32 ninputs;			/**< One more than the highest input used */
+	BitmapExprStep steps[BITMAP_EXPR_MAX_STEPS];
+} BitmapExpr;
+
+/**
+ * The state of the expression compiler.
+ */
+typedef struct BitmapExprParser {
+	const char *str;		/**< The expression being compiled */
+	const char *pos;		/**< The current position within str */
+	BitmapExpr *expr;		/**< The program being built */
+	int32       depth;		/**< Stack depth following the last step */
+	int32       nesting;	/**< The current depth of parentheses */
+} BitmapExprParser;
+
+/** 
+ * Write an error for a badly formed bitmap expression.
+ * 
+ * @param parser The expression compiler state
+ * @param detail What is wrong at the current position
+ */
+static void
+bitmapExprError(BitmapExprParser *parser,
+				const char *detail)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid bitmap expression: \"%s\"", parser->str),
+			 errdetail("%s at position %d.", detail,
+					   (int) (parser->pos - parser->str) + 1)));
+}
+
+/** 
+ * Skip any whitespace and return the next character of an expression.
+ * 
+ * @param parser The expression compiler state
+ *
+ * @return The next non-space character, or '\0' at the end.
+ */
+static char
+bitmapExprPeek(BitmapExprParser *parser)
+{
+	while ((*parser->pos == ' ') || (*parser->pos == '\t') ||
+		   (*parser->pos == '\n') || (*parser->pos == '\r')) {
+		parser->pos++;
+	}
+	return *parser->pos;
+}
+
+/** 
+ * Append a step to the program being compiled, keeping track of the
+ * depth of the evaluation stack.
+ * 
+ * @param parser The expression compiler state
+ * @param op The ::BitmapExprOp for the step
+ * @param input For BITMAP_EXPR_INPUT, the 0-based input
+ */
+static void
+bitmapExprEmit(BitmapExprParser *parser,
+			   int32 op,
+			   int32 input)
+{
+	BitmapExpr *expr = parser->expr;
+
+	if (expr->nsteps >= BITMAP_EXPR_MAX_STEPS) {
+		bitmapExprError(parser, "Expression too long");
+	}
+	if (op == BITMAP_EXPR_INPUT) {
+		parser->depth++;
+		if (parser->depth > BITMAP_EXPR_MAX_DEPTH) {
+			bitmapExprError(parser, "Expression too deeply nested");
+		}
+		if (input >= expr->ninputs) {
+			expr->ninputs = input + 1;
+		}
+	}
+	else {
+		parser->depth--;
+	}
+	expr->steps[expr->nsteps].op = op;
+	expr->steps[expr->nsteps].input = input;
+	expr->nsteps++;
+}
+
+static void
+bitmapExprSum(BitmapExprParser *parser);
+
+/** 
+ * Compile an operand: an input, given as $n or as a single lower case
+ * letter (a for $1, b for $2, and so on), or a parenthesised
+ * expression.
+ * 
+ * @param parser The expression compiler state
+ */
+static void
+bitmapExprOperand(BitmapExprParser *parser)
+{
+	char  c = bitmapExprPeek(parser);
+	int32 input = 0;
+
+	if (c == '(') {
+		parser->pos++;
+		parser->nesting++;
+		if (parser->nesting > BITMAP_EXPR_MAX_STEPS) {
+			bitmapExprError(parser, "Expression too deeply nested");
+		}
+		bitmapExprSum(parser);
+		if (bitmapExprPeek(parser) != ')') {
+			bitmapExprError(parser, "Expected \")\"");
+		}
+		parser->pos++;
+		parser->nesting--;
+	}
+	else if (c == '$') {
+		parser->pos++;
+		if ((*parser->pos < '0') || (*parser->pos > '9')) {
+			bitmapExprError(parser, "Expected an input number");
+		}
+		while ((*parser->pos >= '0') && (*parser->pos <= '9')) {
+			input = (input * 10) + (*parser->pos - '0');
+			if (input > BITMAP_EXPR_MAX_INPUT) {
+				bitmapExprError(parser, "Input number too large");
+			}
+			parser->pos++;
+		}
+		if (input == 0) {
+			bitmapExprError(parser, "Input numbers start from 1");
+		}
+		bitmapExprEmit(parser, BITMAP_EXPR_INPUT, input - 1);
+	}
+	else if ((c >= 'a') && (c <= 'z')) {
+		parser->pos++;
+		bitmapExprEmit(parser, BITMAP_EXPR_INPUT, c - 'a');
+	}
+	else {
+		bitmapExprError(parser, "Expected an operand");
+	}
+}
+
+/** 
+ * Compile a sequence of operands separated by the * operator, which
+ * binds more tightly than + and -.
+ * 
+ * @param parser The expression compiler state
+ */
+static void
+bitmapExprProduct(BitmapExprParser *parser)
+{
+	bitmapExprOperand(parser);
+	while (bitmapExprPeek(parser) == '*') {
+		parser->pos++;
+		bitmapExprOperand(parser);
+		bitmapExprEmit(parser, BITMAP_EXPR_INTERSECT, 0);
+	}
+}
+
+/** 
+ * Compile a sequence of products separated by the + and - operators,
+ * which are left-associative.
+ * 
+ * @param parser The expression compiler state
+ */
+static void
+bitmapExprSum(BitmapExprParser *parser)
+{
+	char c;
+
+	bitmapExprProduct(parser);
+	while (((c = bitmapExprPeek(parser)) == '+') || (c == '-')) {
+		parser->pos++;
+		bitmapExprProduct(parser);
+		bitmapExprEmit(parser, (c == '+')? BITMAP_EXPR_UNION:
+					   BITMAP_EXPR_MINUS, 0);
+	}
+}
+
+/** 
+ * Compile a bitmap expression, raising an error if it is badly formed.
+ * 
+ * @param str The expression
+ * @param expr The ::BitmapExpr into which the program is compiled
+ */
+static void
+bitmapExprCompile(const char *str,
+				  BitmapExpr *expr)
+{
+	BitmapExprParser parser;
+
+	parser.str = str;
+	parser.pos = str;
+	parser.expr = expr;
+	parser.depth = 0;
+	parser.nesting = 0;
+	expr->nsteps = 0;
+	expr->ninputs = 0;
+
+	bitmapExprSum(&parser);
+	if (bitmapExprPeek(&parser) != '\0') {
+		bitmapExprError(&parser, (*parser.pos == ')')?
+						"Unexpected \")\"": "Expected an operator");
+	}
+}
+
+/** 
+ * Work out bounds for the result of a bitmap expression from those of
+ * its inputs: a union is bounded by the bounds of both of its
+ * operands, an intersection by their overlap, and a difference by its
+ * first operand.
+ * 
+ * @param expr The compiled expression
+ * @param inputs The input bitmaps, indexed by input number
+ * @param p_bitmin Set to the lowest bit that may be in the result
+ * @param p_bitmax Set to the highest bit that may be in the result
+ *
+ * @return False if the result is certain to be empty.
+ */
+static bool
+bitmapExprBounds(BitmapExpr *expr,
+				 Bitmap **inputs,
+				 int32 *p_bitmin,
+				 int32 *p_bitmax)
+{
+	int32   mins[BITMAP_EXPR_MAX_DEPTH];
+	int32   maxs[BITMAP_EXPR_MAX_DEPTH];
+	bool    empty[BITMAP_EXPR_MAX_DEPTH];
+	Bitmap *bitmap;
+	int32   depth = 0;
+	int32   i;
+
+	for (i = 0; i < expr->nsteps; i++) {
+		switch (expr->steps[i].op) {
+		case BITMAP_EXPR_INPUT:
+			bitmap = inputs[expr->steps[i].input];
+			mins[depth] = bitmap->bitmin;
+			maxs[depth] = bitmap->bitmax;
+			empty[depth] = bitmapEmpty(bitmap);
+			depth++;
+			break;
+		case BITMAP_EXPR_UNION:
+			depth--;
+			if (empty[depth - 1]) {
+				mins[depth - 1] = mins[depth];
+				maxs[depth - 1] = maxs[depth];
+				empty[depth - 1] = empty[depth];
+			}
+			else if (!empty[depth]) {
+				mins[depth - 1] = MIN(mins[depth - 1], mins[depth]);
+				maxs[depth - 1] = MAX(maxs[depth - 1], maxs[depth]);
+			}
+			break;
+		case BITMAP_EXPR_INTERSECT:
+			depth--;
+			mins[depth - 1] = MAX(mins[depth - 1], mins[depth]);
+			maxs[depth - 1] = MIN(maxs[depth - 1], maxs[depth]);
+			empty[depth - 1] = empty[depth - 1] || empty[depth] ||
+				(mins[depth - 1] > maxs[depth - 1]);
+			break;
+		case BITMAP_EXPR_MINUS:
+			depth--;
+			break;
+		}
+	}
+	*p_bitmin = mins[0];
+	*p_bitmax = maxs[0];
+	return !empty[0];
+}
+
+/** 
+ * Evaluate a compiled bitmap expression.  The result words are built
+ * a block at a time, every step of the program being applied to the
+ * block before moving on to the next, so each input word is read
+ * once, and the only bitmap allocated is the result.
+ * 
+ * @param expr The compiled expression
+ * @param inputs The flat input bitmaps, indexed by input number.  Every
+ * input used by expr must be present.
+ *
+ * @return A newly allocated bitmap, the result of the expression.
+ */
+static Bitmap *
+bitmapExprEval(BitmapExpr *expr,
+			   Bitmap **inputs)
+{
+	bm_int  stack[BITMAP_EXPR_MAX_DEPTH][BITMAP_EXPR_BLOCK_WORDS];
+	int64   offsets[BITMAP_EXPR_MAX_STEPS];
+	int64   elems[BITMAP_EXPR_MAX_STEPS];
+	Bitmap *result;
+	Bitmap *bitmap;
+	bm_int *to;
+	bm_int *from;
+	int32   bitmin;
+	int32   bitmax;
+	int64   res_elems;
+	int64   start;
+	int64   lo;
+	int64   hi;
+	int32   len;
+	int32   depth;
+	int32   i;
+	int32   j;
+
+	if (!bitmapExprBounds(expr, inputs, &bitmin, &bitmax)) {
+		result = newBitmap(0, 0);
+		clearBitmap(result);
+		return result;
+	}
+	result = newBitmap(bitmin, bitmax);
+	res_elems = ARRAYELEMS(bitmin, bitmax);
+
+	/* Record where the words of each input lie relative to those of
+	 * the result. */
+	for (i = 0; i < expr->nsteps; i++) {
+		if (expr->steps[i].op == BITMAP_EXPR_INPUT) {
+			bitmap = inputs[expr->steps[i].input];
+			offsets[i] = BITSET_ELEM((int64) (int32) BITZERO(bitmap->bitmin) -
+									 (int32) BITZERO(bitmin));
+			elems[i] = bitmapEmpty(bitmap)? 0:
+				ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+		}
+	}
+
+	for (start = 0; start < res_elems; start += BITMAP_EXPR_BLOCK_WORDS) {
+		len = (int32) MIN(res_elems - start, BITMAP_EXPR_BLOCK_WORDS);
+		depth = 0;
+		for (i = 0; i < expr->nsteps; i++) {
+			if (expr->steps[i].op == BITMAP_EXPR_INPUT) {
+				/* Push the input's words for this block, which are
+				 * zero outside of its bounds. */
+				bitmap = inputs[expr->steps[i].input];
+				to = stack[depth];
+				lo = MAX(start, offsets[i]);
+				hi = MIN(start + len, offsets[i] + elems[i]);
+				for (j = 0; j < len; j++) {
+					to[j] = 0;
+				}
+				if (lo < hi) {
+					from = bitmap->bitset + (lo - offsets[i]);
+					to += lo - start;
+					for (j = 0; j < (int32) (hi - lo); j++) {
+						to[j] = from[j];
+					}
+				}
+				depth++;
+				continue;
+			}
+			depth--;
+			to = stack[depth - 1];
+			from = stack[depth];
+			switch (expr->steps[i].op) {
+			case BITMAP_EXPR_UNION:
+				for (j = 0; j < len; j++) {
+					to[j] |= from[j];
+				}
+				break;
+			case BITMAP_EXPR_INTERSECT:
+				for (j = 0; j < len; j++) {
+					to[j] &= from[j];
+				}
+				break;
+			case BITMAP_EXPR_MINUS:
+				for (j = 0; j < len; j++) {
+					to[j] &= ~from[j];
+				}
+				break;
+			}
+		}
+		to = result->bitset + start;
+		for (j = 0; j < len; j++) {
+			to[j] = stack[0][j];
+		}
+	}
+	reduceBitmap(result);
+	return result;
+}
+
+
+/*
+ * Serialisation functions follow
+ **********************************************************************
+ */
+
+
+/** 
+ * Serialise an int32 value as a base64 stream (truncated to save a
+ * byte) into *p_stream.
+ *
+ * @param p_stream Pointer into stream currently being written.  This
+ * must be large enought to take the contents to be written.  This
+ * pointer is updated to point to the next free slot in the stream after
+ * writing the int32 value, and is null terminated at that position.
+ * @param value The value to be written to the stream.
+ */
+static void
+serialise_int32(char **p_stream, int32 value)
+{
+	int32 len = b64_encode((char *) &value, sizeof(int32), *p_stream);
+	(*p_stream) += (len - 1);  /* X: dumb optimisation saves a byte */
+	(**p_stream) = '\0';
+}
+
+
+/** 
+ * De-serialise an int32 value from a base64 character stream.
+ *
+ * @param p_stream Pointer into the stream currently being read.
+ * must be large enought to take the contents to be written.  This
+ * pointer is updated to point to the next free slot in the stream after
+ * reading the int32 value.
+ * @return the int32 value read from the stream
+ */
+static int32
+deserialise_int32(char **p_stream)
+{
+	int32 value;
+	char *endpos = (*p_stream) + INT32SIZE_B64;
+	char endchar = *endpos;
+	*endpos = '=';	/* deal with dumb optimisation (X) above */
+	b64_decode(*p_stream, INT32SIZE_B64 + 1, (char *) &value);
+	*endpos = endchar;
+	(*p_stream) += INT32SIZE_B64;
+	return value;
+}
+
+
+/** 
+ * Serialise a binary stream as a base64 stream into *p_stream.
+ *
+ * @param p_stream Pointer into stream currently being written.  This
+ * pointer is updated to point to the next free slot in the stream after
+ * writing the contents of instream and is null terminated at that
+ * position.
+ *
+ * @param bytes The number of bytes to be written.
+ * @param instream The binary stream to be written.
+ */
+static void
+serialise_stream(char **p_stream, int32 bytes, char *instream)
+{
+	int32 len = b64_encode(instream, bytes, *p_stream);
+	(*p_stream)[len] = '\0';
+	(*p_stream) += len;
+}
+
+
+/** 
+ * Return the length of a base64 encoded stream for a binary stream of
+ * ::bytes length.
+ * 
+ * @param bytes The length of the input binary stream in bytes
+ * @return The length of the base64 character stream required to
+ * represent the input stream.
+ */
+static int
+streamlen(int32 bytes)
+{
+	return (4 * ((bytes + 2) / 3));
+}
+
+
+/** 
+ * De-serialise a binary stream.  Only the base64 characters of the
+ * stream are counted against streamlen(), as text written by versions
+ * before 0.9.6 has a line break after every 76 of them.  These are
+ * skipped by b64_decode().
  *
  * @param p_stream Pointer into the stream currently being read.
  * pointer is updated to point to the next free slot in the stream after
@@ -952,808 +5383,3930 @@ streamlen(int32 bytes)
  * @param outstream Pointer into the pre-allocated memory are into which
  * the binary from p_stream is to be written.
  */
-static void
-deserialise_stream(char **p_stream, int32 bytes, char *outstream)
+static void
+deserialise_stream(char **p_stream, int32 bytes, char *outstream)
+{
+	int32 len = streamlen(bytes);
+	char *start = *p_stream;
+	char *p = start;
+
+	while ((len > 0) && *p) {
+		if (!((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r'))) {
+			len--;
+		}
+		p++;
+	}
+	if ((len > 0) || (b64_decode(start, p - start, outstream) != bytes)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type bitmap"),
+				 errdetail("The bitset is shorter than the bounds "
+						   "require.")));
+	}
+	*p_stream = p;
+}
+
+
+/** 
+ * Serialise a bitmap.
+ *
+ * @param bitmap The bitmap to be serialised.
+ */
+static char *
+serialise_bitmap(Bitmap *bitmap)
+{
+    int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+    int32 stream_len = (INT32SIZE_B64 * 2) + 
+		streamlen(sizeof(bm_int) * elems) + 1;
+	char *stream = palloc(stream_len * sizeof(char));
+	char *streamstart = stream;
+
+	serialise_int32(&stream, bitmap->bitmin);
+	serialise_int32(&stream, bitmap->bitmax);
+	serialise_stream(&stream, elems * sizeof(bm_int), 
+					 (char *) &(bitmap->bitset));
+	*stream = '\0';
+
+	/* Ensure bitmap is valid. */
+	if (bitmap->bitmin != bitmap->bitmax) {
+		if (! (bitmapTestbit(bitmap, bitmap->bitmin) &&
+			   bitmapTestbit(bitmap, bitmap->bitmax)))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+					 errmsg("Corrupted bitmap"),
+					 errdetail("one of bitmin or bitmax is not set.")));
+		}
+	}
+	return streamstart;
+}
+
+
+/** 
+ * De-serialise a bitmap.
+ *
+ * @param charstream The serialised character string containing the bitmap.
+ */
+static Bitmap *
+deserialise_bitmap(char *charstream)
+{
+	Bitmap *bitmap;
+	char **p_stream = &charstream;
+	int32 elems;
+    int32 bitmin;
+	int32 bitmax;
+
+	if (strcmp(charstream, "[]") == 0) {
+		bitmap = newBitmap(0, 0);
+		clearBitmap(bitmap);
+	}
+	else {
+		bitmin = deserialise_int32(p_stream);
+		bitmax = deserialise_int32(p_stream);
+		bitmap = newBitmap(bitmin, bitmax);
+		elems = ARRAYELEMS(bitmin, bitmax);
+
+		deserialise_stream(p_stream, elems * sizeof(bitmap->bitset[0]), 
+						   (char *) &(bitmap->bitset[0]));
+	}
+	return bitmap;
+}
+
+
+/** 
+ * Compare 2 bitmaps for indexing/sorting purposes.  Unequal bitmaps
+ * are ordered by their serialised text, so any change to that text
+ * changes the btree order of bitmaps and requires existing btree
+ * indexes to be rebuilt.
+ * 
+ * @param bitmap1 The first ::Bitmap to be compared
+ * @param bitmap2 The second ::Bitmap to be compared
+ *
+ * @return < 0, 0, or > 0 like strcmp
+ */
+static int
+bitmapCmp(Bitmap *bitmap1,
+		  Bitmap *bitmap2)
+{
+	if (bitmapEqual(bitmap1, bitmap2)) {
+		return 0;
+	}
+	else {
+		char *s1 = serialise_bitmap(bitmap1);
+		char *s2 = serialise_bitmap(bitmap2);
+		int result = strcmp(s1, s2);
+		pfree(s1);
+		pfree(s2);
+		return result;
+	}
+}
+
+
+/*
+ * Interface functions follow
+ **********************************************************************
+ */
+
+#ifndef PGBITMAP_BENCH
+/* The standalone benchmark in test/bench is built from everything
+ * above this point, without a postgres server. */
+
+
+PG_FUNCTION_INFO_V1(bitmap_in);
+/** 
+ * <code>bitmap_in(serialised_bitmap text) returns bitmap</code>
+ * Create a Bitmap initialised from a (base64) text value.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>serialised_bitmap text</code> A base64 serialiastion of a
+ * bitmap value.
+ * @return <code>Bitmap</code> the newly created bitmap
+ */
+Datum
+bitmap_in(PG_FUNCTION_ARGS)
+{
+	char    *stream;
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+    stream = PG_GETARG_CSTRING(0);
+	bitmap = deserialise_bitmap(stream);
+
+    PG_RETURN_BITMAP(bitmap);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_out);
+/** 
+ * <code>bitmap_out(bitmap bitmap) returns text</code>
+ * Create a (base64) text representation of a bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> A base64 serialiastion of a
+ * bitmap value.
+ * @return <code>cstring</code> the newly serialised text stream.
+ */
+Datum
+bitmap_out(PG_FUNCTION_ARGS)
+{
+	char    *result;
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP(0);
+	result = serialise_bitmap(bitmap);
+
+	PG_RETURN_CSTRING(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_is_empty);
+/** 
+ * <code>bitmap_is_empty(bitmap bitmap) returns boolean</code>
+ * Predicate to identify whether a bitmap is empty or not.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * bitmap value.
+ * @return <code>boolean</code> true, if the bitmap has no bits.
+ */
+Datum
+bitmap_is_empty(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+	PG_RETURN_BOOL(!BITMAP_IS_FROZEN(bitmap) && bitmapEmpty(bitmap));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_bitmin);
+/** 
+ * <code>bitmap_bitmin(bitmap bitmap) returns boolean</code>
+ * Return the lowest bit set in the bitmap, or NULL if none are set.
+ * This relies on bitmap->bitmin always identifying the lowest numbered
+ * bit in the bitset, unless the bitmap is empty.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * @return <code>integer</code> The lowest bit set in the bitmap or
+ * NULL if there are no bits set.
+ */
+Datum
+bitmap_bitmin(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+    int32 relative_bit = bitmap->bitmin - BITZERO(bitmap->bitmin);
+
+	BITMAP_COUNT_CALL();
+
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		/* Frozen bitmaps are never empty. */
+		PG_RETURN_INT32(bitmap->bitmin);
+	}
+	if (bitmap->bitset[0] & bitmasks[relative_bit]) {
+		PG_RETURN_INT32(bitmap->bitmin);
+	}
+	if (bitmap->bitmin != bitmap->bitmax) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("Corrupted bitmap"),
+				 errdetail("bitzeo is incorrect for bitmap (range %d..%d).", 
+						   bitmap->bitmin, bitmap->bitmax)));
+	}
+	PG_RETURN_NULL();
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_bitmax);
+/** 
+ * <code>bitmap_bitmax(bitmap bitmap) returns boolean</code>
+ * Return the highest bit set in the bitmap, or NULL if none are set.
+ * This relies on bitmap->bitmax always identifying the highest numbered
+ * bit in the bitset, unless the bitmap is empty.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * @return <code>integer</code> The lowest bit set in the bitmap or
+ * NULL if there are no bits set.
+ */
+Datum
+bitmap_bitmax(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+    int32 relative_bit = bitmap->bitmax - BITZERO(bitmap->bitmin);
+	int32 elem = BITSET_ELEM(relative_bit);
+
+	BITMAP_COUNT_CALL();
+
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		PG_RETURN_INT32(bitmap->bitmax);
+	}
+	if (bitmap->bitset[elem] & bitmasks[BITSET_BIT(relative_bit)]) {
+		PG_RETURN_INT32(bitmap->bitmax);
+	}
+	if (bitmap->bitmin != bitmap->bitmax) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("Corrupted bitmap"),
+				 errdetail("bitmax is incorrect for bitmap (range %d..%d).", 
+						   bitmap->bitmin, bitmap->bitmax)));
+	}
+	PG_RETURN_NULL();
+}
+
+
+/**
+ * Determine whether a set returning function should return its entire
+ * result in one go, using materialize mode, rather than one row per
+ * call.  We do this only when the caller says that it prefers
+ * materialize mode, which is the case for function scans (functions
+ * in the FROM clause) as these would otherwise store each row in a
+ * tuplestore themselves.  Other callers, such as set returning
+ * functions in a select list, may stop fetching rows early so are
+ * better served by value-per-call mode.
+ *
+ * @param fcinfo The function call info of the set returning function
+ *
+ * @return The function's ReturnSetInfo if materialize mode should be
+ * used, or NULL otherwise.
+ */
+static ReturnSetInfo *
+materialisePreferred(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+	if (SRF_IS_FIRSTCALL() && rsinfo && IsA(rsinfo, ReturnSetInfo) &&
+		(rsinfo->allowedModes & SFRM_Materialize) &&
+		(rsinfo->allowedModes & SFRM_Materialize_Preferred)) {
+		return rsinfo;
+	}
+	return NULL;
+}
+
+/**
+ * The tuplestore being filled by materialiseBits().
+ */
+typedef struct BitsTuplestore {
+	Tuplestorestate *tupstore;	/**< The tuplestore */
+	TupleDesc        tupdesc;	/**< Its tuple descriptor */
+} BitsTuplestore;
+
+/**
+ * frozenForEach() callback for materialiseBits(): add bit to the
+ * tuplestore.
+ */
+static void
+putBit(int32 bit,
+	   void *arg)
+{
+	BitsTuplestore *store = (BitsTuplestore *) arg;
+	Datum value = Int32GetDatum(bit);
+	bool  isnull = false;
+
+	tuplestore_putvalues(store->tupstore, store->tupdesc, &value, &isnull);
+}
+
+/**
+ * Return all bits set in a bitmap between lo and hi inclusive, using
+ * materialize mode.  The bitmap is scanned in a single pass, a word at
+ * a time, with each set bit being added directly to a tuplestore.
+ * Frozen bitmaps are scanned using frozenForEach().
+ *
+ * @param rsinfo The ReturnSetInfo of the calling function
+ * @param bitmap The ::Bitmap being scanned
+ * @param lo The lowest bit to be returned
+ * @param hi The highest bit to be returned
+ * @param reverse Whether the bits are to be returned in descending order
+ */
+static void
+materialiseBits(ReturnSetInfo *rsinfo,
+				Bitmap *bitmap,
+				int32 lo,
+				int32 hi,
+				bool reverse)
+{
+	MemoryContext    oldcontext;
+	Tuplestorestate *tupstore;
+	TupleDesc        tupdesc;
+	int32  bitzero = BITZERO(bitmap->bitmin);
+	int32  first_elem;
+	int32  last_elem;
+	int32  elem;
+	int32  base;
+	bm_int lomask;
+	bm_int himask;
+	bm_int word;
+	Datum  value;
+	bool   isnull = false;
+
+	oldcontext = MemoryContextSwitchTo(
+		rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTemplateTupleDesc(1);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 1, "bits", INT4OID, -1, 0);
+	tupstore = tuplestore_begin_heap(
+		(rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+		false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	lo = MAX(lo, bitmap->bitmin);
+	hi = MIN(hi, bitmap->bitmax);
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		BitsTuplestore store = {tupstore, tupdesc};
+
+		frozenForEach((FrozenBitmap *) bitmap, lo, hi, reverse,
+					  putBit, &store);
+		return;
+	}
+	if ((lo > hi) || bitmapEmpty(bitmap)) {
+		return;
+	}
+
+	/* From here on, lo and hi are relative to bitzero. */
+	lo -= bitzero;
+	hi -= bitzero;
+	first_elem = BITSET_ELEM(lo);
+	last_elem = BITSET_ELEM(hi);
+	lomask = ~(bitmasks[BITSET_BIT(lo)] - 1);
+	himask = bitmasks[BITSET_BIT(hi)];
+	himask |= himask - 1;
+
+	for (elem = reverse? last_elem: first_elem;
+		 (elem >= first_elem) && (elem <= last_elem);
+		 elem += reverse? -1: 1) {
+		word = bitmap->bitset[elem];
+		if (elem == first_elem) {
+			word &= lomask;
+		}
+		if (elem == last_elem) {
+			word &= himask;
+		}
+		base = bitzero + (elem * ELEMBITS);
+		while (word) {
+			if (reverse) {
+				value = Int32GetDatum(base + BM_HIGHBIT(word));
+				word &= ~bitmasks[BM_HIGHBIT(word)];
+			}
+			else {
+				value = Int32GetDatum(base + BM_CTZ(word));
+				word &= word - 1;
+			}
+			tuplestore_putvalues(tupstore, tupdesc, &value, &isnull);
+		}
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_bits);
+/** 
+ * <code>bitmap_bits(name text)</code> returns setof int4
+ * Return the set of all bits set in the specified Bitmap.  If the
+ * caller prefers it, the bits are returned all at once in materialize
+ * mode, otherwise one bit is returned per call.
+ *
+ * @param fcinfo <code>name text</code> The name of the bitmap.
+ * @return <code>setof int4</code>The set of bits that are set in the
+ * bitmap.
+ */
+Datum
+bitmap_bits(PG_FUNCTION_ARGS)
+{
+	struct bitmap_bits_state {
+		Bitmap *bitmap;
+		int32   bit;
+	} *state;
+    FuncCallContext *funcctx;
+	MemoryContext    oldcontext;
+	ReturnSetInfo   *rsinfo;
+	Bitmap *bitmap;
+    bool   found;
+    Datum  datum;
+
+	BITMAP_COUNT_CALL();
+
+	if ((rsinfo = materialisePreferred(fcinfo))) {
+		bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+		materialiseBits(rsinfo, bitmap, bitmap->bitmin, bitmap->bitmax, false);
+		return (Datum) 0;
+	}
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		state = palloc(sizeof(struct bitmap_bits_state));
+        MemoryContextSwitchTo(oldcontext);
+
+        state->bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+        state->bit = state->bitmap->bitmin;
+		funcctx->user_fctx = state;
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+	state = funcctx->user_fctx;
+    
+    state->bit = anyNextBit(state->bitmap, state->bit, &found);
+    
+    if (found) {
+        datum = Int32GetDatum(state->bit);
+        state->bit++;
+        SRF_RETURN_NEXT(funcctx, datum);
+    }
+    else {
+        SRF_RETURN_DONE(funcctx);
+    }
+}
+
+
+/**
+ * State for bitmap_bits_range() and bitmap_bits_reverse().
+ */
+typedef struct BitsRangeState {
+	Bitmap *bitmap;     /**< The bitmap being scanned */
+	int32   bit;        /**< The next bit to be examined */
+	int32   bound;      /**< The last bit that may be returned */
+	int64   remaining;  /**< The number of bits still to be returned,
+						 * or -1 if there is no limit */
+	bool    reverse;    /**< Whether we are scanning downwards */
+	bool    done;       /**< Set once the scan has been exhausted */
+} BitsRangeState;
+
+/**
+ * Common implementation for bitmap_bits_range() and
+ * bitmap_bits_reverse().  Arguments are a bitmap, a lower and an upper
+ * bound, and a limit on the number of rows, all of which may be null.
+ * The scan starts at whichever bound is appropriate for its direction,
+ * seeking directly to the word containing that bound, and stops as
+ * soon as the other bound or the limit is reached.  Unless a limit is
+ * given, the result is returned in materialize mode if the caller
+ * prefers it.  With a limit, one bit is returned per call so that a
+ * caller that needs only a few bits does not pay for the rest.
+ *
+ * @param fcinfo The function call info of the caller
+ * @param reverse Whether the bits are to be returned in descending order
+ *
+ * @return The next bit, or the end of the result set.
+ */
+static Datum
+bitsRange(FunctionCallInfo fcinfo,
+		  bool reverse)
+{
+	BitsRangeState  *state;
+    FuncCallContext *funcctx;
+	MemoryContext    oldcontext;
+	ReturnSetInfo   *rsinfo;
+	Bitmap *bitmap;
+	int32  lo;
+	int32  hi;
+    bool   found;
+    int32  bit;
+    
+	if (!PG_ARGISNULL(0) && PG_ARGISNULL(3) &&
+		(rsinfo = materialisePreferred(fcinfo))) {
+		bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+		lo = PG_ARGISNULL(1)? bitmap->bitmin: PG_GETARG_INT32(1);
+		hi = PG_ARGISNULL(2)? bitmap->bitmax: PG_GETARG_INT32(2);
+		materialiseBits(rsinfo, bitmap, lo, hi, reverse);
+		return (Datum) 0;
+	}
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		state = palloc(sizeof(BitsRangeState));
+        MemoryContextSwitchTo(oldcontext);
+		funcctx->user_fctx = state;
+
+		state->reverse = reverse;
+		state->remaining = -1;
+		state->done = PG_ARGISNULL(0);
+		if (!state->done) {
+			state->bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+			lo = PG_ARGISNULL(1)? state->bitmap->bitmin: PG_GETARG_INT32(1);
+			hi = PG_ARGISNULL(2)? state->bitmap->bitmax: PG_GETARG_INT32(2);
+			if (!PG_ARGISNULL(3)) {
+				state->remaining = PG_GETARG_INT64(3);
+				if (state->remaining < 0) {
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("row limit must not be negative")));
+				}
+			}
+			state->bit = reverse? hi: lo;
+			state->bound = reverse? lo: hi;
+			state->done = (lo > hi) ||
+				(!BITMAP_IS_FROZEN(state->bitmap) &&
+				 bitmapEmpty(state->bitmap));
+		}
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+	state = funcctx->user_fctx;
+
+	if (state->done || (state->remaining == 0)) {
+        SRF_RETURN_DONE(funcctx);
+	}
+
+	if (state->reverse) {
+		bit = anyPrevBit(state->bitmap, state->bit, &found);
+		found = found && (bit >= state->bound);
+	}
+	else {
+		bit = anyNextBit(state->bitmap, state->bit, &found);
+		found = found && (bit <= state->bound);
+	}
+    if (!found) {
+		state->done = true;
+        SRF_RETURN_DONE(funcctx);
+	}
+
+	/* Step past the found bit, taking care not to overflow at the
+	 * extremes of the int4 range. */
+	if (bit == state->bound) {
+		state->done = true;
+	}
+	else {
+		state->bit = state->reverse? bit - 1: bit + 1;
+	}
+	if (state->remaining > 0) {
+		state->remaining--;
+	}
+	SRF_RETURN_NEXT(funcctx, Int32GetDatum(bit));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_bits_range);
+/** 
+ * <code>bitmap_bits_range(bitmap bitmap, lo int4, hi int4, 
+ *   max_rows int8) returns setof int4</code>
+ * Return, in ascending order, the bits set in bitmap that lie between
+ * lo and hi inclusive, returning no more than max_rows bits.  Any of
+ * lo, hi or max_rows may be null, meaning no bound.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * <br><code>lo int4</code> The lowest bit to be returned.
+ * <br><code>hi int4</code> The highest bit to be returned.
+ * <br><code>max_rows int8</code> The maximum number of bits to return.
+ * @return <code>setof int4</code> The bits set within the range.
+ */
+Datum
+bitmap_bits_range(PG_FUNCTION_ARGS)
+{
+	BITMAP_COUNT_CALL();
+
+	return bitsRange(fcinfo, false);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_bits_reverse);
+/** 
+ * <code>bitmap_bits_reverse(bitmap bitmap, lo int4, hi int4, 
+ *   max_rows int8) returns setof int4</code>
+ * As bitmap_bits_range() but returning the bits in descending order,
+ * starting from hi.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * <br><code>lo int4</code> The lowest bit to be returned.
+ * <br><code>hi int4</code> The highest bit to be returned.
+ * <br><code>max_rows int8</code> The maximum number of bits to return.
+ * @return <code>setof int4</code> The bits set within the range.
+ */
+Datum
+bitmap_bits_reverse(PG_FUNCTION_ARGS)
+{
+	BITMAP_COUNT_CALL();
+
+	return bitsRange(fcinfo, true);
+}
+
+PG_FUNCTION_INFO_V1(bitmap_new_empty);
+/** 
+ * <code>bitmap_new_empty() returns bitmap;</code>
+ * Create an empty Bitmap, for dealing with a named range of
+ * values.
+ *
+ * @param fcinfo Params as described_below
+ * @return <code>Bitmap</code> the newly allocated bitmap
+ */
+Datum
+bitmap_new_empty(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+	bitmap = newBitmap(0, 0);
+	clearBitmap(bitmap);
+	
+    PG_RETURN_BITMAP(bitmap);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_new);
+/** 
+ * <code>bitmap_new() returns bitmap;</code>
+ * Create or re-initialise a Bitmap, for dealing with a named range of
+ * values.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitno int32</code> The first integer value to be recorded in
+ * the bitmap
+ * @return <code>Bitmap</code> the newly allocated bitmap
+ */
+Datum
+bitmap_new(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int32   bit;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		PG_RETURN_NULL();
+	}
+    bit = PG_GETARG_INT32(0);
+	bitmap = newBitmap(bit, bit);
+	clearBitmap(bitmap);
+	doSetBit(bitmap, bit);
+
+    PG_RETURN_BITMAP(bitmap);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_setbit);
+/** 
+ * <code>bitmap_setbit(bitmap bitmap, bit int4) returns bool</code>
+ * Set the given bit in the bitmap, returning TRUE.  This can be used as
+ * an aggregate function in which case the bitmap parameter will be null
+ * for the first call.  In this case simply create a bitmap from the
+ * second argument.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bitno int4</code> The bitnumber to be set.
+ * @return <code>bitmap</code> The result.
+ */
+Datum
+bitmap_setbit(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int32   bitno;
+	Bitmap *result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		if (PG_ARGISNULL(1)) {
+			PG_RETURN_NULL();
+		}
+		bitno = PG_GETARG_INT32(1);
+		result = newBitmap(bitno, bitno);
+		clearBitmap(result);
+		doSetBit(result, bitno);
+	}
+	else {
+		bitno = PG_GETARG_INT32(1);
+		bitmap = PG_GETARG_BITMAP(0);
+		if (PG_ARGISNULL(1)) {
+			result = bitmapCopy(bitmap);
+		}
+		else {
+			result = bitmapSetbit(bitmap, bitno);
+		}
+	}
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_testbit);
+/** 
+ * <code>bitmap_testbit(bitmap bitmap, bit int4) returns bool</code>
+ * Test the given bit in the bitmap, returning TRUE if it is 1.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bitno int4</code> The bitnumber to be tested.
+ * @return <code>bool</code> the truth value of the bit.
+ */
+Datum
+bitmap_testbit(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int32   bitno;
+	bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+    bitno = PG_GETARG_INT32(1);
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		result = frozenTestbit((FrozenBitmap *) bitmap, bitno);
+	}
+	else {
+		result = bitmapTestbit(bitmap, bitno);
+	}
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_setmin);
+/** 
+ * <code>bitmap_setmin(bitmap bitmap, bitmin int4) returns bitmap</code>
+ * Return a new bitmap having no bits less than bitmin
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bitmin int4</code> The new minimum bit.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_setmin(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int32   bitmin;
+	Bitmap *result;
+	
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP(0);
+    bitmin = PG_GETARG_INT32(1);
+	result = bitmapCopy(bitmap);
+	result = bitmapSetMin(result, bitmin);
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_setmax);
+/** 
+ * <code>bitmap_setmax(bitmap bitmap, bitmax int4) returns bitmap</code>
+ * Return a new bitmap having no bits greater than bitmax
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bitmax int4</code> The new maximum bit.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_setmax(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int32   bitmax;
+	Bitmap *result;
+	
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP(0);
+    bitmax = PG_GETARG_INT32(1);
+	result = bitmapCopy(bitmap);
+	result = bitmapSetMax(result, bitmax);
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_equal);
+/** 
+ * <code>bitmap_equal(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if the bitmaps are equivalent,
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true if the bitmaps contain the same bits.
+ */
+Datum
+bitmap_equal(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapEqual(bitmap1, bitmap2);
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_nequal);
+/** 
+ * <code>bitmap_nequal(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if the bitmaps are not equivalent,
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ */
+Datum
+bitmap_nequal(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = !bitmapEqual(bitmap1, bitmap2);
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_cmp);
+/** 
+ * <code>bitmap_cmp(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return result of comparison of bitmap1's string representation with
+ *        bitmap2's.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>int4</code> result of comparison
+ */
+Datum
+bitmap_cmp(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    int32   result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapCmp(bitmap1, bitmap2);
+
+	PG_RETURN_INT32(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_lt);
+/** 
+ * <code>bitmap_lt(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if bitmap1's string representation should be sorted
+ * 		       earlier than bitmap2's.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ */
+Datum
+bitmap_lt(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapCmp(bitmap1, bitmap2) < 0;
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_le);
+/** 
+ * <code>bitmap_le(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if bitmap1's string representation should be sorted
+ * 		       earlier than, or the same as, bitmap2's.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ */
+Datum
+bitmap_le(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapCmp(bitmap1, bitmap2) <= 0;
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gt);
+/** 
+ * <code>bitmap_gt(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if bitmap1's string representation should be sorted
+ * 		       later than bitmap2's.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ */
+Datum
+bitmap_gt(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapCmp(bitmap1, bitmap2) > 0;
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_ge);
+/** 
+ * <code>bitmap_ge(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if bitmap1's string representation should be sorted
+ * 		       later than, or the same as, bitmap2's.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ */
+Datum
+bitmap_ge(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapCmp(bitmap1, bitmap2) >= 0;
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_union);
+/** 
+ * <code>bitmap_union(bitmap1 bitmap, bitmap2 bitmap) returns bitmap</code>
+ * Return the union of 2 bitmaps.  This can be used as an aggregate
+ * function in which case the bitmap1 parameter will be null for the
+ * first call.  In this case simply return the second argument.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bitmap</code> the union of the two bitmaps.
+ */
+Datum
+bitmap_union(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    Bitmap *result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		if (PG_ARGISNULL(1)) {
+			PG_RETURN_NULL();
+		}
+		else {
+			bitmap2 = PG_GETARG_BITMAP(1);
+			result = bitmapCopy(bitmap2);
+		}
+	}
+	else {
+		bitmap1 = PG_GETARG_BITMAP(0);
+		if (PG_ARGISNULL(1)) {
+			result = bitmapCopy(bitmap1);
+		}
+		else {
+			bitmap2 = PG_GETARG_BITMAP(1);
+			result = bitmapUnion(bitmap1, bitmap2);
+		}
+	}
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_clearbit);
+/** 
+ * <code>bitmap_clearbit(bitmap bitmap, bit int4) returns bool</code>
+ * Clear the given bit in the bitmap, returning FALSE.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bitno int4</code> The bitnumber to be set.
+ * @return <code>bool</code> TRUE
+ */
+Datum
+bitmap_clearbit(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int32    bitno;
+	Bitmap *result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP(0);
+    bitno = PG_GETARG_INT32(1);
+	result = bitmapCopy(bitmap);
+	result = bitmapClearbit(result, bitno);
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+/** 
+ * Return the non-null elements of an integer array.
+ * 
+ * @param array The array
+ * @param nbits Returns the number of elements returned
+ *
+ * @return The elements.
+ */
+static int32 *
+arrayBits(ArrayType *array,
+		  int32 *nbits)
+{
+	Datum  *elems;
+	bool   *nulls;
+	int     nelems;
+	int32  *bits;
+	int     i;
+
+	deconstruct_array(array, INT4OID, sizeof(int32), true, TYPALIGN_INT,
+					  &elems, &nulls, &nelems);
+	bits = palloc(sizeof(int32) * (nelems + 1));
+	*nbits = 0;
+	for (i = 0; i < nelems; i++) {
+		if (!nulls[i]) {
+			bits[(*nbits)++] = DatumGetInt32(elems[i]);
+		}
+	}
+	return bits;
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_setbits);
+/** 
+ * <code>bitmap_setbits(bitmap bitmap, bits int4[]) returns bitmap</code>
+ * Return the bitmap with each of the bits in an array set.  Nulls in
+ * the array are ignored.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bits int4[]</code> The bits to be set.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_setbits(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap = PG_GETARG_BITMAP(0);
+	int32  *bits;
+	int32   nbits;
+
+	BITMAP_COUNT_CALL();
+
+	bits = arrayBits(PG_GETARG_ARRAYTYPE_P(1), &nbits);
+	PG_RETURN_BITMAP(bitmapSetBits(bitmap, bits, nbits));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_clearbits);
+/** 
+ * <code>bitmap_clearbits(bitmap bitmap, bits int4[]) returns
+ * bitmap</code>
+ * Return the bitmap with each of the bits in an array cleared.  Nulls
+ * in the array are ignored.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
+ * <br><code>bits int4[]</code> The bits to be cleared.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_clearbits(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap = PG_GETARG_BITMAP(0);
+	int32  *bits;
+	int32   nbits;
+
+	BITMAP_COUNT_CALL();
+
+	bits = arrayBits(PG_GETARG_ARRAYTYPE_P(1), &nbits);
+	PG_RETURN_BITMAP(bitmapClearBits(bitmap, bits, nbits));
+}
+
+
+/** 
+ * Return a bitmap argument shifted by the given amount, after checking
+ * that its shifted bounds are valid bit numbers.
+ * 
+ * @param bitmap The ::Bitmap to be shifted
+ * @param shift The amount to be added to each bit
+ *
+ * @return The new bitmap.
+ */
+static Bitmap *
+shiftedBitmap(Bitmap *bitmap,
+			  int64 shift)
+{
+	if ((!bitmapEmpty(bitmap)) &&
+		(((bitmap->bitmin + shift) < PG_INT32_MIN) ||
+		 ((bitmap->bitmax + shift) > PG_INT32_MAX))) {
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("shifted bitmap bits are out of range"),
+				 errdetail("The bitmap contains bits from %d to %d.",
+						   bitmap->bitmin, bitmap->bitmax)));
+	}
+	return bitmapShift(bitmap, shift);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_shift_left);
+/** 
+ * <code>bitmap_shift_left(bitmap bitmap, n int4) returns bitmap</code>
+ * Return the bitmap with n added to each of its bits, as for the
+ * bitmap << n operator.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be shifted.
+ * <br><code>n int4</code> The amount to add to each bit.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_shift_left(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap = PG_GETARG_BITMAP(0);
+	int32   n = PG_GETARG_INT32(1);
+
+	BITMAP_COUNT_CALL();
+
+	PG_RETURN_BITMAP(shiftedBitmap(bitmap, (int64) n));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_shift_right);
+/** 
+ * <code>bitmap_shift_right(bitmap bitmap, n int4) returns bitmap</code>
+ * Return the bitmap with n subtracted from each of its bits, as for the
+ * bitmap >> n operator.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be shifted.
+ * <br><code>n int4</code> The amount to subtract from each bit.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_shift_right(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap = PG_GETARG_BITMAP(0);
+	int32   n = PG_GETARG_INT32(1);
+
+	BITMAP_COUNT_CALL();
+
+	PG_RETURN_BITMAP(shiftedBitmap(bitmap, -((int64) n)));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_intersection);
+/** 
+ * <code>bitmap_intersection(bitmap1 bitmap, bitmap2 bitmap) 
+ *     returns bitmap</code>
+ * Return the intersection of 2 bitmaps.  This can be used as an
+ * aggregate function in which case the bitmap1 parameter will be null
+ * for the first call.  In this case simply return the second argument.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bitmap</code> the intersection of the two bitmaps.
+ */
+Datum
+bitmap_intersection(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    Bitmap *result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		if (PG_ARGISNULL(1)) {
+			PG_RETURN_NULL();
+		}
+		bitmap2 = PG_GETARG_BITMAP(1);
+		result = bitmapCopy(bitmap2);
+	}
+	else {
+		if (PG_ARGISNULL(1)) {
+			bitmap1 = PG_GETARG_BITMAP(0);
+			result = bitmapCopy(bitmap1);
+		}
+		else {
+			bitmap1 = PG_GETARG_BITMAP_NOTHAW(0);
+			bitmap2 = PG_GETARG_BITMAP_NOTHAW(1);
+			if (BITMAP_IS_FROZEN(bitmap1) || BITMAP_IS_FROZEN(bitmap2)) {
+				result = frozenIntersect(bitmap1, bitmap2);
+			}
+			else {
+				result = bitmapIntersect(bitmap1, bitmap2);
+			}
+		}
+	}
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_minus);
+/** 
+ * <code>bitmap_minus(bitmap1 bitmap, bitmap2 bitmap) 
+ *     returns bitmap</code>
+ * Return the bitmap1 with all bits from bitmap2 subtracted (cleared)
+ *     from it.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bitmap</code> the subtraction of the two bitmaps.
+ */
+Datum
+bitmap_minus(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    Bitmap *result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapMinus(bitmap1, bitmap2);
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_contains);
+/** 
+ * <code>bitmap_contains(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if every bit in bitmap2 is also set in bitmap1.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true if bitmap1 contains bitmap2.
+ */
+Datum
+bitmap_contains(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapContains(bitmap1, bitmap2);
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_contained);
+/** 
+ * <code>bitmap_contained(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if every bit in bitmap1 is also set in bitmap2.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true if bitmap1 is contained by bitmap2.
+ */
+Datum
+bitmap_contained(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapContains(bitmap2, bitmap1);
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_overlaps);
+/** 
+ * <code>bitmap_overlaps(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
+ * Return true if the bitmaps have any bits in common.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>bool</code> true if the bitmaps overlap.
+ */
+Datum
+bitmap_overlaps(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1;
+    Bitmap *bitmap2;
+    bool    result;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+    bitmap1 = PG_GETARG_BITMAP(0);
+    bitmap2 = PG_GETARG_BITMAP(1);
+	result = bitmapOverlaps(bitmap1, bitmap2);
+
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_jaccard_distance);
+/** 
+ * <code>bitmap_jaccard_distance(bitmap1 bitmap, bitmap2 bitmap) returns
+ * float8</code>
+ * Return the Jaccard distance between two bitmaps: 1 minus the size of
+ * their intersection divided by the size of their union.  The distance
+ * between two empty bitmaps is 0.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>float8</code> The distance, from 0 to 1.
+ */
+Datum
+bitmap_jaccard_distance(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1 = PG_GETARG_BITMAP(0);
+    Bitmap *bitmap2 = PG_GETARG_BITMAP(1);
+	int64   card1;
+	int64   card2;
+	int64   common;
+
+	BITMAP_COUNT_CALL();
+
+	bitmapDistanceCounts(bitmap1, bitmap2, &card1, &card2, &common);
+	if (card1 + card2 == 0) {
+		PG_RETURN_FLOAT8(0.0);
+	}
+	PG_RETURN_FLOAT8(1.0 - ((float8) common / (card1 + card2 - common)));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_hamming_distance);
+/** 
+ * <code>bitmap_hamming_distance(bitmap1 bitmap, bitmap2 bitmap) returns
+ * float8</code>
+ * Return the Hamming distance between two bitmaps: the number of bits
+ * set in one but not the other.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap1 bitmap</code> The first bitmap
+ * <br><code>bitmap2 bitmap</code> The second bitmap
+ * @return <code>float8</code> The distance.
+ */
+Datum
+bitmap_hamming_distance(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap1 = PG_GETARG_BITMAP(0);
+    Bitmap *bitmap2 = PG_GETARG_BITMAP(1);
+	int64   card1;
+	int64   card2;
+	int64   common;
+
+	BITMAP_COUNT_CALL();
+
+	bitmapDistanceCounts(bitmap1, bitmap2, &card1, &card2, &common);
+	PG_RETURN_FLOAT8((float8) (card1 + card2 - (2 * common)));
+}
+
+
+/**
+ * A copy of a bitmap argument and its rank directory, cached in
+ * fn_extra by bitmap_rank() and bitmap_select().
+ */
+typedef struct RankCache {
+	Bitmap *bitmap;  /**< Copy of the bitmap argument */
+	int64  *counts;  /**< Rank directory for the bitmap */
+} RankCache;
+
+
+/**
+ * Predicate identifying whether an argument of a function call is a
+ * literal constant.  Unlike get_fn_expr_arg_stable(), this is false
+ * for parameters, which may change between executions of a cached
+ * plan while fn_extra is retained.
+ *
+ * @param flinfo The function's FmgrInfo
+ * @param argnum The 0-based argument number
+ *
+ * @return True if the argument is a Const node.
+ */
+static bool
+fnExprArgIsConst(FmgrInfo *flinfo,
+				 int argnum)
+{
+	Node *expr = flinfo->fn_expr;
+	List *args;
+
+	if (expr == NULL) {
+		return false;
+	}
+	if (IsA(expr, FuncExpr)) {
+		args = ((FuncExpr *) expr)->args;
+	}
+	else if (IsA(expr, OpExpr)) {
+		args = ((OpExpr *) expr)->args;
+	}
+	else {
+		return false;
+	}
+	if ((argnum < 0) || (argnum >= list_length(args))) {
+		return false;
+	}
+	return IsA(list_nth(args, argnum), Const);
+}
+
+
+/**
+ * Get the bitmap argument for bitmap_rank() or bitmap_select(), along
+ * with a rank directory if one is available.  If the bitmap argument
+ * has a stored rank directory, that is used.  Otherwise, if the
+ * argument is a literal constant, a rank directory is built on first
+ * use and cached in fn_extra.  In any other case there is no
+ * directory, and the caller must scan the bitmap.
+ * Frozen bitmaps are returned as they are, with no directory.
+ *
+ * @param fcinfo The function call info of the caller
+ * @param p_counts Set to the rank directory, or NULL.
+ *
+ * @return The bitmap argument.
+ */
+static Bitmap *
+getRankedBitmapArg(FunctionCallInfo fcinfo, int64 **p_counts)
+{
+	RankCache *cache = (RankCache *) fcinfo->flinfo->fn_extra;
+	Bitmap *bitmap;
+	MemoryContext oldcontext;
+
+	if (cache) {
+		*p_counts = cache->counts;
+		return cache->bitmap;
+	}
+
+	bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		*p_counts = NULL;
+		return bitmap;
+	}
+	*p_counts = bitmapStoredRankDirectory(bitmap);
+	if ((*p_counts == NULL) && fnExprArgIsConst(fcinfo->flinfo, 0)) {
+		oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+		cache = palloc(sizeof(RankCache));
+		cache->bitmap = bitmapAddRankDirectory(bitmap);
+		cache->counts = bitmapStoredRankDirectory(cache->bitmap);
+		MemoryContextSwitchTo(oldcontext);
+		fcinfo->flinfo->fn_extra = cache;
+
+		*p_counts = cache->counts;
+		return cache->bitmap;
+	}
+	return bitmap;
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_rank);
+/** 
+ * <code>bitmap_rank(bitmap bitmap, bitno int4) returns int8</code>
+ * Return the number of bits in bitmap that are less than or equal to
+ * bitno.  If bitno is set, this is its 1-based position in the bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * <br><code>bitno int4</code> The bit whose rank is required.
+ * @return <code>int8</code> The rank of bitno.
+ */
+Datum
+bitmap_rank(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int64  *counts;
+	int32   bitno;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+	bitmap = getRankedBitmapArg(fcinfo, &counts);
+    bitno = PG_GETARG_INT32(1);
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		PG_RETURN_INT64(frozenRank((FrozenBitmap *) bitmap, bitno));
+	}
+
+	PG_RETURN_INT64(bitmapRank(bitmap, counts, bitno));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_select);
+/** 
+ * <code>bitmap_select(bitmap bitmap, n int8) returns int4</code>
+ * Return the nth lowest bit set in bitmap, counting from 1, or NULL if
+ * the bitmap does not have n bits.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * <br><code>n int8</code> The position of the required bit.
+ * @return <code>int4</code> The nth bit.
+ */
+Datum
+bitmap_select(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	int64  *counts;
+	int64   n;
+	int32   bit;
+	bool    found;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+		PG_RETURN_NULL();
+	}
+	bitmap = getRankedBitmapArg(fcinfo, &counts);
+    n = PG_GETARG_INT64(1);
+	if (BITMAP_IS_FROZEN(bitmap)) {
+		bit = frozenSelect((FrozenBitmap *) bitmap, n, &found);
+	}
+	else {
+		bit = bitmapSelect(bitmap, counts, n, &found);
+	}
+	if (!found) {
+		PG_RETURN_NULL();
+	}
+
+	PG_RETURN_INT32(bit);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_rank_index);
+/** 
+ * <code>bitmap_rank_index(bitmap bitmap) returns bitmap</code>
+ * Return a copy of bitmap with a stored rank directory, allowing
+ * bitmap_rank() and bitmap_select() to find their results without
+ * scanning the whole bitmap.  The directory adds one int8 for every
+ * 32 words of the bitmap.  It is not retained by any function that
+ * creates a new bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be indexed.
+ * @return <code>bitmap</code> The indexed copy of the bitmap.
+ */
+Datum
+bitmap_rank_index(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP(0);
+
+	PG_RETURN_BITMAP(bitmapAddRankDirectory(bitmap));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_freeze);
+/** 
+ * <code>bitmap_freeze(bitmap bitmap) returns bitmap</code>
+ * Return bitmap in its frozen, Elias-Fano encoded, form, if that is
+ * smaller than its normal form.  Frozen bitmaps can be tested, scanned,
+ * ranked, selected from and intersected directly.  Any other function
+ * will first convert the bitmap back to its normal form.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be frozen.
+ * @return <code>bitmap</code> The frozen bitmap.
+ */
+Datum
+bitmap_freeze(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+
+	PG_RETURN_BITMAP(bitmapFreeze(bitmap));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_thaw);
+/** 
+ * <code>bitmap_thaw(bitmap bitmap) returns bitmap</code>
+ * Return bitmap in its normal form.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be thawed.
+ * @return <code>bitmap</code> The thawed bitmap.
+ */
+Datum
+bitmap_thaw(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		PG_RETURN_NULL();
+	}
+    bitmap = PG_GETARG_BITMAP(0);
+
+	PG_RETURN_BITMAP(bitmap);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_is_frozen);
+/** 
+ * <code>bitmap_is_frozen(bitmap bitmap) returns boolean</code>
+ * Predicate to identify whether a bitmap is in its frozen form.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap being examined.
+ * @return <code>boolean</code> true, if the bitmap is frozen.
+ */
+Datum
+bitmap_is_frozen(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+	PG_RETURN_BOOL(BITMAP_IS_FROZEN(bitmap));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_to_bytea);
+/** 
+ * <code>bitmap_to_bytea(bitmap bitmap) returns bytea</code>
+ * Return the binary form of a bitmap.  This is bitmin and bitmax as
+ * little-endian int4 values, followed by the bits from the 64-bit
+ * boundary at or below bitmin, up to bitmax, as little-endian 64-bit
+ * words.  This is used for the cast from bitmap to bytea.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be converted.
+ * @return <code>bytea</code> The binary form of the bitmap.
+ */
+Datum
+bitmap_to_bytea(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	bytea  *result;
+	Size    size;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP(0);
+	size = VARHDRSZ + bitmapByteaSize(bitmap);
+	result = palloc(size);
+	SET_VARSIZE(result, size);
+	bitmapToBytes(bitmap, VARDATA(result));
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_from_bytea);
+/** 
+ * <code>bitmap_from_bytea(bytes bytea) returns bitmap</code>
+ * Create a bitmap from its binary form, as returned by
+ * bitmap_to_bytea().  This is used for the cast from bytea to bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bytes bytea</code> The binary form of the bitmap.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_from_bytea(PG_FUNCTION_ARGS)
+{
+	bytea *bytes;
+
+	BITMAP_COUNT_CALL();
+
+	bytes = PG_GETARG_BYTEA_PP(0);
+
+	PG_RETURN_BITMAP(bitmapFromBytes(VARDATA_ANY(bytes),
+									 VARSIZE_ANY_EXHDR(bytes)));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_to_varbit);
+/** 
+ * <code>bitmap_to_varbit(bitmap bitmap) returns varbit</code>
+ * Return a bit string in which bit n is 1 if n is in the bitmap.  The
+ * length of the bit string is bitmax + 1.  This is used for the cast
+ * from bitmap to varbit.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be converted.
+ * @return <code>varbit</code> The bit string.
+ */
+Datum
+bitmap_to_varbit(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	VarBit *result;
+	int64   len = 0;
+	Size    size;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP(0);
+	if (!bitmapEmpty(bitmap)) {
+		if (bitmap->bitmin < 0) {
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("bitmap with negative bits cannot be "
+							"converted to bit varying")));
+		}
+		len = (int64) bitmap->bitmax + 1;
+		if (len > VARBITMAXLEN) {
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("bitmap is too large to be converted to "
+							"bit varying")));
+		}
+	}
+	size = VARBITTOTALLEN(len);
+	result = palloc0(size);
+	SET_VARSIZE(result, size);
+	VARBITLEN(result) = (int32) len;
+	if (len > 0) {
+		bitmapToBitString(bitmap, VARBITS(result), VARBITBYTES(result));
+	}
+
+	PG_RETURN_VARBIT_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_from_varbit);
+/** 
+ * <code>bitmap_from_varbit(bits varbit) returns bitmap</code>
+ * Create a bitmap containing n for each bit n that is 1 in a bit
+ * string.  This is used for the cast from varbit to bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bits varbit</code> The bit string.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_from_varbit(PG_FUNCTION_ARGS)
+{
+	VarBit *bits;
+
+	BITMAP_COUNT_CALL();
+
+	bits = PG_GETARG_VARBIT_P(0);
+
+	PG_RETURN_BITMAP(bitmapFromBitString(VARBITS(bits),
+										 VARBITBYTES(bits)));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_to_roaring);
+/** 
+ * <code>bitmap_to_roaring(bitmap bitmap) returns bytea</code>
+ * Return a bitmap in the portable serialisation format of the Roaring
+ * bitmap libraries.  Negative integers become values of 2^31 and
+ * above.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be converted.
+ * @return <code>bytea</code> The serialised Roaring bitmap.
+ */
+Datum
+bitmap_to_roaring(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	RoaringContainer *containers = NULL;
+	int32   ncontainers = 0;
+	bool    runs;
+	int64   len;
+	bytea  *result;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP(0);
+	if (!bitmapEmpty(bitmap)) {
+		containers = palloc(sizeof(RoaringContainer) *
+							(((bitmap->bitmax >> 16) -
+							  (bitmap->bitmin >> 16)) + 1));
+		ncontainers = roaringContainers(bitmap, containers);
+	}
+	len = roaringSize(containers, ncontainers, &runs);
+	if (len > MaxAllocSize - VARHDRSZ) {
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("bitmap is too large to be converted to a "
+						"roaring bitmap")));
+	}
+	result = palloc0(VARHDRSZ + len);
+	SET_VARSIZE(result, VARHDRSZ + len);
+	bitmapToRoaring(bitmap, containers, ncontainers, runs, VARDATA(result));
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_from_roaring);
+/** 
+ * <code>bitmap_from_roaring(bytes bytea) returns bitmap</code>
+ * Create a bitmap from a Roaring bitmap in the portable serialisation
+ * format.  Values of 2^31 and above become negative integers.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bytes bytea</code> The serialised Roaring bitmap.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_from_roaring(PG_FUNCTION_ARGS)
+{
+	bytea *bytes;
+
+	BITMAP_COUNT_CALL();
+
+	bytes = PG_GETARG_BYTEA_PP(0);
+
+	PG_RETURN_BITMAP(bitmapFromRoaring(VARDATA_ANY(bytes),
+									   VARSIZE_ANY_EXHDR(bytes)));
+}
+
+
+/**
+ * Create a range from its bounds.  From PostgreSQL 16, range_serialize()
+ * takes a context for soft error reporting, which we do not need.
+ */
+#if PG_VERSION_NUM >= 160000
+#define RANGE_SERIALIZE(typcache, lower, upper)			\
+	range_serialize(typcache, lower, upper, false, NULL)
+#else
+#define RANGE_SERIALIZE(typcache, lower, upper)	\
+	range_serialize(typcache, lower, upper, false)
+#endif
+
+PG_FUNCTION_INFO_V1(bitmap_to_ranges);
+/** 
+ * <code>bitmap_to_ranges(bitmap bitmap) returns int4multirange</code>
+ * Return the runs of consecutive bits in a bitmap as a multirange.
+ * This is used for the cast from bitmap to int4multirange.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be converted.
+ * @return <code>int4multirange</code> The ranges of bits in the bitmap.
+ */
+Datum
+bitmap_to_ranges(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	TypeCacheEntry *typcache;
+	RangeType **ranges;
+	RangeBound lower;
+	RangeBound upper;
+	int32  *runs;
+	int32   nruns;
+	int32   i;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP(0);
+	if ((!bitmapEmpty(bitmap)) && (bitmap->bitmax == PG_INT32_MAX)) {
+		/* The exclusive upper bound of the last range would not be a
+		 * valid int4. */
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("bitmap containing %d cannot be converted to "
+						"int4multirange", PG_INT32_MAX)));
+	}
+	runs = bitmapRuns(bitmap, &nruns);
+	typcache = multirange_get_typcache(fcinfo, INT4MULTIRANGEOID);
+	ranges = palloc(sizeof(RangeType *) * (nruns + 1));
+
+	lower.infinite = false;
+	lower.inclusive = true;
+	lower.lower = true;
+	upper.infinite = false;
+	upper.inclusive = false;
+	upper.lower = false;
+	for (i = 0; i < nruns; i++) {
+		lower.val = Int32GetDatum(runs[2 * i]);
+		upper.val = Int32GetDatum(runs[(2 * i) + 1] + 1);
+		ranges[i] = RANGE_SERIALIZE(typcache->rngtype, &lower, &upper);
+	}
+
+	PG_RETURN_MULTIRANGE_P(make_multirange(INT4MULTIRANGEOID,
+										   typcache->rngtype, nruns, ranges));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_from_ranges);
+/** 
+ * <code>bitmap(ranges int4multirange) returns bitmap</code>
+ * Create a bitmap containing each integer in a multirange.  This is
+ * used for the cast from int4multirange to bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>ranges int4multirange</code> The ranges of bits to be set.
+ * @return <code>bitmap</code> The new bitmap.
+ */
+Datum
+bitmap_from_ranges(PG_FUNCTION_ARGS)
+{
+	MultirangeType *ranges;
+	TypeCacheEntry *typcache;
+	RangeBound lower;
+	RangeBound upper;
+	int32  *runs;
+	int32   nruns;
+	int32   i;
+
+	BITMAP_COUNT_CALL();
+
+	ranges = PG_GETARG_MULTIRANGE_P(0);
+	typcache = multirange_get_typcache(fcinfo, MultirangeTypeGetOid(ranges));
+	nruns = ranges->rangeCount;
+	runs = palloc(sizeof(int32) * 2 * (nruns + 1));
+	for (i = 0; i < nruns; i++) {
+		multirange_get_bounds(typcache->rngtype, ranges, i, &lower, &upper);
+		if (lower.infinite || upper.infinite) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unbounded ranges cannot be converted to a "
+							"bitmap")));
+		}
+		runs[2 * i] = DatumGetInt32(lower.val) + (lower.inclusive? 0: 1);
+		runs[(2 * i) + 1] = DatumGetInt32(upper.val) -
+			(upper.inclusive? 0: 1);
+	}
+
+	PG_RETURN_BITMAP(bitmapFromRuns(runs, nruns));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_storage_size);
+/** 
+ * <code>bitmap_storage_size(bitmap bitmap) returns integer</code>
+ * Return the size in bytes of a bitmap datum, before any compression.
+ * The bitmap is not detoasted.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be examined.
+ * @return <code>integer</code> The size of the bitmap.
+ */
+Datum
+bitmap_storage_size(PG_FUNCTION_ARGS)
+{
+	BITMAP_COUNT_CALL();
+
+	PG_RETURN_INT32((int32) toast_raw_datum_size(PG_GETARG_DATUM(0)));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_compact);
+/** 
+ * <code>bitmap_compact(bitmap bitmap) returns bitmap</code>
+ * Return a bitmap with its bounds reduced to its lowest and highest
+ * bits, and its size reduced to match.  This repairs bitmaps, stored
+ * by earlier versions, that carry unused words.  Frozen bitmaps, and
+ * those with a stored rank directory, are returned unchanged.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be compacted.
+ * @return <code>bitmap</code> The compacted bitmap.
+ */
+Datum
+bitmap_compact(PG_FUNCTION_ARGS)
+{
+    Bitmap *bitmap;
+	Bitmap *result;
+
+	BITMAP_COUNT_CALL();
+
+    bitmap = PG_GETARG_BITMAP_NOTHAW(0);
+	if (BITMAP_IS_FROZEN(bitmap) || bitmapStoredRankDirectory(bitmap)) {
+		PG_RETURN_BITMAP(bitmap);
+	}
+	result = bitmapCopy(bitmap);
+	reduceBitmap(result);
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+/**
+ * State for bitmap_split().
+ */
+typedef struct SplitState {
+	Bitmap *bitmap;      /**< The bitmap being split */
+	int64   next;        /**< The first bit of the next chunk */
+	int32   chunk_bits;  /**< The number of integers in each chunk */
+} SplitState;
+
+PG_FUNCTION_INFO_V1(bitmap_split);
+/** 
+ * <code>bitmap_split(bitmap bitmap, chunk_bits int4) returns setof
+ * bitmap</code>
+ * Split a bitmap into chunks, each containing the bits of the bitmap
+ * from one range of chunk_bits integers, starting from a multiple of
+ * chunk_bits.  Chunks with no bits are skipped, so each chunk is
+ * returned as a non-empty bitmap.  This is used to store bitmaps in
+ * chunks.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be split.
+ * <br><code>chunk_bits int4</code> The number of integers in each chunk.
+ * @return <code>setof bitmap</code> The chunks, in ascending order.
+ */
+Datum
+bitmap_split(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+	MemoryContext    oldcontext;
+	SplitState *state;
+	Bitmap *chunk;
+	int64   lo;
+	int32   bit;
+	bool    found;
+
+	BITMAP_COUNT_CALL();
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		state = palloc(sizeof(SplitState));
+        state->bitmap = PG_GETARG_BITMAP(0);
+		state->chunk_bits = PG_GETARG_INT32(1);
+        MemoryContextSwitchTo(oldcontext);
+
+		if (state->chunk_bits <= 0) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("chunk_bits must be greater than zero")));
+		}
+        state->next = state->bitmap->bitmin;
+		funcctx->user_fctx = state;
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+	state = funcctx->user_fctx;
+
+	if (state->next <= PG_INT32_MAX) {
+		bit = bitmapNextBit(state->bitmap, (int32) state->next, &found);
+		if (found) {
+			/* Find the start of the chunk, rounding down. */
+			lo = bit - ((((int64) bit % state->chunk_bits) +
+						 state->chunk_bits) % state->chunk_bits);
+			state->next = lo + state->chunk_bits;
+			chunk = bitmapChunk(state->bitmap, bit,
+								(int32) MIN(state->next - 1, PG_INT32_MAX));
+			SRF_RETURN_NEXT(funcctx, PointerGetDatum(chunk));
+		}
+	}
+	SRF_RETURN_DONE(funcctx);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_union_all);
+/** 
+ * <code>bitmap_union_all(bitmaps bitmap[]) returns bitmap</code>
+ * Return the union of an array of bitmaps.  Null elements are ignored.
+ * The result is built in a single pass, so this is much faster than
+ * union_of() for large numbers of bitmaps, such as the chunks of a
+ * chunked bitmap.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmaps bitmap[]</code> The bitmaps to be unioned.
+ * @return <code>bitmap</code> The union.
+ */
+Datum
+bitmap_union_all(PG_FUNCTION_ARGS)
+{
+	ArrayType *array;
+	Datum     *elems;
+	bool      *nulls;
+	int        nelems;
+	Bitmap   **bitmaps;
+	Bitmap    *result;
+	int        i;
+
+	BITMAP_COUNT_CALL();
+
+	array = PG_GETARG_ARRAYTYPE_P(0);
+	deconstruct_array(array, ARR_ELEMTYPE(array), -1, false,
+					  TYPALIGN_DOUBLE, &elems, &nulls, &nelems);
+	bitmaps = palloc(sizeof(Bitmap *) * (nelems + 1));
+	for (i = 0; i < nelems; i++) {
+		bitmaps[i] = nulls[i]? NULL: DatumGetBitmap(elems[i]);
+	}
+	result = bitmapUnionAll(bitmaps, nelems);
+
+	PG_RETURN_BITMAP(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_minhash);
+/** 
+ * <code>bitmap_minhash(bitmap bitmap, k int4) returns int4[]</code>
+ * Return the MinHash signature of a bitmap, using k hash functions.
+ * The signature is computed in a single pass over the words of the
+ * bitmap.  Every element of an empty bitmap's signature is -1.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap to be examined.
+ * <br><code>k int4</code> The number of hash functions.
+ * @return <code>int4[]</code> The signature.
+ */
+Datum
+bitmap_minhash(PG_FUNCTION_ARGS)
+{
+	Bitmap *bitmap = PG_GETARG_BITMAP(0);
+	int32   k = PG_GETARG_INT32(1);
+	uint32 *mins;
+	Datum  *values;
+	int32   i;
+
+	BITMAP_COUNT_CALL();
+
+	if ((k <= 0) || (k > MINHASH_MAX_K)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("k must be between 1 and %d", MINHASH_MAX_K)));
+	}
+	mins = palloc(sizeof(uint32) * k);
+	bitmapMinhash(bitmap, k, mins);
+	values = palloc(sizeof(Datum) * k);
+	for (i = 0; i < k; i++) {
+		values[i] = Int32GetDatum((int32) mins[i]);
+	}
+	PG_RETURN_ARRAYTYPE_P(construct_array(values, k, INT4OID,
+										  sizeof(int32), true, TYPALIGN_INT));
+}
+
+/** 
+ * Return the values of a MinHash signature, raising an error if it
+ * contains nulls.
+ * 
+ * @param array The signature
+ * @param nvalues Returns the number of values
+ *
+ * @return The signature values
+ */
+static uint32 *
+minhashSignature(ArrayType *array,
+				 int *nvalues)
+{
+	Datum  *elems;
+	bool   *nulls;
+	uint32 *values;
+	int     i;
+
+	deconstruct_array(array, INT4OID, sizeof(int32), true, TYPALIGN_INT,
+					  &elems, &nulls, nvalues);
+	values = palloc(sizeof(uint32) * (*nvalues + 1));
+	for (i = 0; i < *nvalues; i++) {
+		if (nulls[i]) {
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("MinHash signature may not contain nulls")));
+		}
+		values[i] = (uint32) DatumGetInt32(elems[i]);
+	}
+	return values;
+}
+
+PG_FUNCTION_INFO_V1(bitmap_minhash_bands);
+/** 
+ * <code>bitmap_minhash_bands(signature int4[], bands int4) returns
+ * int8[]</code>
+ * Divide a MinHash signature into bands of equal numbers of values, and
+ * return a locality sensitive hashing bucket key for each band.
+ * Bitmaps whose signatures match in every value of any band share a
+ * bucket key, so candidate pairs of similar bitmaps may be found using
+ * an equality join on the keys.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>signature int4[]</code> The signature from bitmap_minhash().
+ * <br><code>bands int4</code> The number of bands, which must divide
+ * the length of the signature.
+ * @return <code>int8[]</code> The bucket keys.
+ */
+Datum
+bitmap_minhash_bands(PG_FUNCTION_ARGS)
+{
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+	int32      bands = PG_GETARG_INT32(1);
+	uint32    *values;
+	int        nvalues;
+	int32      rows;
+	Datum     *keys;
+	int32      i;
+
+	BITMAP_COUNT_CALL();
+
+	values = minhashSignature(array, &nvalues);
+	if ((bands <= 0) || (bands > nvalues) || ((nvalues % bands) != 0)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid number of bands (%d)", bands),
+				 errdetail("The number of bands must divide the signature "
+						   "length (%d).", nvalues)));
+	}
+	rows = nvalues / bands;
+	keys = palloc(sizeof(Datum) * bands);
+	for (i = 0; i < bands; i++) {
+		keys[i] = Int64GetDatum(minhashBandKey(i, values + (i * rows), rows));
+	}
+	PG_RETURN_ARRAYTYPE_P(construct_array(keys, bands, INT8OID,
+										  sizeof(int64), FLOAT8PASSBYVAL,
+										  TYPALIGN_DOUBLE));
+}
+
+PG_FUNCTION_INFO_V1(bitmap_minhash_similarity);
+/** 
+ * <code>bitmap_minhash_similarity(signature1 int4[], signature2 int4[])
+ * returns float8</code>
+ * Estimate the Jaccard similarity of two bitmaps from their MinHash
+ * signatures, as the proportion of values that match.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>signature1 int4[]</code> The signature of the first bitmap.
+ * <br><code>signature2 int4[]</code> The signature of the second bitmap,
+ * which must have the same length.
+ * @return <code>float8</code> The estimated similarity.
+ */
+Datum
+bitmap_minhash_similarity(PG_FUNCTION_ARGS)
 {
-	int32 len = streamlen(bytes);
-	b64_decode(*p_stream, len, outstream);
-	(*p_stream) += len;
+	uint32 *values1;
+	uint32 *values2;
+	int     nvalues1;
+	int     nvalues2;
+	int     matches = 0;
+	int     i;
+
+	BITMAP_COUNT_CALL();
+
+	values1 = minhashSignature(PG_GETARG_ARRAYTYPE_P(0), &nvalues1);
+	values2 = minhashSignature(PG_GETARG_ARRAYTYPE_P(1), &nvalues2);
+	if ((nvalues1 != nvalues2) || (nvalues1 == 0)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("MinHash signatures do not match"),
+				 errdetail("Signatures must be non-empty and of equal "
+						   "length (%d and %d).", nvalues1, nvalues2)));
+	}
+	for (i = 0; i < nvalues1; i++) {
+		matches += (values1[i] == values2[i]);
+	}
+	PG_RETURN_FLOAT8((float8) matches / nvalues1);
 }
 
 
+/*
+ * Moving aggregate functions follow.  These allow union_of(),
+ * intersect_of() and bitmap_of() to be used efficiently with moving
+ * window frames.
+ **********************************************************************
+ */
+
+/**
+ * The moving-aggregate state for union_of(), intersect_of() and
+ * bitmap_of().  For each bit, this records the number of rows in the
+ * window frame that contain that bit, so that rows leaving the frame
+ * can be removed from the state rather than the whole frame being
+ * aggregated again.  Counters are allocated a word's worth at a time,
+ * when a bit in that word is first seen, and the present array records
+ * which bits have non-zero counts.
+ */
+typedef struct BitCountState {
+	MemoryContext context;	/**< Memory context for the state */
+	int64    rows;		    /**< The number of non-null rows counted */
+	int32    firstword;	    /**< BITSET_ELEM() of the first bit covered */
+	int32    nwords;	    /**< The number of words covered */
+	bm_int  *present;	    /**< Bitset of bits with non-zero counts */
+	int32  **counts;	    /**< For each word, NULL or an array of
+							 * ELEMBITS counters */
+} BitCountState;
+
 /** 
- * Serialise a bitmap.
+ * Return the moving-aggregate state from the first argument of an
+ * aggregate transition function, creating it if necessary.
+ * 
+ * @param fcinfo The function call info of the transition function
  *
- * @param bitmap The bitmap to be serialised.
+ * @return The ::BitCountState.
  */
-static char *
-serialise_bitmap(Bitmap *bitmap)
+static BitCountState *
+getBitCountState(FunctionCallInfo fcinfo)
 {
-    int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
-    int32 stream_len = (INT32SIZE_B64 * 2) + 
-		streamlen(sizeof(bm_int) * elems) + 1;
-	char *stream = palloc(stream_len * sizeof(char));
-	char *streamstart = stream;
+	MemoryContext  aggcontext;
+	BitCountState *state;
 
-	serialise_int32(&stream, bitmap->bitmin);
-	serialise_int32(&stream, bitmap->bitmax);
-	serialise_stream(&stream, elems * sizeof(bm_int), 
-					 (char *) &(bitmap->bitset));
-	*stream = '\0';
+	if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+		elog(ERROR, "bitmap moving aggregate called in "
+			 "non-aggregate context");
+	}
+	if (!PG_ARGISNULL(0)) {
+		return (BitCountState *) PG_GETARG_POINTER(0);
+	}
+	state = MemoryContextAllocZero(aggcontext, sizeof(BitCountState));
+	state->context = aggcontext;
+	return state;
+}
 
-	/* Ensure bitmap is valid. */
-	if (bitmap->bitmin != bitmap->bitmax) {
-		if (! (bitmapTestbit(bitmap, bitmap->bitmin) &&
-			   bitmapTestbit(bitmap, bitmap->bitmax)))
-		{
-			ereport(ERROR,
-					(errcode(ERRCODE_INTERNAL_ERROR),
-					 errmsg("Corrupted bitmap"),
-					 errdetail("one of bitmin or bitmax is not set.")));
+/** 
+ * Ensure that a ::BitCountState covers the words containing bits lo to
+ * hi.  When the state must be extended, it is extended by at least its
+ * current size, so that a frame that moves steadily through the bits
+ * does not cause the state to be copied for every row.
+ * 
+ * @param state The ::BitCountState
+ * @param lo The lowest bit to be covered
+ * @param hi The highest bit to be covered
+ */
+static void
+coverBitCounts(BitCountState *state,
+			   int32 lo,
+			   int32 hi)
+{
+	int32    lo_word = BITSET_ELEM(lo);
+	int32    hi_word = BITSET_ELEM(hi);
+	int32    last_word = state->firstword + state->nwords - 1;
+	int32    new_first;
+	int32    new_last;
+	int32    offset;
+	bm_int  *present;
+	int32  **counts;
+
+	if (state->nwords == 0) {
+		new_first = lo_word;
+		new_last = hi_word;
+	}
+	else if ((lo_word >= state->firstword) && (hi_word <= last_word)) {
+		return;
+	}
+	else {
+		new_first = state->firstword;
+		new_last = last_word;
+		if (lo_word < state->firstword) {
+			new_first = MAX(BITSET_ELEM(PG_INT32_MIN),
+							MIN(lo_word, state->firstword - state->nwords));
+		}
+		if (hi_word > last_word) {
+			new_last = MIN(BITSET_ELEM(PG_INT32_MAX),
+						   MAX(hi_word, last_word + state->nwords));
 		}
 	}
-	return streamstart;
-}
 
+	/* For the widest bitmaps, the counts array can exceed
+	 * MaxAllocSize. */
+	present = MemoryContextAllocExtended(
+		state->context, sizeof(bm_int) * (new_last - new_first + 1),
+		MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+	counts = MemoryContextAllocExtended(
+		state->context, sizeof(int32 *) * (new_last - new_first + 1),
+		MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+	if (state->nwords) {
+		offset = state->firstword - new_first;
+		memcpy(present + offset, state->present,
+			   sizeof(bm_int) * state->nwords);
+		memcpy(counts + offset, state->counts,
+			   sizeof(int32 *) * state->nwords);
+		pfree(state->present);
+		pfree(state->counts);
+	}
+	state->present = present;
+	state->counts = counts;
+	state->firstword = new_first;
+	state->nwords = new_last - new_first + 1;
+}
 
 /** 
- * De-serialise a bitmap.
- *
- * @param charstream The serialised character string containing the bitmap.
+ * Add one to, or subtract one from, the counter for each bit in a word.
+ * 
+ * @param state The ::BitCountState, which must already cover the word
+ * @param word_idx The index of the word in state->present
+ * @param word The bits to be counted
+ * @param add True to add to the counters, false to subtract
  */
-static Bitmap *
-deserialise_bitmap(char *charstream)
+static void
+countWord(BitCountState *state,
+		  int32 word_idx,
+		  bm_int word,
+		  bool add)
 {
-	Bitmap *bitmap;
-	char **p_stream = &charstream;
-	int32 elems;
-    int32 bitmin;
-	int32 bitmax;
+	int32 *counts = state->counts[word_idx];
+	int32  bitno;
 
-	if (strcmp(charstream, "[]") == 0) {
-		bitmap = newBitmap(0, 0);
-		clearBitmap(bitmap);
+	if (!counts) {
+		if (!add) {
+			elog(ERROR, "bitmap moving aggregate state is inconsistent");
+		}
+		counts = MemoryContextAllocZero(state->context,
+										sizeof(int32) * ELEMBITS);
+		state->counts[word_idx] = counts;
 	}
-	else {
-		bitmin = deserialise_int32(p_stream);
-		bitmax = deserialise_int32(p_stream);
-		bitmap = newBitmap(bitmin, bitmax);
-		elems = ARRAYELEMS(bitmin, bitmax);
+	while (word) {
+		bitno = BM_CTZ(word);
+		word &= word - 1;
+		if (add) {
+			if (counts[bitno]++ == 0) {
+				state->present[word_idx] |= bitmasks[bitno];
+			}
+		}
+		else {
+			if (counts[bitno] <= 0) {
+				elog(ERROR, "bitmap moving aggregate state is inconsistent");
+			}
+			if (--counts[bitno] == 0) {
+				state->present[word_idx] &= ~bitmasks[bitno];
+			}
+		}
+	}
+}
 
-		deserialise_stream(p_stream, elems * sizeof(bitmap->bitset[0]), 
-						   (char *) &(bitmap->bitset[0]));
+/** 
+ * Add every bit of a bitmap to, or remove every bit from, a
+ * ::BitCountState.  The cost is proportional to the size of the bitmap
+ * rather than to the number of rows aggregated.
+ * 
+ * @param state The ::BitCountState
+ * @param bitmap The ::Bitmap being added or removed
+ * @param add True to add the bitmap, false to remove it
+ */
+static void
+countBitmap(BitCountState *state,
+			Bitmap *bitmap,
+			bool add)
+{
+	int32  bitzero = BITZERO(bitmap->bitmin);
+	int32  last_elem = BITSET_ELEM(bitmap->bitmax - bitzero);
+	int32  word_offset;
+	int32  elem;
+	bm_int himask;
+	bm_int word;
+
+	state->rows += add? 1: -1;
+	if (bitmapEmpty(bitmap)) {
+		return;
+	}
+	if (add) {
+		coverBitCounts(state, bitmap->bitmin, bitmap->bitmax);
+	}
+	else if ((bitmap->bitmin < (state->firstword * ELEMBITS)) ||
+			 (BITSET_ELEM(bitmap->bitmax) >=
+			  state->firstword + state->nwords)) {
+		elog(ERROR, "bitmap moving aggregate state is inconsistent");
+	}
+
+	himask = bitmasks[BITSET_BIT(bitmap->bitmax)];
+	himask |= himask - 1;
+	word_offset = BITSET_ELEM(bitzero) - state->firstword;
+	for (elem = 0; elem <= last_elem; elem++) {
+		word = bitmap->bitset[elem];
+		if (elem == last_elem) {
+			word &= himask;
+		}
+		if (word) {
+			countWord(state, elem + word_offset, word, add);
+		}
 	}
-	return bitmap;
 }
 
+/** 
+ * Add a single bit to, or remove it from, a ::BitCountState.
+ * 
+ * @param state The ::BitCountState
+ * @param bit The bit being added or removed
+ * @param add True to add the bit, false to remove it
+ */
+static void
+countBit(BitCountState *state,
+		 int32 bit,
+		 bool add)
+{
+	int32 word_idx;
+
+	state->rows += add? 1: -1;
+	if (add) {
+		coverBitCounts(state, bit, bit);
+	}
+	word_idx = BITSET_ELEM(bit) - state->firstword;
+	if ((word_idx < 0) || (word_idx >= state->nwords)) {
+		elog(ERROR, "bitmap moving aggregate state is inconsistent");
+	}
+	countWord(state, word_idx, bitmasks[BITSET_BIT(bit)], add);
+}
 
 /** 
- * Compare 2 bitmaps for indexing/sorting purposes
+ * Create a bitmap from a ::BitCountState, containing each bit whose
+ * count is at least min_count.  The state is not modified.
  * 
- * @param bitmap1 The first ::Bitmap to be compared
- * @param bitmap2 The second ::Bitmap to be compared
+ * @param state The ::BitCountState
+ * @param min_count The lowest count for which a bit is included
  *
- * @return < 0, 0, or > 0 like strcmp
+ * @return The new bitmap.
  */
-static int
-bitmapCmp(Bitmap *bitmap1,
-		  Bitmap *bitmap2)
+static Bitmap *
+bitCountsToBitmap(BitCountState *state,
+				  int64 min_count)
 {
-	if (bitmapEqual(bitmap1, bitmap2)) {
-		return 0;
+	Bitmap *result;
+	bm_int *words = state->present;
+	int32   first = -1;
+	int32   last = -1;
+	int32  *counts;
+	bm_int  word;
+	int32   bitno;
+	int32   i;
+
+	if (min_count > 1) {
+		/* Only bits with high enough counts are wanted, so build a
+		 * filtered copy of present. */
+		words = palloc(sizeof(bm_int) * state->nwords);
+		for (i = 0; i < state->nwords; i++) {
+			words[i] = 0;
+			counts = state->counts[i];
+			word = state->present[i];
+			while (word) {
+				bitno = BM_CTZ(word);
+				word &= word - 1;
+				if (counts[bitno] >= min_count) {
+					words[i] |= bitmasks[bitno];
+				}
+			}
+		}
 	}
-	else {
-		char *s1 = serialise_bitmap(bitmap1);
-		char *s2 = serialise_bitmap(bitmap2);
-		int result = strcmp(s1, s2);
-		pfree(s1);
-		pfree(s2);
+
+	for (i = 0; i < state->nwords; i++) {
+		if (words[i]) {
+			if (first < 0) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+	if (first < 0) {
+		result = newBitmap(0, 0);
+		clearBitmap(result);
 		return result;
 	}
+
+	result = newBitmap(
+		((state->firstword + first) * ELEMBITS) + BM_CTZ(words[first]),
+		((state->firstword + last) * ELEMBITS) + BM_HIGHBIT(words[last]));
+	memcpy(result->bitset, words + first, sizeof(bm_int) * (last - first + 1));
+	return result;
 }
 
 
-/*
- * Interface functions follow
- **********************************************************************
+PG_FUNCTION_INFO_V1(bitmap_count_add);
+/** 
+ * <code>bitmap_count_add(state internal, bitmap bitmap) 
+ *     returns internal</code>
+ * Moving-aggregate transition function for union_of() and
+ * intersect_of(), adding the bits of bitmap to the state.  Null
+ * bitmaps are ignored.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>state internal</code> The ::BitCountState, or null.
+ * <br><code>bitmap bitmap</code> The bitmap to be added.
+ * @return <code>internal</code> The updated ::BitCountState.
  */
+Datum
+bitmap_count_add(PG_FUNCTION_ARGS)
+{
+	BitCountState *state;
 
+	BITMAP_COUNT_CALL();
 
-PG_FUNCTION_INFO_V1(bitmap_in);
+	state = getBitCountState(fcinfo);
+	if (!PG_ARGISNULL(1)) {
+		countBitmap(state, PG_GETARG_BITMAP(1), true);
+	}
+	PG_RETURN_POINTER(state);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_count_remove);
 /** 
- * <code>bitmap_in(serialised_bitmap text) returns bitmap</code>
- * Create a Bitmap initialised from a (base64) text value.
+ * <code>bitmap_count_remove(state internal, bitmap bitmap) 
+ *     returns internal</code>
+ * Moving-aggregate inverse transition function for union_of() and
+ * intersect_of(), removing the bits of a bitmap, previously added by
+ * bitmap_count_add(), from the state.
  *
  * @param fcinfo Params as described_below
- * <br><code>serialised_bitmap text</code> A base64 serialiastion of a
- * bitmap value.
- * @return <code>Bitmap</code> the newly created bitmap
+ * <br><code>state internal</code> The ::BitCountState.
+ * <br><code>bitmap bitmap</code> The bitmap to be removed.
+ * @return <code>internal</code> The updated ::BitCountState.
  */
 Datum
-bitmap_in(PG_FUNCTION_ARGS)
+bitmap_count_remove(PG_FUNCTION_ARGS)
 {
-	char    *stream;
-    Bitmap *bitmap;
+	BitCountState *state;
 
-    stream = PG_GETARG_CSTRING(0);
-	bitmap = deserialise_bitmap(stream);
+	BITMAP_COUNT_CALL();
 
-    PG_RETURN_BITMAP(bitmap);
+	state = getBitCountState(fcinfo);
+	if (!PG_ARGISNULL(1)) {
+		countBitmap(state, PG_GETARG_BITMAP(1), false);
+	}
+	PG_RETURN_POINTER(state);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_out);
+PG_FUNCTION_INFO_V1(bitmap_count_add_bit);
 /** 
- * <code>bitmap_out(bitmap bitmap) returns text</code>
- * Create a (base64) text representation of a bitmap.
+ * <code>bitmap_count_add_bit(state internal, bitno int4) 
+ *     returns internal</code>
+ * Moving-aggregate transition function for bitmap_of(), adding bitno to
+ * the state.  Null values are ignored.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> A base64 serialiastion of a
- * bitmap value.
- * @return <code>cstring</code> the newly serialised text stream.
+ * <br><code>state internal</code> The ::BitCountState, or null.
+ * <br><code>bitno int4</code> The bit to be added.
+ * @return <code>internal</code> The updated ::BitCountState.
  */
 Datum
-bitmap_out(PG_FUNCTION_ARGS)
+bitmap_count_add_bit(PG_FUNCTION_ARGS)
 {
-	char    *result;
-    Bitmap *bitmap;
+	BitCountState *state;
 
-    bitmap = PG_GETARG_BITMAP(0);
-	result = serialise_bitmap(bitmap);
+	BITMAP_COUNT_CALL();
 
-	PG_RETURN_CSTRING(result);
+	state = getBitCountState(fcinfo);
+	if (!PG_ARGISNULL(1)) {
+		countBit(state, PG_GETARG_INT32(1), true);
+	}
+	PG_RETURN_POINTER(state);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_is_empty);
+PG_FUNCTION_INFO_V1(bitmap_count_remove_bit);
 /** 
- * <code>bitmap_is_empty(bitmap bitmap) returns boolean</code>
- * Predicate to identify whether a bitmap is empty or not.
+ * <code>bitmap_count_remove_bit(state internal, bitno int4) 
+ *     returns internal</code>
+ * Moving-aggregate inverse transition function for bitmap_of(),
+ * removing bitno, previously added by bitmap_count_add_bit(), from the
+ * state.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap being examined.
- * bitmap value.
- * @return <code>boolean</code> true, if the bitmap has no bits.
+ * <br><code>state internal</code> The ::BitCountState.
+ * <br><code>bitno int4</code> The bit to be removed.
+ * @return <code>internal</code> The updated ::BitCountState.
  */
 Datum
-bitmap_is_empty(PG_FUNCTION_ARGS)
+bitmap_count_remove_bit(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
+	BitCountState *state;
 
-    bitmap = PG_GETARG_BITMAP(0);
-	PG_RETURN_BOOL(bitmapEmpty(bitmap));
+	BITMAP_COUNT_CALL();
+
+	state = getBitCountState(fcinfo);
+	if (!PG_ARGISNULL(1)) {
+		countBit(state, PG_GETARG_INT32(1), false);
+	}
+	PG_RETURN_POINTER(state);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_bitmin);
+PG_FUNCTION_INFO_V1(bitmap_count_union);
 /** 
- * <code>bitmap_bitmin(bitmap bitmap) returns boolean</code>
- * Return the lowest bit set in the bitmap, or NULL if none are set.
- * This relies on bitmap->bitmin always identifying the lowest numbered
- * bit in the bitset, unless the bitmap is empty.
+ * <code>bitmap_count_union(state internal) returns bitmap</code>
+ * Moving-aggregate final function for union_of() and bitmap_of(),
+ * returning the bits counted in at least one row, or null if there
+ * are no non-null rows.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap being examined.
- * @return <code>integer</code> The lowest bit set in the bitmap or
- * NULL if there are no bits set.
+ * <br><code>state internal</code> The ::BitCountState.
+ * @return <code>bitmap</code> The union of the rows in the frame.
  */
 Datum
-bitmap_bitmin(PG_FUNCTION_ARGS)
+bitmap_count_union(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap = PG_GETARG_BITMAP(0);
-    int32 relative_bit = bitmap->bitmin - BITZERO(bitmap->bitmin);
+	BitCountState *state;
 
-	if (bitmap->bitset[0] & bitmasks[relative_bit]) {
-		PG_RETURN_INT32(bitmap->bitmin);
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		PG_RETURN_NULL();
 	}
-	if (bitmap->bitmin != bitmap->bitmax) {
-		ereport(ERROR,
-				(errcode(ERRCODE_INTERNAL_ERROR),
-				 errmsg("Corrupted bitmap"),
-				 errdetail("bitzeo is incorrect for bitmap (range %d..%d).", 
-						   bitmap->bitmin, bitmap->bitmax)));
+	state = (BitCountState *) PG_GETARG_POINTER(0);
+	if (state->rows == 0) {
+		PG_RETURN_NULL();
 	}
-	PG_RETURN_NULL();
+	PG_RETURN_BITMAP(bitCountsToBitmap(state, 1));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_bitmax);
+PG_FUNCTION_INFO_V1(bitmap_count_intersect);
 /** 
- * <code>bitmap_bitmax(bitmap bitmap) returns boolean</code>
- * Return the highest bit set in the bitmap, or NULL if none are set.
- * This relies on bitmap->bitmax always identifying the highest numbered
- * bit in the bitset, unless the bitmap is empty.
+ * <code>bitmap_count_intersect(state internal) returns bitmap</code>
+ * Moving-aggregate final function for intersect_of(), returning the
+ * bits counted in every non-null row, or null if there are no non-null
+ * rows.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap being examined.
- * @return <code>integer</code> The lowest bit set in the bitmap or
- * NULL if there are no bits set.
+ * <br><code>state internal</code> The ::BitCountState.
+ * @return <code>bitmap</code> The intersection of the rows in the frame.
+ */
+Datum
+bitmap_count_intersect(PG_FUNCTION_ARGS)
+{
+	BitCountState *state;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		PG_RETURN_NULL();
+	}
+	state = (BitCountState *) PG_GETARG_POINTER(0);
+	if (state->rows == 0) {
+		PG_RETURN_NULL();
+	}
+	PG_RETURN_BITMAP(bitCountsToBitmap(state, state->rows));
+}
+
+
+/*
+ * Bit-sliced index interface functions follow.  A bsi is built by the
+ * bsi_of() aggregate, which collects its (rowid, value) pairs before
+ * building the slices in its final function.
+ **********************************************************************
+ */
+
+/**
+ * The aggregate state for bsi_of(), recording each non-null (rowid,
+ * value) pair.
+ */
+typedef struct BsiState {
+	MemoryContext context;	/**< Memory context for the state */
+	int64    rows;		    /**< The number of pairs recorded */
+	int64    capacity;	    /**< The number of pairs allocated */
+	int32   *rowids;	    /**< The row id of each pair */
+	int32   *values;	    /**< The value of each pair */
+} BsiState;
+
+/** 
+ * Write an error for a badly formed bsi text value.
+ * 
+ * @param str The text value
+ */
+static void
+bsiSyntaxError(char *str)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+			 errmsg("invalid input syntax for type bsi: \"%s\"", str)));
+}
+
+
+PG_FUNCTION_INFO_V1(bsi_in);
+/** 
+ * <code>bsi_in(serialised_bsi text) returns bsi</code>
+ * Create a bsi from its text representation, which is the base value,
+ * the number of slices, and the serialised existence and slice
+ * bitmaps, separated by colons.  Each slice must be contained in the
+ * existence bitmap, and every value that the slices can record must
+ * fit in an int4.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>serialised_bsi text</code> The text representation of a
+ * bsi value.
+ * @return <code>bsi</code> the newly created bsi
  */
 Datum
-bitmap_bitmax(PG_FUNCTION_ARGS)
+bsi_in(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap = PG_GETARG_BITMAP(0);
-    int32 relative_bit = bitmap->bitmax - BITZERO(bitmap->bitmin);
-	int32 elem = BITSET_ELEM(relative_bit);
-
-	if (bitmap->bitset[elem] & bitmasks[BITSET_BIT(relative_bit)]) {
-		PG_RETURN_INT32(bitmap->bitmax);
+	char    *str = PG_GETARG_CSTRING(0);
+	char    *stream = pstrdup(str);
+	char    *next;
+	char    *end;
+	int64    base;
+	long     nslices;
+	Bitmap  *bitmaps[BSI_MAX_SLICES + 1];
+	int32    i;
+
+	BITMAP_COUNT_CALL();
+
+	base = strtoll(stream, &end, 10);
+	if ((end == stream) || (*end != ':') ||
+		(base < PG_INT32_MIN) || (base > PG_INT32_MAX)) {
+		bsiSyntaxError(str);
 	}
-	if (bitmap->bitmin != bitmap->bitmax) {
+	next = end + 1;
+	nslices = strtol(next, &end, 10);
+	if ((end == next) || (*end != ':') ||
+		(nslices < 0) || (nslices > BSI_MAX_SLICES)) {
+		bsiSyntaxError(str);
+	}
+	for (i = 0; i <= nslices; i++) {
+		if (end == NULL) {
+			bsiSyntaxError(str);
+		}
+		next = end + 1;
+		end = strchr(next, ':');
+		if (end) {
+			*end = '\0';
+		}
+		bitmaps[i] = deserialise_bitmap(next);
+	}
+	if (end != NULL) {
+		bsiSyntaxError(str);
+	}
+	if (base + (((int64) 1) << nslices) - 1 > PG_INT32_MAX) {
 		ereport(ERROR,
-				(errcode(ERRCODE_INTERNAL_ERROR),
-				 errmsg("Corrupted bitmap"),
-				 errdetail("bitmax is incorrect for bitmap (range %d..%d).", 
-						   bitmap->bitmin, bitmap->bitmax)));
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid input syntax for type bsi: \"%s\"", str),
+				 errdetail("Values from %lld with %ld slices exceed int4.",
+						   (long long) base, nslices)));
 	}
-	PG_RETURN_NULL();
+	for (i = 1; i <= nslices; i++) {
+		if (!bitmapContains(bitmaps[0], bitmaps[i])) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					 errmsg("invalid input syntax for type bsi: \"%s\"", str),
+					 errdetail("Slice %d has rows that are not in the "
+							   "existence bitmap.", i - 1)));
+		}
+	}
+	PG_RETURN_POINTER(bsiBuild(bitmaps, (int32) nslices, base));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_bits);
+PG_FUNCTION_INFO_V1(bsi_out);
 /** 
- * <code>bitmap_bits(name text)</code> returns setof int4
- * Return the set of all bits set in the specified Bitmap.
+ * <code>bsi_out(index bsi) returns text</code>
+ * Create the text representation of a bsi.
  *
- * @param fcinfo <code>name text</code> The name of the bitmap.
- * @return <code>setof int4</code>The set of bits that are set in the
- * bitmap.
+ * @param fcinfo Params as described_below
+ * <br><code>index bsi</code> The bsi to be represented.
+ * @return <code>cstring</code> the newly serialised text stream.
  */
 Datum
-bitmap_bits(PG_FUNCTION_ARGS)
+bsi_out(PG_FUNCTION_ARGS)
 {
-	struct bitmap_bits_state {
-		Bitmap *bitmap;
-		int32   bit;
-	} *state;
-    FuncCallContext *funcctx;
-	MemoryContext    oldcontext;
-    bool   found;
-    Datum  datum;
-    
-    if (SRF_IS_FIRSTCALL())
-    {
-        funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-		state = palloc(sizeof(struct bitmap_bits_state));
-        MemoryContextSwitchTo(oldcontext);
-
-        state->bitmap = PG_GETARG_BITMAP(0);
-        state->bit = state->bitmap->bitmin;
-		funcctx->user_fctx = state;
-    }
-    
-    funcctx = SRF_PERCALL_SETUP();
-	state = funcctx->user_fctx;
-    
-    state->bit = bitmapNextBit(state->bitmap, state->bit, &found);
-    
-    if (found) {
-        datum = Int32GetDatum(state->bit);
-        state->bit++;
-        SRF_RETURN_NEXT(funcctx, datum);
-    }
-    else {
-        SRF_RETURN_DONE(funcctx);
-    }
+	Bsi   *bsi;
+	char  *parts[BSI_MAX_SLICES + 1];
+	char  *result;
+	char  *p;
+	Size   len;
+	int32  i;
+
+	BITMAP_COUNT_CALL();
+
+	bsi = PG_GETARG_BSI(0);
+	len = 24;	/* Enough for the base, nslices and the null */
+	for (i = 0; i <= bsi->nslices; i++) {
+		parts[i] = serialise_bitmap(bsiBitmap(bsi, i));
+		len += strlen(parts[i]) + 1;
+	}
+	result = palloc(len);
+	p = result + sprintf(result, "%d:%d", (int32) bsi->base, bsi->nslices);
+	for (i = 0; i <= bsi->nslices; i++) {
+		p += sprintf(p, ":%s", parts[i]);
+	}
+	PG_RETURN_CSTRING(result);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_new_empty);
+PG_FUNCTION_INFO_V1(bsi_of_trans);
 /** 
- * <code>bitmap_new_empty() returns bitmap;</code>
- * Create an empty Bitmap, for dealing with a named range of
- * values.
+ * <code>bsi_of_trans(state internal, rowid int4, value int4)
+ * returns internal</code>
+ * Aggregate transition function for bsi_of(), recording a (rowid,
+ * value) pair.  Pairs in which either is null are ignored.
  *
  * @param fcinfo Params as described_below
- * @return <code>Bitmap</code> the newly allocated bitmap
+ * <br><code>state internal</code> The ::BsiState, or null.
+ * <br><code>rowid int4</code> The row id.
+ * <br><code>value int4</code> The value for the row.
+ * @return <code>internal</code> The updated ::BsiState.
  */
 Datum
-bitmap_new_empty(PG_FUNCTION_ARGS)
+bsi_of_trans(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	bitmap = newBitmap(0, 0);
-	clearBitmap(bitmap);
-	
-    PG_RETURN_BITMAP(bitmap);
+	MemoryContext aggcontext;
+	BsiState     *state;
+
+	BITMAP_COUNT_CALL();
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+		elog(ERROR, "bsi_of_trans called in non-aggregate context");
+	}
+	if (PG_ARGISNULL(0)) {
+		state = MemoryContextAllocZero(aggcontext, sizeof(BsiState));
+		state->context = aggcontext;
+	}
+	else {
+		state = (BsiState *) PG_GETARG_POINTER(0);
+	}
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+		PG_RETURN_POINTER(state);
+	}
+
+	if (state->rows == state->capacity) {
+		if (state->capacity == 0) {
+			state->capacity = 1024;
+			state->rowids = MemoryContextAlloc(
+				state->context, sizeof(int32) * state->capacity);
+			state->values = MemoryContextAlloc(
+				state->context, sizeof(int32) * state->capacity);
+		}
+		else {
+			state->capacity *= 2;
+			state->rowids = repalloc_huge(state->rowids,
+										  sizeof(int32) * state->capacity);
+			state->values = repalloc_huge(state->values,
+										  sizeof(int32) * state->capacity);
+		}
+	}
+	state->rowids[state->rows] = PG_GETARG_INT32(1);
+	state->values[state->rows] = PG_GETARG_INT32(2);
+	state->rows++;
+	PG_RETURN_POINTER(state);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_new);
+PG_FUNCTION_INFO_V1(bsi_of_final);
 /** 
- * <code>bitmap_new() returns bitmap;</code>
- * Create or re-initialise a Bitmap, for dealing with a named range of
- * values.
+ * <code>bsi_of_final(state internal) returns bsi</code>
+ * Aggregate final function for bsi_of(), building the bsi from the
+ * recorded pairs, or returning null if there are none.  The values
+ * are stored as offsets from the lowest value, in as many slices as
+ * are needed for the highest offset.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitno int32</code> The first integer value to be recorded in
- * the bitmap
- * @return <code>Bitmap</code> the newly allocated bitmap
+ * <br><code>state internal</code> The ::BsiState.
+ * @return <code>bsi</code> The new bsi.
  */
 Datum
-bitmap_new(PG_FUNCTION_ARGS)
+bsi_of_final(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	int32   bit;
+	BsiState *state;
+	Bitmap   *bitmaps[BSI_MAX_SLICES + 1];
+	int32     minrow;
+	int32     maxrow;
+	int32     minval;
+	int32     maxval;
+	uint32    offset;
+	int32     nslices;
+	int32     relative_bit;
+	int32     element;
+	bm_int    mask;
+	int64     row;
+	int32     i;
+
+	BITMAP_COUNT_CALL();
 
 	if (PG_ARGISNULL(0)) {
 		PG_RETURN_NULL();
 	}
-    bit = PG_GETARG_INT32(0);
-	bitmap = newBitmap(bit, bit);
-	clearBitmap(bitmap);
-	doSetBit(bitmap, bit);
+	state = (BsiState *) PG_GETARG_POINTER(0);
+	if (state->rows == 0) {
+		PG_RETURN_NULL();
+	}
 
-    PG_RETURN_BITMAP(bitmap);
+	minrow = maxrow = state->rowids[0];
+	minval = maxval = state->values[0];
+	for (row = 1; row < state->rows; row++) {
+		minrow = MIN(minrow, state->rowids[row]);
+		maxrow = MAX(maxrow, state->rowids[row]);
+		minval = MIN(minval, state->values[row]);
+		maxval = MAX(maxval, state->values[row]);
+	}
+	offset = (uint32) ((int64) maxval - minval);
+	nslices = 0;
+	while (offset) {
+		nslices++;
+		offset >>= 1;
+	}
+
+	/* All of the bitmaps are created with the bounds of the existence
+	 * bitmap, so that bits can be set directly, and are reduced once
+	 * they are complete. */
+	for (i = 0; i <= nslices; i++) {
+		bitmaps[i] = newBitmap(minrow, maxrow);
+		clearBitmap(bitmaps[i]);
+	}
+	for (row = 0; row < state->rows; row++) {
+		relative_bit = state->rowids[row] - (int32) BITZERO(minrow);
+		element = BITSET_ELEM(relative_bit);
+		mask = bitmasks[BITSET_BIT(relative_bit)];
+		if (bitmaps[0]->bitset[element] & mask) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("duplicate rowid %d in bsi_of()",
+							state->rowids[row])));
+		}
+		bitmaps[0]->bitset[element] |= mask;
+		offset = (uint32) ((int64) state->values[row] - minval);
+		for (i = 0; offset; i++) {
+			if (offset & 1) {
+				bitmaps[i + 1]->bitset[element] |= mask;
+			}
+			offset >>= 1;
+		}
+	}
+	for (i = 1; i <= nslices; i++) {
+		reduceBitmap(bitmaps[i]);
+	}
+	PG_RETURN_POINTER(bsiBuild(bitmaps, nslices, minval));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_setbit);
+PG_FUNCTION_INFO_V1(bsi_range);
 /** 
- * <code>bitmap_setbit(bitmap bitmap, bit int4) returns bool</code>
- * Set the given bit in the bitmap, returning TRUE.  This can be used as
- * an aggregate function in which case the bitmap parameter will be null
- * for the first call.  In this case simply create a bitmap from the
- * second argument.
+ * <code>bsi_range(index bsi, lo int4, hi int4) returns bitmap</code>
+ * Return the rows of a bsi whose values lie between lo and hi
+ * inclusive.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
- * <br><code>bitno int4</code> The bitnumber to be set.
- * @return <code>bitmap</code> The result.
+ * <br><code>index bsi</code> The bsi to be searched.
+ * <br><code>lo int4</code> The lowest value to be matched.
+ * <br><code>hi int4</code> The highest value to be matched.
+ * @return <code>bitmap</code> The matching rows.
  */
 Datum
-bitmap_setbit(PG_FUNCTION_ARGS)
+bsi_range(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	int32   bitno;
-	Bitmap *result;
+	Bsi   *bsi;
+	int32  lo;
+	int32  hi;
 
-	if (PG_ARGISNULL(0)) {
-		if (PG_ARGISNULL(1)) {
-			PG_RETURN_NULL();
-		}
-		bitno = PG_GETARG_INT32(1);
-		result = newBitmap(bitno, bitno);
-		clearBitmap(result);
-		doSetBit(result, bitno);
-	}
-	else {
-		bitno = PG_GETARG_INT32(1);
-		bitmap = PG_GETARG_BITMAP(0);
-		if (PG_ARGISNULL(1)) {
-			result = bitmapCopy(bitmap);
-		}
-		else {
-			result = bitmapSetbit(bitmap, bitno);
-		}
-	}
+	BITMAP_COUNT_CALL();
 
-	PG_RETURN_BITMAP(result);
+	bsi = PG_GETARG_BSI(0);
+	lo = PG_GETARG_INT32(1);
+	hi = PG_GETARG_INT32(2);
+	PG_RETURN_BITMAP(bsiRange(bsi, lo, hi));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_testbit);
+PG_FUNCTION_INFO_V1(bsi_sum);
 /** 
- * <code>bitmap_testbit(bitmap bitmap, bit int4) returns bool</code>
- * Test the given bit in the bitmap, returning TRUE if it is 1.
+ * <code>bsi_sum(index bsi, filter bitmap) returns int8</code>
+ * Return the sum of the values of a bsi for the rows in filter.  This
+ * is the sum over each slice of the number of filter rows in the slice,
+ * scaled by the slice's bit value, plus base for each filter row in the
+ * bsi.  No intersections are created.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
- * <br><code>bitno int4</code> The bitnumber to be tested.
- * @return <code>bool</code> the truth value of the bit.
+ * <br><code>index bsi</code> The bsi.
+ * <br><code>filter bitmap</code> The rows to be summed.
+ * @return <code>int8</code> The sum.
  */
 Datum
-bitmap_testbit(PG_FUNCTION_ARGS)
+bsi_sum(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	int32   bitno;
-	bool    result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	Bsi    *bsi;
+	Bitmap *filter;
+	int64   sum;
+	int64   part;
+	int32   i;
+
+	BITMAP_COUNT_CALL();
+
+	bsi = PG_GETARG_BSI(0);
+	filter = PG_GETARG_BITMAP(1);
+	if (pg_mul_s64_overflow(bsi->base,
+							bitmapIntersectCount(bsiBitmap(bsi, 0), filter),
+							&sum)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("bigint out of range")));
 	}
-    bitmap = PG_GETARG_BITMAP(0);
-    bitno = PG_GETARG_INT32(1);
-	result = bitmapTestbit(bitmap, bitno);
-
-	PG_RETURN_BOOL(result);
+	for (i = 0; i < bsi->nslices; i++) {
+		part = bitmapIntersectCount(bsiBitmap(bsi, i + 1), filter);
+		if (pg_mul_s64_overflow(part, ((int64) 1) << i, &part) ||
+			pg_add_s64_overflow(sum, part, &sum)) {
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("bigint out of range")));
+		}
+	}
+	PG_RETURN_INT64(sum);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_setmin);
+PG_FUNCTION_INFO_V1(bsi_rows);
 /** 
- * <code>bitmap_setmin(bitmap bitmap, bitmin int4) returns bitmap</code>
- * Return a new bitmap having no bits less than bitmin
+ * <code>bsi_rows(index bsi) returns bitmap</code>
+ * Return the rows that have values in a bsi.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
- * <br><code>bitmin int4</code> The new minimum bit.
- * @return <code>bitmap</code> The new bitmap.
+ * <br><code>index bsi</code> The bsi.
+ * @return <code>bitmap</code> The existence bitmap of the bsi.
  */
 Datum
-bitmap_setmin(PG_FUNCTION_ARGS)
+bsi_rows(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	int32   bitmin;
-	Bitmap *result;
-	
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
-	}
-    bitmap = PG_GETARG_BITMAP(0);
-    bitmin = PG_GETARG_INT32(1);
-	result = bitmapCopy(bitmap);
-	result = bitmapSetMin(result, bitmin);
+	Bsi   *bsi;
 
-	PG_RETURN_BITMAP(result);
+	BITMAP_COUNT_CALL();
+
+	bsi = PG_GETARG_BSI(0);
+	PG_RETURN_BITMAP(bitmapCopy(bsiBitmap(bsi, 0)));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_setmax);
+
+/*
+ * Overlap matrix interface functions follow.
+ **********************************************************************
+ */
+
+/**
+ * The aggregate state for bitmap_overlap_matrix(), recording a copy of
+ * each non-null bitmap and its label.
+ */
+typedef struct OverlapState {
+	MemoryContext context;	/**< Memory context for the state */
+	int32    n;			    /**< The number of bitmaps recorded */
+	int32    capacity;	    /**< The number of bitmaps allocated */
+	Bitmap **bitmaps;	    /**< The thawed bitmaps */
+	Datum   *labels;	    /**< The label for each bitmap */
+	bool    *nulls;		    /**< Whether each label is null */
+} OverlapState;
+
+
+PG_FUNCTION_INFO_V1(bitmap_overlap_trans);
 /** 
- * <code>bitmap_setmax(bitmap bitmap, bitmax int4) returns bitmap</code>
- * Return a new bitmap having no bits greater than bitmax
+ * <code>bitmap_overlap_trans(state internal, label text, bitmap bitmap)
+ * returns internal</code>
+ * Aggregate transition function for bitmap_overlap_matrix(), recording
+ * a bitmap and its label.  Rows with null bitmaps are ignored.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
- * <br><code>bitmax int4</code> The new maximum bit.
- * @return <code>bitmap</code> The new bitmap.
+ * <br><code>state internal</code> The ::OverlapState, or null.
+ * <br><code>label text</code> The label for the bitmap.
+ * <br><code>bitmap bitmap</code> The bitmap.
+ * @return <code>internal</code> The updated ::OverlapState.
  */
 Datum
-bitmap_setmax(PG_FUNCTION_ARGS)
+bitmap_overlap_trans(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	int32   bitmax;
-	Bitmap *result;
-	
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	OverlapState *state;
+	Bitmap       *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+		elog(ERROR, "bitmap_overlap_trans called in non-aggregate context");
+	}
+	if (PG_ARGISNULL(0)) {
+		state = MemoryContextAllocZero(aggcontext, sizeof(OverlapState));
+		state->context = aggcontext;
+	}
+	else {
+		state = (OverlapState *) PG_GETARG_POINTER(0);
+	}
+	if (PG_ARGISNULL(2)) {
+		PG_RETURN_POINTER(state);
 	}
-    bitmap = PG_GETARG_BITMAP(0);
-    bitmax = PG_GETARG_INT32(1);
-	result = bitmapCopy(bitmap);
-	result = bitmapSetMax(result, bitmax);
 
-	PG_RETURN_BITMAP(result);
+	bitmap = PG_GETARG_BITMAP(2);
+	oldcontext = MemoryContextSwitchTo(state->context);
+	if (state->n == state->capacity) {
+		if (state->capacity == 0) {
+			state->capacity = 64;
+			state->bitmaps = palloc(sizeof(Bitmap *) * state->capacity);
+			state->labels = palloc(sizeof(Datum) * state->capacity);
+			state->nulls = palloc(sizeof(bool) * state->capacity);
+		}
+		else {
+			state->capacity *= 2;
+			state->bitmaps = repalloc(state->bitmaps,
+									  sizeof(Bitmap *) * state->capacity);
+			state->labels = repalloc(state->labels,
+									 sizeof(Datum) * state->capacity);
+			state->nulls = repalloc(state->nulls,
+									sizeof(bool) * state->capacity);
+		}
+	}
+	state->bitmaps[state->n] = bitmapCopy(bitmap);
+	state->nulls[state->n] = PG_ARGISNULL(1);
+	state->labels[state->n] =
+		PG_ARGISNULL(1)? (Datum) 0: PointerGetDatum(PG_GETARG_TEXT_P_COPY(1));
+	state->n++;
+	MemoryContextSwitchTo(oldcontext);
+	PG_RETURN_POINTER(state);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_equal);
+PG_FUNCTION_INFO_V1(bitmap_overlap_final);
 /** 
- * <code>bitmap_equal(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return true if the bitmaps are equivalent,
+ * <code>bitmap_overlap_final(state internal) returns bitmap_overlaps</code>
+ * Aggregate final function for bitmap_overlap_matrix(), returning the
+ * labels of the bitmaps, and a matrix of the number of bits that each
+ * pair of bitmaps has in common, or null if there were no bitmaps.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bool</code> true if the bitmaps contain the same bits.
+ * <br><code>state internal</code> The ::OverlapState.
+ * @return <code>bitmap_overlaps</code> The labels and the matrix.
  */
 Datum
-bitmap_equal(PG_FUNCTION_ARGS)
+bitmap_overlap_final(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    bool    result;
+	OverlapState *state;
+	TupleDesc     tupdesc;
+	int64        *counts;
+	Datum        *elems;
+	Datum         values[2];
+	bool          nulls[2] = {false, false};
+	int           dims[2];
+	int           lbs[2] = {1, 1};
+	int32         n;
+	int32         i;
+
+	BITMAP_COUNT_CALL();
 
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+	if (PG_ARGISNULL(0)) {
 		PG_RETURN_NULL();
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapEqual(bitmap1, bitmap2);
+	state = (OverlapState *) PG_GETARG_POINTER(0);
+	n = state->n;
+	if (n == 0) {
+		PG_RETURN_NULL();
+	}
+	if ((Size) n * n > MaxAllocSize / sizeof(Datum)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many bitmaps for bitmap_overlap_matrix()"),
+				 errdetail("%d bitmaps were given.", n)));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+		elog(ERROR, "return type must be a row type");
+	}
 
-	PG_RETURN_BOOL(result);
+	counts = palloc(sizeof(int64) * n * n);
+	bitmapOverlapCounts(state->bitmaps, n, counts);
+	elems = palloc(sizeof(Datum) * n * n);
+	for (i = 0; i < n * n; i++) {
+		elems[i] = Int64GetDatum(counts[i]);
+	}
+
+	dims[0] = n;
+	values[0] = PointerGetDatum(
+		construct_md_array(state->labels, state->nulls, 1, dims, lbs,
+						   TEXTOID, -1, false, TYPALIGN_INT));
+	dims[1] = n;
+	values[1] = PointerGetDatum(
+		construct_md_array(elems, NULL, 2, dims, lbs,
+						   INT8OID, sizeof(int64), FLOAT8PASSBYVAL,
+						   TYPALIGN_DOUBLE));
+	tupdesc = BlessTupleDesc(tupdesc);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc,
+													  values, nulls)));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_nequal);
+
+/*
+ * Bit frequency and threshold aggregate functions follow.  The
+ * bit_frequencies() and threshold_of() aggregates share a
+ * ::BitCounters state, and the functions used to combine, serialise
+ * and deserialise it for parallel aggregation.
+ **********************************************************************
+ */
+
+/**
+ * The fixed part of a serialised ::BitCounters.  It is followed by the
+ * words of each slice in turn.
+ */
+typedef struct BitCountersHeader {
+	int64    rows;		    /**< The number of bitmaps counted */
+	int32    k;			    /**< The threshold for threshold_of() */
+	int32    firstword;	    /**< BITSET_ELEM() of the first bit covered */
+	int32    nwords;	    /**< The number of words covered */
+	int32    nslices;	    /**< The number of slices */
+} BitCountersHeader;
+
 /** 
- * <code>bitmap_nequal(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return true if the bitmaps are not equivalent,
+ * Return the ::BitCounters state from the first argument of an
+ * aggregate support function, creating it if necessary.
+ * 
+ * @param fcinfo The function call info of the support function
+ * @param aggcontext Set to the memory context for the state
  *
- * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ * @return The ::BitCounters.
  */
-Datum
-bitmap_nequal(PG_FUNCTION_ARGS)
+static BitCounters *
+getBitCounters(FunctionCallInfo fcinfo,
+			   MemoryContext *aggcontext)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    bool    result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	if (!AggCheckCallContext(fcinfo, aggcontext)) {
+		elog(ERROR, "bitmap counting aggregate called in "
+			 "non-aggregate context");
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = !bitmapEqual(bitmap1, bitmap2);
+	if (!PG_ARGISNULL(0)) {
+		return (BitCounters *) PG_GETARG_POINTER(0);
+	}
+	return MemoryContextAllocZero(*aggcontext, sizeof(BitCounters));
+}
 
-	PG_RETURN_BOOL(result);
+/** 
+ * Record the threshold for threshold_of() in a ::BitCounters, ensuring
+ * that it is valid, and the same as any threshold already recorded.
+ * 
+ * @param counters The ::BitCounters
+ * @param k The threshold
+ */
+static void
+setBitCountersThreshold(BitCounters *counters,
+						int32 k)
+{
+	if (k < 1) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("threshold_of() threshold must be at least 1"),
+				 errdetail("The threshold given was %d.", k)));
+	}
+	if (counters->k && (counters->k != k)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("threshold_of() threshold must be the same "
+						"for every row"),
+				 errdetail("Thresholds %d and %d were given.",
+						   counters->k, k)));
+	}
+	counters->k = k;
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_cmp);
+PG_FUNCTION_INFO_V1(bit_frequencies_trans);
 /** 
- * <code>bitmap_cmp(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return result of comparison of bitmap1's string representation with
- *        bitmap2's.
+ * <code>bit_frequencies_trans(state internal, bitmap bitmap)
+ *     returns internal</code>
+ * Aggregate transition function for bit_frequencies(), counting the
+ * bits of bitmap.  Null bitmaps are ignored.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>int4</code> result of comparison
+ * <br><code>state internal</code> The ::BitCounters, or null.
+ * <br><code>bitmap bitmap</code> The bitmap to be counted.
+ * @return <code>internal</code> The updated ::BitCounters.
  */
 Datum
-bitmap_cmp(PG_FUNCTION_ARGS)
+bit_frequencies_trans(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    int32   result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	BitCounters  *counters;
+	Bitmap       *bitmap;
+
+	BITMAP_COUNT_CALL();
+
+	counters = getBitCounters(fcinfo, &aggcontext);
+	if (!PG_ARGISNULL(1)) {
+		bitmap = PG_GETARG_BITMAP(1);
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		bitCountersAdd(counters, bitmap);
+		MemoryContextSwitchTo(oldcontext);
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapCmp(bitmap1, bitmap2);
-
-	PG_RETURN_INT32(result);
+	PG_RETURN_POINTER(counters);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_lt);
+PG_FUNCTION_INFO_V1(threshold_of_trans);
 /** 
- * <code>bitmap_lt(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return true if bitmap1's string representation should be sorted
- * 		       earlier than bitmap2's.
+ * <code>threshold_of_trans(state internal, bitmap bitmap, k int4)
+ *     returns internal</code>
+ * Aggregate transition function for threshold_of(), counting the bits
+ * of bitmap.  Null bitmaps are ignored.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ * <br><code>state internal</code> The ::BitCounters, or null.
+ * <br><code>bitmap bitmap</code> The bitmap to be counted.
+ * <br><code>k int4</code> The threshold, which must be the same for
+ * every row.
+ * @return <code>internal</code> The updated ::BitCounters.
  */
 Datum
-bitmap_lt(PG_FUNCTION_ARGS)
+threshold_of_trans(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    bool    result;
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	BitCounters  *counters;
+	Bitmap       *bitmap;
 
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
-	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapCmp(bitmap1, bitmap2) < 0;
+	BITMAP_COUNT_CALL();
 
-	PG_RETURN_BOOL(result);
+	counters = getBitCounters(fcinfo, &aggcontext);
+	if (PG_ARGISNULL(2)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("threshold_of() threshold must not be null")));
+	}
+	setBitCountersThreshold(counters, PG_GETARG_INT32(2));
+	if (!PG_ARGISNULL(1)) {
+		bitmap = PG_GETARG_BITMAP(1);
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		bitCountersAdd(counters, bitmap);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	PG_RETURN_POINTER(counters);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_le);
+PG_FUNCTION_INFO_V1(bit_counters_combine);
 /** 
- * <code>bitmap_le(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return true if bitmap1's string representation should be sorted
- * 		       earlier than, or the same as, bitmap2's.
+ * <code>bit_counters_combine(state1 internal, state2 internal)
+ *     returns internal</code>
+ * Aggregate combine function for bit_frequencies() and threshold_of(),
+ * adding the counts of state2 to those of state1.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ * <br><code>state1 internal</code> The ::BitCounters to be updated,
+ * or null.
+ * <br><code>state2 internal</code> The ::BitCounters to be added, or
+ * null.
+ * @return <code>internal</code> The combined ::BitCounters.
  */
 Datum
-bitmap_le(PG_FUNCTION_ARGS)
+bit_counters_combine(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    bool    result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	BitCounters  *counters;
+	BitCounters  *other;
+
+	BITMAP_COUNT_CALL();
+
+	counters = getBitCounters(fcinfo, &aggcontext);
+	if (!PG_ARGISNULL(1)) {
+		other = (BitCounters *) PG_GETARG_POINTER(1);
+		if (other->k) {
+			setBitCountersThreshold(counters, other->k);
+		}
+		oldcontext = MemoryContextSwitchTo(aggcontext);
+		bitCountersCombine(counters, other);
+		MemoryContextSwitchTo(oldcontext);
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapCmp(bitmap1, bitmap2) <= 0;
-
-	PG_RETURN_BOOL(result);
+	PG_RETURN_POINTER(counters);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_gt);
+PG_FUNCTION_INFO_V1(bit_counters_serialize);
 /** 
- * <code>bitmap_gt(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return true if bitmap1's string representation should be sorted
- * 		       later than bitmap2's.
+ * <code>bit_counters_serialize(state internal) returns bytea</code>
+ * Aggregate serialisation function for bit_frequencies() and
+ * threshold_of(), so that states can be passed between parallel
+ * workers.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ * <br><code>state internal</code> The ::BitCounters.
+ * @return <code>bytea</code> The serialised ::BitCounters.
  */
 Datum
-bitmap_gt(PG_FUNCTION_ARGS)
+bit_counters_serialize(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    bool    result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	BitCounters      *counters;
+	BitCountersHeader header;
+	Size              slice_size;
+	bytea            *result;
+	char             *p;
+	int32             s;
+
+	BITMAP_COUNT_CALL();
+
+	if (!AggCheckCallContext(fcinfo, NULL)) {
+		elog(ERROR, "bit_counters_serialize called in "
+			 "non-aggregate context");
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapCmp(bitmap1, bitmap2) > 0;
-
-	PG_RETURN_BOOL(result);
+	counters = (BitCounters *) PG_GETARG_POINTER(0);
+	header.rows = counters->rows;
+	header.k = counters->k;
+	header.firstword = counters->firstword;
+	header.nwords = counters->nwords;
+	header.nslices = counters->nslices;
+	slice_size = sizeof(bm_int) * counters->nwords;
+
+	result = palloc(VARHDRSZ + sizeof(header) +
+					(slice_size * counters->nslices));
+	SET_VARSIZE(result, VARHDRSZ + sizeof(header) +
+				(slice_size * counters->nslices));
+	p = VARDATA(result);
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	for (s = 0; s < counters->nslices; s++) {
+		memcpy(p, counters->slices[s], slice_size);
+		p += slice_size;
+	}
+	PG_RETURN_BYTEA_P(result);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_ge);
+PG_FUNCTION_INFO_V1(bit_counters_deserialize);
 /** 
- * <code>bitmap_ge(bitmap1 bitmap, bitmap2 bitmap) returns bool</code>
- * Return true if bitmap1's string representation should be sorted
- * 		       later than, or the same as, bitmap2's.
+ * <code>bit_counters_deserialize(serialised bytea, dummy internal)
+ *     returns internal</code>
+ * Aggregate deserialisation function for bit_frequencies() and
+ * threshold_of().
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bool</code> true unless the bitmaps contain the same bits.
+ * <br><code>serialised bytea</code> The result of
+ * bit_counters_serialize().
+ * <br><code>dummy internal</code> Unused.
+ * @return <code>internal</code> The deserialised ::BitCounters.
  */
 Datum
-bitmap_ge(PG_FUNCTION_ARGS)
+bit_counters_deserialize(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    bool    result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	MemoryContext     aggcontext;
+	BitCounters      *counters;
+	BitCountersHeader header;
+	bytea            *serialised;
+	Size              slice_size;
+	char             *p;
+	int32             s;
+
+	BITMAP_COUNT_CALL();
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+		elog(ERROR, "bit_counters_deserialize called in "
+			 "non-aggregate context");
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapCmp(bitmap1, bitmap2) >= 0;
-
-	PG_RETURN_BOOL(result);
+	serialised = PG_GETARG_BYTEA_PP(0);
+	p = VARDATA_ANY(serialised);
+	memcpy(&header, p, sizeof(header));
+	p += sizeof(header);
+
+	counters = MemoryContextAllocZero(aggcontext, sizeof(BitCounters));
+	counters->rows = header.rows;
+	counters->k = header.k;
+	counters->firstword = header.firstword;
+	counters->nwords = header.nwords;
+	counters->nslices = header.nslices;
+	slice_size = sizeof(bm_int) * header.nwords;
+	for (s = 0; s < header.nslices; s++) {
+		counters->slices[s] = MemoryContextAlloc(aggcontext, slice_size);
+		memcpy(counters->slices[s], p, slice_size);
+		p += slice_size;
+	}
+	PG_RETURN_POINTER(counters);
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_union);
+PG_FUNCTION_INFO_V1(bit_frequencies_final);
 /** 
- * <code>bitmap_union(bitmap1 bitmap, bitmap2 bitmap) returns bitmap</code>
- * Return the union of 2 bitmaps.  This can be used as an aggregate
- * function in which case the bitmap1 parameter will be null for the
- * first call.  In this case simply return the second argument.
+ * <code>bit_frequencies_final(state internal)
+ *     returns bitmap_frequencies</code>
+ * Aggregate final function for bit_frequencies(), returning each bit
+ * found in the bitmaps, with the number of bitmaps containing it, or
+ * null if there were no non-null bitmaps.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bitmap</code> the union of the two bitmaps.
+ * <br><code>state internal</code> The ::BitCounters.
+ * @return <code>bitmap_frequencies</code> Arrays of the bits and of
+ * their counts.
  */
 Datum
-bitmap_union(PG_FUNCTION_ARGS)
+bit_frequencies_final(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    Bitmap *result;
+	BitCounters *counters;
+	TupleDesc    tupdesc;
+	int64        nbits;
+	int32       *bits;
+	int64       *counts;
+	Datum       *elems;
+	Datum        values[2];
+	bool         nulls[2] = {false, false};
+	int32        i;
+
+	BITMAP_COUNT_CALL();
 
 	if (PG_ARGISNULL(0)) {
-		if (PG_ARGISNULL(1)) {
-			PG_RETURN_NULL();
-		}
-		else {
-			bitmap2 = PG_GETARG_BITMAP(1);
-			result = bitmapCopy(bitmap2);
-		}
+		PG_RETURN_NULL();
 	}
-	else {
-		bitmap1 = PG_GETARG_BITMAP(0);
-		if (PG_ARGISNULL(1)) {
-			result = bitmapCopy(bitmap1);
-		}
-		else {
-			bitmap2 = PG_GETARG_BITMAP(1);
-			result = bitmapUnion(bitmap1, bitmap2);
-		}
+	counters = (BitCounters *) PG_GETARG_POINTER(0);
+	if (counters->rows == 0) {
+		PG_RETURN_NULL();
 	}
-	PG_RETURN_BITMAP(result);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+		elog(ERROR, "return type must be a row type");
+	}
+	nbits = bitCountersBits(counters);
+	if (nbits > MaxAllocSize / sizeof(Datum)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many bits for bit_frequencies()")));
+	}
+
+	bits = palloc(sizeof(int32) * (nbits + 1));
+	counts = palloc(sizeof(int64) * (nbits + 1));
+	bitCountersFrequencies(counters, bits, counts);
+	elems = palloc(sizeof(Datum) * (nbits + 1));
+	for (i = 0; i < nbits; i++) {
+		elems[i] = Int32GetDatum(bits[i]);
+	}
+	values[0] = PointerGetDatum(construct_array(elems, nbits, INT4OID,
+												sizeof(int32), true,
+												TYPALIGN_INT));
+	for (i = 0; i < nbits; i++) {
+		elems[i] = Int64GetDatum(counts[i]);
+	}
+	values[1] = PointerGetDatum(construct_array(elems, nbits, INT8OID,
+												sizeof(int64),
+												FLOAT8PASSBYVAL,
+												TYPALIGN_DOUBLE));
+	tupdesc = BlessTupleDesc(tupdesc);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc,
+													  values, nulls)));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_clearbit);
+PG_FUNCTION_INFO_V1(threshold_of_final);
 /** 
- * <code>bitmap_clearbit(bitmap bitmap, bit int4) returns bool</code>
- * Clear the given bit in the bitmap, returning FALSE.
+ * <code>threshold_of_final(state internal) returns bitmap</code>
+ * Aggregate final function for threshold_of(), returning the bits
+ * found in at least k of the bitmaps, or null if there were no
+ * non-null bitmaps.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap bitmap</code> The bitmap to be manipulated.
- * <br><code>bitno int4</code> The bitnumber to be set.
- * @return <code>bool</code> TRUE
+ * <br><code>state internal</code> The ::BitCounters.
+ * @return <code>bitmap</code> The bits found in at least k bitmaps.
  */
 Datum
-bitmap_clearbit(PG_FUNCTION_ARGS)
+threshold_of_final(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap;
-	int32    bitno;
-	Bitmap *result;
+	BitCounters *counters;
 
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
 		PG_RETURN_NULL();
 	}
-    bitmap = PG_GETARG_BITMAP(0);
-    bitno = PG_GETARG_INT32(1);
-	result = bitmapCopy(bitmap);
-	result = bitmapClearbit(result, bitno);
-
-	PG_RETURN_BITMAP(result);
+	counters = (BitCounters *) PG_GETARG_POINTER(0);
+	if (counters->rows == 0) {
+		PG_RETURN_NULL();
+	}
+	PG_RETURN_BITMAP(bitCountersThreshold(counters, counters->k));
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_intersection);
+/*
+ * Expression evaluation interface functions follow.
+ **********************************************************************
+ */
+
+/**
+ * The source and compiled form of the last expression given to
+ * bitmap_eval(), cached in fn_extra so that an expression is compiled
+ * only once for each query in which it is used, however many rows it
+ * is evaluated for.
+ */
+typedef struct BitmapExprCache {
+	char      *source;		/**< The expression, or NULL */
+	int32      len;			/**< The length of source */
+	BitmapExpr expr;		/**< The compiled expression */
+} BitmapExprCache;
+
 /** 
- * <code>bitmap_intersection(bitmap1 bitmap, bitmap2 bitmap) 
- *     returns bitmap</code>
- * Return the intersection of 2 bitmaps.  This can be used as an
- * aggregate function in which case the bitmap1 parameter will be null
- * for the first call.  In this case simply return the second argument.
+ * Return the compiled form of an expression for bitmap_eval(),
+ * compiling it and caching the result only if it differs from the
+ * expression last used by this call of the function.
+ * 
+ * @param fcinfo The function call info of the caller
+ * @param expr_text The expression
  *
- * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bitmap</code> the intersection of the two bitmaps.
+ * @return The compiled expression
  */
-Datum
-bitmap_intersection(PG_FUNCTION_ARGS)
+static BitmapExpr *
+getBitmapExpr(FunctionCallInfo fcinfo,
+			  text *expr_text)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    Bitmap *result;
+	BitmapExprCache *cache = (BitmapExprCache *) fcinfo->flinfo->fn_extra;
+	char  *str = VARDATA_ANY(expr_text);
+	int32  len = VARSIZE_ANY_EXHDR(expr_text);
+	char  *source;
+	MemoryContext oldcontext;
+
+	if (cache && cache->source && (cache->len == len) &&
+		(memcmp(cache->source, str, len) == 0)) {
+		return &cache->expr;
+	}
 
-	if (PG_ARGISNULL(0)) {
-		if (PG_ARGISNULL(1)) {
-			PG_RETURN_NULL();
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	if (cache) {
+		if (cache->source) {
+			pfree(cache->source);
+			cache->source = NULL;
 		}
-		bitmap2 = PG_GETARG_BITMAP(1);
-		result = bitmapCopy(bitmap2);
 	}
 	else {
-		bitmap1 = PG_GETARG_BITMAP(0);
-		if (PG_ARGISNULL(1)) {
-			result = bitmapCopy(bitmap1);
-		}
-		bitmap2 = PG_GETARG_BITMAP(1);
-		result = bitmapIntersect(bitmap1, bitmap2);
+		cache = palloc(sizeof(BitmapExprCache));
+		cache->source = NULL;
+		fcinfo->flinfo->fn_extra = cache;
 	}
-	PG_RETURN_BITMAP(result);
+	source = palloc(len + 1);
+	MemoryContextSwitchTo(oldcontext);
+
+	memcpy(source, str, len);
+	source[len] = '\0';
+	bitmapExprCompile(source, &cache->expr);
+	cache->source = source;
+	cache->len = len;
+	return &cache->expr;
 }
 
 
-PG_FUNCTION_INFO_V1(bitmap_minus);
+PG_FUNCTION_INFO_V1(bitmap_eval);
 /** 
- * <code>bitmap_minus(bitmap1 bitmap, bitmap2 bitmap) 
- *     returns bitmap</code>
- * Return the bitmap1 with all bits from bitmap2 subtracted (cleared)
- *     from it.
+ * <code>bitmap_eval(expr text, variadic bitmaps bitmap[]) returns
+ * bitmap</code>
+ * Evaluate an expression combining bitmaps with the + (union), *
+ * (intersection) and - (minus) operators, and parentheses.  Within the
+ * expression, $1, or a, is the first of the bitmaps, $2, or b, the
+ * second, and so on.  The result is built in a single pass over the
+ * bitmaps, rather than by creating a new bitmap for each operator as
+ * the equivalent SQL expression would.
  *
  * @param fcinfo Params as described_below
- * <br><code>bitmap1 bitmap</code> The first bitmap
- * <br><code>bitmap2 bitmap</code> The second bitmap
- * @return <code>bitmap</code> the subtraction of the two bitmaps.
+ * <br><code>expr text</code> The expression to be evaluated.
+ * <br><code>bitmaps bitmap[]</code> The bitmaps used by the expression.
+ * @return <code>bitmap</code> The result of the expression, or null if
+ * any bitmap that it uses is null.
  */
 Datum
-bitmap_minus(PG_FUNCTION_ARGS)
+bitmap_eval(PG_FUNCTION_ARGS)
 {
-    Bitmap *bitmap1;
-    Bitmap *bitmap2;
-    Bitmap *result;
-
-	if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
-		PG_RETURN_NULL();
+	text       *expr_text = PG_GETARG_TEXT_PP(0);
+	ArrayType  *array = PG_GETARG_ARRAYTYPE_P(1);
+	BitmapExpr *expr;
+	Datum      *elems;
+	bool       *nulls;
+	int         nelems;
+	Bitmap    **inputs;
+	int32       input;
+	int32       i;
+
+	BITMAP_COUNT_CALL();
+
+	expr = getBitmapExpr(fcinfo, expr_text);
+	deconstruct_array(array, ARR_ELEMTYPE(array), -1, false,
+					  TYPALIGN_DOUBLE, &elems, &nulls, &nelems);
+	if (expr->ninputs > nelems) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("bitmap expression uses $%d", expr->ninputs),
+				 errdetail("Only %d bitmaps were given.", nelems)));
 	}
-    bitmap1 = PG_GETARG_BITMAP(0);
-    bitmap2 = PG_GETARG_BITMAP(1);
-	result = bitmapMinus(bitmap1, bitmap2);
 
-	PG_RETURN_BITMAP(result);
+	inputs = palloc0(sizeof(Bitmap *) * expr->ninputs);
+	for (i = 0; i < expr->nsteps; i++) {
+		if (expr->steps[i].op == BITMAP_EXPR_INPUT) {
+			input = expr->steps[i].input;
+			if (nulls[input]) {
+				PG_RETURN_NULL();
+			}
+			if (inputs[input] == NULL) {
+				inputs[input] = DatumGetBitmap(elems[input]);
+			}
+		}
+	}
+	PG_RETURN_BITMAP(bitmapExprEval(expr, inputs));
 }
+
+
+#endif /* PGBITMAP_BENCH */
@@ -132,6 +132,48 @@
 #endif
 
 
+/**
+ * Count the number of bits set in a single bitmap word.
+ *
+ * @param x The word to be counted
+ *
+ * @return The number of 1 bits in x.
+ */
+#ifdef USE_64_BIT
+#define BM_POPCOUNT(x) __builtin_popcountll(x)
+#else
+#define BM_POPCOUNT(x) __builtin_popcount(x)
+#endif
+
+/**
+ * Give the position of the lowest bit set in a bitmap word.  The result
+ * is undefined if x is zero.
+ *
+ * @param x The word to be examined
+ *
+ * @return The index, into ::bitmasks, of the lowest set bit in x.
+ */
+#ifdef USE_64_BIT
+#define BM_CTZ(x) __builtin_ctzll(x)
+#else
+#define BM_CTZ(x) __builtin_ctz(x)
+#endif
+
+/**
+ * Give the position of the highest bit set in a bitmap word.  The
+ * result is undefined if x is zero.
+ *
+ * @param x The word to be examined
+ *
+ * @return The index, into ::bitmasks, of the highest set bit in x.
+ */
+#ifdef USE_64_BIT
+#define BM_HIGHBIT(x) (63 - __builtin_clzll(x))
+#else
+#define BM_HIGHBIT(x) (31 - __builtin_clz(x))
+#endif
+
+
 /**
  * Return the smaller of a or b.  Note that expressions a and b may be
  * evaluated more than once.
@@ -182,33 +224,241 @@ typedef struct Bitmap {
 						 * comprising the bitmap. */
 } Bitmap;
 
+/**
+ * Gives the size of a flat ::Bitmap datum with the given bounds.
+ *
+ * @param min
+ * @param max
+ *
+ * @return The datum size in bytes.
+ */
+#define BITMAP_PLAIN_SIZE(min, max)									\
+	(sizeof(Bitmap) + (sizeof(bm_int) * (ARRAYELEMS(min, max) + DBG_ELEMS)))
+
+/**
+ * Predicate identifying whether a detoasted ::Bitmap datum is in the
+ * frozen, Elias-Fano encoded, form created by bitmap_freeze().  Bitmaps
+ * are only frozen if that makes them smaller, so this is the case if
+ * the datum is smaller than the bounds of the bitmap require.
+ *
+ * @param b The ::Bitmap
+ *
+ * @return True if the bitmap is frozen.
+ */
+#define BITMAP_IS_FROZEN(b)										\
+	(VARSIZE(b) < BITMAP_PLAIN_SIZE((b)->bitmin, (b)->bitmax))
+
 /**
  * Defines a boolean type to make our code more readable.
  */
 typedef unsigned char boolean;
 
 /**
- * Provide a macro for getting a bitmap datum.
+ * Provide a macro for getting a bitmap datum.  Frozen bitmaps are
+ * thawed.
+ */
+#define DatumGetBitmap(x)	bitmapDetoast(x, true)
+
+/**
+ * Counters recording the work done by pgbitmap in this backend.  These
+ * are only maintained while pgbitmap.track_stats is on, and are
+ * reported by pgbitmap_stats().
+ */
+typedef struct BitmapCounters {
+	int64   allocations;	 /**< Bitmaps allocated by newBitmap() */
+	int64   bytes_allocated; /**< Total size of those bitmaps */
+	int64   copies;		     /**< Bitmaps copied by bitmapCopy() */
+	int64   extensions;		 /**< Bitmaps copied by extendBitmap() */
+	int64   detoasts;		 /**< Bitmap arguments that were detoasted */
+	int64   reductions;		 /**< Bitmaps shrunk by reduceBitmap() */
+	int64   thaws;			 /**< Frozen bitmaps thawed by bitmapThaw() */
+} BitmapCounters;
+
+#ifndef PGDLLEXPORT
+#define PGDLLEXPORT
+#endif
+
+/* These are referenced by bitmapDetoast(), and so by DatumGetBitmap()
+ * and PG_GETARG_BITMAP() in other extensions using the C API. */
+extern PGDLLEXPORT bool pgbitmap_track_stats;
+extern PGDLLEXPORT BitmapCounters bitmap_counters;
+
+/**
+ * Add n to the named ::BitmapCounters counter if pgbitmap.track_stats is
+ * on.
  */
-#define DatumGetBitmap(x)	((Bitmap *) PG_DETOAST_DATUM(DatumGetPointer(x)))
+#define BITMAP_STAT_ADD(counter, n)				\
+	do {										\
+		if (unlikely(pgbitmap_track_stats)) {	\
+			bitmap_counters.counter += (n);		\
+		}										\
+	} while (0)
+
+/**
+ * Count a call of the SQL-callable function in which this appears, if
+ * pgbitmap.track_stats is on.  Each function caches the index of its
+ * call counter, which is allocated by bitmapCountCall() on the first
+ * counted call.
+ */
+#define BITMAP_COUNT_CALL()							\
+	do {											\
+		static int call_slot = -1;					\
+		if (unlikely(pgbitmap_track_stats)) {		\
+			bitmapCountCall(__func__, &call_slot);	\
+		}											\
+	} while (0)
+
+extern PGDLLEXPORT Bitmap *bitmapThaw(Bitmap *bitmap);
+
+#ifndef PGBITMAP_BENCH
+/** 
+ * Return a bitmap argument, detoasting it if necessary.  Detoasts are
+ * counted if pgbitmap.track_stats is on.
+ * 
+ * @param datum The bitmap argument
+ * @param thaw Whether a frozen bitmap should be converted to a flat
+ * one.
+ *
+ * @return The detoasted bitmap.
+ */
+static inline Bitmap *
+bitmapDetoast(Datum datum, bool thaw)
+{
+	Bitmap *bitmap = (Bitmap *) PG_DETOAST_DATUM(datum);
+
+	if (unlikely(pgbitmap_track_stats) &&
+		((Pointer) bitmap != DatumGetPointer(datum))) {
+		bitmap_counters.detoasts++;
+	}
+	if (thaw && unlikely(BITMAP_IS_FROZEN(bitmap))) {
+		return bitmapThaw(bitmap);
+	}
+	return bitmap;
+}
+#endif
 
 /**
- * Provide a macro for dealing with bitmap arguments.
+ * Provide a macro for dealing with bitmap arguments.  Frozen bitmaps
+ * are thawed, so that the result is always a flat ::Bitmap.
  */
-#define PG_GETARG_BITMAP(x)	DatumGetBitmap(		\
-		PG_DETOAST_DATUM(PG_GETARG_DATUM(x)))
+#define PG_GETARG_BITMAP(x)	bitmapDetoast(PG_GETARG_DATUM(x), true)
+/**
+ * Provide a macro for bitmap arguments to functions that deal with
+ * frozen bitmaps directly.  The result must be tested using
+ * BITMAP_IS_FROZEN().
+ */
+#define PG_GETARG_BITMAP_NOTHAW(x)	bitmapDetoast(PG_GETARG_DATUM(x), false)
 /**
  * Provide a macro for returning bitmap results.
  */
 #define PG_RETURN_BITMAP(x)	PG_RETURN_POINTER(x)
 
-extern bool bitmapTestbit(Bitmap *bitmap, int32 bit);
-extern Bitmap *bitmapCopy(Bitmap *bitmap);
+/* Internal functions shared between the source files of pgbitmap.
+ * These are not part of the C API declared below, and are not
+ * exported. */
+extern void bitmapCountCall(const char *name, int *slot);
+extern Bitmap *bitmapUnion(Bitmap *bitmap1, Bitmap *bitmap2);
+extern Bitmap *bitmapFold(Bitmap *bitmap, int32 nbits);
+extern bool bitmapFoldedOverlaps(Bitmap *folded, Bitmap *bitmap, int32 nbits);
+
+/**
+ * The version of the C API declared below.  This is incremented
+ * whenever the API changes incompatibly, including any change to the
+ * layout of ::BitmapIterator.  Extensions that call these functions
+ * should check at load time that bitmapApiVersion() returns the value
+ * they were compiled with.
+ *
+ * Functions of the API operate on flat bitmaps, as returned by
+ * DatumGetBitmap() and PG_GETARG_BITMAP(), and must not be given
+ * frozen ones.  Other than bitmapCopy(), none of them allocates
+ * memory: results are built either in place, or in buffers provided
+ * by the caller and sized using the corresponding size function.
+ */
+#define PGBITMAP_API_VERSION 1
+
+extern PGDLLEXPORT int bitmapApiVersion(void);
+extern PGDLLEXPORT bool bitmapTestbit(Bitmap *bitmap, int32 bit);
+extern PGDLLEXPORT Bitmap *bitmapCopy(Bitmap *bitmap);
+extern PGDLLEXPORT int64 bitmapCardinality(Bitmap *bitmap);
+extern PGDLLEXPORT boolean bitmapEmpty(Bitmap *bitmap);
+extern PGDLLEXPORT bool bitmapContains(Bitmap *bitmap1, Bitmap *bitmap2);
+extern PGDLLEXPORT bool bitmapOverlaps(Bitmap *bitmap1, Bitmap *bitmap2);
+extern PGDLLEXPORT Bitmap *bitmapInitEmpty(void *buffer, Size size);
+extern PGDLLEXPORT Size bitmapUnionSize(Bitmap *bitmap1, Bitmap *bitmap2);
+extern PGDLLEXPORT Size bitmapIntersectSize(Bitmap *bitmap1,
+											Bitmap *bitmap2);
+extern PGDLLEXPORT Size bitmapMinusSize(Bitmap *bitmap1, Bitmap *bitmap2);
+extern PGDLLEXPORT bool bitmapUnionInto(Bitmap *target, Size capacity,
+										Bitmap *source);
+extern PGDLLEXPORT void bitmapIntersectInto(Bitmap *target, Bitmap *source);
+extern PGDLLEXPORT void bitmapMinusInto(Bitmap *target, Bitmap *source);
+extern PGDLLEXPORT Bitmap *bitmapUnionBuffer(Bitmap *bitmap1,
+											 Bitmap *bitmap2,
+											 void *buffer, Size size);
+extern PGDLLEXPORT Bitmap *bitmapIntersectBuffer(Bitmap *bitmap1,
+												 Bitmap *bitmap2,
+												 void *buffer, Size size);
+extern PGDLLEXPORT Bitmap *bitmapMinusBuffer(Bitmap *bitmap1,
+											 Bitmap *bitmap2,
+											 void *buffer, Size size);
+
+/**
+ * State for iterating over the bits of a flat ::Bitmap, in ascending
+ * order, using bitmapIteratorInit() and bitmapIteratorNext().  The
+ * bitmap must not be modified while it is being iterated.
+ */
+typedef struct BitmapIterator {
+	Bitmap *bitmap;		/**< The bitmap being iterated */
+	int32   elem;		/**< The index of the current word */
+	int32   elems;		/**< The number of words in the bitmap */
+	bm_int  word;		/**< The bits of the current word not yet returned */
+} BitmapIterator;
+
+/**
+ * Prepare to iterate over the bits of a ::Bitmap.
+ *
+ * @param iter The ::BitmapIterator to be initialised
+ * @param bitmap The flat ::Bitmap to be iterated
+ */
+static inline void
+bitmapIteratorInit(BitmapIterator *iter, Bitmap *bitmap)
+{
+	iter->bitmap = bitmap;
+	iter->elem = 0;
+	iter->elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	iter->word = bitmap->bitset[0];
+}
+
+/**
+ * Return the next bit from a ::BitmapIterator.
+ *
+ * @param iter The ::BitmapIterator
+ * @param bit Location into which the bit is written
+ *
+ * @return True if a bit was returned, false if there are no more.
+ */
+static inline bool
+bitmapIteratorNext(BitmapIterator *iter, int32 *bit)
+{
+	while (iter->word == 0) {
+		if (iter->elem + 1 >= iter->elems) {
+			return false;
+		}
+		iter->elem++;
+		iter->word = iter->bitmap->bitset[iter->elem];
+	}
+	*bit = (int32) BITZERO(iter->bitmap->bitmin) + (iter->elem * ELEMBITS) +
+		BM_CTZ(iter->word);
+	iter->word &= iter->word - 1;
+	return true;
+}
 
 extern Datum bitmap_in(PG_FUNCTION_ARGS);
 extern Datum bitmap_out(PG_FUNCTION_ARGS);
 extern Datum bitmap_is_empty(PG_FUNCTION_ARGS);
 extern Datum bitmap_bits(PG_FUNCTION_ARGS);
+extern Datum bitmap_bits_range(PG_FUNCTION_ARGS);
+extern Datum bitmap_bits_reverse(PG_FUNCTION_ARGS);
 extern Datum bitmap_new_empty(PG_FUNCTION_ARGS);
 extern Datum bitmap_new(PG_FUNCTION_ARGS);
 extern Datum bitmap_bitmin(PG_FUNCTION_ARGS);
@@ -229,6 +479,92 @@ extern Datum bitmap_le(PG_FUNCTION_ARGS);
 extern Datum bitmap_gt(PG_FUNCTION_ARGS);
 extern Datum bitmap_ge(PG_FUNCTION_ARGS);
 extern Datum bitmap_cmp(PG_FUNCTION_ARGS);
+extern Datum bitmap_contains(PG_FUNCTION_ARGS);
+extern Datum bitmap_contained(PG_FUNCTION_ARGS);
+extern Datum bitmap_overlaps(PG_FUNCTION_ARGS);
+extern Datum bitmap_typanalyze(PG_FUNCTION_ARGS);
+extern Datum bitmap_testbit_sel(PG_FUNCTION_ARGS);
+extern Datum bitmap_testbit_joinsel(PG_FUNCTION_ARGS);
+extern Datum bitmap_eq_sel(PG_FUNCTION_ARGS);
+extern Datum bitmap_eq_joinsel(PG_FUNCTION_ARGS);
+extern Datum bitmap_contains_sel(PG_FUNCTION_ARGS);
+extern Datum bitmap_contained_sel(PG_FUNCTION_ARGS);
+extern Datum bitmap_overlaps_sel(PG_FUNCTION_ARGS);
+extern Datum bitmap_contains_joinsel(PG_FUNCTION_ARGS);
+extern Datum bitmap_contained_joinsel(PG_FUNCTION_ARGS);
+extern Datum bitmap_overlaps_joinsel(PG_FUNCTION_ARGS);
+extern Datum bitmap_rank(PG_FUNCTION_ARGS);
+extern Datum bitmap_select(PG_FUNCTION_ARGS);
+extern Datum bitmap_rank_index(PG_FUNCTION_ARGS);
+extern Datum bitmap_count_add(PG_FUNCTION_ARGS);
+extern Datum bitmap_count_remove(PG_FUNCTION_ARGS);
+extern Datum bitmap_count_add_bit(PG_FUNCTION_ARGS);
+extern Datum bitmap_count_remove_bit(PG_FUNCTION_ARGS);
+extern Datum bitmap_count_union(PG_FUNCTION_ARGS);
+extern Datum bitmap_count_intersect(PG_FUNCTION_ARGS);
+extern Datum bitmap_freeze(PG_FUNCTION_ARGS);
+extern Datum bitmap_thaw(PG_FUNCTION_ARGS);
+extern Datum bitmap_is_frozen(PG_FUNCTION_ARGS);
+extern Datum bitmap_to_bytea(PG_FUNCTION_ARGS);
+extern Datum bitmap_from_bytea(PG_FUNCTION_ARGS);
+extern Datum bitmap_to_varbit(PG_FUNCTION_ARGS);
+extern Datum bitmap_from_varbit(PG_FUNCTION_ARGS);
+extern Datum bitmap_to_roaring(PG_FUNCTION_ARGS);
+extern Datum bitmap_from_roaring(PG_FUNCTION_ARGS);
+extern Datum bitmap_to_ranges(PG_FUNCTION_ARGS);
+extern Datum bitmap_from_ranges(PG_FUNCTION_ARGS);
+extern Datum bitmap_storage_size(PG_FUNCTION_ARGS);
+extern Datum bitmap_compact(PG_FUNCTION_ARGS);
+extern Datum bitmap_split(PG_FUNCTION_ARGS);
+extern Datum bitmap_union_all(PG_FUNCTION_ARGS);
+extern Datum bitmap_minhash(PG_FUNCTION_ARGS);
+extern Datum bitmap_minhash_bands(PG_FUNCTION_ARGS);
+extern Datum bitmap_minhash_similarity(PG_FUNCTION_ARGS);
+extern Datum bitmap_jaccard_distance(PG_FUNCTION_ARGS);
+extern Datum bitmap_hamming_distance(PG_FUNCTION_ARGS);
+extern Datum bitmap_setbits(PG_FUNCTION_ARGS);
+extern Datum bitmap_clearbits(PG_FUNCTION_ARGS);
+extern Datum bitmap_shift_left(PG_FUNCTION_ARGS);
+extern Datum bitmap_shift_right(PG_FUNCTION_ARGS);
+extern Datum bsi_in(PG_FUNCTION_ARGS);
+extern Datum bsi_out(PG_FUNCTION_ARGS);
+extern Datum bsi_of_trans(PG_FUNCTION_ARGS);
+extern Datum bsi_of_final(PG_FUNCTION_ARGS);
+extern Datum bsi_range(PG_FUNCTION_ARGS);
+extern Datum bsi_sum(PG_FUNCTION_ARGS);
+extern Datum bsi_rows(PG_FUNCTION_ARGS);
+extern Datum bitmap_overlap_trans(PG_FUNCTION_ARGS);
+extern Datum bitmap_overlap_final(PG_FUNCTION_ARGS);
+extern Datum bit_frequencies_trans(PG_FUNCTION_ARGS);
+extern Datum threshold_of_trans(PG_FUNCTION_ARGS);
+extern Datum bit_counters_combine(PG_FUNCTION_ARGS);
+extern Datum bit_counters_serialize(PG_FUNCTION_ARGS);
+extern Datum bit_counters_deserialize(PG_FUNCTION_ARGS);
+extern Datum bit_frequencies_final(PG_FUNCTION_ARGS);
+extern Datum threshold_of_final(PG_FUNCTION_ARGS);
+extern Datum bitmap_eval(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_consistent(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_distance(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_compress(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_union(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_penalty(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_picksplit(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_same(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_key_in(PG_FUNCTION_ARGS);
+extern Datum bitmap_gist_key_out(PG_FUNCTION_ARGS);
+extern Datum bitmap_brin_opcinfo(PG_FUNCTION_ARGS);
+extern Datum bitmap_brin_add_value(PG_FUNCTION_ARGS);
+extern Datum bitmap_brin_consistent(PG_FUNCTION_ARGS);
+extern Datum bitmap_brin_union(PG_FUNCTION_ARGS);
+extern Datum bitbloom_in(PG_FUNCTION_ARGS);
+extern Datum bitbloom_out(PG_FUNCTION_ARGS);
+extern Datum bitbloom_new(PG_FUNCTION_ARGS);
+extern Datum bitbloom_add(PG_FUNCTION_ARGS);
+extern Datum bitbloom_test(PG_FUNCTION_ARGS);
+extern Datum bitbloom_union(PG_FUNCTION_ARGS);
+extern Datum bitbloom_from_bitmap(PG_FUNCTION_ARGS);
+extern Datum pgbitmap_stats(PG_FUNCTION_ARGS);
+extern Datum pgbitmap_stats_reset(PG_FUNCTION_ARGS);
 
 
 #endif
@@ -0,0 +1,560 @@
+/**
+ * @file   pgbitmap_bloom.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * Define the bitbloom type: a fixed-size Bloom filter over integers.
+ *
+ * A ::BitBloom records an approximate set of integers, for which
+ * membership tests may give false positives but never false negatives.
+ * Its size does not depend on the number or range of the integers
+ * added, so a filter can be sized to stay in cache while it is probed,
+ * for instance to discard rows before an expensive join.
+ *
+ * The bits of the filter are stored in ::bm_int words, and are
+ * addressed in the same way as the bits of a ::Bitmap.  Each integer
+ * sets nhashes bits, chosen by double hashing from a single 64-bit
+ * hash of the integer.
+ */
+
+#include "pgbitmap.h"
+#include "common/hashfn.h"
+
+
+/**
+ * The number of bits in the filter created by bloom_of(integer).
+ * This is 8kB, allowing about 7000 integers to be recorded with a
+ * false positive rate of 1%.
+ */
+#define BLOOM_DEFAULT_BITS 65536
+
+/**
+ * The number of hash functions used by bloom_of(integer).
+ */
+#define BLOOM_DEFAULT_HASHES 5
+
+/**
+ * The number of bits per element in a filter created from a bitmap
+ * without an explicit size.  With BLOOM_AUTO_HASHES hash functions this
+ * gives a false positive rate of about 1%.
+ */
+#define BLOOM_AUTO_BITS_PER_ELEMENT 10
+
+/**
+ * The number of hash functions in a filter created from a bitmap
+ * without an explicit size.
+ */
+#define BLOOM_AUTO_HASHES 7
+
+/**
+ * The largest number of bits allowed in a filter (128MB).
+ */
+#define BLOOM_MAX_BITS (1 << 30)
+
+/**
+ * The largest number of hash functions allowed.
+ */
+#define BLOOM_MAX_HASHES 32
+
+/**
+ * The granularity of filter sizes.  Sizes are rounded up to a multiple
+ * of 64 bits so that a filter is the same size, and has the same text
+ * form, whatever the size of a ::bm_int.
+ */
+#define BLOOM_BIT_GRANULE 64
+
+/**
+ * The seed for the hash of each integer.
+ */
+#define BLOOM_SEED UINT64CONST(0x2545f4914f6cdd1d)
+
+
+/**
+ * A Bloom filter.
+ */
+typedef struct BitBloom {
+	char    vl_len[4];	/**< Standard postgres length header */
+	int32   nbits;		/**< The number of bits in the filter */
+	int32   nhashes;	/**< The number of bits set for each integer */
+	bm_int  words[FLEXIBLE_ARRAY_MEMBER];	/**< The bits of the filter */
+} BitBloom;
+
+/**
+ * Gives the number of words needed for a filter of nbits bits.
+ */
+#define BLOOM_WORDS(nbits) ((nbits) / ELEMBITS)
+
+/**
+ * Gives the size of a ::BitBloom datum of nbits bits.
+ */
+#define BLOOM_SIZE(nbits)										\
+	(offsetof(BitBloom, words) + (sizeof(bm_int) * BLOOM_WORDS(nbits)))
+
+/**
+ * Provide a macro for dealing with bitbloom arguments.
+ */
+#define PG_GETARG_BITBLOOM(x) ((BitBloom *) PG_DETOAST_DATUM(PG_GETARG_DATUM(x)))
+
+/**
+ * Provide a macro for returning bitbloom results.
+ */
+#define PG_RETURN_BITBLOOM(x) PG_RETURN_POINTER(x)
+
+
+/**
+ * Check the size and number of hash functions for a new filter,
+ * returning the size rounded up to a multiple of BLOOM_BIT_GRANULE.
+ *
+ * @param nbits The requested number of bits
+ * @param nhashes The requested number of hash functions
+ *
+ * @return The number of bits for the filter.
+ */
+static int32
+bloomCheckShape(int32 nbits,
+				int32 nhashes)
+{
+	if ((nbits < 1) || (nbits > BLOOM_MAX_BITS)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("bitbloom size must be between 1 and %d bits",
+						BLOOM_MAX_BITS)));
+	}
+	if ((nhashes < 1) || (nhashes > BLOOM_MAX_HASHES)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("bitbloom hash count must be between 1 and %d",
+						BLOOM_MAX_HASHES)));
+	}
+	return ((nbits + BLOOM_BIT_GRANULE - 1) / BLOOM_BIT_GRANULE) *
+		BLOOM_BIT_GRANULE;
+}
+
+
+/**
+ * Create a new, empty, ::BitBloom.
+ *
+ * @param nbits The number of bits, which must already have been
+ * checked by bloomCheckShape()
+ * @param nhashes The number of hash functions
+ *
+ * @return The new filter.
+ */
+static BitBloom *
+newBloom(int32 nbits,
+		 int32 nhashes)
+{
+	BitBloom *bloom = palloc0(BLOOM_SIZE(nbits));
+
+	SET_VARSIZE(bloom, BLOOM_SIZE(nbits));
+	bloom->nbits = nbits;
+	bloom->nhashes = nhashes;
+	return bloom;
+}
+
+
+/**
+ * Return a copy of a ::BitBloom.
+ *
+ * @param bloom The filter to be copied
+ *
+ * @return The new filter.
+ */
+static BitBloom *
+copyBloom(BitBloom *bloom)
+{
+	BitBloom *result = palloc(VARSIZE(bloom));
+
+	memcpy(result, bloom, VARSIZE(bloom));
+	return result;
+}
+
+
+/**
+ * Set, or test, the bits of a ::BitBloom for an integer.  The bit
+ * positions are h1 + i * h2 for i from 0 to nhashes - 1, where h1 and
+ * h2 are the two halves of a 64-bit hash of the integer, each position
+ * being mapped onto the bits of the filter by multiplying, rather than
+ * by taking a remainder.
+ *
+ * @param bloom The filter
+ * @param value The integer
+ * @param set Whether the bits are to be set, rather than tested
+ *
+ * @return True if, before any were set, all of the bits were set.
+ */
+static bool
+bloomBits(BitBloom *bloom,
+		  int32 value,
+		  bool set)
+{
+	uint64 hash = hash_bytes_uint32_extended((uint32) value, BLOOM_SEED);
+	uint32 h1 = (uint32) hash;
+	uint32 h2 = ((uint32) (hash >> 32)) | 1;
+	uint32 pos;
+	bm_int mask;
+	bool   found = true;
+	int32  i;
+
+	for (i = 0; i < bloom->nhashes; i++) {
+		pos = (uint32) ((((uint64) h1) * (uint32) bloom->nbits) >> 32);
+		mask = ((bm_int) 1) << BITSET_BIT(pos);
+		if (!(bloom->words[BITSET_ELEM(pos)] & mask)) {
+			if (!set) {
+				return false;
+			}
+			found = false;
+			bloom->words[BITSET_ELEM(pos)] |= mask;
+		}
+		h1 += h2;
+	}
+	return found;
+}
+
+
+/**
+ * Report that two filters cannot be combined.
+ *
+ * @param bloom1 The first filter
+ * @param bloom2 The second filter
+ */
+static void
+bloomCheckMatch(BitBloom *bloom1,
+				BitBloom *bloom2)
+{
+	if ((bloom1->nbits != bloom2->nbits) ||
+		(bloom1->nhashes != bloom2->nhashes)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("bitbloom filters of different shapes cannot be "
+						"combined"),
+				 errdetail("The filters have %d bits and %d hashes, and "
+						   "%d bits and %d hashes.",
+						   bloom1->nbits, bloom1->nhashes,
+						   bloom2->nbits, bloom2->nhashes)));
+	}
+}
+
+
+/**
+ * Return the hex digit for a 4-bit value.
+ */
+#define HEXDIGIT(x) ("0123456789abcdef"[(x) & 0xf])
+
+/**
+ * Return the value of a hex digit, or -1 if it is not one.
+ *
+ * @param c The character
+ *
+ * @return The value.
+ */
+static int
+hexValue(char c)
+{
+	if ((c >= '0') && (c <= '9')) {
+		return c - '0';
+	}
+	if ((c >= 'a') && (c <= 'f')) {
+		return c - 'a' + 10;
+	}
+	if ((c >= 'A') && (c <= 'F')) {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+
+/**
+ * Report an invalid textual bitbloom.
+ *
+ * @param str The text
+ */
+static void
+invalidBloom(char *str)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+			 errmsg("invalid input syntax for type bitbloom: \"%s\"", str),
+			 errhint("The format is nbits:nhashes:hexdigits.")));
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_in);
+/**
+ * <code>bitbloom_in(textin cstring) returns bitbloom</code>
+ * Create a bitbloom from its text form, nbits:nhashes: followed by
+ * nbits / 4 hex digits.  Each pair of digits is a byte of the filter,
+ * with bit n of the filter being bit n % 8 of byte n / 8.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>textin cstring</code> The text form.
+ * @return <code>bitbloom</code> The new filter.
+ */
+Datum
+bitbloom_in(PG_FUNCTION_ARGS)
+{
+	char     *str = PG_GETARG_CSTRING(0);
+	BitBloom *bloom;
+	int32     nbits;
+	int32     nhashes;
+	int       len;
+	int32     byte;
+	int       hi;
+	int       lo;
+
+	BITMAP_COUNT_CALL();
+
+	/* %n is only assigned if the final colon is matched. */
+	len = -1;
+	if ((sscanf(str, "%d:%d:%n", &nbits, &nhashes, &len) != 2) ||
+		(len < 0) ||
+		(bloomCheckShape(nbits, nhashes) != nbits) ||
+		(strlen(str + len) != (nbits / 4))) {
+		invalidBloom(str);
+	}
+	bloom = newBloom(nbits, nhashes);
+	for (byte = 0; byte < nbits / 8; byte++) {
+		hi = hexValue(str[len + (byte * 2)]);
+		lo = hexValue(str[len + (byte * 2) + 1]);
+		if ((hi < 0) || (lo < 0)) {
+			invalidBloom(str);
+		}
+		bloom->words[byte / sizeof(bm_int)] |=
+			((bm_int) ((hi << 4) | lo)) << (8 * (byte % sizeof(bm_int)));
+	}
+
+	PG_RETURN_BITBLOOM(bloom);
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_out);
+/**
+ * <code>bitbloom_out(bloom bitbloom) returns cstring</code>
+ * Return the text form of a bitbloom, as described for bitbloom_in().
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bloom bitbloom</code> The filter.
+ * @return <code>cstring</code> The text form.
+ */
+Datum
+bitbloom_out(PG_FUNCTION_ARGS)
+{
+	BitBloom *bloom = PG_GETARG_BITBLOOM(0);
+	char     *result;
+	char     *hex;
+	int32     byte;
+	int       value;
+
+	BITMAP_COUNT_CALL();
+
+	result = psprintf("%d:%d:%*s", bloom->nbits, bloom->nhashes,
+					  bloom->nbits / 4, "");
+	hex = result + strlen(result) - (bloom->nbits / 4);
+	for (byte = 0; byte < bloom->nbits / 8; byte++) {
+		value = (int) ((bloom->words[byte / sizeof(bm_int)] >>
+						(8 * (byte % sizeof(bm_int)))) & 0xff);
+		hex[byte * 2] = HEXDIGIT(value >> 4);
+		hex[(byte * 2) + 1] = HEXDIGIT(value);
+	}
+
+	PG_RETURN_CSTRING(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_new);
+/**
+ * <code>bitbloom(nbits int4, nhashes int4) returns bitbloom</code>
+ * Return an empty bitbloom.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>nbits int4</code> The size of the filter in bits.  This is
+ * rounded up to a multiple of 64.
+ * <br><code>nhashes int4</code> The number of bits to be set for each
+ * integer.
+ * @return <code>bitbloom</code> The new filter.
+ */
+Datum
+bitbloom_new(PG_FUNCTION_ARGS)
+{
+	int32 nhashes = PG_GETARG_INT32(1);
+	int32 nbits = bloomCheckShape(PG_GETARG_INT32(0), nhashes);
+
+	BITMAP_COUNT_CALL();
+
+	PG_RETURN_BITBLOOM(newBloom(nbits, nhashes));
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_add);
+/**
+ * <code>bitbloom_add(bloom bitbloom, value int4 [, nbits int4,
+ * nhashes int4]) returns bitbloom</code>
+ * Return the bitbloom with an integer added.  This is the transition
+ * function for bloom_of(), for which the bloom parameter is null on the
+ * first call, and a new filter is created, of the given size or of the
+ * default size.  When called as an aggregate, the filter is updated in
+ * place.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bloom bitbloom</code> The filter, or null
+ * <br><code>value int4</code> The integer to be added.  Nulls are
+ * ignored.
+ * <br><code>nbits int4</code> The size for a new filter.
+ * <br><code>nhashes int4</code> The number of hashes for a new filter.
+ * @return <code>bitbloom</code> The updated filter.
+ */
+Datum
+bitbloom_add(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	BitBloom *bloom;
+	int32     nbits = BLOOM_DEFAULT_BITS;
+	int32     nhashes = BLOOM_DEFAULT_HASHES;
+	bool      in_agg = AggCheckCallContext(fcinfo, &aggcontext);
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_ARGISNULL(0)) {
+		if (PG_NARGS() == 4) {
+			if (PG_ARGISNULL(2) || PG_ARGISNULL(3)) {
+				ereport(ERROR,
+						(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						 errmsg("bitbloom size and hash count may not "
+								"be null")));
+			}
+			nbits = PG_GETARG_INT32(2);
+			nhashes = PG_GETARG_INT32(3);
+		}
+		nbits = bloomCheckShape(nbits, nhashes);
+		if (in_agg) {
+			oldcontext = MemoryContextSwitchTo(aggcontext);
+			bloom = newBloom(nbits, nhashes);
+			MemoryContextSwitchTo(oldcontext);
+		}
+		else {
+			bloom = newBloom(nbits, nhashes);
+		}
+	}
+	else {
+		bloom = PG_GETARG_BITBLOOM(0);
+		if (!in_agg) {
+			bloom = copyBloom(bloom);
+		}
+	}
+	if (!PG_ARGISNULL(1)) {
+		bloomBits(bloom, PG_GETARG_INT32(1), true);
+	}
+
+	PG_RETURN_BITBLOOM(bloom);
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_test);
+/**
+ * <code>bitbloom_test(bloom bitbloom, value int4) returns bool</code>
+ * Test whether an integer may have been added to a bitbloom.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bloom bitbloom</code> The filter
+ * <br><code>value int4</code> The integer to be tested
+ * @return <code>bool</code> False if the integer has certainly not been
+ * added, true if it probably has.
+ */
+Datum
+bitbloom_test(PG_FUNCTION_ARGS)
+{
+	BitBloom *bloom = PG_GETARG_BITBLOOM(0);
+	int32     value = PG_GETARG_INT32(1);
+
+	BITMAP_COUNT_CALL();
+
+	PG_RETURN_BOOL(bloomBits(bloom, value, false));
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_union);
+/**
+ * <code>bitbloom_union(bloom1 bitbloom, bloom2 bitbloom) returns
+ * bitbloom</code>
+ * Return a bitbloom recording every integer recorded by either of two
+ * filters, which must have the same size and number of hashes.  This
+ * is also the combine function for parallel bloom_of() aggregates.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bloom1 bitbloom</code> The first filter
+ * <br><code>bloom2 bitbloom</code> The second filter
+ * @return <code>bitbloom</code> The union of the filters.
+ */
+Datum
+bitbloom_union(PG_FUNCTION_ARGS)
+{
+	BitBloom *bloom1 = PG_GETARG_BITBLOOM(0);
+	BitBloom *bloom2 = PG_GETARG_BITBLOOM(1);
+	BitBloom *result;
+	int32     words;
+	int32     i;
+
+	BITMAP_COUNT_CALL();
+
+	bloomCheckMatch(bloom1, bloom2);
+	result = copyBloom(bloom1);
+	words = BLOOM_WORDS(result->nbits);
+	for (i = 0; i < words; i++) {
+		result->words[i] |= bloom2->words[i];
+	}
+
+	PG_RETURN_BITBLOOM(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitbloom_from_bitmap);
+/**
+ * <code>bitbloom(bitmap bitmap [, nbits int4, nhashes int4]) returns
+ * bitbloom</code>
+ * Return a bitbloom recording each element of a bitmap.  If no size is
+ * given, the filter has 10 bits for each element, and 7 hashes, giving
+ * a false positive rate of about 1%.  This is used for the cast from
+ * bitmap to bitbloom.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bitmap bitmap</code> The bitmap
+ * <br><code>nbits int4</code> The size of the filter in bits
+ * <br><code>nhashes int4</code> The number of hashes
+ * @return <code>bitbloom</code> The new filter.
+ */
+Datum
+bitbloom_from_bitmap(PG_FUNCTION_ARGS)
+{
+	Bitmap   *bitmap = PG_GETARG_BITMAP(0);
+	BitBloom *bloom;
+	BitmapIterator iter;
+	int64     nbits;
+	int32     nhashes;
+	int32     bit;
+
+	BITMAP_COUNT_CALL();
+
+	if (PG_NARGS() == 3) {
+		nbits = PG_GETARG_INT32(1);
+		nhashes = PG_GETARG_INT32(2);
+	}
+	else {
+		nbits = bitmapCardinality(bitmap) * BLOOM_AUTO_BITS_PER_ELEMENT;
+		nbits = MAX(nbits, BLOOM_BIT_GRANULE);
+		nbits = MIN(nbits, BLOOM_MAX_BITS);
+		nhashes = BLOOM_AUTO_HASHES;
+	}
+	bloom = newBloom(bloomCheckShape((int32) nbits, nhashes), nhashes);
+
+	bitmapIteratorInit(&iter, bitmap);
+	while (bitmapIteratorNext(&iter, &bit)) {
+		bloomBits(bloom, bit, true);
+	}
+
+	PG_RETURN_BITBLOOM(bloom);
+}
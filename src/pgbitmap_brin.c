@@ -0,0 +1,270 @@
+/**
+ * @file   pgbitmap_brin.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * BRIN index support for bitmaps.
+ *
+ * The summary for each block range is the union of the bitmaps in the
+ * range, so that ranges whose summaries do not contain a bit, or have
+ * no elements in common with a bitmap, can be skipped by ? and &&
+ * queries.  As a BRIN summary must fit in an index page, a union whose
+ * elements span more than ::BRIN_FOLD_BITS bits is folded, element x
+ * being recorded as x mod ::BRIN_FOLD_BITS, and the summary is marked
+ * as folded.  Folded summaries are lossy, but can still exclude ranges.
+ *
+ * This index is much cheaper to maintain than a GiST index, as only
+ * the summary of the range being appended to is updated, and not at
+ * all if the new bitmap is already covered by it.  It is suited to
+ * append-only tables, in which bitmaps with similar elements are
+ * stored together.
+ */
+
+#include "pgbitmap.h"
+#include "access/brin_internal.h"
+#include "access/brin_tuple.h"
+#include "access/skey.h"
+#include "access/stratnum.h"
+#include "catalog/pg_type.h"
+#include "utils/typcache.h"
+
+
+/**
+ * The size to which the summary of a block range is folded if its
+ * elements span more than this number of bits.  This must be a power
+ * of 2, and small enough for the summary to fit in an index page.
+ */
+#define BRIN_FOLD_BITS 16384
+
+/**
+ * The index within BrinValues.bv_values of the summary bitmap.
+ */
+#define BRIN_SUMMARY 0
+
+/**
+ * The index within BrinValues.bv_values of the flag recording whether
+ * the summary has been folded.
+ */
+#define BRIN_FOLDED 1
+
+/**
+ * Strategy number for bitmap ? int4.
+ */
+#define BITMAP_BRIN_TESTBIT 1
+
+/**
+ * Strategy number for bitmap && bitmap.
+ */
+#define BITMAP_BRIN_OVERLAPS 2
+
+/**
+ * Gives whether a bitmap must be folded to become a summary.
+ */
+#define BRIN_NEEDS_FOLD(b) \
+	(((int64) (b)->bitmax - (b)->bitmin) >= BRIN_FOLD_BITS)
+
+
+/**
+ * Set the summary of a block range, freeing any previous summary, and
+ * folding the new one if necessary.
+ *
+ * @param column The BrinValues for the range
+ * @param summary The new summary, which is not folded if folded is
+ * false
+ * @param folded Whether the new summary has already been folded
+ */
+static void
+setSummary(BrinValues *column,
+		   Bitmap *summary,
+		   bool folded)
+{
+	if (!folded && BRIN_NEEDS_FOLD(summary)) {
+		summary = bitmapFold(summary, BRIN_FOLD_BITS);
+		folded = true;
+	}
+	if (!column->bv_allnulls) {
+		pfree(DatumGetPointer(column->bv_values[BRIN_SUMMARY]));
+	}
+	column->bv_values[BRIN_SUMMARY] = PointerGetDatum(summary);
+	column->bv_values[BRIN_FOLDED] = BoolGetDatum(folded);
+	column->bv_allnulls = false;
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_brin_opcinfo);
+/**
+ * <code>bitmap_brin_opcinfo(typoid internal) returns internal</code>
+ * BRIN opcinfo function.  Each summary is stored as a bitmap and a
+ * flag recording whether the bitmap has been folded.  Nulls are
+ * handled by BRIN itself.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>typoid internal</code> The oid of the bitmap type.
+ * @return <code>internal</code> The BrinOpcInfo.
+ */
+Datum
+bitmap_brin_opcinfo(PG_FUNCTION_ARGS)
+{
+	Oid          typoid = PG_GETARG_OID(0);
+	BrinOpcInfo *result;
+
+	BITMAP_COUNT_CALL();
+
+	result = palloc0(MAXALIGN(SizeofBrinOpcInfo(2)));
+	result->oi_nstored = 2;
+	result->oi_regular_nulls = true;
+	result->oi_opaque = NULL;
+	result->oi_typcache[BRIN_SUMMARY] = lookup_type_cache(typoid, 0);
+	result->oi_typcache[BRIN_FOLDED] = lookup_type_cache(BOOLOID, 0);
+	PG_RETURN_POINTER(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_brin_add_value);
+/**
+ * <code>bitmap_brin_add_value(bdesc internal, column internal,
+ * newval internal, isnull internal) returns bool</code>
+ * BRIN addValue function.  Extend the summary of a block range to
+ * cover a new bitmap, if it does not already.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bdesc internal</code> The BrinDesc.  Unused.
+ * <br><code>column internal</code> The BrinValues for the range.
+ * <br><code>newval internal</code> The new bitmap.
+ * <br><code>isnull internal</code> Unused, as nulls are handled by
+ * BRIN.
+ * @return <code>bool</code> True if the summary was changed.
+ */
+Datum
+bitmap_brin_add_value(PG_FUNCTION_ARGS)
+{
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	Bitmap     *bitmap = bitmapDetoast(PG_GETARG_DATUM(2), true);
+	Bitmap     *summary;
+	bool        folded;
+
+	BITMAP_COUNT_CALL();
+
+	if (column->bv_allnulls) {
+		setSummary(column, bitmapCopy(bitmap), false);
+		PG_RETURN_BOOL(true);
+	}
+
+	summary = bitmapDetoast(column->bv_values[BRIN_SUMMARY], false);
+	folded = DatumGetBool(column->bv_values[BRIN_FOLDED]);
+	if (folded) {
+		bitmap = bitmapFold(bitmap, BRIN_FOLD_BITS);
+	}
+	if (bitmapContains(summary, bitmap)) {
+		PG_RETURN_BOOL(false);
+	}
+	setSummary(column, bitmapUnion(summary, bitmap), folded);
+	PG_RETURN_BOOL(true);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_brin_consistent);
+/**
+ * <code>bitmap_brin_consistent(bdesc internal, column internal,
+ * key internal) returns bool</code>
+ * BRIN consistent function.  Return whether a block range may contain
+ * bitmaps matching the scan key.  Neither check allocates memory, and
+ * the query is not folded: its elements are folded as they are
+ * compared with a folded summary.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bdesc internal</code> The BrinDesc.  Unused.
+ * <br><code>column internal</code> The BrinValues for the range.
+ * <br><code>key internal</code> The ScanKey.
+ * @return <code>bool</code> Whether the range may match.
+ */
+Datum
+bitmap_brin_consistent(PG_FUNCTION_ARGS)
+{
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	ScanKey     key = (ScanKey) PG_GETARG_POINTER(2);
+	Bitmap     *summary;
+	Bitmap     *query;
+	bool        folded;
+	int32       bit;
+
+	BITMAP_COUNT_CALL();
+
+	if (column->bv_allnulls) {
+		PG_RETURN_BOOL(false);
+	}
+	summary = bitmapDetoast(column->bv_values[BRIN_SUMMARY], false);
+	folded = DatumGetBool(column->bv_values[BRIN_FOLDED]);
+
+	switch (key->sk_strategy) {
+	case BITMAP_BRIN_TESTBIT:
+		bit = DatumGetInt32(key->sk_argument);
+		if (folded) {
+			bit = (int32) ((uint32) bit % BRIN_FOLD_BITS);
+		}
+		PG_RETURN_BOOL(bitmapTestbit(summary, bit));
+	case BITMAP_BRIN_OVERLAPS:
+		query = bitmapDetoast(key->sk_argument, true);
+		if (folded) {
+			PG_RETURN_BOOL(bitmapFoldedOverlaps(summary, query,
+												BRIN_FOLD_BITS));
+		}
+		PG_RETURN_BOOL(bitmapOverlaps(summary, query));
+	default:
+		elog(ERROR, "unrecognized strategy number: %d", key->sk_strategy);
+	}
+	PG_RETURN_BOOL(false);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_brin_union);
+/**
+ * <code>bitmap_brin_union(bdesc internal, column_a internal,
+ * column_b internal) returns bool</code>
+ * BRIN union function.  Extend the summary in column_a to cover that
+ * in column_b.  If either is folded, the result is folded.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>bdesc internal</code> The BrinDesc.  Unused.
+ * <br><code>column_a internal</code> The BrinValues to be extended.
+ * <br><code>column_b internal</code> The BrinValues to be added.
+ * @return <code>bool</code> True.
+ */
+Datum
+bitmap_brin_union(PG_FUNCTION_ARGS)
+{
+	BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+	BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+	Bitmap     *summary_a;
+	Bitmap     *summary_b;
+	bool        folded_a;
+	bool        folded_b;
+
+	BITMAP_COUNT_CALL();
+
+	if (col_b->bv_allnulls) {
+		PG_RETURN_BOOL(true);
+	}
+	summary_b = bitmapDetoast(col_b->bv_values[BRIN_SUMMARY], false);
+	folded_b = DatumGetBool(col_b->bv_values[BRIN_FOLDED]);
+	if (col_a->bv_allnulls) {
+		setSummary(col_a, bitmapCopy(summary_b), folded_b);
+		PG_RETURN_BOOL(true);
+	}
+
+	summary_a = bitmapDetoast(col_a->bv_values[BRIN_SUMMARY], false);
+	folded_a = DatumGetBool(col_a->bv_values[BRIN_FOLDED]);
+	if (folded_a && !folded_b) {
+		summary_b = bitmapFold(summary_b, BRIN_FOLD_BITS);
+	}
+	else if (folded_b && !folded_a) {
+		summary_a = bitmapFold(summary_a, BRIN_FOLD_BITS);
+	}
+	setSummary(col_a, bitmapUnion(summary_a, summary_b),
+			   folded_a || folded_b);
+	PG_RETURN_BOOL(true);
+}
@@ -0,0 +1,739 @@
+/**
+ * @file   pgbitmap_gist.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * GiST index support for bitmaps.
+ *
+ * Each index entry is a ::BitmapGistKey, recording a fixed-size
+ * signature along with the range of elements and the range of
+ * cardinalities of the bitmaps that it covers.  The signature has one
+ * bit for each of ::SIGNATURE_BITS classes of integer, integer x
+ * belonging to class x mod ::SIGNATURE_BITS.  For bitmaps whose
+ * elements all lie between 0 and ::SIGNATURE_BITS - 1 the signature is
+ * exact.  The signature of an internal entry is the union of the
+ * signatures of its children.
+ *
+ * The index supports the ?, =, &&, @> and <@ operators, and ordering
+ * by the <-> (Jaccard distance) and <#> (Hamming distance) operators,
+ * so that nearest-neighbour queries such as:
+ *
+ *     select ... order by privs <-> $1 limit 10;
+ *
+ * can be answered without computing the distance for every row.  For
+ * each entry, the distance function returns a lower bound on the
+ * distance from the query of any bitmap that the entry covers.  As
+ * signatures are lossy, all matches and distances are rechecked.
+ */
+
+#include "pgbitmap.h"
+#include "access/gist.h"
+#include "access/stratnum.h"
+
+
+/**
+ * The size, in bytes, of the signature in a ::BitmapGistKey.
+ */
+#define SIGNATURE_BYTES 256
+
+/**
+ * The number of words in a signature.
+ */
+#define SIGNATURE_WORDS (SIGNATURE_BYTES / sizeof(bm_int))
+
+/**
+ * The number of bits, and so of classes of integer, in a signature.
+ */
+#define SIGNATURE_BITS (SIGNATURE_BYTES * 8)
+
+/**
+ * Gives the signature bit, or class, for integer x.  Since 2^32 is a
+ * multiple of SIGNATURE_BITS, this is x mod SIGNATURE_BITS for negative
+ * as well as positive x.
+ */
+#define SIGNATURE_CLASS(x) ((uint32) (x) % SIGNATURE_BITS)
+
+/**
+ * Gives the signature word containing the bit for integer x.
+ */
+#define SIGNATURE_WORD(x) (SIGNATURE_CLASS(x) / ELEMBITS)
+
+/**
+ * Gives the mask for the bit for integer x within its signature word.
+ */
+#define SIGNATURE_MASK(x) (((bm_int) 1) << (SIGNATURE_CLASS(x) % ELEMBITS))
+
+/**
+ * Strategy number for bitmap ? int4.
+ */
+#define BITMAP_GIST_TESTBIT 1
+
+/**
+ * Strategy number for bitmap = bitmap.
+ */
+#define BITMAP_GIST_EQUAL 2
+
+/**
+ * Strategy number for bitmap && bitmap.
+ */
+#define BITMAP_GIST_OVERLAPS 3
+
+/**
+ * Strategy number for bitmap @> bitmap.
+ */
+#define BITMAP_GIST_CONTAINS 4
+
+/**
+ * Strategy number for bitmap <@ bitmap.
+ */
+#define BITMAP_GIST_CONTAINED 5
+
+/**
+ * Strategy number for ordering by bitmap <-> bitmap.
+ */
+#define BITMAP_GIST_JACCARD 6
+
+/**
+ * Strategy number for ordering by bitmap <#> bitmap.
+ */
+#define BITMAP_GIST_HAMMING 7
+
+
+/**
+ * A GiST index entry, for either a single bitmap (a leaf entry) or for
+ * a set of bitmaps (an internal entry).
+ */
+typedef struct BitmapGistKey {
+	char   vl_len[4];	/**< Standard postgres length header */
+	int32  lo;			/**< Lowest element, or PG_INT32_MAX if none */
+	int32  hi;			/**< Highest element, or PG_INT32_MIN if none */
+	int64  mincard;		/**< Cardinality of the smallest bitmap */
+	int64  maxcard;		/**< Cardinality of the largest bitmap */
+	bm_int signature[SIGNATURE_WORDS];	/**< Classes of elements present */
+} BitmapGistKey;
+
+/**
+ * Provide a macro for getting a ::BitmapGistKey from a datum.
+ */
+#define DatumGetBitmapGistKey(x) ((BitmapGistKey *) PG_DETOAST_DATUM(x))
+
+/**
+ * A query bitmap, as seen by the consistent and distance functions,
+ * along with its signature and the number of its elements in each
+ * class.  This is cached in fn_extra, as the same query is presented
+ * for each index entry examined.
+ */
+typedef struct BitmapGistQuery {
+	Bitmap *bitmap;		/**< Copy of the query bitmap */
+	BitmapGistKey key;	/**< Key for the query bitmap */
+	int32  counts[SIGNATURE_BITS];	/**< Elements of the query per class */
+} BitmapGistQuery;
+
+
+/**
+ * Initialise a ::BitmapGistKey to cover no bitmaps.
+ *
+ * @param key The key to be initialised
+ */
+static void
+initKey(BitmapGistKey *key)
+{
+	memset(key, 0, sizeof(BitmapGistKey));
+	SET_VARSIZE(key, sizeof(BitmapGistKey));
+	key->lo = PG_INT32_MAX;
+	key->hi = PG_INT32_MIN;
+	key->mincard = PG_INT64_MAX;
+	key->maxcard = 0;
+}
+
+
+/**
+ * Set a ::BitmapGistKey to describe a single bitmap.  As each word of
+ * the bitmap covers a range of integers that starts at a multiple of
+ * ELEMBITS, and SIGNATURE_BITS is a multiple of ELEMBITS, each word
+ * maps directly onto a single word of the signature.
+ *
+ * @param key The key to be set
+ * @param bitmap The ::Bitmap to be described
+ */
+static void
+setKey(BitmapGistKey *key,
+	   Bitmap *bitmap)
+{
+	int32  bitzero = BITZERO(bitmap->bitmin);
+	int32  elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int32  elem;
+
+	initKey(key);
+	key->mincard = key->maxcard = bitmapCardinality(bitmap);
+	if (key->maxcard == 0) {
+		return;
+	}
+	key->lo = bitmap->bitmin;
+	key->hi = bitmap->bitmax;
+	for (elem = 0; elem < elems; elem++) {
+		key->signature[SIGNATURE_WORD(bitzero + (elem * ELEMBITS))] |=
+			bitmap->bitset[elem];
+	}
+}
+
+
+/**
+ * Extend a ::BitmapGistKey so that it also covers everything covered by
+ * another.
+ *
+ * @param key The key to be extended
+ * @param other The key to be added
+ */
+static void
+unionKey(BitmapGistKey *key,
+		 BitmapGistKey *other)
+{
+	int i;
+
+	key->lo = MIN(key->lo, other->lo);
+	key->hi = MAX(key->hi, other->hi);
+	key->mincard = MIN(key->mincard, other->mincard);
+	key->maxcard = MAX(key->maxcard, other->maxcard);
+	for (i = 0; i < SIGNATURE_WORDS; i++) {
+		key->signature[i] |= other->signature[i];
+	}
+}
+
+
+/**
+ * Count the signature bits set in one key but not in another.
+ *
+ * @param key The key whose bits are counted
+ * @param other The key whose bits are excluded
+ *
+ * @return The number of bits.
+ */
+static int32
+signatureMinus(BitmapGistKey *key,
+			   BitmapGistKey *other)
+{
+	int32 result = 0;
+	int   i;
+
+	for (i = 0; i < SIGNATURE_WORDS; i++) {
+		result += BM_POPCOUNT(key->signature[i] & ~other->signature[i]);
+	}
+	return result;
+}
+
+
+/**
+ * Get the query for a consistent or distance function call, from
+ * fn_extra if the same query was used in the previous call.
+ *
+ * @param fcinfo The function call info of the caller
+ *
+ * @return The query.
+ */
+static BitmapGistQuery *
+getQuery(FunctionCallInfo fcinfo)
+{
+	BitmapGistQuery *query = (BitmapGistQuery *) fcinfo->flinfo->fn_extra;
+	Bitmap *bitmap = PG_GETARG_BITMAP(1);
+	int32   bitzero;
+	int32   elems;
+	int32   elem;
+	bm_int  word;
+
+	if (query && (VARSIZE(query->bitmap) == VARSIZE(bitmap)) &&
+		(memcmp(query->bitmap, bitmap, VARSIZE(bitmap)) == 0)) {
+		return query;
+	}
+
+	if (!query) {
+		query = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+								   sizeof(BitmapGistQuery));
+		query->bitmap = NULL;
+		fcinfo->flinfo->fn_extra = query;
+	}
+	if (query->bitmap) {
+		pfree(query->bitmap);
+	}
+	query->bitmap = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+									   VARSIZE(bitmap));
+	memcpy(query->bitmap, bitmap, VARSIZE(bitmap));
+
+	setKey(&query->key, bitmap);
+	memset(query->counts, 0, sizeof(query->counts));
+	if (query->key.maxcard > 0) {
+		bitzero = BITZERO(bitmap->bitmin);
+		elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+		for (elem = 0; elem < elems; elem++) {
+			word = bitmap->bitset[elem];
+			while (word) {
+				query->counts[SIGNATURE_CLASS(bitzero + (elem * ELEMBITS) +
+											  BM_CTZ(word))]++;
+				word &= word - 1;
+			}
+		}
+	}
+	return query;
+}
+
+
+/**
+ * Return an upper bound on the number of elements that the query has
+ * in common with any bitmap covered by a key.  Only those query
+ * elements within the key's range, and in classes present in the
+ * key's signature, can be shared.
+ *
+ * @param query The query
+ * @param key The index entry's key
+ *
+ * @return The upper bound.
+ */
+static int64
+commonBound(BitmapGistQuery *query,
+			BitmapGistKey *key)
+{
+	Bitmap *bitmap = query->bitmap;
+	int32   lo = MAX(key->lo, query->key.lo);
+	int32   hi = MIN(key->hi, query->key.hi);
+	int64   result = 0;
+	int32   bitzero;
+	int32   first;
+	int32   last;
+	int32   elem;
+	int32   bit;
+	bm_int  word;
+	int     i;
+
+	if (lo > hi) {
+		return 0;
+	}
+	if ((lo == query->key.lo) && (hi == query->key.hi)) {
+		// Every query element is in range, so the per-class counts
+		// can be used.
+		for (i = 0; i < SIGNATURE_WORDS; i++) {
+			word = key->signature[i] & query->key.signature[i];
+			while (word) {
+				result += query->counts[(i * ELEMBITS) + BM_CTZ(word)];
+				word &= word - 1;
+			}
+		}
+	}
+	else {
+		bitzero = BITZERO(bitmap->bitmin);
+		first = BITSET_ELEM((int32) (BITZERO(lo) - bitzero));
+		last = BITSET_ELEM((int32) (BITZERO(hi) - bitzero));
+		for (elem = first; elem <= last; elem++) {
+			word = bitmap->bitset[elem];
+			while (word) {
+				bit = bitzero + (elem * ELEMBITS) + BM_CTZ(word);
+				if ((bit >= lo) && (bit <= hi) &&
+					(key->signature[SIGNATURE_WORD(bit)] &
+					 SIGNATURE_MASK(bit))) {
+					result++;
+				}
+				word &= word - 1;
+			}
+		}
+	}
+	return MIN(result, key->maxcard);
+}
+
+
+/**
+ * Predicate identifying whether the query could be a subset of a
+ * bitmap covered by a key.
+ *
+ * @param query The query
+ * @param key The index entry's key
+ *
+ * @return False if no bitmap covered by the key can contain the query.
+ */
+static bool
+mayContain(BitmapGistQuery *query,
+		   BitmapGistKey *key)
+{
+	if (query->key.maxcard == 0) {
+		return true;
+	}
+	return (key->maxcard >= query->key.maxcard) &&
+		(key->lo <= query->key.lo) && (key->hi >= query->key.hi) &&
+		(signatureMinus(&query->key, key) == 0);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_consistent);
+/**
+ * <code>bitmap_gist_consistent(entry internal, query bitmap, strategy
+ * int2, subtype oid, recheck internal) returns bool</code>
+ * GiST consistent function.  Return false if no bitmap covered by the
+ * entry can satisfy the query.  Results are always rechecked.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>entry internal</code> The GISTENTRY to be checked.
+ * <br><code>query bitmap</code> The query bitmap, or bit for the ?
+ * operator.
+ * <br><code>strategy int2</code> The operator's strategy number.
+ * <br><code>subtype oid</code> Unused.
+ * <br><code>recheck internal</code> Set to true.
+ * @return <code>bool</code> Whether the entry may match.
+ */
+Datum
+bitmap_gist_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool      *recheck = (bool *) PG_GETARG_POINTER(4);
+	BitmapGistKey *key = DatumGetBitmapGistKey(entry->key);
+	BitmapGistQuery *query;
+	int32      bit;
+	bool       result;
+
+	BITMAP_COUNT_CALL();
+
+	*recheck = true;
+	if (strategy == BITMAP_GIST_TESTBIT) {
+		bit = PG_GETARG_INT32(1);
+		PG_RETURN_BOOL((bit >= key->lo) && (bit <= key->hi) &&
+					   (key->signature[SIGNATURE_WORD(bit)] &
+						SIGNATURE_MASK(bit)));
+	}
+
+	query = getQuery(fcinfo);
+	switch (strategy) {
+	case BITMAP_GIST_EQUAL:
+		if (GIST_LEAF(entry)) {
+			result = (key->maxcard == query->key.maxcard) &&
+				(key->lo == query->key.lo) && (key->hi == query->key.hi) &&
+				(signatureMinus(key, &query->key) == 0) &&
+				(signatureMinus(&query->key, key) == 0);
+		}
+		else {
+			result = (key->mincard <= query->key.maxcard) &&
+				mayContain(query, key);
+		}
+		break;
+	case BITMAP_GIST_OVERLAPS:
+		result = commonBound(query, key) > 0;
+		break;
+	case BITMAP_GIST_CONTAINS:
+		result = mayContain(query, key);
+		break;
+	case BITMAP_GIST_CONTAINED:
+		if (GIST_LEAF(entry)) {
+			result = (key->maxcard == 0) ||
+				((key->maxcard <= query->key.maxcard) &&
+				 (key->lo >= query->key.lo) && (key->hi <= query->key.hi) &&
+				 (signatureMinus(key, &query->key) == 0));
+		}
+		else {
+			result = key->mincard <= query->key.maxcard;
+		}
+		break;
+	default:
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+		result = false;
+	}
+	PG_RETURN_BOOL(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_distance);
+/**
+ * <code>bitmap_gist_distance(entry internal, query bitmap, strategy
+ * int2, subtype oid, recheck internal) returns float8</code>
+ * GiST distance function.  Return a lower bound on the Jaccard or
+ * Hamming distance between the query and any bitmap covered by the
+ * entry.  This comes from the upper bound on the number of elements in
+ * common given by commonBound(), and the smallest cardinality covered
+ * by the entry.  Distances are always rechecked.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>entry internal</code> The GISTENTRY to be checked.
+ * <br><code>query bitmap</code> The query bitmap.
+ * <br><code>strategy int2</code> The operator's strategy number.
+ * <br><code>subtype oid</code> Unused.
+ * <br><code>recheck internal</code> Set to true.
+ * @return <code>float8</code> The lower bound on the distance.
+ */
+Datum
+bitmap_gist_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool      *recheck = (bool *) PG_GETARG_POINTER(4);
+	BitmapGistKey *key = DatumGetBitmapGistKey(entry->key);
+	BitmapGistQuery *query = getQuery(fcinfo);
+	int64      common = commonBound(query, key);
+	int64      card = MAX(key->mincard, common);
+	int64      qcard = query->key.maxcard;
+	float8     result;
+
+	BITMAP_COUNT_CALL();
+
+	*recheck = true;
+	if (key->maxcard < key->mincard) {
+		// The key covers no bitmaps.
+		card = common = 0;
+	}
+	switch (strategy) {
+	case BITMAP_GIST_JACCARD:
+		if (qcard + card - common == 0) {
+			result = 0.0;
+		}
+		else {
+			result = 1.0 - ((float8) common / (qcard + card - common));
+		}
+		break;
+	case BITMAP_GIST_HAMMING:
+		result = (float8) (qcard + card - (2 * common));
+		break;
+	default:
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+		result = 0.0;
+	}
+	PG_RETURN_FLOAT8(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_compress);
+/**
+ * <code>bitmap_gist_compress(entry internal) returns internal</code>
+ * GiST compress function.  Convert a leaf entry's bitmap into a
+ * ::BitmapGistKey.  Internal entries are already keys.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>entry internal</code> The GISTENTRY to be compressed.
+ * @return <code>internal</code> The compressed GISTENTRY.
+ */
+Datum
+bitmap_gist_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY *result;
+	BitmapGistKey *key;
+
+	BITMAP_COUNT_CALL();
+
+	if (!entry->leafkey) {
+		PG_RETURN_POINTER(entry);
+	}
+	key = palloc(sizeof(BitmapGistKey));
+	setKey(key, DatumGetBitmap(entry->key));
+	result = palloc(sizeof(GISTENTRY));
+	gistentryinit(*result, PointerGetDatum(key), entry->rel, entry->page,
+				  entry->offset, false);
+	PG_RETURN_POINTER(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_union);
+/**
+ * <code>bitmap_gist_union(entryvec internal, size internal) returns
+ * bitmap_gist_key</code>
+ * GiST union function.  Return a key covering everything covered by
+ * the entries.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>entryvec internal</code> The GistEntryVector of entries.
+ * <br><code>size internal</code> Set to the size of the result.
+ * @return <code>bitmap_gist_key</code> The union.
+ */
+Datum
+bitmap_gist_union(PG_FUNCTION_ARGS)
+{
+	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	int       *size = (int *) PG_GETARG_POINTER(1);
+	BitmapGistKey *result = palloc(sizeof(BitmapGistKey));
+	int32      i;
+
+	BITMAP_COUNT_CALL();
+
+	initKey(result);
+	for (i = 0; i < entryvec->n; i++) {
+		unionKey(result, DatumGetBitmapGistKey(entryvec->vector[i].key));
+	}
+	*size = sizeof(BitmapGistKey);
+	PG_RETURN_POINTER(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_penalty);
+/**
+ * <code>bitmap_gist_penalty(orig internal, new internal, penalty
+ * internal) returns internal</code>
+ * GiST penalty function.  The penalty for adding an entry to a subtree
+ * is the number of bits that it would add to the subtree's signature.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>orig internal</code> The GISTENTRY of the subtree.
+ * <br><code>new internal</code> The GISTENTRY to be added.
+ * <br><code>penalty internal</code> Set to the penalty.
+ * @return <code>internal</code> The penalty.
+ */
+Datum
+bitmap_gist_penalty(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *orig = (GISTENTRY *) PG_GETARG_POINTER(0);
+	GISTENTRY *new = (GISTENTRY *) PG_GETARG_POINTER(1);
+	float     *penalty = (float *) PG_GETARG_POINTER(2);
+
+	BITMAP_COUNT_CALL();
+
+	*penalty = (float) signatureMinus(DatumGetBitmapGistKey(new->key),
+									  DatumGetBitmapGistKey(orig->key));
+	PG_RETURN_POINTER(penalty);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_picksplit);
+/**
+ * <code>bitmap_gist_picksplit(entryvec internal, splitvec internal)
+ * returns internal</code>
+ * GiST picksplit function.  The two entries whose signatures differ
+ * the most are used as seeds, and each other entry is added to
+ * whichever side's signature it would extend the least.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>entryvec internal</code> The GistEntryVector to be split.
+ * <br><code>splitvec internal</code> The GIST_SPLITVEC to be filled.
+ * @return <code>internal</code> The GIST_SPLITVEC.
+ */
+Datum
+bitmap_gist_picksplit(PG_FUNCTION_ARGS)
+{
+	GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+	GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+	OffsetNumber maxoff = entryvec->n - 1;
+	OffsetNumber seed_left = FirstOffsetNumber;
+	OffsetNumber seed_right = OffsetNumberNext(FirstOffsetNumber);
+	OffsetNumber i;
+	OffsetNumber j;
+	BitmapGistKey *left = palloc(sizeof(BitmapGistKey));
+	BitmapGistKey *right = palloc(sizeof(BitmapGistKey));
+	BitmapGistKey *key;
+	int32      distance;
+	int32      worst = -1;
+	int32      cost_left;
+	int32      cost_right;
+
+	BITMAP_COUNT_CALL();
+
+	for (i = FirstOffsetNumber; i < maxoff; i = OffsetNumberNext(i)) {
+		key = DatumGetBitmapGistKey(entryvec->vector[i].key);
+		for (j = OffsetNumberNext(i); j <= maxoff; j = OffsetNumberNext(j)) {
+			distance = signatureMinus(
+				key, DatumGetBitmapGistKey(entryvec->vector[j].key)) +
+				signatureMinus(
+					DatumGetBitmapGistKey(entryvec->vector[j].key), key);
+			if (distance > worst) {
+				worst = distance;
+				seed_left = i;
+				seed_right = j;
+			}
+		}
+	}
+
+	v->spl_left = palloc(sizeof(OffsetNumber) * (maxoff + 1));
+	v->spl_right = palloc(sizeof(OffsetNumber) * (maxoff + 1));
+	v->spl_nleft = 0;
+	v->spl_nright = 0;
+	memcpy(left, DatumGetBitmapGistKey(entryvec->vector[seed_left].key),
+		   sizeof(BitmapGistKey));
+	memcpy(right, DatumGetBitmapGistKey(entryvec->vector[seed_right].key),
+		   sizeof(BitmapGistKey));
+
+	for (i = FirstOffsetNumber; i <= maxoff; i = OffsetNumberNext(i)) {
+		if (i == seed_left) {
+			v->spl_left[v->spl_nleft++] = i;
+			continue;
+		}
+		if (i == seed_right) {
+			v->spl_right[v->spl_nright++] = i;
+			continue;
+		}
+		key = DatumGetBitmapGistKey(entryvec->vector[i].key);
+		cost_left = signatureMinus(key, left);
+		cost_right = signatureMinus(key, right);
+		if ((cost_left < cost_right) ||
+			((cost_left == cost_right) && (v->spl_nleft <= v->spl_nright))) {
+			unionKey(left, key);
+			v->spl_left[v->spl_nleft++] = i;
+		}
+		else {
+			unionKey(right, key);
+			v->spl_right[v->spl_nright++] = i;
+		}
+	}
+
+	v->spl_ldatum = PointerGetDatum(left);
+	v->spl_rdatum = PointerGetDatum(right);
+	PG_RETURN_POINTER(v);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_same);
+/**
+ * <code>bitmap_gist_same(key1 bitmap_gist_key, key2 bitmap_gist_key,
+ * result internal) returns internal</code>
+ * GiST same function.  Identify whether two keys are identical.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>key1 bitmap_gist_key</code> The first key.
+ * <br><code>key2 bitmap_gist_key</code> The second key.
+ * <br><code>result internal</code> Set to true if the keys are equal.
+ * @return <code>internal</code> The result.
+ */
+Datum
+bitmap_gist_same(PG_FUNCTION_ARGS)
+{
+	BitmapGistKey *key1 = DatumGetBitmapGistKey(PG_GETARG_DATUM(0));
+	BitmapGistKey *key2 = DatumGetBitmapGistKey(PG_GETARG_DATUM(1));
+	bool      *result = (bool *) PG_GETARG_POINTER(2);
+
+	BITMAP_COUNT_CALL();
+
+	*result = memcmp(key1, key2, sizeof(BitmapGistKey)) == 0;
+	PG_RETURN_POINTER(result);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_key_in);
+/**
+ * <code>bitmap_gist_key_in(textin cstring) returns bitmap_gist_key</code>
+ * Input function for the GiST key type, which is not supported.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>textin cstring</code> Ignored.
+ * @return <code>bitmap_gist_key</code> Never returns.
+ */
+Datum
+bitmap_gist_key_in(PG_FUNCTION_ARGS)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("cannot accept a value of type bitmap_gist_key")));
+	PG_RETURN_VOID();
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_gist_key_out);
+/**
+ * <code>bitmap_gist_key_out(key bitmap_gist_key) returns cstring</code>
+ * Output function for the GiST key type, which is not supported.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>key bitmap_gist_key</code> Ignored.
+ * @return <code>cstring</code> Never returns.
+ */
+Datum
+bitmap_gist_key_out(PG_FUNCTION_ARGS)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("cannot display a value of type bitmap_gist_key")));
+	PG_RETURN_VOID();
+}
@@ -0,0 +1,1379 @@
+/**
+ * @file   pgbitmap_selfuncs.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * Planner statistics and selectivity estimation for bitmaps.
+ *
+ * ANALYZE of a bitmap column, via bitmap_typanalyze(), records:
+ * - the most common bits and their frequencies, in a standard
+ *   STATISTIC_KIND_MCELEM slot of int4 values;
+ * - a histogram of bitmap cardinalities, in a standard
+ *   STATISTIC_KIND_DECHIST slot;
+ * - histograms of the bitmin and bitmax values of non-empty bitmaps,
+ *   in the private ::STATISTIC_KIND_BITMAP_BITMIN and
+ *   ::STATISTIC_KIND_BITMAP_BITMAX slots.
+ *
+ * The restriction and join selectivity functions for the ?, =, @>, <@
+ * and && operators use these statistics.  Where the statistics are
+ * unavailable they fall back to default estimates.
+ */
+
+#include <math.h>
+
+#include "pgbitmap.h"
+#include "access/htup_details.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#include "common/hashfn.h"
+#include "nodes/primnodes.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+
+
+/**
+ * Statistics kind for the histogram of bitmin values of non-empty
+ * bitmaps.  stavalues contains int4 histogram bounds and stanumbers
+ * contains a single value: the fraction of non-null bitmaps that are
+ * not empty.  The kind value is chosen from the range reserved by
+ * pg_statistic.h for private use.
+ */
+#define STATISTIC_KIND_BITMAP_BITMIN 21201
+
+/**
+ * Statistics kind for the histogram of bitmax values of non-empty
+ * bitmaps.  stavalues contains int4 histogram bounds.
+ */
+#define STATISTIC_KIND_BITMAP_BITMAX 21202
+
+/**
+ * Default selectivity for bitmap ? integer.
+ */
+#define DEFAULT_BITMAP_TESTBIT_SEL 0.005
+
+/**
+ * Default selectivity for the bitmap containment operators.
+ */
+#define DEFAULT_BITMAP_CONTAIN_SEL 0.005
+
+/**
+ * Default selectivity for bitmap && bitmap.
+ */
+#define DEFAULT_BITMAP_OVERLAP_SEL 0.01
+
+/**
+ * Once a running product of probabilities falls below this we stop
+ * multiplying: the result is insignificant.
+ */
+#define BITMAP_MIN_PRODUCT 1.0e-10
+
+/**
+ * The statistics target for the column being analyzed.  From
+ * PostgreSQL 17 this is held in VacAttrStats itself, which no longer
+ * has the column's pg_attribute entry.
+ */
+#if PG_VERSION_NUM >= 170000
+#define STATS_TARGET(stats) ((stats)->attstattarget)
+#else
+#define STATS_TARGET(stats) ((stats)->attr->attstattarget)
+#endif
+
+
+/**
+ * Lossy Counting entry used by ANALYZE to track bit frequencies.  This
+ * is the same algorithm as is used by array_typanalyze().
+ */
+typedef struct BitCount {
+	int32 bit;        /**< The bit being counted.  This is the hash key */
+	int32 frequency;  /**< The number of sampled bitmaps with this bit */
+	int32 delta;      /**< The maximum error in frequency */
+} BitCount;
+
+
+/**
+ * The operators for which selectivity can be estimated.
+ */
+typedef enum BitmapSelOp {
+	BITMAP_SEL_TESTBIT,    /**< bitmap ? int4 */
+	BITMAP_SEL_EQ,         /**< bitmap = bitmap */
+	BITMAP_SEL_CONTAINS,   /**< bitmap @> bitmap */
+	BITMAP_SEL_CONTAINED,  /**< bitmap <@ bitmap */
+	BITMAP_SEL_OVERLAPS    /**< bitmap && bitmap */
+} BitmapSelOp;
+
+
+/**
+ * The statistics for a bitmap column, as read from pg_statistic.  The
+ * histograms are converted to arrays of doubles so that a single
+ * interpolation function can be used for all of them.
+ */
+typedef struct BitmapStats {
+	bool          have_stats;   /**< True if there is a pg_statistic row */
+	double        nullfrac;     /**< Fraction of rows that are null */
+	bool          have_mcelem;  /**< True if mcelem has been loaded */
+	AttStatsSlot  mcelem;       /**< Most common bits and frequencies */
+	double        minfreq;      /**< Lowest frequency in mcelem */
+	int           ncards;       /**< Number of entries in cards */
+	double       *cards;        /**< Cardinality histogram bounds */
+	double        avgcard;      /**< Average cardinality */
+	double        nonempty;     /**< Fraction of non-null bitmaps that
+								 * are not empty */
+	int           nbitmins;     /**< Number of entries in bitmins */
+	double       *bitmins;      /**< Histogram of bitmin values */
+	int           nbitmaxs;     /**< Number of entries in bitmaxs */
+	double       *bitmaxs;      /**< Histogram of bitmax values */
+} BitmapStats;
+
+
+/*
+ * ANALYZE support follows
+ **********************************************************************
+ */
+
+
+/**
+ * qsort comparator for sorting BitCount pointers by descending
+ * frequency.
+ */
+static int
+cmpBitCountFreq(const void *a, const void *b)
+{
+	const BitCount *item1 = *((const BitCount *const *) a);
+	const BitCount *item2 = *((const BitCount *const *) b);
+
+	return item2->frequency - item1->frequency;
+}
+
+
+/**
+ * qsort comparator for sorting BitCount pointers by bit.
+ */
+static int
+cmpBitCountBit(const void *a, const void *b)
+{
+	const BitCount *item1 = *((const BitCount *const *) a);
+	const BitCount *item2 = *((const BitCount *const *) b);
+
+	return (item1->bit > item2->bit) - (item1->bit < item2->bit);
+}
+
+
+/**
+ * qsort comparator for int32 values.
+ */
+static int
+cmpInt32(const void *a, const void *b)
+{
+	int32 x = *((const int32 *) a);
+	int32 y = *((const int32 *) b);
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * qsort comparator for int64 values.
+ */
+static int
+cmpInt64(const void *a, const void *b)
+{
+	int64 x = *((const int64 *) a);
+	int64 y = *((const int64 *) b);
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * qsort comparator for uint32 values.
+ */
+static int
+cmpUint32(const void *a, const void *b)
+{
+	uint32 x = *((const uint32 *) a);
+	uint32 y = *((const uint32 *) b);
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Return a hash of the contents of a bitmap.  All empty bitmaps hash
+ * to the same value regardless of their bitmin and bitmax.
+ *
+ * @param bitmap The ::Bitmap to be hashed.
+ *
+ * @return The hash value.
+ */
+static uint32
+bitmapHash(Bitmap *bitmap)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	uint32 result;
+
+	if (bitmap->bitset[0] == 0) {
+		return 0;
+	}
+	result = hash_bytes((unsigned char *) bitmap->bitset,
+						elems * sizeof(bm_int));
+	return hash_combine(result, hash_bytes_uint32((uint32) bitmap->bitmin));
+}
+
+
+/**
+ * Remove entries from the Lossy Counting hash table that can no longer
+ * be amongst the most common bits.
+ *
+ * @param bits_tab The hash table of BitCount entries
+ * @param b_current The current bucket number
+ */
+static void
+pruneBitCounts(HTAB *bits_tab, int b_current)
+{
+	HASH_SEQ_STATUS scan_status;
+	BitCount *item;
+
+	hash_seq_init(&scan_status, bits_tab);
+	while ((item = (BitCount *) hash_seq_search(&scan_status)) != NULL) {
+		if (item->frequency + item->delta <= b_current) {
+			if (hash_search(bits_tab, (const void *) &item->bit,
+							HASH_REMOVE, NULL) == NULL) {
+				elog(ERROR, "hash table corrupted");
+			}
+		}
+	}
+}
+
+
+/**
+ * Estimate the number of distinct bitmaps in the column from the
+ * hashes of the sampled bitmaps.  This uses the same Duj1 estimator as
+ * ANALYZE uses for scalar types.
+ *
+ * @param hashes Hashes of the non-null sampled bitmaps.  This will be
+ * sorted.
+ * @param nonnull_cnt The number of entries in hashes
+ * @param totalrows The estimated number of rows in the table
+ * @param nullfrac The fraction of null bitmaps
+ *
+ * @return A value suitable for pg_statistic.stadistinct.
+ */
+static double
+estimateDistinct(uint32 *hashes, int nonnull_cnt,
+				 double totalrows, double nullfrac)
+{
+	int ndistinct = 0;
+	int nmultiple = 0;
+	int i;
+	int j;
+	double stadistinct;
+
+	qsort(hashes, nonnull_cnt, sizeof(uint32), cmpUint32);
+	for (i = 0; i < nonnull_cnt; i = j) {
+		for (j = i + 1; (j < nonnull_cnt) && (hashes[j] == hashes[i]); j++) {
+		}
+		ndistinct++;
+		if ((j - i) > 1) {
+			nmultiple++;
+		}
+	}
+
+	if (nmultiple == 0) {
+		/* Every sampled value was unique, so assume a unique column. */
+		return -1.0 * (1.0 - nullfrac);
+	}
+	if (nmultiple == ndistinct) {
+		/* Every sampled value appeared more than once, so assume
+		 * that we have seen them all. */
+		stadistinct = ndistinct;
+	}
+	else {
+		int f1 = ndistinct - nmultiple;
+		double n = nonnull_cnt;
+		double N = totalrows * (1.0 - nullfrac);
+		double denom = (N > 0)? (n - f1) + ((double) f1 * n / N): n - f1;
+
+		stadistinct = (n * (double) ndistinct) / denom;
+		if (stadistinct < ndistinct) {
+			stadistinct = ndistinct;
+		}
+		if ((N > 0) && (stadistinct > N)) {
+			stadistinct = N;
+		}
+		stadistinct = floor(stadistinct + 0.5);
+	}
+
+	if ((totalrows > 0) && (stadistinct > 0.1 * totalrows)) {
+		stadistinct = -(stadistinct / totalrows);
+	}
+	return stadistinct;
+}
+
+
+/**
+ * Record an int4-valued statistics slot.  The values array must have
+ * been allocated in the analyze context.
+ */
+static void
+setInt4Slot(VacAttrStats *stats, int slot, int16 kind,
+			Datum *values, int nvalues, float4 *numbers, int nnumbers)
+{
+	stats->stakind[slot] = kind;
+	stats->staop[slot] = Int4EqualOperator;
+	stats->stacoll[slot] = InvalidOid;
+	stats->stavalues[slot] = values;
+	stats->numvalues[slot] = nvalues;
+	stats->stanumbers[slot] = numbers;
+	stats->numnumbers[slot] = nnumbers;
+	stats->statypid[slot] = INT4OID;
+	stats->statyplen[slot] = sizeof(int32);
+	stats->statypbyval[slot] = true;
+	stats->statypalign[slot] = 'i';
+}
+
+
+/**
+ * Create an equal-frequency histogram of the values in a sorted int32
+ * array, allocated in the current memory context.
+ *
+ * @param sorted The sorted array of sample values
+ * @param count The number of entries in sorted; this must be > 0
+ * @param num_hist The maximum number of histogram bounds
+ * @param p_nvalues Set to the number of histogram bounds created
+ *
+ * @return The palloc'd array of int4 histogram bound datums.
+ */
+static Datum *
+int32Histogram(int32 *sorted, int count, int num_hist, int *p_nvalues)
+{
+	int nvalues = MAX(MIN(num_hist, count), 2);
+	Datum *values = palloc(sizeof(Datum) * nvalues);
+	int i;
+
+	for (i = 0; i < nvalues; i++) {
+		values[i] = Int32GetDatum(
+			sorted[((int64) i * (count - 1)) / (nvalues - 1)]);
+	}
+	*p_nvalues = nvalues;
+	return values;
+}
+
+
+/**
+ * compute_stats function for bitmap columns.  See the file description
+ * for the statistics that are gathered.
+ */
+static void
+compute_bitmap_stats(VacAttrStats *stats,
+					 AnalyzeAttrFetchFunc fetchfunc,
+					 int samplerows,
+					 double totalrows)
+{
+	int num_mcelem = STATS_TARGET(stats) * 10;
+	int num_hist = MAX(STATS_TARGET(stats) + 1, 2);
+	/* Bucket width for Lossy Counting, as in array_typanalyze(). */
+	int bucket_width = num_mcelem * 1000 / 7;
+	int b_current = 1;
+	int64 element_no = 0;
+	int null_cnt = 0;
+	int nonnull_cnt = 0;
+	int nonempty_cnt = 0;
+	double total_width = 0;
+	HASHCTL hash_ctl;
+	HTAB *bits_tab;
+	uint32 *hashes;
+	int64 *cards;
+	int32 *bitmins;
+	int32 *bitmaxs;
+	int slot = 0;
+	int row;
+
+	hash_ctl.keysize = sizeof(int32);
+	hash_ctl.entrysize = sizeof(BitCount);
+	hash_ctl.hcxt = CurrentMemoryContext;
+	bits_tab = hash_create("Analyzed bitmap bits", num_mcelem, &hash_ctl,
+						   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	hashes = palloc(sizeof(uint32) * samplerows);
+	cards = palloc(sizeof(int64) * samplerows);
+	bitmins = palloc(sizeof(int32) * samplerows);
+	bitmaxs = palloc(sizeof(int32) * samplerows);
+
+	for (row = 0; row < samplerows; row++) {
+		Datum value;
+		bool isnull;
+		Bitmap *bitmap;
+		int32 elems;
+		int32 base;
+		int64 card = 0;
+		int32 i;
+
+		vacuum_delay_point();
+
+		value = fetchfunc(stats, row, &isnull);
+		if (isnull) {
+			null_cnt++;
+			continue;
+		}
+		total_width += VARSIZE_ANY(DatumGetPointer(value));
+		bitmap = DatumGetBitmap(value);
+		hashes[nonnull_cnt] = bitmapHash(bitmap);
+
+		if (bitmap->bitset[0] != 0) {
+			bitmins[nonempty_cnt] = bitmap->bitmin;
+			bitmaxs[nonempty_cnt] = bitmap->bitmax;
+			nonempty_cnt++;
+
+			elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+			base = BITZERO(bitmap->bitmin);
+			for (i = 0; i < elems; i++) {
+				bm_int word = bitmap->bitset[i];
+
+				while (word) {
+					int32 bit = base + (i * ELEMBITS) + BM_CTZ(word);
+					BitCount *item;
+					bool found;
+
+					word &= word - 1;
+					card++;
+					element_no++;
+					item = (BitCount *) hash_search(bits_tab, &bit,
+													HASH_ENTER, &found);
+					if (found) {
+						item->frequency++;
+					}
+					else {
+						item->frequency = 1;
+						item->delta = b_current - 1;
+					}
+					if ((element_no % bucket_width) == 0) {
+						pruneBitCounts(bits_tab, b_current);
+						b_current++;
+					}
+				}
+			}
+		}
+		cards[nonnull_cnt] = card;
+		nonnull_cnt++;
+
+		if ((Pointer) bitmap != DatumGetPointer(value)) {
+			pfree(bitmap);
+		}
+	}
+
+	stats->stats_valid = true;
+	stats->stanullfrac = (double) null_cnt / (double) samplerows;
+	if (nonnull_cnt == 0) {
+		/* We found only nulls; assume the column is entirely null. */
+		stats->stawidth = 0;
+		stats->stadistinct = 0.0;
+		return;
+	}
+	stats->stawidth = total_width / (double) nonnull_cnt;
+	stats->stadistinct = estimateDistinct(hashes, nonnull_cnt, totalrows,
+										  stats->stanullfrac);
+
+	/* Most common bits. */
+	{
+		int64 cutoff_freq = 9 * element_no / bucket_width;
+		BitCount **sort_table;
+		HASH_SEQ_STATUS scan_status;
+		BitCount *item;
+		int track_len = 0;
+		int minfreq = nonnull_cnt;
+		int maxfreq = 0;
+		int i;
+
+		sort_table = palloc(sizeof(BitCount *) *
+							(hash_get_num_entries(bits_tab) + 1));
+		hash_seq_init(&scan_status, bits_tab);
+		while ((item = (BitCount *) hash_seq_search(&scan_status)) != NULL) {
+			if (item->frequency > cutoff_freq) {
+				sort_table[track_len++] = item;
+			}
+		}
+		if (track_len > num_mcelem) {
+			qsort(sort_table, track_len, sizeof(BitCount *),
+				  cmpBitCountFreq);
+			track_len = num_mcelem;
+		}
+		if (track_len > 0) {
+			MemoryContext old_context;
+			Datum *mcelem_values;
+			float4 *mcelem_freqs;
+
+			for (i = 0; i < track_len; i++) {
+				minfreq = MIN(minfreq, sort_table[i]->frequency);
+				maxfreq = MAX(maxfreq, sort_table[i]->frequency);
+			}
+			/* The selectivity functions binary search the bits, so
+			 * they must be stored in bit order. */
+			qsort(sort_table, track_len, sizeof(BitCount *),
+				  cmpBitCountBit);
+
+			old_context = MemoryContextSwitchTo(stats->anl_context);
+			mcelem_values = palloc(sizeof(Datum) * track_len);
+			mcelem_freqs = palloc(sizeof(float4) * (track_len + 3));
+			for (i = 0; i < track_len; i++) {
+				mcelem_values[i] = Int32GetDatum(sort_table[i]->bit);
+				mcelem_freqs[i] = (double) sort_table[i]->frequency /
+					(double) nonnull_cnt;
+			}
+			/* As for arrays, the frequencies are followed by the
+			 * minimum and maximum frequencies and the frequency of
+			 * null elements (bitmaps have none). */
+			mcelem_freqs[i++] = (double) minfreq / (double) nonnull_cnt;
+			mcelem_freqs[i++] = (double) maxfreq / (double) nonnull_cnt;
+			mcelem_freqs[i++] = 0.0;
+			MemoryContextSwitchTo(old_context);
+
+			setInt4Slot(stats, slot, STATISTIC_KIND_MCELEM,
+						mcelem_values, track_len, mcelem_freqs, i);
+			slot++;
+		}
+	}
+
+	/* Histogram of cardinalities, followed by their average. */
+	{
+		MemoryContext old_context;
+		float4 *hist;
+		double total = 0;
+		int i;
+
+		qsort(cards, nonnull_cnt, sizeof(int64), cmpInt64);
+		for (i = 0; i < nonnull_cnt; i++) {
+			total += cards[i];
+		}
+		old_context = MemoryContextSwitchTo(stats->anl_context);
+		hist = palloc(sizeof(float4) * (num_hist + 1));
+		for (i = 0; i < num_hist; i++) {
+			hist[i] = cards[((int64) i * (nonnull_cnt - 1)) / (num_hist - 1)];
+		}
+		hist[num_hist] = total / (double) nonnull_cnt;
+		MemoryContextSwitchTo(old_context);
+
+		stats->stakind[slot] = STATISTIC_KIND_DECHIST;
+		stats->staop[slot] = Int4EqualOperator;
+		stats->stacoll[slot] = InvalidOid;
+		stats->stanumbers[slot] = hist;
+		stats->numnumbers[slot] = num_hist + 1;
+		slot++;
+	}
+
+	/* Histograms of bitmin and bitmax values. */
+	if (nonempty_cnt > 0) {
+		MemoryContext old_context;
+		Datum *values;
+		float4 *nonempty;
+		int nvalues;
+
+		qsort(bitmins, nonempty_cnt, sizeof(int32), cmpInt32);
+		qsort(bitmaxs, nonempty_cnt, sizeof(int32), cmpInt32);
+
+		old_context = MemoryContextSwitchTo(stats->anl_context);
+		nonempty = palloc(sizeof(float4));
+		*nonempty = (double) nonempty_cnt / (double) nonnull_cnt;
+		values = int32Histogram(bitmins, nonempty_cnt, num_hist, &nvalues);
+		setInt4Slot(stats, slot, STATISTIC_KIND_BITMAP_BITMIN,
+					values, nvalues, nonempty, 1);
+		slot++;
+
+		values = int32Histogram(bitmaxs, nonempty_cnt, num_hist, &nvalues);
+		setInt4Slot(stats, slot, STATISTIC_KIND_BITMAP_BITMAX,
+					values, nvalues, NULL, 0);
+		slot++;
+		MemoryContextSwitchTo(old_context);
+	}
+
+	hash_destroy(bits_tab);
+}
+
+
+/*
+ * Selectivity estimation follows
+ **********************************************************************
+ */
+
+
+/**
+ * Convert the int4 values from a statistics slot into a palloc'd array
+ * of doubles.
+ */
+static double *
+int4SlotValues(AttStatsSlot *sslot)
+{
+	double *result = palloc(sizeof(double) * sslot->nvalues);
+	int i;
+
+	for (i = 0; i < sslot->nvalues; i++) {
+		result[i] = DatumGetInt32(sslot->values[i]);
+	}
+	return result;
+}
+
+
+/**
+ * Load the bitmap statistics for a variable.  Any statistics that are
+ * missing, or do not look like ours, are left unset in bstats.
+ *
+ * @param vardata The variable for which we want statistics
+ * @param bstats The BitmapStats structure to be filled in.
+ */
+static void
+loadBitmapStats(VariableStatData *vardata, BitmapStats *bstats)
+{
+	HeapTuple tuple = vardata->statsTuple;
+	AttStatsSlot sslot;
+
+	memset(bstats, 0, sizeof(BitmapStats));
+	bstats->nonempty = 1.0;
+	if (!HeapTupleIsValid(tuple)) {
+		return;
+	}
+	bstats->have_stats = true;
+	bstats->nullfrac = ((Form_pg_statistic) GETSTRUCT(tuple))->stanullfrac;
+
+	if (get_attstatsslot(&bstats->mcelem, tuple, STATISTIC_KIND_MCELEM,
+						 InvalidOid,
+						 ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS)) {
+		if ((bstats->mcelem.valuetype == INT4OID) &&
+			(bstats->mcelem.nnumbers == bstats->mcelem.nvalues + 3)) {
+			bstats->have_mcelem = true;
+			bstats->minfreq = bstats->mcelem.numbers[bstats->mcelem.nvalues];
+		}
+		else {
+			free_attstatsslot(&bstats->mcelem);
+		}
+	}
+
+	if (get_attstatsslot(&sslot, tuple, STATISTIC_KIND_DECHIST,
+						 InvalidOid, ATTSTATSSLOT_NUMBERS)) {
+		if (sslot.nnumbers >= 3) {
+			int i;
+
+			bstats->ncards = sslot.nnumbers - 1;
+			bstats->cards = palloc(sizeof(double) * bstats->ncards);
+			for (i = 0; i < bstats->ncards; i++) {
+				bstats->cards[i] = sslot.numbers[i];
+			}
+			bstats->avgcard = sslot.numbers[bstats->ncards];
+		}
+		free_attstatsslot(&sslot);
+	}
+
+	if (get_attstatsslot(&sslot, tuple, STATISTIC_KIND_BITMAP_BITMIN,
+						 InvalidOid,
+						 ATTSTATSSLOT_VALUES | ATTSTATSSLOT_NUMBERS)) {
+		if ((sslot.nvalues >= 2) && (sslot.nnumbers == 1)) {
+			bstats->nbitmins = sslot.nvalues;
+			bstats->bitmins = int4SlotValues(&sslot);
+			bstats->nonempty = sslot.numbers[0];
+		}
+		free_attstatsslot(&sslot);
+	}
+	else if (bstats->ncards) {
+		/* No bitmin histogram means that no bitmaps were non-empty. */
+		bstats->nonempty = 0.0;
+	}
+
+	if (get_attstatsslot(&sslot, tuple, STATISTIC_KIND_BITMAP_BITMAX,
+						 InvalidOid, ATTSTATSSLOT_VALUES)) {
+		if (sslot.nvalues >= 2) {
+			bstats->nbitmaxs = sslot.nvalues;
+			bstats->bitmaxs = int4SlotValues(&sslot);
+		}
+		free_attstatsslot(&sslot);
+	}
+}
+
+
+/**
+ * Release the statistics loaded by loadBitmapStats().
+ */
+static void
+freeBitmapStats(BitmapStats *bstats)
+{
+	if (bstats->have_mcelem) {
+		free_attstatsslot(&bstats->mcelem);
+	}
+	if (bstats->cards) {
+		pfree(bstats->cards);
+	}
+	if (bstats->bitmins) {
+		pfree(bstats->bitmins);
+	}
+	if (bstats->bitmaxs) {
+		pfree(bstats->bitmaxs);
+	}
+}
+
+
+/**
+ * Estimate the fraction of a population with values less than x, from
+ * an equal-frequency histogram of integer values.  Each integer value v
+ * is treated as covering the interval [v, v + 1), and we interpolate
+ * linearly within histogram buckets.
+ *
+ * @param hist The histogram bounds, in ascending order
+ * @param nhist The number of histogram bounds; at least 2
+ * @param x The value to be located
+ *
+ * @return The estimated fraction of values below x.
+ */
+static double
+histogramBelow(double *hist, int nhist, double x)
+{
+	int lo = 0;
+	int hi = nhist - 1;
+	double bucket_lo;
+	double bucket_hi;
+	double frac;
+
+	if (x <= hist[0]) {
+		return 0.0;
+	}
+	if (x >= hist[nhist - 1] + 1.0) {
+		return 1.0;
+	}
+	while ((hi - lo) > 1) {
+		int mid = (lo + hi) / 2;
+
+		if (hist[mid] <= x) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	bucket_lo = hist[lo];
+	bucket_hi = (hi == nhist - 1)? hist[hi] + 1.0: hist[hi];
+	frac = (x - bucket_lo) / (bucket_hi - bucket_lo);
+	CLAMP_PROBABILITY(frac);
+	return ((double) lo + frac) / (double) (nhist - 1);
+}
+
+
+/**
+ * Estimate the fraction of non-null bitmaps whose bitmin..bitmax range
+ * includes bit.  Since bitmax can never be less than bitmin, this is
+ * the fraction with bitmin <= bit, less the fraction with bitmax < bit.
+ */
+static double
+rangeFraction(BitmapStats *bstats, int32 bit)
+{
+	double result;
+
+	if (!(bstats->bitmins && bstats->bitmaxs)) {
+		return bstats->nonempty;
+	}
+	result = histogramBelow(bstats->bitmins, bstats->nbitmins, bit + 1.0) -
+		histogramBelow(bstats->bitmaxs, bstats->nbitmaxs, bit);
+	CLAMP_PROBABILITY(result);
+	return result * bstats->nonempty;
+}
+
+
+/**
+ * Estimate the fraction of non-null bitmaps that have a given bit set.
+ * Most common bits have their frequencies recorded.  Any other bit must
+ * be less frequent than the least common of those, and can only appear
+ * in bitmaps whose range includes it.
+ */
+static double
+bitFrequency(BitmapStats *bstats, int32 bit)
+{
+	double range_frac = rangeFraction(bstats, bit);
+
+	if (bstats->have_mcelem) {
+		int lo = 0;
+		int hi = bstats->mcelem.nvalues - 1;
+
+		while (lo <= hi) {
+			int mid = (lo + hi) / 2;
+			int32 value = DatumGetInt32(bstats->mcelem.values[mid]);
+
+			if (value == bit) {
+				return bstats->mcelem.numbers[mid];
+			}
+			if (value < bit) {
+				lo = mid + 1;
+			}
+			else {
+				hi = mid - 1;
+			}
+		}
+		return MIN(bstats->minfreq / 2.0, range_frac);
+	}
+	return MIN(DEFAULT_BITMAP_TESTBIT_SEL, range_frac);
+}
+
+
+/**
+ * Estimate the fraction of non-null bitmaps with a cardinality of
+ * exactly card.
+ */
+static double
+cardinalityEqFraction(BitmapStats *bstats, int64 card)
+{
+	return histogramBelow(bstats->cards, bstats->ncards, card + 1.0) -
+		histogramBelow(bstats->cards, bstats->ncards, card);
+}
+
+
+/**
+ * Estimate the average number of bits, amongst all bitmaps in the
+ * column, that any single bit value appears in.  This is the size of
+ * the universe of bits from which the column's bitmaps are drawn.  Bits
+ * that are not amongst the most common are each assumed to have half
+ * of the lowest recorded frequency.
+ */
+static double
+bitUniverse(BitmapStats *bstats)
+{
+	double mass = 0.0;
+	double rest;
+	int i;
+
+	if (!bstats->have_mcelem) {
+		return MAX(bstats->avgcard / DEFAULT_BITMAP_TESTBIT_SEL, 1.0);
+	}
+	for (i = 0; i < bstats->mcelem.nvalues; i++) {
+		mass += bstats->mcelem.numbers[i];
+	}
+	rest = MAX(bstats->avgcard - mass, 0.0);
+	return MAX(bstats->mcelem.nvalues +
+			   (rest / MAX(bstats->minfreq / 2.0, BITMAP_MIN_PRODUCT)),
+			   1.0);
+}
+
+
+/**
+ * Estimate the fraction of non-null bitmaps equal to bitmap.
+ */
+static double
+eqSelec(VariableStatData *vardata, BitmapStats *bstats, Bitmap *bitmap)
+{
+	bool isdefault;
+	double nd = get_variable_numdistinct(vardata, &isdefault);
+	double result = isdefault? DEFAULT_EQ_SEL: 1.0 / MAX(nd, 1.0);
+	bool empty = (bitmap->bitset[0] == 0);
+
+	if (bstats->cards) {
+		result = MIN(result, cardinalityEqFraction(
+						 bstats, empty? 0: bitmapCardinality(bitmap)));
+	}
+	if (!empty && bstats->bitmins && bstats->bitmaxs) {
+		double frac;
+
+		frac = histogramBelow(bstats->bitmins, bstats->nbitmins,
+							  bitmap->bitmin + 1.0) -
+			histogramBelow(bstats->bitmins, bstats->nbitmins, bitmap->bitmin);
+		result = MIN(result, frac * bstats->nonempty);
+		frac = histogramBelow(bstats->bitmaxs, bstats->nbitmaxs,
+							  bitmap->bitmax + 1.0) -
+			histogramBelow(bstats->bitmaxs, bstats->nbitmaxs, bitmap->bitmax);
+		result = MIN(result, frac * bstats->nonempty);
+	}
+	return result;
+}
+
+
+/**
+ * Estimate the fraction of non-null bitmaps that either contain, or
+ * overlap with, bitmap.  Bits are assumed to occur independently.
+ *
+ * @param bstats The column's statistics
+ * @param bitmap The constant ::Bitmap
+ * @param overlap True for overlap, false for containment
+ *
+ * @return The estimated fraction.
+ */
+static double
+containOverlapSelec(BitmapStats *bstats, Bitmap *bitmap, bool overlap)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int32 base = BITZERO(bitmap->bitmin);
+	double product = 1.0;
+	int64 card = 0;
+	int32 i;
+
+	for (i = 0; (i < elems) && (product > BITMAP_MIN_PRODUCT); i++) {
+		bm_int word = bitmap->bitset[i];
+
+		while (word && (product > BITMAP_MIN_PRODUCT)) {
+			double freq = bitFrequency(bstats, base + (i * ELEMBITS) +
+									   BM_CTZ(word));
+
+			word &= word - 1;
+			card++;
+			product *= overlap? (1.0 - freq): freq;
+		}
+	}
+
+	if (overlap) {
+		return 1.0 - product;
+	}
+	if (bstats->cards) {
+		/* A bitmap must have at least as many bits as it contains. */
+		product = MIN(product, 1.0 - histogramBelow(bstats->cards,
+													bstats->ncards, card));
+	}
+	return product;
+}
+
+
+/**
+ * Estimate the fraction of non-null bitmaps that are contained by
+ * bitmap.  We estimate the proportion, q, of the bits in an average
+ * column bitmap that are also in bitmap, and then find the average
+ * over the cardinality histogram of the probability, q^cardinality,
+ * that all of a column bitmap's bits are in bitmap.
+ */
+static double
+containedSelec(BitmapStats *bstats, Bitmap *bitmap)
+{
+	int32 elems = ARRAYELEMS(bitmap->bitmin, bitmap->bitmax);
+	int32 base = BITZERO(bitmap->bitmin);
+	double mass = 0.0;
+	double q;
+	double result = 0.0;
+	int32 i;
+
+	if (!bstats->cards) {
+		return DEFAULT_BITMAP_CONTAIN_SEL;
+	}
+	if (bstats->avgcard <= 0.0) {
+		/* All bitmaps are empty. */
+		return 1.0;
+	}
+	for (i = 0; (i < elems) && (mass < bstats->avgcard); i++) {
+		bm_int word = bitmap->bitset[i];
+
+		while (word) {
+			mass += bitFrequency(bstats, base + (i * ELEMBITS) +
+								 BM_CTZ(word));
+			word &= word - 1;
+		}
+	}
+	q = MIN(mass / bstats->avgcard, 1.0);
+	for (i = 0; i < bstats->ncards; i++) {
+		result += pow(q, bstats->cards[i]);
+	}
+	return result / bstats->ncards;
+}
+
+
+/**
+ * Common code for all of the restriction selectivity functions.
+ *
+ * @param root The planner info
+ * @param args The operator's arguments
+ * @param varRelid As passed to the restriction selectivity function
+ * @param op The operator being estimated
+ * @param default_sel The estimate to use when we have nothing better
+ *
+ * @return The estimated selectivity.
+ */
+static Selectivity
+bitmapRestrictSel(PlannerInfo *root, List *args, int varRelid,
+				  BitmapSelOp op, double default_sel)
+{
+	VariableStatData vardata;
+	Node *other;
+	bool varonleft;
+	Const *constant;
+	BitmapStats bstats;
+	Bitmap *bitmap = NULL;
+	Selectivity result;
+
+	if (!get_restriction_variable(root, args, varRelid,
+								  &vardata, &other, &varonleft)) {
+		return default_sel;
+	}
+	if (!IsA(other, Const)) {
+		ReleaseVariableStats(vardata);
+		return default_sel;
+	}
+	constant = (Const *) other;
+	if (constant->constisnull) {
+		ReleaseVariableStats(vardata);
+		return 0.0;
+	}
+	if (!varonleft) {
+		if (op == BITMAP_SEL_TESTBIT) {
+			/* The variable is the integer, for which we have no
+			 * useful statistics. */
+			ReleaseVariableStats(vardata);
+			return default_sel;
+		}
+		/* Commute the operator so that the variable is on the left. */
+		if (op == BITMAP_SEL_CONTAINS) {
+			op = BITMAP_SEL_CONTAINED;
+		}
+		else if (op == BITMAP_SEL_CONTAINED) {
+			op = BITMAP_SEL_CONTAINS;
+		}
+	}
+
+	loadBitmapStats(&vardata, &bstats);
+	if (!bstats.have_stats && (op != BITMAP_SEL_EQ)) {
+		ReleaseVariableStats(vardata);
+		return default_sel;
+	}
+	if (op != BITMAP_SEL_TESTBIT) {
+		bitmap = DatumGetBitmap(constant->constvalue);
+	}
+
+	switch (op) {
+	case BITMAP_SEL_TESTBIT:
+		result = bitFrequency(&bstats, DatumGetInt32(constant->constvalue));
+		break;
+	case BITMAP_SEL_EQ:
+		result = eqSelec(&vardata, &bstats, bitmap);
+		break;
+	case BITMAP_SEL_CONTAINS:
+		result = containOverlapSelec(&bstats, bitmap, false);
+		break;
+	case BITMAP_SEL_CONTAINED:
+		result = containedSelec(&bstats, bitmap);
+		break;
+	default:
+		result = containOverlapSelec(&bstats, bitmap, true);
+		break;
+	}
+	result *= (1.0 - bstats.nullfrac);
+
+	freeBitmapStats(&bstats);
+	ReleaseVariableStats(vardata);
+	CLAMP_PROBABILITY(result);
+	return result;
+}
+
+
+/**
+ * Return the null fraction recorded for a variable, or zero.
+ */
+static double
+varNullFrac(VariableStatData *vardata)
+{
+	if (HeapTupleIsValid(vardata->statsTuple)) {
+		return ((Form_pg_statistic)
+				GETSTRUCT(vardata->statsTuple))->stanullfrac;
+	}
+	return 0.0;
+}
+
+
+/**
+ * Common code for all of the join selectivity functions.  For
+ * operators between two bitmaps, we estimate the probability that a
+ * bit of one bitmap is in the other as the average cardinality of the
+ * other divided by the size of the universe of bits.
+ *
+ * @param root The planner info
+ * @param args The operator's arguments
+ * @param sjinfo The special join info, as passed to the join
+ * selectivity function
+ * @param op The operator being estimated
+ * @param default_sel The estimate to use when we have nothing better
+ *
+ * @return The estimated selectivity.
+ */
+static Selectivity
+bitmapJoinSel(PlannerInfo *root, List *args, SpecialJoinInfo *sjinfo,
+			  BitmapSelOp op, double default_sel)
+{
+	VariableStatData vardata1;
+	VariableStatData vardata2;
+	bool join_is_reversed;
+	BitmapStats bstats1;
+	BitmapStats bstats2;
+	Selectivity result = default_sel;
+	bool isdefault1;
+	bool isdefault2;
+	double nd1;
+	double nd2;
+	double universe;
+
+	get_join_variables(root, args, sjinfo, &vardata1, &vardata2,
+					   &join_is_reversed);
+	loadBitmapStats(&vardata1, &bstats1);
+
+	switch (op) {
+	case BITMAP_SEL_TESTBIT:
+		/* The right hand variable is an integer.  If it takes nd2
+		 * distinct values, an average bitmap will contain
+		 * avgcard / nd2 of them. */
+		nd2 = get_variable_numdistinct(&vardata2, &isdefault2);
+		if (bstats1.cards && !isdefault2) {
+			result = MIN(bstats1.avgcard / MAX(nd2, 1.0), 1.0);
+		}
+		result *= (1.0 - bstats1.nullfrac) * (1.0 - varNullFrac(&vardata2));
+		break;
+	case BITMAP_SEL_EQ:
+		nd1 = get_variable_numdistinct(&vardata1, &isdefault1);
+		nd2 = get_variable_numdistinct(&vardata2, &isdefault2);
+		result = (1.0 - varNullFrac(&vardata1)) *
+			(1.0 - varNullFrac(&vardata2)) / MAX(MAX(nd1, nd2), 1.0);
+		break;
+	default:
+		loadBitmapStats(&vardata2, &bstats2);
+		if (bstats1.cards && bstats2.cards) {
+			universe = MAX(bitUniverse(&bstats1), bitUniverse(&bstats2));
+			if (op == BITMAP_SEL_OVERLAPS) {
+				result = 1.0 - pow(1.0 - MIN(bstats1.avgcard / universe, 1.0),
+								   bstats2.avgcard);
+			}
+			else if (op == BITMAP_SEL_CONTAINS) {
+				result = pow(MIN(bstats1.avgcard / universe, 1.0),
+							 bstats2.avgcard);
+			}
+			else {
+				result = pow(MIN(bstats2.avgcard / universe, 1.0),
+							 bstats1.avgcard);
+			}
+		}
+		result *= (1.0 - bstats1.nullfrac) * (1.0 - bstats2.nullfrac);
+		freeBitmapStats(&bstats2);
+		break;
+	}
+
+	freeBitmapStats(&bstats1);
+	ReleaseVariableStats(vardata1);
+	ReleaseVariableStats(vardata2);
+	CLAMP_PROBABILITY(result);
+	return result;
+}
+
+
+/*
+ * Interface functions follow
+ **********************************************************************
+ */
+
+
+PG_FUNCTION_INFO_V1(bitmap_typanalyze);
+/**
+ * <code>bitmap_typanalyze(internal) returns bool</code>
+ * The typanalyze function for the bitmap type.  This arranges for
+ * compute_bitmap_stats() to be called by ANALYZE.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>stats internal</code> The VacAttrStats for the column.
+ * @return <code>bool</code> true, as we can always gather statistics.
+ */
+Datum
+bitmap_typanalyze(PG_FUNCTION_ARGS)
+{
+	VacAttrStats *stats = (VacAttrStats *) PG_GETARG_POINTER(0);
+
+	if (STATS_TARGET(stats) < 0) {
+		STATS_TARGET(stats) = default_statistics_target;
+	}
+	stats->compute_stats = compute_bitmap_stats;
+	/* This is the same sample size as is used for scalar types. */
+	stats->minrows = 300 * STATS_TARGET(stats);
+
+	PG_RETURN_BOOL(true);
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_testbit_sel);
+/**
+ * <code>bitmap_testbit_sel(internal, oid, internal, int4)
+ *     returns float8</code>
+ * Restriction selectivity for bitmap ? int4.
+ *
+ * @param fcinfo The standard restriction selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_testbit_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapRestrictSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2), PG_GETARG_INT32(3),
+						 BITMAP_SEL_TESTBIT, DEFAULT_BITMAP_TESTBIT_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_eq_sel);
+/**
+ * <code>bitmap_eq_sel(internal, oid, internal, int4) returns float8</code>
+ * Restriction selectivity for bitmap = bitmap.
+ *
+ * @param fcinfo The standard restriction selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_eq_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapRestrictSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2), PG_GETARG_INT32(3),
+						 BITMAP_SEL_EQ, DEFAULT_EQ_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_contains_sel);
+/**
+ * <code>bitmap_contains_sel(internal, oid, internal, int4)
+ *     returns float8</code>
+ * Restriction selectivity for bitmap @> bitmap.
+ *
+ * @param fcinfo The standard restriction selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_contains_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapRestrictSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2), PG_GETARG_INT32(3),
+						 BITMAP_SEL_CONTAINS, DEFAULT_BITMAP_CONTAIN_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_contained_sel);
+/**
+ * <code>bitmap_contained_sel(internal, oid, internal, int4)
+ *     returns float8</code>
+ * Restriction selectivity for bitmap <@ bitmap.
+ *
+ * @param fcinfo The standard restriction selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_contained_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapRestrictSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2), PG_GETARG_INT32(3),
+						 BITMAP_SEL_CONTAINED, DEFAULT_BITMAP_CONTAIN_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_overlaps_sel);
+/**
+ * <code>bitmap_overlaps_sel(internal, oid, internal, int4)
+ *     returns float8</code>
+ * Restriction selectivity for bitmap && bitmap.
+ *
+ * @param fcinfo The standard restriction selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_overlaps_sel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapRestrictSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2), PG_GETARG_INT32(3),
+						 BITMAP_SEL_OVERLAPS, DEFAULT_BITMAP_OVERLAP_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_testbit_joinsel);
+/**
+ * <code>bitmap_testbit_joinsel(internal, oid, internal, int2, internal)
+ *     returns float8</code>
+ * Join selectivity for bitmap ? int4.
+ *
+ * @param fcinfo The standard join selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_testbit_joinsel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapJoinSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2),
+						 (SpecialJoinInfo *) PG_GETARG_POINTER(4),
+						 BITMAP_SEL_TESTBIT, DEFAULT_BITMAP_TESTBIT_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_eq_joinsel);
+/**
+ * <code>bitmap_eq_joinsel(internal, oid, internal, int2, internal)
+ *     returns float8</code>
+ * Join selectivity for bitmap = bitmap.
+ *
+ * @param fcinfo The standard join selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_eq_joinsel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapJoinSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2),
+						 (SpecialJoinInfo *) PG_GETARG_POINTER(4),
+						 BITMAP_SEL_EQ, DEFAULT_EQ_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_contains_joinsel);
+/**
+ * <code>bitmap_contains_joinsel(internal, oid, internal, int2, internal)
+ *     returns float8</code>
+ * Join selectivity for bitmap @> bitmap.
+ *
+ * @param fcinfo The standard join selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_contains_joinsel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapJoinSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2),
+						 (SpecialJoinInfo *) PG_GETARG_POINTER(4),
+						 BITMAP_SEL_CONTAINS, DEFAULT_BITMAP_CONTAIN_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_contained_joinsel);
+/**
+ * <code>bitmap_contained_joinsel(internal, oid, internal, int2, internal)
+ *     returns float8</code>
+ * Join selectivity for bitmap <@ bitmap.
+ *
+ * @param fcinfo The standard join selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_contained_joinsel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapJoinSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2),
+						 (SpecialJoinInfo *) PG_GETARG_POINTER(4),
+						 BITMAP_SEL_CONTAINED, DEFAULT_BITMAP_CONTAIN_SEL));
+}
+
+
+PG_FUNCTION_INFO_V1(bitmap_overlaps_joinsel);
+/**
+ * <code>bitmap_overlaps_joinsel(internal, oid, internal, int2, internal)
+ *     returns float8</code>
+ * Join selectivity for bitmap && bitmap.
+ *
+ * @param fcinfo The standard join selectivity parameters.
+ * @return <code>float8</code> The estimated selectivity.
+ */
+Datum
+bitmap_overlaps_joinsel(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT8(bitmapJoinSel(
+						 (PlannerInfo *) PG_GETARG_POINTER(0),
+						 (List *) PG_GETARG_POINTER(2),
+						 (SpecialJoinInfo *) PG_GETARG_POINTER(4),
+						 BITMAP_SEL_OVERLAPS, DEFAULT_BITMAP_OVERLAP_SEL));
+}
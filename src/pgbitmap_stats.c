@@ -0,0 +1,483 @@
+/**
+ * @file   pgbitmap_stats.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * Runtime statistics for pgbitmap.
+ *
+ * While the pgbitmap.track_stats GUC is on, each backend counts calls
+ * to each of the SQL-callable functions of pgbitmap.c, along with the
+ * ::BitmapCounters for bitmap allocations, copies, detoasts,
+ * reductions and thaws.  When it is off, the only cost is a test of the
+ * GUC variable.  The counters are reported by pgbitmap_stats() and
+ * reset by pgbitmap_stats_reset().
+ *
+ * If pgbitmap is loaded using shared_preload_libraries, each backend
+ * also adds its counts to totals kept in shared memory, when it exits
+ * and whenever the shared totals are requested, so that
+ * pgbitmap_stats(true) can report on the whole cluster.
+ */
+
+#include "pgbitmap.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/tuplestore.h"
+
+
+/**
+ * The maximum number of functions for which calls can be counted.
+ * This must be at least the number of functions that use
+ * BITMAP_COUNT_CALL().
+ */
+#define MAX_COUNTED_FUNCTIONS 128
+
+/**
+ * Prefix for the names of call counters in the output of
+ * pgbitmap_stats().
+ */
+#define CALLS_PREFIX "calls."
+
+/**
+ * Identifies a ::BitmapCounters counter, for reporting.
+ */
+typedef struct StatField {
+	const char *name;	/**< Name reported by pgbitmap_stats() */
+	Size        offset; /**< Offset of the counter in ::BitmapCounters */
+} StatField;
+
+/**
+ * The ::BitmapCounters, in the order in which they are reported.
+ */
+static const StatField stat_fields[] = {
+	{"bitmaps_allocated", offsetof(BitmapCounters, allocations)},
+	{"bytes_allocated", offsetof(BitmapCounters, bytes_allocated)},
+	{"copies", offsetof(BitmapCounters, copies)},
+	{"extensions", offsetof(BitmapCounters, extensions)},
+	{"detoasts", offsetof(BitmapCounters, detoasts)},
+	{"reductions", offsetof(BitmapCounters, reductions)},
+	{"thaws", offsetof(BitmapCounters, thaws)}
+};
+
+/**
+ * Return the ::BitmapCounters counter identified by field from stats.
+ */
+#define STAT_FIELD(stats, field)									\
+	(*((int64 *) (((char *) (stats)) + stat_fields[field].offset)))
+
+/**
+ * The count of calls to a single function.
+ */
+typedef struct CallCount {
+	char   name[NAMEDATALEN];  /**< The C name of the function */
+	int64  calls;			   /**< The number of calls counted */
+} CallCount;
+
+/**
+ * The cluster-wide statistics, in shared memory.
+ */
+typedef struct SharedStats {
+	LWLock        *lock;	/**< Protects the rest of this struct */
+	BitmapCounters totals;	/**< Totals of the ::BitmapCounters */
+	int            ncalls;	/**< The number of entries in calls */
+	CallCount      calls[MAX_COUNTED_FUNCTIONS]; /**< Call counts */
+} SharedStats;
+
+/**
+ * The call counts for this backend.  Entries are allocated, in order,
+ * by bitmapCountCall().
+ */
+static CallCount calls[MAX_COUNTED_FUNCTIONS];
+
+/**
+ * The number of entries in calls.
+ */
+static int ncalls = 0;
+
+/**
+ * The values of bitmap_counters when they were last added to the
+ * shared totals.
+ */
+static BitmapCounters flushed_counters;
+
+/**
+ * The values of the call counts when they were last added to the
+ * shared totals.
+ */
+static int64 flushed_calls[MAX_COUNTED_FUNCTIONS];
+
+/**
+ * The shared statistics, or NULL if pgbitmap was not loaded using
+ * shared_preload_libraries.
+ */
+static SharedStats *shared_stats = NULL;
+
+/**
+ * Whether flushStatsAtExit() has been registered for this backend.
+ */
+static bool exit_callback_registered = false;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+void _PG_init(void);
+static void flushStatsAtExit(int code, Datum arg);
+
+
+/*
+ * Counter maintenance functions follow
+ **********************************************************************
+ */
+
+/**
+ * Count a call to a function.  This is called, by BITMAP_COUNT_CALL(),
+ * only when pgbitmap.track_stats is on.  On the first call from each
+ * function a counter is allocated, and its index is saved in *slot for
+ * subsequent calls.
+ *
+ * @param name The name of the function being called
+ * @param slot Pointer to the calling function's cached counter index
+ */
+void
+bitmapCountCall(const char *name, int *slot)
+{
+	if (*slot < 0) {
+		if (ncalls >= MAX_COUNTED_FUNCTIONS) {
+			/* Should not happen: just don't count the function. */
+			*slot = MAX_COUNTED_FUNCTIONS;
+			return;
+		}
+		strlcpy(calls[ncalls].name, name, NAMEDATALEN);
+		calls[ncalls].calls = 0;
+		flushed_calls[ncalls] = 0;
+		*slot = ncalls++;
+
+		if (shared_stats && !exit_callback_registered) {
+			before_shmem_exit(flushStatsAtExit, (Datum) 0);
+			exit_callback_registered = true;
+		}
+	}
+	if (*slot < MAX_COUNTED_FUNCTIONS) {
+		calls[*slot].calls++;
+	}
+}
+
+/**
+ * Add the counts accumulated by this backend, since they were last
+ * added, to the shared totals.
+ */
+static void
+flushStats(void)
+{
+	int64 delta;
+	int   field;
+	int   i;
+	int   j;
+
+	if (!shared_stats) {
+		return;
+	}
+
+	LWLockAcquire(shared_stats->lock, LW_EXCLUSIVE);
+	for (field = 0; field < lengthof(stat_fields); field++) {
+		STAT_FIELD(&shared_stats->totals, field) +=
+			STAT_FIELD(&bitmap_counters, field) -
+			STAT_FIELD(&flushed_counters, field);
+	}
+	flushed_counters = bitmap_counters;
+
+	for (i = 0; i < ncalls; i++) {
+		delta = calls[i].calls - flushed_calls[i];
+		if (delta == 0) {
+			continue;
+		}
+		for (j = 0; j < shared_stats->ncalls; j++) {
+			if (strcmp(shared_stats->calls[j].name, calls[i].name) == 0) {
+				break;
+			}
+		}
+		if (j == shared_stats->ncalls) {
+			if (j >= MAX_COUNTED_FUNCTIONS) {
+				continue;
+			}
+			strlcpy(shared_stats->calls[j].name, calls[i].name, NAMEDATALEN);
+			shared_stats->calls[j].calls = 0;
+			shared_stats->ncalls++;
+		}
+		shared_stats->calls[j].calls += delta;
+		flushed_calls[i] = calls[i].calls;
+	}
+	LWLockRelease(shared_stats->lock);
+}
+
+/**
+ * Backend exit callback, adding this backend's counts to the shared
+ * totals.
+ *
+ * @param code The exit code (unused)
+ * @param arg Unused
+ */
+static void
+flushStatsAtExit(int code, Datum arg)
+{
+	flushStats();
+}
+
+/**
+ * Reset the counts for this backend to zero.
+ */
+static void
+resetLocalStats(void)
+{
+	int i;
+
+	memset(&bitmap_counters, 0, sizeof(BitmapCounters));
+	memset(&flushed_counters, 0, sizeof(BitmapCounters));
+	for (i = 0; i < ncalls; i++) {
+		calls[i].calls = 0;
+		flushed_calls[i] = 0;
+	}
+}
+
+
+/*
+ * Shared memory functions follow
+ **********************************************************************
+ */
+
+/**
+ * Request the shared memory, and the lock, needed for the shared
+ * statistics.
+ */
+static void
+statsShmemRequest(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook) {
+		prev_shmem_request_hook();
+	}
+#endif
+	RequestAddinShmemSpace(MAXALIGN(sizeof(SharedStats)));
+	RequestNamedLWLockTranche("pgbitmap", 1);
+}
+
+/**
+ * Attach to, and if necessary initialise, the shared statistics.
+ */
+static void
+statsShmemStartup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook) {
+		prev_shmem_startup_hook();
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	shared_stats = ShmemInitStruct("pgbitmap stats",
+								   sizeof(SharedStats), &found);
+	if (!found) {
+		memset(shared_stats, 0, sizeof(SharedStats));
+		shared_stats->lock = &(GetNamedLWLockTranche("pgbitmap"))->lock;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/**
+ * Library initialisation: define the pgbitmap.track_stats GUC and, if
+ * we are being loaded by shared_preload_libraries, arrange for the
+ * shared statistics to be created.
+ */
+void
+_PG_init(void)
+{
+	DefineCustomBoolVariable(
+		"pgbitmap.track_stats",
+		"Collects statistics on calls to pgbitmap functions and the "
+		"bitmaps that they allocate.",
+		"The statistics are reported by pgbitmap_stats().",
+		&pgbitmap_track_stats,
+		false,
+		PGC_USERSET,
+		0, NULL, NULL, NULL);
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("pgbitmap");
+#else
+	EmitWarningsOnPlaceholders("pgbitmap");
+#endif
+
+	if (!process_shared_preload_libraries_in_progress) {
+		return;
+	}
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = statsShmemRequest;
+#else
+	statsShmemRequest();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = statsShmemStartup;
+}
+
+
+/*
+ * Interface functions follow
+ **********************************************************************
+ */
+
+/**
+ * Add a row to the result of pgbitmap_stats().
+ *
+ * @param tupstore The tuplestore for the result
+ * @param tupdesc The descriptor of the result rows
+ * @param prefix Prefix for the statistic name
+ * @param name The name of the statistic
+ * @param value The value of the statistic
+ */
+static void
+addStatRow(Tuplestorestate *tupstore,
+		   TupleDesc tupdesc,
+		   const char *prefix,
+		   const char *name,
+		   int64 value)
+{
+	Datum values[2];
+	bool  nulls[2] = {false, false};
+
+	values[0] = CStringGetTextDatum(psprintf("%s%s", prefix, name));
+	values[1] = Int64GetDatum(value);
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+
+PG_FUNCTION_INFO_V1(pgbitmap_stats);
+/**
+ * <code>pgbitmap_stats(shared bool) returns setof record</code>
+ * Return the pgbitmap statistics counters as (stat, value) pairs,
+ * either for this backend or, if shared is true, the totals for all
+ * backends.  Only functions that have been called are reported.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>shared bool</code> Whether to report the shared totals.
+ * @return <code>setof record</code> The statistics.
+ */
+Datum
+pgbitmap_stats(PG_FUNCTION_ARGS)
+{
+	bool             shared = PG_GETARG_BOOL(0);
+	ReturnSetInfo   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext    oldcontext;
+	Tuplestorestate *tupstore;
+	TupleDesc        tupdesc;
+	int              field;
+	int              i;
+
+	if (!rsinfo || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize)) {
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+	}
+	if (shared && !shared_stats) {
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("shared pgbitmap statistics are not available"),
+				 errhint("Add pgbitmap to shared_preload_libraries.")));
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+		elog(ERROR, "return type must be a row type");
+	}
+
+	oldcontext = MemoryContextSwitchTo(
+		rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(
+		(rsinfo->allowedModes & SFRM_Materialize_Random) != 0,
+		false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	if (shared) {
+		flushStats();
+		LWLockAcquire(shared_stats->lock, LW_SHARED);
+		for (field = 0; field < lengthof(stat_fields); field++) {
+			addStatRow(tupstore, tupdesc, "", stat_fields[field].name,
+					   STAT_FIELD(&shared_stats->totals, field));
+		}
+		for (i = 0; i < shared_stats->ncalls; i++) {
+			addStatRow(tupstore, tupdesc, CALLS_PREFIX,
+					   shared_stats->calls[i].name,
+					   shared_stats->calls[i].calls);
+		}
+		LWLockRelease(shared_stats->lock);
+	}
+	else {
+		for (field = 0; field < lengthof(stat_fields); field++) {
+			addStatRow(tupstore, tupdesc, "", stat_fields[field].name,
+					   STAT_FIELD(&bitmap_counters, field));
+		}
+		for (i = 0; i < ncalls; i++) {
+			if (calls[i].calls) {
+				addStatRow(tupstore, tupdesc, CALLS_PREFIX,
+						   calls[i].name, calls[i].calls);
+			}
+		}
+	}
+	return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pgbitmap_stats_reset);
+/**
+ * <code>pgbitmap_stats_reset(shared bool) returns void</code>
+ * Reset the pgbitmap statistics counters for this backend and, if
+ * shared is true, the shared totals.  Only superusers may reset the
+ * shared totals.  Unless the shared totals are being reset, this
+ * backend's counts are added to them before being reset.
+ *
+ * @param fcinfo Params as described_below
+ * <br><code>shared bool</code> Whether to also reset the shared totals.
+ * @return <code>void</code>
+ */
+Datum
+pgbitmap_stats_reset(PG_FUNCTION_ARGS)
+{
+	bool shared = PG_GETARG_BOOL(0);
+
+	if (shared) {
+		if (!shared_stats) {
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("shared pgbitmap statistics are not available"),
+					 errhint("Add pgbitmap to shared_preload_libraries.")));
+		}
+		if (!superuser()) {
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+					 errmsg("only superusers may reset the shared "
+							"pgbitmap statistics")));
+		}
+		LWLockAcquire(shared_stats->lock, LW_EXCLUSIVE);
+		memset(&shared_stats->totals, 0, sizeof(BitmapCounters));
+		shared_stats->ncalls = 0;
+		LWLockRelease(shared_stats->lock);
+	}
+	else {
+		flushStats();
+	}
+	resetLocalStats();
+	PG_RETURN_VOID();
+}
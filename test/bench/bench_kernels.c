@@ -0,0 +1,492 @@
+/**
+ * @file   bench_kernels.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * Standalone microbenchmark for the core bitmap functions of
+ * pgbitmap.c.  This is built, by "make bench", against the stand-in
+ * postgres headers in test/bench/shim so that no server is needed.
+ *
+ * Each kernel is run over a range of generated workloads, and one
+ * tab-separated line is written to stdout for each combination,
+ * giving the time and memory allocated per operation.  The output is
+ * intended to be saved and compared across versions.
+ *
+ * Usage: bench_kernels [min_ms [kernel]]
+ *
+ * min_ms is the minimum time, in milliseconds, for which each kernel
+ * is run on each workload (default 200).  If kernel is given, only
+ * that kernel is run.
+ */
+
+#include <time.h>
+
+#include "pgbitmap.c"
+
+/**
+ * The version of pgbitmap being benchmarked, which is normally
+ * provided by the makefile.
+ */
+#ifndef PGBITMAP_VERSION
+#define PGBITMAP_VERSION "unknown"
+#endif
+
+/**
+ * The spans, in bits, of the generated bitmaps.
+ */
+static const int32 spans[] = {1000, 10000, 100000, 1000000};
+
+/**
+ * Describes a type of generated bitmap.
+ */
+typedef struct Workload {
+	const char *name;   /**< Name of the workload, for reporting */
+	/** Function to populate a bitmap of the given span */
+	void      (*generate)(Bitmap **p_bitmap, int32 span, uint32 seed);
+} Workload;
+
+/**
+ * Describes a function being benchmarked.
+ */
+typedef struct Kernel {
+	const char *name;   /**< Name of the kernel, for reporting */
+	/** Function performing one operation on the pair of bitmaps */
+	int64     (*run)(Bitmap *bitmap1, Bitmap *bitmap2);
+} Kernel;
+
+/**
+ * State for the pseudo-random number generator.  The same seed always
+ * yields the same workloads so that results are comparable between
+ * runs.
+ */
+static uint64 rng_state;
+
+/**
+ * Prevents the compiler from optimising away the kernel results.
+ */
+static volatile int64 sink;
+
+
+/*
+ * Workload generation functions follow
+ **********************************************************************
+ */
+
+/**
+ * Return the next value from a simple xorshift pseudo-random number
+ * generator.
+ */
+static uint32
+nextRandom(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32) (rng_state >> 16);
+}
+
+/**
+ * qsort comparison function for int32 values.
+ */
+static int
+compareInt32(const void *a, const void *b)
+{
+	int32 x = *(const int32 *) a;
+	int32 y = *(const int32 *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Create a bitmap from an array of bits, which need not be sorted.
+ * The bits are sorted first as doSetBit() expects to be given bits in
+ * ascending order when filling a newly allocated bitmap.
+ *
+ * @param bits The bits to be set
+ * @param nbits The number of bits
+ *
+ * @return The new bitmap.
+ */
+static Bitmap *
+bitmapFromBits(int32 *bits, int32 nbits)
+{
+	Bitmap *bitmap;
+	int32   i;
+
+	qsort(bits, nbits, sizeof(int32), compareInt32);
+	bitmap = newBitmap(bits[0], bits[nbits - 1]);
+	clearBitmap(bitmap);
+	for (i = 0; i < nbits; i++) {
+		doSetBit(bitmap, bits[i]);
+	}
+	return bitmap;
+}
+
+/**
+ * Every bit in the span is set.
+ */
+static void
+generateDense(Bitmap **p_bitmap, int32 span, uint32 seed)
+{
+	int32 *bits = malloc(sizeof(int32) * span);
+	int32  i;
+
+	for (i = 0; i < span; i++) {
+		bits[i] = i;
+	}
+	*p_bitmap = bitmapFromBits(bits, span);
+	free(bits);
+}
+
+/**
+ * Roughly one bit in a thousand is set, at random, with the first and
+ * last bits of the span always set.
+ */
+static void
+generateSparse(Bitmap **p_bitmap, int32 span, uint32 seed)
+{
+	int32  nbits = span / 1000 + 2;
+	int32 *bits = malloc(sizeof(int32) * nbits);
+	int32  i;
+
+	rng_state = seed;
+	bits[0] = 0;
+	bits[1] = span - 1;
+	for (i = 2; i < nbits; i++) {
+		bits[i] = nextRandom() % span;
+	}
+	*p_bitmap = bitmapFromBits(bits, nbits);
+	free(bits);
+}
+
+/**
+ * Runs of 64 consecutive bits, placed at random, covering about a
+ * sixteenth of the span.
+ */
+static void
+generateClustered(Bitmap **p_bitmap, int32 span, uint32 seed)
+{
+	int32  runs = span / 1024 + 1;
+	int32 *bits = malloc(sizeof(int32) * runs * 64);
+	int32  start;
+	int32  i;
+	int32  j;
+
+	rng_state = seed;
+	for (i = 0; i < runs; i++) {
+		start = nextRandom() % MAX(span - 64, 1);
+		for (j = 0; j < 64; j++) {
+			bits[(i * 64) + j] = start + j;
+		}
+	}
+	*p_bitmap = bitmapFromBits(bits, runs * 64);
+	free(bits);
+}
+
+/**
+ * 32 bits scattered over a range 64 times larger than the span, so
+ * that almost every word of the bitmap is empty.
+ */
+static void
+generateWide(Bitmap **p_bitmap, int32 span, uint32 seed)
+{
+	int32 bits[32];
+	int32 i;
+
+	rng_state = seed;
+	for (i = 0; i < 32; i++) {
+		bits[i] = nextRandom() % (span * 64);
+	}
+	*p_bitmap = bitmapFromBits(bits, 32);
+}
+
+/**
+ * The set of workloads.
+ */
+static const Workload workloads[] = {
+	{"dense", generateDense},
+	{"sparse", generateSparse},
+	{"clustered", generateClustered},
+	{"wide", generateWide}
+};
+
+
+/*
+ * Kernel functions follow.  Each performs one operation using one or
+ * both of its bitmap arguments.
+ **********************************************************************
+ */
+
+static int64
+runUnion(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return bitmapUnion(bitmap1, bitmap2)->bitmax;
+}
+
+/**
+ * The buffer used by runUnionBuffer().  This is allocated with malloc,
+ * rather than palloc, so that it is neither counted nor freed after
+ * each operation.
+ */
+static void *union_buffer = NULL;
+static Size union_buffer_size = 0;
+
+/**
+ * Create the union in a caller-provided buffer, as an extension using
+ * the C API would.
+ */
+static int64
+runUnionBuffer(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	Size size = bitmapUnionSize(bitmap1, bitmap2);
+
+	if (size > union_buffer_size) {
+		free(union_buffer);
+		union_buffer = malloc(size);
+		union_buffer_size = size;
+	}
+	return bitmapUnionBuffer(bitmap1, bitmap2,
+							 union_buffer, union_buffer_size)->bitmax;
+}
+
+static int64
+runIntersect(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return bitmapIntersect(bitmap1, bitmap2)->bitmax;
+}
+
+static int64
+runMinus(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return bitmapMinus(bitmap1, bitmap2)->bitmax;
+}
+
+/**
+ * Visit every bit in the first bitmap, as bits() does.
+ */
+static int64
+runNextBit(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	int32 bit = bitmap1->bitmin;
+	int64 count = 0;
+	bool  found;
+
+	while (true) {
+		bit = bitmapNextBit(bitmap1, bit, &found);
+		if (!found) {
+			break;
+		}
+		count++;
+		if (bit == bitmap1->bitmax) {
+			break;
+		}
+		bit++;
+	}
+	return count;
+}
+
+static int64
+runSerialise(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return strlen(serialise_bitmap(bitmap1));
+}
+
+/**
+ * The serialised form of the bitmap, for use by runDeserialise().
+ * This is created before timing starts.
+ */
+static char *serialised;
+
+static int64
+runDeserialise(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return deserialise_bitmap(serialised)->bitmax;
+}
+
+static int64
+runCmp(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return bitmapCmp(bitmap1, bitmap2);
+}
+
+/**
+ * Count the bits needed for the Jaccard and Hamming distances, as the
+ * <-> and <#> operators do.
+ */
+static int64
+runDistance(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	int64 card1;
+	int64 card2;
+	int64 common;
+
+	bitmapDistanceCounts(bitmap1, bitmap2, &card1, &card2, &common);
+	return card1 + card2 - common;
+}
+
+/**
+ * Compute the symmetric difference of the bitmaps as the SQL
+ * expression (a + b) - (a * b) would, creating a bitmap for each
+ * operator.
+ */
+static int64
+runExpr(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	return bitmapMinus(bitmapUnion(bitmap1, bitmap2),
+					   bitmapIntersect(bitmap1, bitmap2))->bitmax;
+}
+
+/**
+ * The compiled expression used by runEval().  This is compiled before
+ * timing starts.
+ */
+static BitmapExpr eval_expr;
+
+/**
+ * Compute the same result as runExpr() in a single pass, as
+ * bitmap_eval() does.
+ */
+static int64
+runEval(Bitmap *bitmap1, Bitmap *bitmap2)
+{
+	Bitmap *inputs[2];
+
+	inputs[0] = bitmap1;
+	inputs[1] = bitmap2;
+	return bitmapExprEval(&eval_expr, inputs)->bitmax;
+}
+
+/**
+ * The set of kernels.
+ */
+static const Kernel kernels[] = {
+	{"union", runUnion},
+	{"union_buffer", runUnionBuffer},
+	{"intersect", runIntersect},
+	{"minus", runMinus},
+	{"nextbit", runNextBit},
+	{"serialise", runSerialise},
+	{"deserialise", runDeserialise},
+	{"cmp", runCmp},
+	{"distance", runDistance},
+	{"expr", runExpr},
+	{"eval", runEval}
+};
+
+
+/*
+ * Timing functions follow
+ **********************************************************************
+ */
+
+/**
+ * Return the current time in nanoseconds from an arbitrary start.
+ */
+static int64
+nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/**
+ * Run a kernel against a pair of bitmaps, repeatedly, until at least
+ * min_ns nanoseconds have elapsed, and report the results.  Memory
+ * allocated by each operation is freed after that operation, and the
+ * time taken to do so is included in the results.
+ */
+static void
+benchmark(const Kernel *kernel,
+		  const Workload *workload,
+		  int32 span,
+		  Bitmap *bitmap1,
+		  Bitmap *bitmap2,
+		  int64 min_ns)
+{
+	void  *mark = bench_mark();
+	int64  iterations = 1;
+	int64  elapsed;
+	int64  start;
+	int64  i;
+	Size   bytes;
+	Size   allocs;
+
+	/* Warm up, then double the number of iterations until enough time
+	 * has been spent. */
+	sink = kernel->run(bitmap1, bitmap2);
+	bench_release(mark);
+	while (true) {
+		bytes = bench_bytes_allocated;
+		allocs = bench_allocations;
+		start = nowNs();
+		for (i = 0; i < iterations; i++) {
+			sink = kernel->run(bitmap1, bitmap2);
+			bench_release(mark);
+		}
+		elapsed = nowNs() - start;
+		if ((elapsed >= min_ns) || (iterations >= (INT64_MAX / 2))) {
+			break;
+		}
+		iterations *= 2;
+	}
+
+	printf("%s\t%s\t%d\t%lld\t%lld\t%.1f\t%.1f\t%.2f\n",
+		   kernel->name, workload->name, span,
+		   (long long) bitmapCardinality(bitmap1),
+		   (long long) iterations,
+		   (double) elapsed / iterations,
+		   (double) (bench_bytes_allocated - bytes) / iterations,
+		   (double) (bench_allocations - allocs) / iterations);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	int64       min_ns = 200 * 1000000LL;
+	const char *only = NULL;
+	Bitmap     *bitmap1;
+	Bitmap     *bitmap2;
+	int32       w;
+	int32       s;
+	int32       k;
+	void       *mark;
+
+	if (argc > 1) {
+		min_ns = atoll(argv[1]) * 1000000LL;
+	}
+	if (argc > 2) {
+		only = argv[2];
+	}
+
+	bitmapExprCompile("(a + b) - (a * b)", &eval_expr);
+
+	printf("# pgbitmap %s, %d-bit words\n", PGBITMAP_VERSION, ELEMBITS);
+	printf("kernel\tworkload\tspan\tbits\titerations\t"
+		   "ns_per_op\tbytes_per_op\tallocs_per_op\n");
+
+	for (w = 0; w < lengthof(workloads); w++) {
+		for (s = 0; s < lengthof(spans); s++) {
+			mark = bench_mark();
+			workloads[w].generate(&bitmap1, spans[s], 12345);
+			workloads[w].generate(&bitmap2, spans[s], 54321);
+			serialised = serialise_bitmap(bitmap1);
+
+			for (k = 0; k < lengthof(kernels); k++) {
+				if (only && strcmp(only, kernels[k].name) != 0) {
+					continue;
+				}
+				benchmark(&kernels[k], &workloads[w], spans[s],
+						  bitmap1, bitmap2, min_ns);
+			}
+			bench_release(mark);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+-- setup.sql
+--
+--      Create the data used by the pgbench scripts in this directory.
+--      This is run by test/bench/run_pgbench with the psql variable
+--      scale set.  At scale 1 there are 100,000 users and documents,
+--      and 500,000 group memberships.
+--
+--      Copyright (c) 2020 Marc Munro
+--      Author:  Marc Munro
+--      License: BSD
+
+\set ON_ERROR_STOP true
+
+create extension if not exists pgbitmap;
+
+drop schema if exists pgbitmap_bench cascade;
+create schema pgbitmap_bench;
+set search_path = pgbitmap_bench, public;
+
+-- Each member belongs to 5 of 1000 groups.
+create table members as
+select m as member, ((m * 7919) + (k * 104729)) % 1000 as grp
+  from generate_series(1, :scale * 100000) m
+ cross join generate_series(1, 5) k;
+
+-- The same memberships, aggregated into a bitmap for each group.
+create table groups as
+select grp, bitmap_of(member) as members
+  from members
+ group by grp;
+
+alter table groups add primary key (grp);
+
+-- Each user has 20 privileges from a set of 10,000, in the style of
+-- veil2.
+create table user_privs as
+select u as user_id,
+       (select bitmap_of(((u * 31) + (i * i * 17)) % 10000)
+          from generate_series(1, 20) i) as privs
+  from generate_series(1, :scale * 100000) u;
+
+alter table user_privs add primary key (user_id);
+
+-- Each document requires one privilege to be seen.
+create table documents as
+select d as doc_id, (d * 7) % 10000 as required_priv
+  from generate_series(1, :scale * 100000) d;
+
+-- Target for the COPY in benchmark.
+create table user_privs_load (like user_privs);
+
+analyze;
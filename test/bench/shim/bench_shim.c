@@ -0,0 +1,192 @@
+/**
+ * @file   bench_shim.c
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * Implementations of the postgres functions declared in the stand-in
+ * postgres.h for the standalone benchmark.
+ */
+
+#include <stdarg.h>
+#include "postgres.h"
+
+/**
+ * Header for each block of memory allocated by palloc().  Blocks are
+ * kept on a doubly linked list, newest first, so that bench_release()
+ * can free everything allocated since a given point.
+ */
+typedef struct BenchChunk {
+	struct BenchChunk *prev;  /**< The next older chunk */
+	struct BenchChunk *next;  /**< The next newer chunk */
+	Size   size;              /**< The size requested by palloc() */
+	Size   pad;               /**< Keeps the user data MAXALIGNed */
+} BenchChunk;
+
+/**
+ * The total number of bytes requested from palloc().
+ */
+Size bench_bytes_allocated = 0;
+
+/**
+ * The total number of calls to palloc().
+ */
+Size bench_allocations = 0;
+
+/**
+ * The most recently allocated chunk that has not been freed.
+ */
+static BenchChunk *newest = NULL;
+
+/**
+ * The most recent message passed to errmsg().
+ */
+static char last_message[256] = "";
+
+
+/**
+ * Allocate memory, recording the allocation.  As in postgres, requests
+ * for more than MaxAllocSize bytes are rejected.
+ *
+ * @param size The number of bytes required
+ *
+ * @return Pointer to the allocated memory.
+ */
+void *
+palloc(Size size)
+{
+	BenchChunk *chunk;
+
+	if (!AllocSizeIsValid(size)) {
+		errmsg("invalid memory alloc request size %zu", size);
+		bench_report(ERROR);
+	}
+	chunk = malloc(sizeof(BenchChunk) + size);
+	if (!chunk) {
+		fprintf(stderr, "out of memory allocating %zu bytes\n", size);
+		exit(2);
+	}
+	chunk->size = size;
+	chunk->next = NULL;
+	chunk->prev = newest;
+	if (newest) {
+		newest->next = chunk;
+	}
+	newest = chunk;
+	bench_bytes_allocated += size;
+	bench_allocations++;
+	return (void *) (chunk + 1);
+}
+
+/**
+ * Allocate zeroed memory, recording the allocation.
+ *
+ * @param size The number of bytes required
+ *
+ * @return Pointer to the allocated memory.
+ */
+void *
+palloc0(Size size)
+{
+	void *result = palloc(size);
+
+	memset(result, 0, size);
+	return result;
+}
+
+/**
+ * Free memory allocated by palloc().
+ *
+ * @param pointer The memory to be freed
+ */
+void
+pfree(void *pointer)
+{
+	BenchChunk *chunk = ((BenchChunk *) pointer) - 1;
+
+	if (chunk->next) {
+		chunk->next->prev = chunk->prev;
+	}
+	else {
+		newest = chunk->prev;
+	}
+	if (chunk->prev) {
+		chunk->prev->next = chunk->next;
+	}
+	free(chunk);
+}
+
+/**
+ * Identify the current point in the allocation history, for use with
+ * bench_release().
+ *
+ * @return An opaque marker.
+ */
+void *
+bench_mark(void)
+{
+	return newest;
+}
+
+/**
+ * Free everything allocated since bench_mark() was called, much as
+ * resetting a memory context would in postgres.
+ *
+ * @param mark The value previously returned by bench_mark()
+ */
+void
+bench_release(void *mark)
+{
+	BenchChunk *chunk;
+
+	while (newest && (newest != (BenchChunk *) mark)) {
+		chunk = newest;
+		newest = chunk->prev;
+		free(chunk);
+	}
+	if (newest) {
+		newest->next = NULL;
+	}
+}
+
+
+int
+errcode(int sqlerrcode)
+{
+	return 0;
+}
+
+int
+errmsg(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(last_message, sizeof(last_message), fmt, args);
+	va_end(args);
+	return 0;
+}
+
+int
+errdetail(const char *fmt, ...)
+{
+	return 0;
+}
+
+/**
+ * Complete an ereport() call.  Anything of ERROR level or above
+ * terminates the benchmark.
+ *
+ * @param elevel The level of the report
+ */
+void
+bench_report(int elevel)
+{
+	if (elevel >= ERROR) {
+		fprintf(stderr, "ERROR: %s\n", last_message);
+		exit(2);
+	}
+}
@@ -0,0 +1,15 @@
+/*
+ * funcapi.h
+ *
+ *      Stand-in for the postgres header of the same name, used
+ *      by the standalone benchmark.  See postgres.h in this directory.
+ */
+
+#ifndef PGBITMAP_BENCH_FUNCAPI
+#define PGBITMAP_BENCH_FUNCAPI 1
+
+typedef struct FunctionCallInfoBaseData *FunctionCallInfo;
+
+#define PG_FUNCTION_ARGS FunctionCallInfo fcinfo
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file   postgres.h
+ * \code
+ *     Author:       Marc Munro
+ *     Copyright (c) 2020 Marc Munro
+ *     License:      BSD
+ *
+ * \endcode
+ * @brief
+ * Minimal stand-in for the postgres server headers, providing just
+ * enough for the low-level functions of pgbitmap.c to be built into
+ * the standalone benchmark (see test/bench/bench_kernels.c).  Memory
+ * allocation is done with malloc, with every allocation being
+ * recorded so that the benchmark can report the number of bytes
+ * allocated, and can free everything allocated by an operation in the
+ * way that postgres would reset a memory context.
+ */
+
+#ifndef PGBITMAP_BENCH_POSTGRES
+/**
+ * Prevent this header from being included multiple times.
+ */
+#define PGBITMAP_BENCH_POSTGRES 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIZEOF_VOID_P __SIZEOF_POINTER__
+
+typedef int8_t   int8;
+typedef int16_t  int16;
+typedef int32_t  int32;
+typedef int64_t  int64;
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef size_t   Size;
+typedef uintptr_t Datum;
+typedef char    *Pointer;
+
+#define MAXIMUM_ALIGNOF 8
+#define MAXALIGN(len) \
+	(((uintptr_t) (len) + (MAXIMUM_ALIGNOF - 1)) & \
+	 ~((uintptr_t) (MAXIMUM_ALIGNOF - 1)))
+
+#define VARHDRSZ ((int32) sizeof(int32))
+#define SET_VARSIZE(ptr, len) (*((uint32 *) (ptr)) = (uint32) (len))
+#define VARSIZE(ptr) (*((uint32 *) (ptr)))
+
+#define UINT64CONST(x) UINT64_C(x)
+#define PG_UINT32_MAX UINT32_MAX
+#define PG_INT32_MIN INT32_MIN
+#define PG_INT32_MAX INT32_MAX
+
+#define lengthof(array) (sizeof (array) / sizeof ((array)[0]))
+
+#define PG_MODULE_MAGIC extern int pgbitmap_bench_no_magic
+
+#define CHECK_FOR_INTERRUPTS()
+
+#define unlikely(x) __builtin_expect((x) != 0, 0)
+
+#define MaxAllocSize ((Size) 0x3fffffff)
+#define AllocSizeIsValid(size) ((Size) (size) <= MaxAllocSize)
+
+
+/*
+ * Memory allocation.
+ */
+
+extern Size bench_bytes_allocated;
+extern Size bench_allocations;
+
+extern void *palloc(Size size);
+extern void *palloc0(Size size);
+extern void pfree(void *pointer);
+extern void *bench_mark(void);
+extern void bench_release(void *mark);
+
+
+/*
+ * Error reporting.  Errors are not expected in the benchmark, so any
+ * ERROR is reported to stderr and terminates the program.
+ */
+
+#define NOTICE 18
+#define WARNING 19
+#define ERROR 21
+
+#define ERRCODE_INTERNAL_ERROR 1
+#define ERRCODE_INVALID_PARAMETER_VALUE 2
+#define ERRCODE_INVALID_BINARY_REPRESENTATION 3
+#define ERRCODE_INVALID_TEXT_REPRESENTATION 4
+
+extern int errcode(int sqlerrcode);
+extern int errmsg(const char *fmt, ...);
+extern int errdetail(const char *fmt, ...);
+extern void bench_report(int elevel);
+
+#define ereport(elevel, rest) \
+	do { (void) rest; bench_report(elevel); } while (0)
+
+#endif
@@ -0,0 +1,6 @@
+/*
+ * utils/varbit.h
+ *
+ *      Empty stand-in for the postgres header of the same name, used
+ *      by the standalone benchmark.  See postgres.h in this directory.
+ */
@@ -103,6 +103,18 @@ end;
 $$
 language 'plpgsql' security definer volatile;
 
+create or replace
+function plan_rows(qry text) returns integer as
+$$
+declare
+  plan json;
+begin
+  execute 'explain (format json) ' || qry into plan;
+  return (plan->0->'Plan'->>'Plan Rows')::integer;
+end;
+$$
+language 'plpgsql' volatile;
+
 create extension pgbitmap;
 
 -- We put expect() into the where clause so that no rows are returned
@@ -394,6 +406,1345 @@ select null
     or expect(bi ? 322, true, '322 SHOULD BE IN INTERSECTION AGG')
     or expect(bi ? 701, true, '701 SHOULD BE IN INTERSECTION AGG');
 
+-- containment and overlap
+with set1 as (
+  select to_bitmap('{13, 171, 222, 279, 322, 701, 900}') as bm1),
+set2 as (
+  select to_bitmap('{171, 279, 900}') as bm2),
+set3 as (
+  select to_bitmap('{172, 900}') as bm3)
+select null
+  from set1 cross join set2 cross join set3
+ where record_test(21)
+    or expect(bm1 @> bm2, true, 'BM1 SHOULD CONTAIN BM2')
+    or expect(bm1 @> bm3, false, 'BM1 SHOULD NOT CONTAIN BM3')
+    or expect(bm2 <@ bm1, true, 'BM2 SHOULD BE CONTAINED BY BM1')
+    or expect(bm1 <@ bm2, false, 'BM1 SHOULD NOT BE CONTAINED BY BM2')
+    or expect(bm1 @> bitmap(), true, 'BM1 SHOULD CONTAIN EMPTY BITMAP')
+    or expect(bitmap() @> bm1, false, 'EMPTY BITMAP SHOULD NOT CONTAIN BM1')
+    or expect(bm1 && bm3, true, 'BM1 SHOULD OVERLAP BM3')
+    or expect(bm2 && bm3, true, 'BM2 SHOULD OVERLAP BM3')
+    or expect(bm2 && to_bitmap('{172, 223}'), false,
+              'BM2 SHOULD NOT OVERLAP')
+    or expect(bitmap() && bm1, false, 'EMPTY BITMAP SHOULD NOT OVERLAP');
+
+-- planner statistics and selectivity
+create temporary table bitmap_stats_test as
+select bitmap(42) + (n % 100) + (1000 + n) as privs
+  from generate_series(1, 2000) n;
+
+analyze bitmap_stats_test;
+
+select null
+ where record_test(22)
+    or expect((select 42 = any(most_common_elems::text::int4[])
+                 from pg_stats
+                where tablename = 'bitmap_stats_test'),
+              true, '42 SHOULD BE A MOST COMMON BIT')
+    or expect(plan_rows('select * from bitmap_stats_test where privs ? 42')
+                > 1500, true, 'PRIVS ? 42 SHOULD MATCH MOST ROWS')
+    or expect(plan_rows('select * from bitmap_stats_test where privs ? 5000')
+                < 20, true, 'PRIVS ? 5000 SHOULD MATCH FEW ROWS')
+    or expect(plan_rows('select * from bitmap_stats_test
+                          where privs @> bitmap(42) + 7') < 100, true,
+              'PRIVS @> {7, 42} SHOULD MATCH FEW ROWS');
+
+-- rank and select
+with set1 as (
+  select to_bitmap('{13, 171, 222, 279, 322, 701, 900}') as bm1),
+set2 as (
+  select bitmap_rank_index(bitmap_of(x)) as bm2
+    from generate_series(1, 100000, 3) x),
+set3 as (
+  select bitmap_of(x) as bm3
+    from generate_series(1, 100000, 3) x)
+select null
+  from set1 cross join set2 cross join set3
+ where record_test(23)
+    or expect(bitmap_rank(bm1, 222)::integer, 3, '222 SHOULD HAVE RANK 3')
+    or expect(bitmap_rank(bm1, 300)::integer, 4, '300 SHOULD HAVE RANK 4')
+    or expect(bitmap_rank(bm1, 0)::integer, 0, '0 SHOULD HAVE RANK 0')
+    or expect(bitmap_rank(bm1, 1000)::integer, 7, '1000 SHOULD HAVE RANK 7')
+    or expect(bitmap_rank(bitmap(), 1)::integer, 0,
+              'EMPTY BITMAP SHOULD HAVE RANK 0')
+    or expect(bitmap_select(bm1, 3), 222, 'THIRD BIT SHOULD BE 222')
+    or expect(bitmap_select(bm1, 7), 900, 'SEVENTH BIT SHOULD BE 900')
+    or expect(bitmap_select(bm1, 8), null, 'THERE SHOULD BE NO EIGHTH BIT')
+    or expect(bitmap_select(bm1, 0), null, 'THERE SHOULD BE NO ZEROTH BIT')
+    or expect(bitmap_select(bm2, 10000), 29998,
+              '10000TH BIT SHOULD BE 29998')
+    or expect(bitmap_select(bm3, 10000), 29998,
+              '10000TH BIT SHOULD BE 29998(2)')
+    or expect(bitmap_rank(bm2, 29998)::integer, 10000,
+              '29998 SHOULD HAVE RANK 10000')
+    or expect(bitmap_rank(bm3, 29999)::integer, 10000,
+              '29999 SHOULD HAVE RANK 10000')
+    or expect(bm2 = bm3, true, 'RANK INDEX SHOULD NOT AFFECT EQUALITY');
+
+-- Each iteration of a plpgsql loop evaluates the same expression, with
+-- the same fn_extra, for a different value of the bitmap parameter, so
+-- no rank directory may be cached for it.
+create or replace
+function ranks_in_loop(bit int4, n int8) returns text as
+$$
+declare
+  bm bitmap;
+  result text = '';
+begin
+  foreach bm in array array[to_bitmap('{1, 2, 3}'), to_bitmap('{1, 3}')]
+  loop
+    result = result || bitmap_rank(bm, bit) || ':' ||
+                       bitmap_select(bm, n) || ';';
+  end loop;
+  return result;
+end;
+$$
+language plpgsql;
+
+select null
+ where record_test(24)
+    or expect((select count(*)
+                 from generate_series(1, 500) n
+                where bitmap_select(to_bitmap('{5, 99, 1000, 70000}'),
+                                    (n % 4) + 1)
+                        = (array[5, 99, 1000, 70000])[(n % 4) + 1])::integer,
+              500, 'CACHED SELECT SHOULD BE STABLE')
+    or expect((select count(*)
+                 from generate_series(1, 500) n
+                where bitmap_rank(to_bitmap('{5, 99, 1000, 70000}'), n * 150)
+                        = (select count(*)
+                             from unnest(array[5, 99, 1000, 70000]) e
+                            where e <= n * 150))::integer,
+              500, 'CACHED RANK SHOULD BE STABLE')
+    or expect(ranks_in_loop(3, 2) = '3:2;2:3;', true,
+              'RANK OF PARAMETER SHOULD NOT BE CACHED');
+
+-- bounded and reverse bits()
+with set1 as (
+  select to_bitmap('{-70, -1, 0, 13, 63, 64, 127, 128, 222, 900}') as bm1)
+select null
+  from set1
+ where record_test(25)
+    or expect((select array_agg(b)::text from bits(bm1, 13, 222) b)
+                = '{13,63,64,127,128,222}', true, 'BOUNDED BITS INCORRECT')
+    or expect((select array_agg(b)::text from bits(bm1, 14, 221) b)
+                = '{63,64,127,128}', true, 'BOUNDED BITS INCORRECT(2)')
+    or expect((select array_agg(b)::text from bits(bm1, 64, null, 3) b)
+                = '{64,127,128}', true, 'LIMITED BITS INCORRECT')
+    or expect((select array_agg(b)::text from bits(bm1, null, 0) b)
+                = '{-70,-1,0}', true, 'BOUNDED BITS INCORRECT(3)')
+    or expect((select count(*) from bits(bm1, 300, 800))::integer,
+              0, 'THERE SHOULD BE NO BITS BETWEEN 300 AND 800')
+    or expect((select count(*) from bits(bm1, 222, 13))::integer,
+              0, 'THERE SHOULD BE NO BITS IN AN INVERTED RANGE')
+    or expect((select count(*) from bits(bm1, null, null, 0))::integer,
+              0, 'A ZERO LIMIT SHOULD RETURN NO BITS')
+    or expect((select count(*) from bits(null, null, null))::integer,
+              0, 'A NULL BITMAP SHOULD HAVE NO BITS')
+    or expect((select array_agg(b)::text from bits_reverse(bm1) b)
+                = '{900,222,128,127,64,63,13,0,-1,-70}',
+              true, 'REVERSE BITS INCORRECT')
+    or expect((select array_agg(b)::text from bits_reverse(bm1, 0, 127) b)
+                = '{127,64,63,13,0}', true, 'BOUNDED REVERSE BITS INCORRECT')
+    or expect((select array_agg(b)::text
+                 from bits_reverse(bm1, max_rows => 2) b)
+                = '{900,222}', true, 'LIMITED REVERSE BITS INCORRECT')
+    or expect((select max(b) from bits(bitmap(2147483647), 0, null) b),
+              2147483647, 'EXTREME BITS INCORRECT')
+    or expect((select min(b)
+                 from bits_reverse(bitmap((-2147483648)::int4)) b),
+              (-2147483648)::int4, 'EXTREME BITS INCORRECT(2)');
+
+-- bits() in materialize and value-per-call modes
+with set1 as (
+  select bitmap_of(x) as bm1
+    from (select generate_series(-1000, 1000, 7) x
+          union all
+          select generate_series(5000, 6000)) x)
+select null
+  from set1
+ where record_test(26)
+    or expect((select array_agg(b order by b) from bits(bm1) b)
+                = to_array(bm1), true, 'MATERIALIZED BITS INCORRECT')
+    or expect((select count(*) from bits(bm1))::integer,
+              1287, 'MATERIALIZED BITS COUNT INCORRECT')
+    or expect((select array_agg(b) from (select bits(bm1) b) x)
+                = to_array(bm1), true, 'PER-CALL BITS INCORRECT')
+    or expect((select count(*)
+                 from (select bits(bm1) limit 10) x)::integer,
+              10, 'LIMITED PER-CALL BITS INCORRECT')
+    or expect((select array_agg(b) from bits(bm1, -20, 20) b)::text
+                = '{-20,-13,-6,1,8,15}', true, 'MATERIALIZED RANGE INCORRECT')
+    or expect((select array_agg(b) from bits_reverse(bm1, 5995, 6003) b)::text
+                = '{6000,5999,5998,5997,5996,5995}', true,
+              'MATERIALIZED REVERSE RANGE INCORRECT')
+    or expect((select array_agg(b) from bits_reverse(bm1, null, -990) b)::text
+                = '{-993,-1000}', true,
+              'MATERIALIZED REVERSE RANGE INCORRECT(2)');
+
+-- Text round trip of a bitmap too large for a single line of base64,
+-- and intersection of bitmaps whose ranges do not overlap.
+with set1 as (
+  select bitmap_of(x) as bm1
+    from generate_series(1, 5000, 3) x)
+select null
+  from set1
+ where record_test(27)
+    or expect(bm1::text::bitmap = bm1, true, 'LARGE BITMAP TEXT ROUND TRIP')
+    or expect(position(E'\n' in bm1::text), 0,
+              'SERIALISED BITMAP SHOULD NOT CONTAIN NEWLINES')
+    or expect(is_empty(bitmap(1) * bitmap(100000)), true,
+              'DISJOINT INTERSECTION SHOULD BE EMPTY')
+    or expect(is_empty(bm1 * (bitmap(-500000) + 500000)), true,
+              'DISJOINT INTERSECTION SHOULD BE EMPTY(2)');
+
+-- Runtime statistics.  Counting is off by default, so nothing is
+-- counted until pgbitmap.track_stats is set.
+do $$
+begin
+  perform pgbitmap_stats_reset();
+  perform bitmap(1) + 2;
+end;
+$$;
+
+select null
+ where record_test(28)
+    or expect((select count(*) from pgbitmap_stats()
+                where stat like 'calls.%')::integer,
+              0, 'CALLS COUNTED WITH TRACK_STATS OFF');
+
+-- While statistics are being tracked, record_test() is called after
+-- the checks, as the bitmaps that it uses are themselves counted.
+set local pgbitmap.track_stats = on;
+do $$
+begin
+  perform bitmap_of(x) + bitmap(100000)
+     from generate_series(1, 1000) x;
+end;
+$$;
+
+select null
+ where expect((select value from pgbitmap_stats()
+                where stat = 'calls.bitmap_union')::integer,
+              1, 'BITMAP_UNION CALL NOT COUNTED')
+    or expect((select value > 0 from pgbitmap_stats()
+                where stat = 'bitmaps_allocated'),
+              true, 'BITMAP ALLOCATIONS NOT COUNTED')
+    or expect((select value > 0 from pgbitmap_stats()
+                where stat = 'extensions'),
+              true, 'BITMAP EXTENSIONS NOT COUNTED')
+    or record_test(48);
+
+do $$
+begin
+  perform pgbitmap_stats_reset();
+end;
+$$;
+
+select null
+ where expect((select sum(value) from pgbitmap_stats())::integer,
+              0, 'STATS NOT RESET')
+    or record_test(49);
+set local pgbitmap.track_stats = off;
+
+-- Moving window frames, which use the moving-aggregate forms of the
+-- aggregates, should give the same results as aggregating each frame
+-- from scratch.  Day 13 has a null bitmap and day 20 an empty one.
+create temporary table days as
+select d as day,
+       case when d = 13 then null
+            when d = 20 then bitmap()
+            else bitmap_of(x) end as members
+  from generate_series(1, 30) d
+ cross join lateral generate_series(d * 50, d * 50 + (d % 7) * 200, 3) x
+ group by d;
+
+with windowed as (
+  select day,
+         union_of(members) over w as u,
+         intersect_of(members) over w as i,
+         bitmap_of(day * 100 + (day % 3)) over w as b
+    from days
+  window w as (order by day rows 4 preceding)),
+fresh as (
+  select d1.day,
+         union_of(d2.members) as u,
+         intersect_of(d2.members) as i,
+         bitmap_of(d2.day * 100 + (d2.day % 3)) as b
+    from days d1
+   inner join days d2
+      on d2.day between d1.day - 4 and d1.day
+   group by d1.day)
+select null
+ where record_test(29)
+    or expect((select bool_and(w.u is not distinct from f.u)
+                 from windowed w inner join fresh f using (day)),
+              true, 'MOVING UNION_OF INCORRECT')
+    or expect((select bool_and(w.i is not distinct from f.i)
+                 from windowed w inner join fresh f using (day)),
+              true, 'MOVING INTERSECT_OF INCORRECT')
+    or expect((select bool_and(w.b is not distinct from f.b)
+                 from windowed w inner join fresh f using (day)),
+              true, 'MOVING BITMAP_OF INCORRECT');
+
+-- Frozen bitmaps.  Tests, scans, rank, select and intersection work
+-- directly on the frozen form; anything else thaws the bitmap first.
+create temporary table sparse as
+select bitmap_of(x * 100003) as plain,
+       bitmap_freeze(bitmap_of(x * 100003)) as frozen,
+       bitmap_of(x * 300009 - 2) as other
+  from generate_series(-100, 300) x;
+
+select null
+  from sparse
+ where record_test(30)
+    or expect(bitmap_is_frozen(frozen), true, 'BITMAP NOT FROZEN')
+    or expect(bitmap_is_frozen(plain), false, 'PLAIN BITMAP IS FROZEN')
+    or expect(bitmap_is_frozen(bitmap_freeze(bitmap(5))), false,
+              'SINGLE BIT BITMAP SHOULD NOT FREEZE')
+    or expect(bitmap_is_frozen(bitmap_freeze(to_bitmap('{1,2,3,4,5,6}'))),
+              false, 'DENSE BITMAP SHOULD NOT FREEZE')
+    or expect(bitmap_is_frozen(bitmap_freeze(bitmap())), false,
+              'EMPTY BITMAP SHOULD NOT FREEZE')
+    or expect(bitmap_is_frozen(bitmap_thaw(frozen)), false,
+              'THAWED BITMAP IS FROZEN')
+    or expect(bitmap_thaw(frozen) = plain, true, 'THAWED BITMAP DIFFERS')
+    or expect(frozen = plain, true, 'FROZEN BITMAP NOT EQUAL')
+    or expect(frozen::text = plain::text, true, 'FROZEN TEXT DIFFERS')
+    or expect(bitmin(frozen), -10000300, 'FROZEN BITMIN')
+    or expect(bitmax(frozen), 30000900, 'FROZEN BITMAX')
+    or expect(is_empty(frozen), false, 'FROZEN BITMAP IS EMPTY')
+    or expect((select bool_and(frozen ? (x * 100003) and
+                               not frozen ? (x * 100003 + 1))
+                 from generate_series(-100, 300) x),
+              true, 'FROZEN TESTBIT')
+    or expect(frozen ? 0, true, 'FROZEN TESTBIT(2)')
+    or expect(frozen ? 2147483647, false, 'FROZEN TESTBIT(3)')
+    or expect((select array_agg(b) from bits(frozen) b) =
+              (select array_agg(b) from bits(plain) b),
+              true, 'FROZEN BITS')
+    or expect((select array_agg(b) from (select bits(frozen) b) x) =
+              (select array_agg(b) from (select bits(plain) b) x),
+              true, 'FROZEN BITS PER CALL')
+    or expect((select array_agg(b) from bits(frozen, -500000, 500000) b) =
+              (select array_agg(b) from bits(plain, -500000, 500000) b),
+              true, 'FROZEN BITS RANGE')
+    or expect((select array_agg(b)
+                 from (select bits_reverse(frozen, null, 1000000, 5) b) x) =
+              (select array_agg(b)
+                 from (select bits_reverse(plain, null, 1000000, 5) b) x),
+              true, 'FROZEN BITS REVERSE')
+    or expect((select bool_and(bitmap_rank(frozen, x) =
+                               bitmap_rank(plain, x))
+                 from generate_series(-20000000, 40000000, 99991) x),
+              true, 'FROZEN RANK')
+    or expect((select bool_and(bitmap_select(frozen, n) is not distinct from
+                               bitmap_select(plain, n))
+                 from generate_series(0, 402) n),
+              true, 'FROZEN SELECT')
+    or expect(frozen * other = plain * other, true, 'FROZEN INTERSECTION')
+    or expect(other * frozen = plain * other, true, 'FROZEN INTERSECTION(2)')
+    or expect(frozen * bitmap_freeze(other) = plain * other, true,
+              'FROZEN INTERSECTION(3)')
+    or expect(bitmap_is_frozen(frozen * other), false,
+              'INTERSECTION SHOULD NOT BE FROZEN')
+    or expect(frozen + 7 = plain + 7, true, 'FROZEN SETBIT')
+    or expect(frozen - 0 = plain - 0, true, 'FROZEN CLEARBIT')
+    or expect(frozen + other = plain + other, true, 'FROZEN UNION');
+
+-- Conversion to and from bytea and varbit.
+create or replace
+function bad_bytea(bytes bytea) returns boolean as
+$$
+begin
+  perform bytes::bitmap;
+  return false;
+exception
+  when invalid_binary_representation then
+    return true;
+end;
+$$
+language plpgsql;
+
+select null
+ where record_test(31)
+    or expect('0101'::varbit::bitmap = to_bitmap('{1,3}'), true,
+              'VARBIT TO BITMAP')
+    or expect(to_bitmap('{1,3}')::varbit = '0101'::varbit, true,
+              'BITMAP TO VARBIT')
+    or expect(is_empty('0000'::varbit::bitmap), true,
+              'EMPTY VARBIT TO BITMAP')
+    or expect(length(bitmap()::varbit), 0, 'EMPTY BITMAP TO VARBIT')
+    or expect((select bool_and(b::varbit::bitmap = b)
+                 from (select bitmap_of(x * 37 + y) b
+                         from generate_series(0, 100) x,
+                              generate_series(0, 40) y
+                        group by y) x),
+              true, 'VARBIT ROUND TRIP')
+    or expect((select bool_and(b::bytea::bitmap = b)
+                 from (select bitmap_of(x * 37 * y - 1500) b
+                         from generate_series(0, 100) x,
+                              generate_series(0, 40) y
+                        group by y) x),
+              true, 'BYTEA ROUND TRIP')
+    or expect(is_empty(bitmap()::bytea::bitmap), true,
+              'EMPTY BYTEA ROUND TRIP')
+    or expect(to_bitmap('{0,3,64}')::bytea =
+              '\x000000004000000009000000000000000100000000000000'::bytea,
+              true, 'BYTEA FORMAT')
+    or expect((select bitmap_freeze(b)::bytea::bitmap = b
+                 from (select bitmap_of(x * 100003) b
+                         from generate_series(-100, 300) x) x),
+              true, 'FROZEN BITMAP TO BYTEA')
+    or expect(bad_bytea('\x0000'), true, 'SHORT BYTEA ACCEPTED')
+    or expect(bad_bytea('\x0000000040000000090000000000000001'), true,
+              'TRUNCATED BYTEA ACCEPTED')
+    or expect(bad_bytea('\x01000000000000000000000000000000'), true,
+              'INVERTED BYTEA RANGE ACCEPTED');
+
+-- Conversion to and from the Roaring portable serialisation format.
+create or replace
+function bad_roaring(bytes bytea) returns boolean as
+$$
+begin
+  perform bitmap_from_roaring(bytes);
+  return false;
+exception
+  when invalid_binary_representation then
+    return true;
+end;
+$$
+language plpgsql;
+
+select null
+ where record_test(32)
+    or expect(bitmap_to_roaring(to_bitmap('{1,3}')) =
+              '\x3a30000001000000000001001000000001000300'::bytea, true,
+              'ROARING ARRAY CONTAINER')
+    or expect(bitmap_from_roaring(
+                  '\x3a30000001000000000001001000000001000300') =
+              to_bitmap('{1,3}'), true, 'ROARING ARRAY CONTAINER(2)')
+    or expect((select bitmap_to_roaring(bitmap_of(x))
+                 from generate_series(0, 99) x) =
+              '\x3b3000000100006300010000006300'::bytea, true,
+              'ROARING RUN CONTAINER')
+    or expect((select bitmap_from_roaring(
+                          '\x3b3000000100006300010000006300') = bitmap_of(x)
+                 from generate_series(0, 99) x), true,
+              'ROARING RUN CONTAINER(2)')
+    or expect(bitmap_to_roaring(to_bitmap('{-1,5}')) =
+              '\x3a3000000200000000000000ffff0000180000001a0000000500ffff'
+                  ::bytea, true, 'ROARING NEGATIVE')
+    or expect(bitmap_from_roaring(
+                  '\x3a3000000200000000000000ffff0000180000001a0000000500ffff')
+              = to_bitmap('{-1,5}'), true, 'ROARING NEGATIVE(2)')
+    or expect(is_empty(bitmap_from_roaring(bitmap_to_roaring(bitmap()))),
+              true, 'ROARING EMPTY')
+    or expect((select bool_and(bitmap_from_roaring(bitmap_to_roaring(b)) = b)
+                 from (select bitmap_of(x * y - 300000) b
+                         from generate_series(0, 20000) x,
+                              generate_series(1, 40, 3) y
+                        where x % y != 1
+                        group by y) x),
+              true, 'ROARING ROUND TRIP')
+    or expect((select bitmap_from_roaring(
+                          bitmap_to_roaring(bitmap_freeze(b))) = b
+                 from (select bitmap_of(x * 100003) b
+                         from generate_series(-100, 300) x) x),
+              true, 'ROARING FROZEN')
+    or expect(bad_roaring('\x3a300000'), true, 'SHORT ROARING ACCEPTED')
+    or expect(bad_roaring('\x3a300000010000000000010010000000010003'),
+              true, 'TRUNCATED ROARING ACCEPTED')
+    or expect(bad_roaring('\x3a30000001000000000001001000000003000100'),
+              true, 'UNSORTED ROARING ACCEPTED')
+    or expect(bad_roaring('\x3c3000000100006300010000006300'),
+              true, 'BAD ROARING COOKIE ACCEPTED');
+
+-- Results are sized to fit their bits.
+select null
+ where record_test(33)
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size(bitmap(1) + 1000000 - 1000000),
+              'CLEARBIT NOT RIGHT-SIZED')
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size(bitmap(1000000) + 1 - 1000000),
+              'CLEARBIT NOT RIGHT-SIZED(2)')
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size((bitmap(1) + 1000000) * bitmap(1)),
+              'INTERSECTION NOT RIGHT-SIZED')
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size((bitmap(1) + 1000000) - bitmap(1000000)),
+              'MINUS NOT RIGHT-SIZED')
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size(bitmap(1) + (bitmap(1000000) - 1000000)),
+              'UNION NOT RIGHT-SIZED')
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size(bitmap_setmax(bitmap(1) + 1000000, 10)),
+              'SETMAX NOT RIGHT-SIZED')
+    or expect(bitmap_storage_size(bitmap(1)),
+              bitmap_storage_size(bitmap_setmin(bitmap(1) + 1000000, 10)),
+              'SETMIN NOT RIGHT-SIZED')
+    or expect(bitmap() + 1000 = bitmap(1000), true,
+              'SETBIT IN EMPTY BITMAP')
+    or expect(to_bitmap('{5,70}') - to_bitmap('{1,100}') =
+              to_bitmap('{5,70}'), true, 'MINUS CLEARED WRONG BIT')
+    or expect(bitmin(bitmap_setmin(to_bitmap('{1,70}'), 2)), 70,
+              'SETMIN BITMIN INCORRECT')
+    or expect(bitmax(bitmap_setmax(to_bitmap('{1,70}'), 69)), 1,
+              'SETMAX BITMAX INCORRECT')
+    or expect(is_empty(bitmap_setmin(to_bitmap('{1,70}'), 71)), true,
+              'SETMIN BEYOND BITMAX')
+    or expect(bitmap_compact(to_bitmap('{1,3,1000}')) =
+              to_bitmap('{1,3,1000}'), true, 'COMPACT CHANGED BITMAP')
+    or expect(bitmap_is_frozen(bitmap_compact(bitmap_freeze(
+                  bitmap(1) + 100000000))), true, 'COMPACT THAWED BITMAP')
+    or expect((select bitmap_storage_size(bitmap_compact(b)) =
+                      bitmap_storage_size(b)
+                 from (select bitmap_rank_index(bitmap_of(x)) b
+                         from generate_series(1, 100000) x) x),
+              true, 'COMPACT DROPPED RANK DIRECTORY');
+
+-- Chunked bitmaps, and the splitting and combining of bitmaps that
+-- they use.
+create or replace
+function bad_chunk_bits(chunk_bits int4) returns boolean as
+$$
+begin
+  perform bitmap_split(bitmap(1), chunk_bits);
+  return false;
+exception
+  when invalid_parameter_value then
+    return true;
+end;
+$$
+language plpgsql;
+
+create temporary table chunk_test (
+    name  text,
+    handle bitmap_handle
+);
+
+insert into chunk_test
+select 'store', bitmap_chunked_store(bitmap_of(x * 37 - 50000))
+  from generate_series(0, 5000) x;
+
+insert into chunk_test
+select 'new', bitmap_chunked_new();
+
+do
+$$
+begin
+  perform bitmap_chunked_set(handle, x * 101)
+     from chunk_test, generate_series(-300, 3000) x
+    where name = 'new';
+  perform bitmap_chunked_clear(handle, 1010)
+     from chunk_test
+    where name = 'new';
+  perform bitmap_chunked_clear(handle, x * 101)
+     from chunk_test, generate_series(-300, 3000) x
+    where name = 'new'
+      and x * 101 between 200000 and 300000;
+end;
+$$;
+
+select null
+ where record_test(34)
+    or expect((select count(*)::int4
+                 from bitmap_split(to_bitmap('{-1,0,5,8192,9000,100000}'),
+                                   8192)), 4, 'SPLIT CHUNK COUNT')
+    or expect((select bool_and(bitmax(b) - bitmin(b) < 8192 and
+                               bitmin(b) >> 13 = bitmax(b) >> 13)
+                 from bitmap_split(to_bitmap('{-1,0,5,8192,9000,100000}'),
+                                   8192) b), true, 'SPLIT CHUNK BOUNDS')
+    or expect((select bitmap_union_all(array_agg(b)) =
+                      to_bitmap('{-1,0,5,8192,9000,100000}')
+                 from bitmap_split(to_bitmap('{-1,0,5,8192,9000,100000}'),
+                                   3) b), true, 'SPLIT ROUND TRIP')
+    or expect(bitmap_union_all(array[to_bitmap('{1,3}'), null,
+                                     bitmap_freeze(bitmap(100000)),
+                                     bitmap()]) =
+              to_bitmap('{1,3,100000}'), true, 'UNION_ALL INCORRECT')
+    or expect(is_empty(bitmap_union_all('{}')), true, 'UNION_ALL OF NOTHING')
+    or expect(bad_chunk_bits(0), true, 'ZERO CHUNK_BITS ACCEPTED')
+    or expect((select bitmap_chunked_get(handle) = bitmap_of(x * 37 - 50000)
+                 from chunk_test, generate_series(0, 5000) x
+                where name = 'store'
+                group by handle), true, 'CHUNKED STORE ROUND TRIP')
+    or expect((select count(*)::int4
+                 from chunk_test c
+                inner join bitmap_chunks b
+                   on b.handle = c.handle
+                where c.name = 'store'), 24, 'CHUNKED STORE CHUNK COUNT')
+    or expect((select bitmap_chunked_get(handle) =
+                      bitmap_of(x * 101) - 1010 - bitmap_of(x * 101)
+                          filter (where x * 101 between 200000 and 300000)
+                 from chunk_test, generate_series(-300, 3000) x
+                where name = 'new'
+                group by handle), true, 'CHUNKED SET/CLEAR')
+    or expect((select bitmap_chunked_test(handle, 707)
+                 from chunk_test where name = 'new'),
+              true, 'CHUNKED TEST')
+    or expect((select bitmap_chunked_test(handle, 1010)
+                 from chunk_test where name = 'new'),
+              false, 'CHUNKED TEST CLEARED')
+    or expect((select bitmap_chunked_test(handle, 100000000)
+                 from chunk_test where name = 'new'),
+              false, 'CHUNKED TEST MISSING CHUNK')
+    or expect((select count(*)::int4
+                 from chunk_test c
+                inner join bitmap_chunks b
+                   on b.handle = c.handle
+                where c.name = 'new'
+                  and b.chunkno between 25 and 35), 0,
+              'EMPTY CHUNKS NOT DELETED')
+    or expect((select bitmap_chunked_union(c1.handle, c2.handle) =
+                      bitmap_chunked_get(c1.handle) +
+                      bitmap_chunked_get(c2.handle)
+                 from chunk_test c1, chunk_test c2
+                where c1.name = 'store' and c2.name = 'new'),
+              true, 'CHUNKED UNION')
+    or expect((select bitmap_chunked_intersect(c1.handle, c2.handle) =
+                      bitmap_chunked_get(c1.handle) *
+                      bitmap_chunked_get(c2.handle)
+                 from chunk_test c1, chunk_test c2
+                where c1.name = 'store' and c2.name = 'new'),
+              true, 'CHUNKED INTERSECTION')
+    or expect((select is_empty(bitmap_chunked_get(bitmap_chunked_new()))),
+              true, 'NEW CHUNKED BITMAP NOT EMPTY');
+
+do
+$$
+begin
+  perform bitmap_chunked_drop(handle)
+     from chunk_test;
+end;
+$$;
+
+select null
+ where record_test(47)
+    or expect((select count(*)::int4
+                 from chunk_test c
+                inner join bitmap_chunks b
+                   on b.handle = c.handle), 0, 'CHUNKED DROP');
+
+-- Chunked bitmaps are private to the role that writes them.  Another
+-- role using the same handle sees, changes and drops only its own
+-- chunks.
+create role pgbitmap_chunk_owner;
+create role pgbitmap_chunk_other;
+
+set local role pgbitmap_chunk_owner;
+select null
+ where set_config('pgbitmap_test.handle',
+                  bitmap_chunked_store(to_bitmap('{1, 9000, 20000}'))::text,
+                  true) is null;
+
+set local role pgbitmap_chunk_other;
+do
+$$
+declare
+  h bitmap_handle := current_setting('pgbitmap_test.handle');
+begin
+  perform bitmap_chunked_set(h, 2);
+  perform bitmap_chunked_set(h, 9001);
+  perform bitmap_chunked_clear(h, 20000);
+end;
+$$;
+
+select null
+ where record_test(51)
+    or expect(bitmap_chunked_get(current_setting('pgbitmap_test.handle')
+                                   ::bitmap_handle) = to_bitmap('{2, 9001}'),
+              true, 'CHUNKED BITMAP SHARED BETWEEN ROLES')
+    or expect(bitmap_chunked_test(current_setting('pgbitmap_test.handle')
+                                    ::bitmap_handle, 1),
+              false, 'CHUNKED BIT VISIBLE TO ANOTHER ROLE');
+
+do
+$$
+begin
+  perform bitmap_chunked_drop(current_setting('pgbitmap_test.handle')
+                                ::bitmap_handle);
+end;
+$$;
+
+set local role pgbitmap_chunk_owner;
+select null
+ where record_test(52)
+    or expect(bitmap_chunked_get(current_setting('pgbitmap_test.handle')
+                                   ::bitmap_handle) =
+              to_bitmap('{1, 9000, 20000}'),
+              true, 'CHUNKED BITMAP CHANGED BY ANOTHER ROLE');
+
+reset role;
+
+-- MinHash signatures and LSH bands.  Sets a and b have a Jaccard
+-- similarity of 1/3.
+create or replace
+function bad_parameter(query text) returns boolean as
+$$
+begin
+  execute query;
+  return false;
+exception
+  when invalid_parameter_value then
+    return true;
+end;
+$$
+language plpgsql;
+
+create temporary table minhash_test as
+select bitmap_minhash(a, 256) as sig_a,
+       bitmap_minhash(b, 256) as sig_b,
+       bitmap_minhash(c, 256) as sig_c
+  from (select bitmap_of(x * 7) filter (where x < 10000) as a,
+               bitmap_of(x * 7) filter (where x >= 5000) as b,
+               bitmap_of(x * 7 + 1) filter (where x < 10000) as c
+          from generate_series(0, 14999) x) x;
+
+select null
+ where record_test(35)
+    or expect(bitmap_minhash(to_bitmap('{1,2,3}'), 4) =
+              '{526553749,683237387,184002,1669120006}', true,
+              'MINHASH SIGNATURE CHANGED')
+    or expect(bitmap_minhash(bitmap(), 3) = '{-1,-1,-1}', true,
+              'MINHASH OF EMPTY BITMAP')
+    or expect((select bitmap_minhash(bitmap_freeze(b), 64) =
+                      bitmap_minhash(b, 64)
+                 from (select bitmap_of(x * 1000) b
+                         from generate_series(-1000, 1000) x) x),
+              true, 'MINHASH OF FROZEN BITMAP')
+    or expect((select array_length(sig_a, 1) from minhash_test), 256,
+              'MINHASH SIGNATURE LENGTH')
+    or expect((select bitmap_minhash_similarity(sig_a, sig_b)
+                        between 0.25 and 0.42
+                 from minhash_test), true, 'MINHASH SIMILARITY ESTIMATE')
+    or expect((select bitmap_minhash_similarity(sig_a, sig_a)
+                 from minhash_test) = 1.0, true, 'MINHASH SELF SIMILARITY')
+    or expect((select array_length(bitmap_minhash_bands(sig_a, 64), 1)
+                 from minhash_test), 64, 'LSH BAND COUNT')
+    or expect((select count(*)::int4
+                 from minhash_test,
+                      unnest(bitmap_minhash_bands(sig_a, 128)) k1,
+                      unnest(bitmap_minhash_bands(sig_c, 128)) k2
+                where k1 = k2), 0, 'LSH KEYS OF DISJOINT SETS MATCH')
+    or expect((select count(*)::int4
+                 from minhash_test,
+                      unnest(bitmap_minhash_bands(sig_a, 128)) k1,
+                      unnest(bitmap_minhash_bands(sig_b, 128)) k2
+                where k1 = k2) > 0, true, 'LSH KEYS OF SIMILAR SETS DIFFER')
+    or expect((select bitmap_minhash_bands(sig_a, 64) =
+                      bitmap_minhash_bands(sig_a, 64)
+                 from minhash_test), true, 'LSH KEYS NOT STABLE')
+    or expect(bad_parameter('select bitmap_minhash(bitmap(1), 0)'), true,
+              'ZERO MINHASH K ACCEPTED')
+    or expect(bad_parameter(
+                  'select bitmap_minhash_bands(''{1,2,3,4}'', 3)'), true,
+              'UNEVEN LSH BANDS ACCEPTED')
+    or expect(bad_parameter(
+                  'select bitmap_minhash_similarity(''{1,2}'', ''{1}'')'),
+              true, 'MISMATCHED SIGNATURES ACCEPTED');
+
+-- Distance operators, and GiST indexes for nearest-neighbour and other
+-- searches.  Results using the index must match those without.
+create temporary table gist_test as
+select x as id,
+       bitmap_of(y) filter (where (x * y) % 7 < 2 or y = x % 50) as privs
+  from generate_series(0, 1999) x,
+       generate_series(-100, 3000, 13) y
+ group by x;
+
+insert into gist_test values (2000, bitmap()), (2001, null);
+
+create temporary table gist_results as
+select 'knn_jaccard' as test,
+       array(select privs <-> to_bitmap('{-35,0,26,78,91}')
+               from gist_test
+              order by 1 limit 20) as result
+union all
+select 'knn_hamming',
+       array(select privs <#> to_bitmap('{-35,0,26,78,91}')
+               from gist_test
+              order by 1 limit 20)
+union all
+select 'testbit', array(select id from gist_test where privs ? 78
+                         order by id)
+union all
+select 'equal', array(select id from gist_test
+                       where privs = (select privs from gist_test
+                                       where id = 42) order by id)
+union all
+select 'overlaps', array(select id from gist_test
+                          where privs && to_bitmap('{-35,2000}')
+                          order by id)
+union all
+select 'contains', array(select id from gist_test
+                          where privs @> to_bitmap('{0,26}') order by id)
+union all
+select 'contained', array(select id from gist_test
+                           where privs <@ (select privs from gist_test
+                                            where id = 42) order by id);
+
+create index gist_test_idx on gist_test using gist (privs);
+set local enable_seqscan = off;
+
+select null
+ where record_test(36)
+    or expect(to_bitmap('{1,2,3}') <-> to_bitmap('{2,3,4}') = 0.5, true,
+              'JACCARD DISTANCE INCORRECT')
+    or expect(bitmap() <-> bitmap() = 0, true, 'JACCARD DISTANCE OF EMPTY')
+    or expect(bitmap(1) <-> bitmap(1000000) = 1, true,
+              'JACCARD DISTANCE OF DISJOINT')
+    or expect((to_bitmap('{1,2,3}') <#> to_bitmap('{2,3,400}'))::int4, 2,
+              'HAMMING DISTANCE INCORRECT')
+    or expect((bitmap_freeze(to_bitmap('{1,2,3}')) <#> bitmap())::int4, 3,
+              'HAMMING DISTANCE OF FROZEN')
+    or expect((select array(select privs <-> to_bitmap('{-35,0,26,78,91}')
+                              from gist_test
+                             order by 1 limit 20) = result
+                 from gist_results where test = 'knn_jaccard'),
+              true, 'GIST JACCARD ORDERING INCORRECT')
+    or expect((select array(select privs <#> to_bitmap('{-35,0,26,78,91}')
+                              from gist_test
+                             order by 1 limit 20) = result
+                 from gist_results where test = 'knn_hamming'),
+              true, 'GIST HAMMING ORDERING INCORRECT')
+    or expect((select array(select id from gist_test where privs ? 78
+                             order by id) = result
+                 from gist_results where test = 'testbit'),
+              true, 'GIST TESTBIT INCORRECT')
+    or expect((select array(select id from gist_test
+                             where privs = (select privs from gist_test
+                                             where id = 42)
+                             order by id) = result
+                 from gist_results where test = 'equal'),
+              true, 'GIST EQUAL INCORRECT')
+    or expect((select array(select id from gist_test
+                             where privs && to_bitmap('{-35,2000}')
+                             order by id) = result
+                 from gist_results where test = 'overlaps'),
+              true, 'GIST OVERLAPS INCORRECT')
+    or expect((select array(select id from gist_test
+                             where privs @> to_bitmap('{0,26}')
+                             order by id) = result
+                 from gist_results where test = 'contains'),
+              true, 'GIST CONTAINS INCORRECT')
+    or expect((select array(select id from gist_test
+                             where privs <@ (select privs from gist_test
+                                              where id = 42)
+                             order by id) = result
+                 from gist_results where test = 'contained'),
+              true, 'GIST CONTAINED INCORRECT');
+
+reset enable_seqscan;
+
+-- Setting and clearing arrays of bits.
+select null
+ where record_test(37)
+    or expect(bitmap_setbits(to_bitmap('{5,70}'), array[1000, -3, 70, null])
+              = to_bitmap('{-3,5,70,1000}'), true, 'SETBITS INCORRECT')
+    or expect(bitmap() + array[300, 200] = to_bitmap('{200,300}'), true,
+              'SETBITS IN EMPTY BITMAP')
+    or expect(to_bitmap('{1,2}') + '{}'::int4[] = to_bitmap('{1,2}'), true,
+              'SETBITS OF NOTHING')
+    or expect(bitmap_clearbits(to_bitmap('{-3,5,70,1000}'),
+                               array[1000, -3, 6, null]) =
+              to_bitmap('{5,70}'), true, 'CLEARBITS INCORRECT')
+    or expect(bitmap_storage_size(to_bitmap('{1,100000}') -
+                                  array[100000, 99999]),
+              bitmap_storage_size(bitmap(1)), 'CLEARBITS NOT RIGHT-SIZED')
+    or expect(is_empty(to_bitmap('{1,2,3}') - array[3, 2, 1]), true,
+              'CLEARBITS TO EMPTY')
+    or expect((select bitmap_setbits(bitmap(), array_agg(x)) = bitmap_of(x)
+                 from generate_series(-5000, 5000, 7) x), true,
+              'SETBITS DOES NOT MATCH BITMAP_OF')
+    or expect((select bitmap_freeze(bitmap_of(x)) - array_agg(x) filter
+                          (where x % 2 = 0) =
+                      bitmap_of(x) filter (where x % 2 != 0)
+                 from generate_series(1, 5000, 3) x), true,
+              'CLEARBITS OF FROZEN BITMAP');
+
+-- Shifting bitmaps.
+create or replace
+function out_of_range(query text) returns boolean as
+$$
+begin
+  execute query;
+  return false;
+exception
+  when numeric_value_out_of_range then
+    return true;
+end;
+$$
+language plpgsql;
+
+select null
+ where record_test(38)
+    or expect(to_bitmap('{1,5,70}') << 128 = to_bitmap('{129,133,198}'),
+              true, 'WORD SHIFT LEFT INCORRECT')
+    or expect(to_bitmap('{1,5,70}') << 3 = to_bitmap('{4,8,73}'),
+              true, 'SHIFT LEFT INCORRECT')
+    or expect(to_bitmap('{1,5,70}') >> 10 = to_bitmap('{-9,-5,60}'),
+              true, 'SHIFT RIGHT INCORRECT')
+    or expect(to_bitmap('{1,5,70}') << -10 = to_bitmap('{1,5,70}') >> 10,
+              true, 'NEGATIVE SHIFT INCORRECT')
+    or expect(is_empty(bitmap() << 1000), true, 'SHIFT OF EMPTY BITMAP')
+    or expect((select bitmap_of(x) << 37 = bitmap_of(x + 37)
+                 from generate_series(-3000, 3000, 7) x), true,
+              'SHIFT DOES NOT MATCH BITMAP_OF')
+    or expect((select bitmap_of(x) >> 1000 = bitmap_of(x - 1000)
+                 from generate_series(1, 100000, 3) x), true,
+              'REBASE DOES NOT MATCH BITMAP_OF')
+    or expect(bitmap_storage_size(to_bitmap('{60,70}') << 5),
+              bitmap_storage_size(to_bitmap('{65,75}')),
+              'SHIFTED BITMAP NOT RIGHT-SIZED')
+    or expect(out_of_range('select bitmap(2147483600) << 100'), true,
+              'SHIFT OUT OF RANGE NOT DETECTED')
+    or expect(out_of_range('select bitmap(-2147483600) >> 100'), true,
+              'NEGATIVE SHIFT OUT OF RANGE NOT DETECTED');
+
+-- Conversion to and from int4multirange.
+select null
+ where record_test(39)
+    or expect(bitmap_to_ranges(to_bitmap('{1,2,3,7,9,10}')) =
+              '{[1,4),[7,8),[9,11)}'::int4multirange, true,
+              'BITMAP_TO_RANGES INCORRECT')
+    or expect(isempty(bitmap_to_ranges(bitmap())), true,
+              'BITMAP_TO_RANGES OF EMPTY BITMAP')
+    or expect(bitmap('{[-70,-60), [62,130], [1000,1001)}'::int4multirange) =
+              (select bitmap_of(x)
+                 from generate_series(-70, 1000) x
+                where x < -60 or x between 62 and 130 or x = 1000),
+              true, 'BITMAP FROM RANGES INCORRECT')
+    or expect(is_empty('{}'::int4multirange::bitmap), true,
+              'BITMAP FROM EMPTY MULTIRANGE')
+    or expect((select bitmap_of(x)::int4multirange::bitmap = bitmap_of(x)
+                 from generate_series(1, 100000) x
+                where x % 1000 < 300 or x % 7 = 0), true,
+              'RANGES DO NOT ROUND TRIP')
+    or expect((select bitmap_to_ranges(bitmap_of(x)) =
+                      '{[-128,256)}'::int4multirange
+                 from generate_series(-128, 255) x),
+              true, 'WORD-ALIGNED RUN INCORRECT')
+    or expect(out_of_range('select bitmap_to_ranges(bitmap(2147483647))'),
+              true, 'RANGE BOUND OUT OF RANGE NOT DETECTED')
+    or expect(bad_parameter('select bitmap(''{[1,)}''::int4multirange)'),
+              true, 'UNBOUNDED RANGE NOT DETECTED');
+
+-- Bloom filters.
+create or replace
+function bad_text(query text) returns boolean as
+$$
+begin
+  execute query;
+  return false;
+exception
+  when invalid_text_representation then
+    return true;
+end;
+$$
+language plpgsql;
+
+create temporary table bloom_test as
+select bloom_of(x) as bloom,
+       bloom_of(x, 4096, 3) as small,
+       bitbloom(bitmap_of(x)) as from_bitmap
+  from generate_series(1, 20000, 3) x;
+
+select null
+ where record_test(40)
+    or expect((select count(*)::int4
+                 from bloom_test, generate_series(1, 20000, 3) x
+                where not (bloom ? x and from_bitmap ? x)), 0,
+              'BLOOM FALSE NEGATIVES')
+    or expect((select count(*) from bloom_test,
+                      generate_series(2, 20000, 3) x
+                where bloom ? x) < 200, true,
+              'TOO MANY BLOOM FALSE POSITIVES')
+    or expect((select count(*) from bloom_test,
+                      generate_series(2, 20000, 3) x
+                where from_bitmap ? x) < 200, true,
+              'TOO MANY FALSE POSITIVES FROM BITMAP')
+    or expect((select bloom::text::bitbloom::text = bloom::text
+                 from bloom_test), true, 'BLOOM TEXT DOES NOT ROUND TRIP')
+    or expect(bitbloom(100, 3)::text =
+              '128:3:00000000000000000000000000000000', true,
+              'EMPTY BLOOM TEXT')
+    or expect((select (bloom_of(x, 4096, 3) filter (where x % 2 = 0) +
+                       bloom_of(x, 4096, 3) filter (where x % 2 = 1))::text =
+                      small::text
+                 from bloom_test, generate_series(1, 20000, 3) x
+                group by small::text), true, 'BLOOM UNION INCORRECT')
+    or expect(bitbloom_add(bitbloom(64, 2), 7) ? 7, true, 'BLOOM ADD FAILED')
+    or expect(bad_parameter('select bitbloom(64, 2) + bitbloom(128, 2)'), true,
+              'BLOOM SHAPE MISMATCH NOT DETECTED')
+    or expect(bad_parameter('select bitbloom(64, 0)'), true,
+              'BAD BLOOM HASH COUNT NOT DETECTED')
+    or expect(bad_text('select ''64:2''::bitbloom'), true,
+              'BLOOM TEXT WITHOUT HEX NOT DETECTED')
+    or expect(bad_text('select ''64:2:''::bitbloom'), true,
+              'BLOOM TEXT WITH EMPTY HEX NOT DETECTED')
+    or expect(bad_text('select ''64:2:000000000000000''::bitbloom'), true,
+              'BLOOM TEXT WITH ODD LENGTH HEX NOT DETECTED');
+
+-- Bit-sliced indexes.
+create temporary table bsi_test as
+select x as rowid, (x * 37) % 1001 - 500 as value
+  from generate_series(1, 2000) x
+ where x % 7 != 0;
+
+create temporary table bsi_index as
+select bsi_of(rowid, value) as index from bsi_test;
+
+select null
+ where record_test(41)
+    or expect((select bsi_range(index, -100, 250) =
+                      (select bitmap_of(rowid) from bsi_test
+                        where value between -100 and 250)
+                 from bsi_index), true, 'BSI RANGE INCORRECT')
+    or expect((select bsi_range(index, -500, -500) =
+                      (select bitmap_of(rowid) from bsi_test
+                        where value = -500)
+                 from bsi_index), true, 'BSI LOWEST VALUE INCORRECT')
+    or expect((select bsi_range(index, -2147483648, 2147483647) =
+                      bsi_rows(index)
+                 from bsi_index), true, 'BSI FULL RANGE INCORRECT')
+    or expect((select bsi_rows(index) =
+                      (select bitmap_of(rowid) from bsi_test)
+                 from bsi_index), true, 'BSI ROWS INCORRECT')
+    or expect((select is_empty(bsi_range(index, 10, 9)) and
+                      is_empty(bsi_range(index, 501, 1000))
+                 from bsi_index), true, 'BSI EMPTY RANGE INCORRECT')
+    or expect((select bsi_sum(index, (select bitmap_of(x)
+                                         from generate_series(0, 3000, 2) x)) =
+                      (select sum(value) from bsi_test where rowid % 2 = 0)
+                 from bsi_index), true, 'BSI SUM INCORRECT')
+    or expect((select index::text::bsi::text = index::text
+                 from bsi_index), true, 'BSI TEXT DOES NOT ROUND TRIP')
+    or expect((select bsi_range(bsi_of(x, 42), 42, 42) = bitmap_of(x)
+                 from generate_series(10, 20) x), true,
+              'SINGLE VALUE BSI INCORRECT')
+    or expect(bad_parameter('select bsi_of(x % 3, x)
+                               from generate_series(1, 10) x'), true,
+              'DUPLICATE BSI ROWID NOT DETECTED')
+    or expect(bad_text('select (''0:1:'' || to_bitmap(''{1, 2}'')::text ||
+                               '':'' || to_bitmap(''{2, 3}'')::text)::bsi'),
+              true, 'BSI SLICE OUTSIDE EXISTENCE BITMAP NOT DETECTED')
+    or expect(bad_text('select (''2147483647:1:'' ||
+                               to_bitmap(''{1}'')::text || '':'' ||
+                               to_bitmap(''{1}'')::text)::bsi'),
+              true, 'BSI VALUES BEYOND INT4 NOT DETECTED')
+    or expect((select bsi_range(('-2147483648:32:' ||
+                                 to_bitmap('{1}')::text ||
+                                 repeat(':' || bitmap()::text, 32))::bsi,
+                                -2147483648, -2147483648) = bitmap(1)),
+              true, 'BSI WITH FULL INT4 RANGE REJECTED');
+
+-- Overlap matrices.
+create temporary table cohorts as
+select 'c' || lpad(i::text, 2, '0') as label,
+       (select bitmap_of(x + case when i = 12 then 1000000 else 0 end)
+          from generate_series(-5000, 20000) x
+         where x % (i + 1) = 0) as members
+  from generate_series(1, 12) i
+union all
+select 'none', null;
+
+create temporary table overlaps as
+select bitmap_overlap_matrix(label, members order by label) as m
+  from cohorts;
+
+select null
+ where record_test(42)
+    or expect((select array_length((m).labels, 1) from overlaps), 12,
+              'OVERLAP MATRIX LABELS INCORRECT')
+    or expect((select bool_and(((o.m).counts)[i][j] =
+                               (select count(*)
+                                  from bits(c1.members * c2.members)))
+                 from overlaps o,
+                      generate_subscripts((o.m).labels, 1) i,
+                      generate_subscripts((o.m).labels, 1) j,
+                      cohorts c1, cohorts c2
+                where c1.label = ((o.m).labels)[i]
+                  and c2.label = ((o.m).labels)[j]), true,
+              'OVERLAP MATRIX INCORRECT')
+    or expect((select bitmap_overlap_matrix(label, members) is null
+                 from cohorts where members is null), true,
+              'EMPTY OVERLAP MATRIX NOT NULL');
+
+-- Bit frequencies and thresholds.
+create temporary table cohort_bit_counts as
+select b as bit, count(*) as count
+  from cohorts, bits(members) b
+ group by b;
+
+select null
+ where record_test(43)
+    or expect((select count(*)::int4
+                 from unnest((select bit_frequencies(members)
+                                from cohorts)) f
+                 full join cohort_bit_counts c
+                using (bit, count)
+                where f.bit is null or c.bit is null), 0,
+              'BIT FREQUENCIES INCORRECT')
+    or expect((select (bit_frequencies(members)).bits =
+                      (select array_agg(bit order by bit)
+                         from cohort_bit_counts)
+                 from cohorts), true, 'BIT FREQUENCIES NOT IN ORDER')
+    or expect((select threshold_of(members, 3) =
+                      (select bitmap_of(bit) from cohort_bit_counts
+                        where count >= 3)
+                 from cohorts), true, 'THRESHOLD INCORRECT')
+    or expect((select threshold_of(members, 1) = union_of(members)
+                 from cohorts), true, 'THRESHOLD OF 1 IS NOT UNION')
+    or expect((select threshold_of(members, 11) = intersect_of(members)
+                 from cohorts where members is not null and label != 'c12'),
+              true, 'THRESHOLD OF ALL IS NOT INTERSECTION')
+    or expect((select is_empty(threshold_of(members, 13)) from cohorts),
+              true, 'THRESHOLD ABOVE ROW COUNT NOT EMPTY')
+    or expect((select bit_frequencies(members) is null
+                 from cohorts where members is null), true,
+              'EMPTY BIT FREQUENCIES NOT NULL')
+    or expect(bad_parameter('select threshold_of(bitmap(1), 0)'), true,
+              'BAD THRESHOLD NOT DETECTED');
+
+-- Parallel bit frequencies and thresholds.  Temporary tables cannot be
+-- read by parallel workers, so an ordinary table is used, and parallel
+-- plans are forced so that partial states are serialised and combined.
+-- The results must match those of a serial run.
+create or replace
+function plan_has(query text, node text) returns boolean as
+$$
+declare
+  line text;
+begin
+  for line in execute 'explain ' || query loop
+    if line like '%' || node || '%' then
+      return true;
+    end if;
+  end loop;
+  return false;
+end;
+$$
+language plpgsql;
+
+create table parallel_cohorts as
+select c.label, c.members
+  from cohorts c, generate_series(1, 40) n;
+
+analyze parallel_cohorts;
+
+set local max_parallel_workers_per_gather = 0;
+create temporary table serial_frequencies as
+select bit_frequencies(members) as freqs,
+       threshold_of(members, 100) as threshold
+  from parallel_cohorts;
+
+set local max_parallel_workers_per_gather = 2;
+set local parallel_setup_cost = 0;
+set local parallel_tuple_cost = 0;
+set local min_parallel_table_scan_size = 0;
+do $$
+begin
+  if current_setting('server_version_num')::int4 >= 160000 then
+    set local debug_parallel_query = on;
+  else
+    set local force_parallel_mode = on;
+  end if;
+end;
+$$;
+
+create temporary table parallel_frequencies as
+select bit_frequencies(members) as freqs,
+       threshold_of(members, 100) as threshold
+  from parallel_cohorts;
+
+select null
+ where record_test(50)
+    or expect(plan_has('select bit_frequencies(members),
+                               threshold_of(members, 100)
+                          from parallel_cohorts', 'Partial Aggregate'),
+              true, 'BIT FREQUENCIES NOT AGGREGATED IN PARALLEL')
+    or expect((select p.freqs::text = s.freqs::text
+                 from parallel_frequencies p, serial_frequencies s),
+              true, 'PARALLEL BIT FREQUENCIES INCORRECT')
+    or expect((select p.threshold = s.threshold
+                 from parallel_frequencies p, serial_frequencies s),
+              true, 'PARALLEL THRESHOLD INCORRECT');
+
+do $$
+begin
+  if current_setting('server_version_num')::int4 >= 160000 then
+    reset debug_parallel_query;
+  else
+    reset force_parallel_mode;
+  end if;
+end;
+$$;
+reset min_parallel_table_scan_size;
+reset parallel_tuple_cost;
+reset parallel_setup_cost;
+reset max_parallel_workers_per_gather;
+
+-- BRIN indexes.  Bitmaps in neighbouring rows have neighbouring
+-- elements, and some rows have very wide bitmaps, so that the
+-- summaries of some block ranges are folded.  Results using the index
+-- must match those without.
+create temporary table brin_test as
+select x as id,
+       bitmap_of(y) filter (where y % 3 != x % 3)
+         + case when x % 97 = 0 then bitmap(x * 10000)
+                else bitmap() end as privs
+  from generate_series(0, 4999) x,
+       generate_series(x, x + 40) y
+ group by x;
+
+insert into brin_test values (5000, bitmap()), (5001, null);
+
+create temporary table brin_results as
+select 'testbit' as test,
+       array(select id from brin_test where privs ? 1000
+              order by id) as result
+union all
+select 'testbit_folded',
+       array(select id from brin_test where privs ? 970000 order by id)
+union all
+select 'testbit_aliased',
+       array(select id from brin_test where privs ? (970000 + 16384)
+              order by id)
+union all
+select 'overlaps',
+       array(select id from brin_test
+              where privs && to_bitmap('{-35,30,4000}') order by id)
+union all
+select 'overlaps_folded',
+       array(select id from brin_test
+              where privs && to_bitmap('{1940000,2000000}') order by id);
+
+create index brin_test_idx on brin_test using brin (privs)
+  with (pages_per_range = 1);
+set local enable_seqscan = off;
+
+select null
+ where record_test(44)
+    or expect((select array(select id from brin_test where privs ? 1000
+                             order by id) = result
+                 from brin_results where test = 'testbit'),
+              true, 'BRIN TESTBIT INCORRECT')
+    or expect((select array(select id from brin_test where privs ? 970000
+                             order by id) = result
+                 from brin_results where test = 'testbit_folded'),
+              true, 'BRIN FOLDED TESTBIT INCORRECT')
+    or expect((select array(select id from brin_test
+                             where privs ? (970000 + 16384)
+                             order by id) = result
+                 from brin_results where test = 'testbit_aliased'),
+              true, 'BRIN ALIASED TESTBIT INCORRECT')
+    or expect((select array(select id from brin_test
+                             where privs && to_bitmap('{-35,30,4000}')
+                             order by id) = result
+                 from brin_results where test = 'overlaps'),
+              true, 'BRIN OVERLAPS INCORRECT')
+    or expect((select array(select id from brin_test
+                             where privs && to_bitmap('{1940000,2000000}')
+                             order by id) = result
+                 from brin_results where test = 'overlaps_folded'),
+              true, 'BRIN FOLDED OVERLAPS INCORRECT');
+
+reset enable_seqscan;
+
+-- bitmap_eval().  Results must match those of the equivalent operator
+-- expressions, whatever the bounds of the bitmaps.
+create temporary table eval_test as
+select to_bitmap('{1, 2, 3, 64, 65, 200}') as a,
+       to_bitmap('{-70, 2, 3, 65, 300}') as b,
+       to_bitmap('{3, 65, 200, 300, 1000}') as c,
+       to_bitmap('{100000, 100001}') as d,
+       bitmap() as e;
+
+select null
+ where record_test(45)
+    or expect((select bitmap_eval('(a + b) * c - (d * e)', a, b, c, d, e) =
+                      (a + b) * c - (d * e)
+                 from eval_test), true, 'BITMAP_EVAL INCORRECT')
+    or expect((select bitmap_eval('$1 + $2 * $3', a, b, c) = a + (b * c)
+                 from eval_test), true, 'BITMAP_EVAL PRECEDENCE INCORRECT')
+    or expect((select bitmap_eval('$1 - $2 - $3', a, b, c) = (a - b) - c
+                 from eval_test), true,
+              'BITMAP_EVAL ASSOCIATIVITY INCORRECT')
+    or expect((select bitmap_eval('d + (b - a)', a, b, c, d) = d + (b - a)
+                 from eval_test), true, 'BITMAP_EVAL DISJOINT UNION INCORRECT')
+    or expect((select is_empty(bitmap_eval('a * d', a, b, c, d))
+                 from eval_test), true,
+              'BITMAP_EVAL DISJOINT INTERSECTION NOT EMPTY')
+    or expect((select is_empty(bitmap_eval('(a - a) + e', a, b, c, d, e))
+                 from eval_test), true, 'BITMAP_EVAL EMPTY RESULT NOT EMPTY')
+    or expect((select bitmap_eval('$2 - $1', variadic array[a, b]) = b - a
+                 from eval_test), true, 'BITMAP_EVAL ARRAY INCORRECT')
+    or expect((select bitmap_eval('a', a, null) = a
+                 from eval_test), true, 'BITMAP_EVAL UNUSED NULL NOT IGNORED')
+    or expect((select bitmap_eval('a + b', a, null) is null
+                 from eval_test), true, 'BITMAP_EVAL NULL NOT NULL')
+    or expect((select count(*)::int4
+                 from cohorts c1, cohorts c2, cohorts c3,
+                      (values ('a + b * c'), ('(a + b) * c'), ('a - b - c'),
+                              ('a - (b - c)'), ('a * b * c')) e(expr)
+                where bitmap_eval(e.expr, c1.members, c2.members,
+                                  c3.members) is distinct from
+                      case e.expr
+                      when 'a + b * c' then
+                           c1.members + c2.members * c3.members
+                      when '(a + b) * c' then
+                           (c1.members + c2.members) * c3.members
+                      when 'a - b - c' then
+                           c1.members - c2.members - c3.members
+                      when 'a - (b - c)' then
+                           c1.members - (c2.members - c3.members)
+                      else c1.members * c2.members * c3.members
+                      end), 0, 'BITMAP_EVAL ROWS INCORRECT')
+    or expect(bad_parameter('select bitmap_eval(''a +'', bitmap())'), true,
+              'BITMAP_EVAL MISSING OPERAND NOT DETECTED')
+    or expect(bad_parameter('select bitmap_eval(''a b'', bitmap(), bitmap())'),
+              true, 'BITMAP_EVAL MISSING OPERATOR NOT DETECTED')
+    or expect(bad_parameter('select bitmap_eval(''(a'', bitmap())'), true,
+              'BITMAP_EVAL UNBALANCED PARENTHESES NOT DETECTED')
+    or expect(bad_parameter('select bitmap_eval(''$0'', bitmap())'), true,
+              'BITMAP_EVAL BAD INPUT NUMBER NOT DETECTED')
+    or expect(bad_parameter('select bitmap_eval(''$1 + $3'', bitmap(),
+                                                 bitmap())'), true,
+              'BITMAP_EVAL MISSING INPUT NOT DETECTED');
+
+-- The btree order of wide bitmaps.  This depends on their text form,
+-- which contains no line breaks, and must not change without bitmap
+-- btree indexes being rebuilt.  Text written by versions before 0.9.6,
+-- with a line break after every 76 characters of the bitset, must
+-- still be read.
+create or replace
+function legacy_text(bm bitmap) returns text as
+$$
+select substr(bm::text, 1, 14) ||
+       regexp_replace(substr(bm::text, 15), '(.{76})', E'\\1\n', 'g');
+$$
+language sql;
+
+select null
+ where record_test(46)
+    or expect(strpos(legacy_text(to_bitmap('{0, 1000}')), E'\n') > 0, true,
+              'LEGACY BITMAP TEXT HAS NO LINE BREAK')
+    or expect((select count(*)::int4
+                 from (select bitmap_of(x) as bm
+                         from generate_series(1, 4000, 250) w,
+                              generate_series(-w, w, 7) x
+                        group by w) b
+                where legacy_text(bm)::bitmap <> bm), 0,
+              'LEGACY BITMAP TEXT NOT READ')
+    or expect(strpos(to_bitmap('{0, 1000}')::text, E'\n'), 0,
+              'WIDE BITMAP TEXT CONTAINS A LINE BREAK')
+    or expect(to_bitmap('{0, 1000}') < to_bitmap('{0, 999, 1000}'), true,
+              'WIDE BITMAP ORDER CHANGED')
+    or expect(to_bitmap('{0, 999, 1000}') < to_bitmap('{0, 64, 1000}'), true,
+              'WIDE BITMAP ORDER CHANGED(2)');
+
 -- Publish the set of tests that we have run
 select 'Tests run: ' || to_array(tests_run)::text as "Passed tests"
   from my_tests;